@@ -17,6 +17,13 @@
 #define ANALYSIS_H
 #include <vector>
 #include <string>
+#include <map>
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <algorithm>
+#include <memory>
 
 #include "sbnana/CAFAna/Core/SpectrumLoader.h"
 #include "sbnana/CAFAna/Core/Tree.h"
@@ -25,6 +32,13 @@
 
 #include "TDirectory.h"
 #include "TFile.h"
+#include "TROOT.h"
+
+#include "framework.h"
+#include "loader.h"
+#include "output.h"
+#include "progress.h"
+#include "histograms.h"
 
 /**
  * @namespace ana
@@ -48,7 +62,7 @@ namespace ana
     struct Sample
     {
         std::string name;
-        ana::SpectrumLoader * loader;
+        ana::RecordSpectrumLoader * loader;
         bool is_sim;
     };
 
@@ -62,7 +76,8 @@ namespace ana
      * name of the Tree, the names of the variables, the SpillMultiVars that
      * implement the variables, and a boolean indicating whether the Tree
      * represents a simulation sample. The simulation flag is used to determine
-     * if truth information is present in the Tree.
+     * if truth information is present in the Tree. The storage types of the
+     * branches (by name) are optional; unlisted branches are stored as doubles.
      */
     struct TreeSet
     {
@@ -70,8 +85,14 @@ namespace ana
         std::vector<std::string> names;
         std::vector<ana::SpillMultiVar> vars;
         bool is_sim;
+        std::map<std::string, StorageType> storage;
     };
 
+    /**
+     * @brief A Tree booked for a sample, with the TreeSet it implements.
+     */
+    using BookedTree = std::pair<ana::Tree*, const TreeSet*>;
+
     /**
      * @class Analysis
      * @brief Class designed to streamline the running of multiple samples
@@ -90,15 +111,31 @@ namespace ana
     {
         public:
             Analysis(std::string name);
-            void AddLoader(std::string name, ana::SpectrumLoader * loader, bool is_sim);
+            void AddLoader(std::string name, ana::RecordSpectrumLoader * loader, bool is_sim);
             void AddTree(std::string name, std::map<std::string, ana::SpillMultiVar> & vars, bool is_sim);
-            void AddTreeForSample(std::string sname, std::string name, std::map<std::string, ana::SpillMultiVar> & vars, bool is_sim);
+            void AddTreeForSample(std::string sname, std::string name, std::map<std::string, ana::SpillMultiVar> & vars, bool is_sim, const std::map<std::string, StorageType> & storage = {});
+            void AddCutflowForSample(std::string sname, std::string name, std::shared_ptr<Cutflow> cutflow);
+            void AddHistogramsForSample(std::string sname, std::string name, std::shared_ptr<HistogramSet> histograms);
+            void SetParallelSamples(size_t n);
+            void SetOutputOptions(const OutputOptions & options);
+            void SetProgressMonitor(std::shared_ptr<ProgressMonitor> monitor);
             void Go();
         private:
+            std::vector<BookedTree> BookTrees(const Sample & s);
+            void SaveSample(const Sample & s, TDirectory * subdir, std::vector<BookedTree> & sbruce_trees);
+            static void ReleaseTrees(std::vector<BookedTree> & sbruce_trees);
+            void WriteProfile(TFile * f);
+            void RunSample(const Sample & s);
             std::string name;
+            size_t parallel_samples = 1;
+            OutputOptions output_options;
             std::vector<Sample> samples;
             std::vector<TreeSet> trees;
             std::map<std::pair<std::string, std::string>, TreeSet> trees_map;
+            std::map<std::pair<std::string, std::string>, std::shared_ptr<Cutflow>> cutflows;
+            std::map<std::pair<std::string, std::string>, std::shared_ptr<HistogramSet>> histograms;
+            std::map<std::string, std::shared_ptr<ExposureLedger>> ledgers;
+            std::shared_ptr<ProgressMonitor> progress;
     };
 
     /**
@@ -128,7 +165,7 @@ namespace ana
      * information is available.
      * @return void
      */
-    void Analysis::AddLoader(std::string name, ana::SpectrumLoader * loader, bool is_sim)
+    void Analysis::AddLoader(std::string name, ana::RecordSpectrumLoader * loader, bool is_sim)
     {
         samples.push_back({name, loader, is_sim});
     }
@@ -157,7 +194,7 @@ namespace ana
             n.push_back(name);
             v.push_back(var);
         }
-        trees.push_back({name, n, v, is_sim});
+        trees.push_back({name, n, v, is_sim, {}});
     }
 
     /**
@@ -173,9 +210,11 @@ namespace ana
      * @param is_sim A boolean indicating whether the Tree represents a simulation
      * sample, which is principally used to determine if truth information is
      * available.
+     * @param storage A map of variable names to their storage type in the
+     * output file. Variables that are not listed are stored as doubles.
      * @return void
      */
-    void Analysis::AddTreeForSample(std::string sname, std::string name, std::map<std::string, ana::SpillMultiVar> & vars, bool is_sim)
+    void Analysis::AddTreeForSample(std::string sname, std::string name, std::map<std::string, ana::SpillMultiVar> & vars, bool is_sim, const std::map<std::string, StorageType> & storage)
     {
         std::vector<std::string> n;
         std::vector<ana::SpillMultiVar> v;
@@ -184,7 +223,234 @@ namespace ana
             n.push_back(name);
             v.push_back(var);
         }
-        trees_map[std::make_pair(sname, name)] = {name, n, v, is_sim};
+        trees_map[std::make_pair(sname, name)] = {name, n, v, is_sim, storage};
+    }
+
+    /**
+     * @brief Add a cutflow to the Analysis class for a specific sample.
+     * @details The cutflow is accumulated by the selection of the Tree during
+     * the normal pass over the sample, and is written to the directory of
+     * the sample once the sample has been run.
+     * @param sname The name of the sample to which the cutflow belongs.
+     * @param name The name of the Tree to which the cutflow belongs.
+     * @param cutflow The cutflow attached to the selection of the Tree.
+     * @return void
+     */
+    void Analysis::AddCutflowForSample(std::string sname, std::string name, std::shared_ptr<Cutflow> cutflow)
+    {
+        cutflows[std::make_pair(sname, name)] = cutflow;
+    }
+
+    /**
+     * @brief Add the histograms of a Tree to the Analysis class for a
+     * specific sample.
+     * @details The histograms are filled during the normal pass over the
+     * sample (see @ref HistogramSet), and are written to the directory of the
+     * sample, normalized with the exposure of the sample, once the sample has
+     * been run.
+     * @param sname The name of the sample to which the histograms belong.
+     * @param name The name of the Tree to which the histograms belong.
+     * @param histograms The histograms of the Tree.
+     * @return void
+     */
+    void Analysis::AddHistogramsForSample(std::string sname, std::string name, std::shared_ptr<HistogramSet> histograms)
+    {
+        this->histograms[std::make_pair(sname, name)] = histograms;
+    }
+
+    /**
+     * @brief Set the number of samples that are run concurrently.
+     * @details This function sets the number of samples that are run
+     * concurrently by @ref Go. Each sample has its own SpectrumLoader, set of
+     * Trees, cutflows, and exposure ledger, so the samples are independent of
+     * one another and may be run on separate threads. The per-record state of
+     * the framework (the match index, the particle and geometry caches, and
+     * the worker ledger of the unfolded exposure) is thread-local and the
+     * profiler is guarded by a mutex, so no mutable state is shared between
+     * the threads. A value of one (the default) runs the samples
+     * sequentially.
+     * @param n The number of samples to run concurrently. A value of zero
+     * uses one thread per available hardware thread.
+     * @return void
+     */
+    void Analysis::SetParallelSamples(size_t n)
+    {
+        parallel_samples = (n == 0) ? std::max<size_t>(1, std::thread::hardware_concurrency()) : n;
+    }
+
+    /**
+     * @brief Set the configuration of the output file.
+     * @details This function sets the compression of the output file and the
+     * basket size of the output trees.
+     * @param options The configuration of the output file.
+     * @return void
+     */
+    void Analysis::SetOutputOptions(const OutputOptions & options)
+    {
+        output_options = options;
+    }
+
+    /**
+     * @brief Set the monitor reporting the progress of the samples.
+     * @details The samples for which the monitor holds a progress (see
+     * @ref ProgressMonitor::sample) are monitored: their records are counted
+     * and the compute time of their Trees is measured on a subset of the
+     * records.
+     * @param monitor The progress monitor.
+     * @return void
+     */
+    void Analysis::SetProgressMonitor(std::shared_ptr<ProgressMonitor> monitor)
+    {
+        progress = monitor;
+    }
+
+    /**
+     * @brief Book the Trees for the specified sample.
+     * @details This function creates the Trees for the sample, which
+     * registers their variables with the SpectrumLoader of the sample. The
+     * Trees are owned by the caller. The exposure ledger of the sample (see
+     * @ref ExposureLedger), the progress counters (if the sample is
+     * monitored), and the histograms of the sample (see @ref HistogramSet)
+     * are added to the loader as record observers (see @ref RecordObserver),
+     * so they see every record independently of the cuts of the Trees.
+     * @param s The sample to book the Trees for.
+     * @return A vector of the booked Trees with their TreeSets.
+     */
+    std::vector<BookedTree> Analysis::BookTrees(const Sample & s)
+    {
+        std::vector<BookedTree> sbruce_trees;
+        auto ledger = std::make_shared<ExposureLedger>();
+        s.loader->AddObserver([ledger](const caf::SRSpillProxy & sr) { ledger->observe(sr); });
+        ledgers[s.name] = ledger;
+        std::shared_ptr<SampleProgress> monitored = progress ? progress->find(s.name) : nullptr;
+        if(monitored)
+            s.loader->AddObserver(progress_observer(monitored));
+        for(const auto & [name, h] : histograms)
+        {
+            if(name.first != s.name)
+                continue;
+            s.loader->AddObserver(monitored ? timed_observer(h->observer(), monitored) : h->observer());
+        }
+
+        // Measure the compute time of the variables of monitored samples.
+        auto book = [&](const TreeSet & t)
+        {
+            if(!monitored)
+                return new ana::Tree(t.name, t.names, *s.loader, t.vars, ana::kNoSpillCut, true);
+            std::vector<ana::SpillMultiVar> vars;
+            vars.reserve(t.vars.size());
+            for(const ana::SpillMultiVar & var : t.vars)
+                vars.push_back(timed_var(var, monitored));
+            return new ana::Tree(t.name, t.names, *s.loader, vars, ana::kNoSpillCut, true);
+        };
+
+        for(const TreeSet & t : trees)
+        {
+            if(t.is_sim && !s.is_sim)
+                continue;
+            sbruce_trees.emplace_back(book(t), &t);
+        }
+        for(const auto & [name, t] : trees_map)
+        {
+            if((t.is_sim && !s.is_sim) || name.first != s.name)
+                continue;
+            sbruce_trees.emplace_back(book(t), &t);
+        }
+        return sbruce_trees;
+    }
+
+    /**
+     * @brief Write the results of a sample to its directory.
+     * @details This function writes the Trees (which are then deleted) and
+     * the cutflows of the sample to the directory of the sample. The branches
+     * of the Trees are stored with their configured storage types (see
+     * @ref write_tree). The exposure of each subrun of the sample is written
+     * to the "exposure_summary" TTree, and the histograms of the sample are
+     * normalized with the POT of their trees (see @ref HistogramSet).
+     * @param s The sample to write the results of.
+     * @param subdir The directory of the sample.
+     * @param sbruce_trees The Trees booked for the sample.
+     * @return void
+     */
+    void Analysis::SaveSample(const Sample & s, TDirectory * subdir, std::vector<BookedTree> & sbruce_trees)
+    {
+        for(const auto & [t, set] : sbruce_trees)
+        {
+            write_tree(*t, subdir, set->storage, output_options);
+            delete t;
+        }
+        sbruce_trees.clear();
+        for(const auto & [name, cutflow] : cutflows)
+        {
+            if(name.first == s.name)
+                cutflow->write(subdir, name.second);
+        }
+
+        const ExposureLedger & ledger = *ledgers.at(s.name);
+        ledger.write(subdir, "exposure_summary");
+        ExposureCounts totals = ledger.totals();
+        for(const auto & [name, h] : histograms)
+        {
+            if(name.first == s.name)
+                h->write(subdir);
+        }
+        std::cout << "Exposure of " << s.name << ": " << totals.pot << " POT, " << totals.livetime << " livetime, "
+                  << totals.spills << " spills (" << ledger.subruns().size() << " subruns)." << std::endl;
+        if(ledger.duplicates() > 0)
+            std::cerr << "Warning: " << ledger.duplicates() << " records of " << s.name << " share the (run, subrun, event) of an earlier record. "
+                      << "Their exposure is summed; check that no input file is listed twice." << std::endl;
+    }
+
+    /**
+     * @brief Delete the Trees of a sample without writing them.
+     * @details This is used on the error path of @ref Go, once no loader is
+     * running.
+     * @param sbruce_trees The Trees booked for the sample.
+     * @return void
+     */
+    void Analysis::ReleaseTrees(std::vector<BookedTree> & sbruce_trees)
+    {
+        for(const auto & [t, set] : sbruce_trees)
+            delete t;
+        sbruce_trees.clear();
+    }
+
+    /**
+     * @brief Emit the profiling report (if the profiling mode is enabled).
+     * @details The per-sample, per-tree report of the cuts, variables, and
+     * selectors is printed to stdout, written as a TTree in the "profile"
+     * directory of the output file, and written as JSON next to the output
+     * file ("<name>_profile.json").
+     * @param f The output file.
+     * @return void
+     */
+    void Analysis::WriteProfile(TFile * f)
+    {
+        if(!Profiler::instance().enabled())
+            return;
+        Profiler::instance().report(std::cout);
+        Profiler::instance().write(f->mkdir("profile"));
+        Profiler::instance().write_json(name + "_profile.json");
+    }
+
+    /**
+     * @brief Run the loader of a sample.
+     * @details The start and the end of the sample are reported to the
+     * progress monitor (if the sample is monitored). The worker ledger of the
+     * current thread (see @ref ExposureLedger::worker) is reset first, as a
+     * thread may run several samples in turn.
+     * @param s The sample to run.
+     * @return void
+     */
+    void Analysis::RunSample(const Sample & s)
+    {
+        std::shared_ptr<SampleProgress> monitored = progress ? progress->find(s.name) : nullptr;
+        if(monitored)
+            monitored->begin();
+        ExposureLedger::worker() = ExposureLedger();
+        s.loader->Go();
+        if(monitored)
+            progress->finished(s.name);
     }
 
     /**
@@ -194,41 +460,122 @@ namespace ana
      * running the analysis on the sample to populate the Trees with the
      * results of the analysis. The results are stored in a TFile in the output
      * ROOT file in a parent directory named "events" and a subdirectory for
-     * each sample.
+     * each sample. If more than one sample is configured to run concurrently
+     * (see @ref SetParallelSamples), the samples are run on a pool of worker
+     * threads and the Trees are written to the output file by the calling
+     * thread once all samples have finished. Running the loaders of
+     * different samples concurrently assumes that the CAFAna loaders share
+     * no mutable state: each loader reads its own files, ROOT is made
+     * thread-safe (ROOT::EnableThreadSafety) before they run, and the
+     * per-record state of the framework is kept per thread (see
+     * @ref current_record). If a sample fails, the samples that have not
+     * started are skipped and the running loaders are aborted (see
+     * @ref RecordSpectrumLoader::Abort). Once all workers have joined, the
+     * booked Trees are deleted, the output file is closed, and the first
+     * error is rethrown on the calling thread.
      * @return void
      */
     void Analysis::Go()
     {
         TFile * f = new TFile(std::string(name + ".root").c_str(), "RECREATE");
+        if(output_options.compression >= 0)
+            f->SetCompressionSettings(output_options.compression);
         TDirectory * dir = f->mkdir("events");
         dir->cd();
+        if(progress)
+            progress->start();
 
-        for(const Sample & s : samples)
+        if(parallel_samples <= 1 || samples.size() <= 1)
         {
-            TDirectory * subdir = dir->mkdir(s.name.c_str());
-            subdir->cd();
-            std::vector<ana::Tree*> sbruce_trees;
-            for(const TreeSet & t : trees)
+            for(const Sample & s : samples)
             {
-                if(t.is_sim && !s.is_sim)
-                    continue;
-                sbruce_trees.push_back(new ana::Tree(t.name, t.names, *s.loader, t.vars, ana::kNoSpillCut, true));
+                TDirectory * subdir = dir->mkdir(s.name.c_str());
+                subdir->cd();
+                std::vector<BookedTree> sbruce_trees = BookTrees(s);
+
+                try
+                {
+                    RunSample(s);
+                }
+                catch(...)
+                {
+                    ReleaseTrees(sbruce_trees);
+                    f->Close();
+                    throw;
+                }
+                SaveSample(s, subdir, sbruce_trees);
+                dir->cd();
             }
-            for(const auto & [name, t] : trees_map)
+            if(progress)
+                progress->stop();
+            WriteProfile(f);
+            f->Close();
+            return;
+        }
+
+        // Booking the Trees and writing them touches the output file, so both
+        // are done serially on this thread. Only the loaders run concurrently.
+        ROOT::EnableThreadSafety();
+        std::vector<std::vector<BookedTree>> sbruce_trees;
+        sbruce_trees.reserve(samples.size());
+        for(const Sample & s : samples)
+            sbruce_trees.push_back(BookTrees(s));
+
+        std::atomic<size_t> next(0);
+        std::atomic<bool> failed(false);
+        std::vector<std::exception_ptr> errors(samples.size());
+        auto worker = [&]()
+        {
+            for(size_t i = next++; i < samples.size() && !failed; i = next++)
             {
-                if((t.is_sim && !s.is_sim) || name.first != s.name)
-                    continue;
-                sbruce_trees.push_back(new ana::Tree(t.name, t.names, *s.loader, t.vars, ana::kNoSpillCut, true));
+                try
+                {
+                    RunSample(samples[i]);
+                }
+                catch(const LoaderAborted &)
+                {
+                    // Aborted after the failure of another sample.
+                }
+                catch(...)
+                {
+                    errors[i] = std::current_exception();
+                    failed = true;
+                    for(const Sample & s : samples)
+                        s.loader->Abort();
+                }
             }
+        };
+
+        size_t nthreads = std::min(parallel_samples, samples.size());
+        std::cout << "Running " << samples.size() << " samples on " << nthreads << " threads." << std::endl;
+        std::vector<std::thread> pool;
+        pool.reserve(nthreads);
+        for(size_t i = 0; i < nthreads; ++i)
+            pool.emplace_back(worker);
+        for(std::thread & t : pool)
+            t.join();
+        if(progress)
+            progress->stop();
 
-            s.loader->Go();
-            for(const ana::Tree * t : sbruce_trees)
+        for(const std::exception_ptr & e : errors)
+        {
+            if(e)
             {
-                t->SaveTo(subdir);
-                delete t;
+                for(std::vector<BookedTree> & t : sbruce_trees)
+                    ReleaseTrees(t);
+                f->Close();
+                std::rethrow_exception(e);
             }
+        }
+
+        for(size_t i = 0; i < samples.size(); ++i)
+        {
+            TDirectory * subdir = dir->mkdir(samples[i].name.c_str());
+            subdir->cd();
+            SaveSample(samples[i], subdir, sbruce_trees[i]);
             dir->cd();
         }
+        WriteProfile(f);
         f->Close();
     }
 }
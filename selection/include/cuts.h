@@ -118,7 +118,7 @@ namespace cuts
      * @return true if the interaction mode is one of the specified modes.
      */
     template<class T>
-    bool is_interaction_mode(const T & obj, std::vector<double> params={})
+    bool is_interaction_mode(const T & obj, const std::vector<double> & params={})
     {
         if(params.empty())
             return true; // No cut applied if no parameters are given.
@@ -254,7 +254,7 @@ namespace cuts
      * observed in data and simulation.
      */
     template<class T>
-    bool flash_cut(const T & obj, std::vector<double> params={})
+    bool flash_cut(const T & obj, const std::vector<double> & params={})
     {
         if(!valid_flashmatch(obj))
             return false;
@@ -283,7 +283,7 @@ namespace cuts
      * some maximum value (the desired multiplicity + 1).
      */
     template<class T>
-    size_t particle_multiplicity(const T & obj, size_t mult, size_t particle_species, std::vector<double> params={})
+    size_t particle_multiplicity(const T & obj, size_t mult, size_t particle_species, const std::vector<double> & params={})
     {
         size_t count(0);
         for(const auto & p : obj.particles)
@@ -308,7 +308,7 @@ namespace cuts
      * @return true if the interaction has a single primary photon.
      */
     template<class T>
-    bool single_photon(const T & obj, std::vector<double> params={25.0,})
+    bool single_photon(const T & obj, const std::vector<double> & params={25.0,})
     {
         return particle_multiplicity(obj, 1, 0, params) == 1;
     }
@@ -326,7 +326,7 @@ namespace cuts
      * @return true if the interaction has a single primary electron.
      */
     template<class T>
-    bool single_electron(const T & obj, std::vector<double> params={25.0,})
+    bool single_electron(const T & obj, const std::vector<double> & params={25.0,})
     {
         return particle_multiplicity(obj, 1, 1, params) == 1;
     }
@@ -345,7 +345,7 @@ namespace cuts
      * @return true if the interaction has a single primary muon.
      */
     template<class T>
-    bool single_muon(const T & obj, std::vector<double> params={143.425,})
+    bool single_muon(const T & obj, const std::vector<double> & params={143.425,})
     {
         return particle_multiplicity(obj, 1, 2, params) == 1;
     }
@@ -363,7 +363,7 @@ namespace cuts
      * @return true if the interaction has a single primary charged pion.
      */
     template<class T>
-    bool single_pion(const T & obj, std::vector<double> params={25.0,})
+    bool single_pion(const T & obj, const std::vector<double> & params={25.0,})
     {
         return particle_multiplicity(obj, 1, 3, params) == 1;
     }
@@ -381,7 +381,7 @@ namespace cuts
      * @return true if the interaction has a single primary proton.
      */
     template<class T>
-    bool single_proton(const T & obj, std::vector<double> params={50.0,})
+    bool single_proton(const T & obj, const std::vector<double> & params={50.0,})
     {
         return particle_multiplicity(obj, 1, 4, params) == 1;
     }
@@ -401,7 +401,7 @@ namespace cuts
      * @return true if the interaction has a nonzero primary photon.
      */
     template<class T>
-    bool no_photons(const T & obj, std::vector<double> params={25.0,})
+    bool no_photons(const T & obj, const std::vector<double> & params={25.0,})
     {
         return particle_multiplicity(obj, 0, 0, params) == 0;
     }
@@ -422,7 +422,7 @@ namespace cuts
      * @return true if the interaction has a nonzero primary electron.
      */
     template<class T>
-    bool no_electrons(const T & obj, std::vector<double> params={25.0,})
+    bool no_electrons(const T & obj, const std::vector<double> & params={25.0,})
     {
         return particle_multiplicity(obj, 0, 1, params) == 0;
     }
@@ -444,7 +444,7 @@ namespace cuts
      */
 
     template<class T>
-    bool no_muons(const T & obj, std::vector<double> params={143.425,})
+    bool no_muons(const T & obj, const std::vector<double> & params={143.425,})
     {
         return particle_multiplicity(obj, 0, 2, params) == 0;
     }
@@ -464,7 +464,7 @@ namespace cuts
      * @return true if the interaction has a nonzero primary charged pion.
      */
     template<class T>
-    bool no_charged_pions(const T & obj, std::vector<double> params={25.0,})
+    bool no_charged_pions(const T & obj, const std::vector<double> & params={25.0,})
     {
         return particle_multiplicity(obj, 0, 3, params) == 0;
     }
@@ -484,7 +484,7 @@ namespace cuts
      * @return true if the interaction has a nonzero primary proton.
      */
     template<class T>
-    bool no_protons(const T & obj, std::vector<double> params={50.0,})
+    bool no_protons(const T & obj, const std::vector<double> & params={50.0,})
     {
         return particle_multiplicity(obj, 0, 4, params) == 0;
     }
@@ -500,7 +500,7 @@ namespace cuts
      * @return true if the interaction has more than one proton.
      */
     template<class T>
-    bool multiproton(const T & obj, std::vector<double> params={50.0,})
+    bool multiproton(const T & obj, const std::vector<double> & params={50.0,})
     {
         return particle_multiplicity(obj, 1, 4, params) > 1;
     }
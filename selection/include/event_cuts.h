@@ -36,6 +36,7 @@ namespace ecut
     template<typename T>
     bool no_cut(const T & sr) { return true; }
     REGISTER_CUT_SCOPE(RegistrationScope::Event, no_cut, no_cut);
+    REGISTER_BRANCHES(RegistrationScope::Event, no_cut, "hdr");
 
     /**
      * @brief Apply a cut enforcing that there are nonzero reco interactions.
@@ -53,6 +54,7 @@ namespace ecut
         return (sr.ndlp > 0);
     }
     REGISTER_CUT_SCOPE(RegistrationScope::Event, nonzero_reco_interactions, nonzero_reco_interactions);
+    REGISTER_BRANCHES(RegistrationScope::Event, nonzero_reco_interactions, "dlp");
 
     /**
      * @brief Apply a cut enforcing a CRT-PMT veto.
@@ -66,7 +68,7 @@ namespace ecut
      * that is not associated with a CRT hit, false otherwise.
      */
     template<typename T>
-    bool crtpmt_veto(const T & sr, std::vector<double> params={})
+    bool crtpmt_veto(const T & sr, const std::vector<double> & params={})
     {
         if(params.size() < 2)
         {
@@ -81,6 +83,7 @@ namespace ecut
         return crtpmt_matched;
     }
     REGISTER_CUT_SCOPE(RegistrationScope::Event, crtpmt_veto, crtpmt_veto);
+    REGISTER_BRANCHES(RegistrationScope::Event, crtpmt_veto, "crtpmt_matches");
 
     /**
      * @brief Apply a cut on the global trigger time.
@@ -93,7 +96,7 @@ namespace ecut
      * @return true if the global trigger time is within the specified interval,
      */
     template<typename T>
-    bool global_trigger_time_cut(const T & sr, std::vector<double> params={})
+    bool global_trigger_time_cut(const T & sr, const std::vector<double> & params={})
     {
         if(params.empty())
         {
@@ -112,6 +115,7 @@ namespace ecut
         }
     }
     REGISTER_CUT_SCOPE(RegistrationScope::Event, global_trigger_time_cut, global_trigger_time_cut);
+    REGISTER_BRANCHES(RegistrationScope::Event, global_trigger_time_cut, "hdr");
 
     /**
      * @brief Apply a data quality cut on the event metadata.
@@ -136,6 +140,7 @@ namespace ecut
         }
     }
     REGISTER_CUT_SCOPE(RegistrationScope::Event, data_quality_cut, data_quality_cut);
+    REGISTER_BRANCHES(RegistrationScope::Event, data_quality_cut, "hdr");
 
     /**
      * @brief Cut that implements trigger emulation on simulated data.
@@ -161,6 +166,7 @@ namespace ecut
         }
     }
     REGISTER_CUT_SCOPE(RegistrationScope::Event, trigger_emulation_cut, trigger_emulation_cut);
+    REGISTER_BRANCHES(RegistrationScope::Event, trigger_emulation_cut, "hdr");
 
     /**
      * @brief A cut that places a threshold on the BNB Figure of Merit 2 (FoM2).
@@ -175,7 +181,7 @@ namespace ecut
      * @return true if the FoM2 value is above the threshold, false otherwise.
      */
     /*template<typename T>
-    bool bnb_fom2_cut(const T & sr, std::vector<double> params={})
+    bool bnb_fom2_cut(const T & sr, const std::vector<double> & params={})
     {
         if(params.empty())
         {
@@ -211,6 +217,7 @@ namespace ecut
         return sr.hdr.first_in_subrun;
     }
     REGISTER_CUT_SCOPE(RegistrationScope::Event, is_first_in_subrun_cut, is_first_in_subrun_cut);
+    REGISTER_BRANCHES(RegistrationScope::Event, is_first_in_subrun_cut, "hdr");
 }
 
 #endif // EVENT_CUTS_H
\ No newline at end of file
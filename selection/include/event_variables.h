@@ -17,18 +17,6 @@
 #include "framework.h"
 #include "utilities.h"
 
-/**
- * @brief Global vector to store BNB information across events.
- * @details This vector is used to store the BNB information across events,
- * which is necessary for certain calculations because the spill information is
- * only stored for the first event in the subrun. The vector is cleared when
- * the first event in the subrun is encountered, and it is filled with the
- * event number and the TOR875 value from the BNBInfo vector in the header of
- * the record.
- */
-std::vector<std::tuple<uint32_t, double>> global_bnb_info;
-size_t global_bnb_event_number = 0;
-
 /**
  * @namespace evar
  * @brief Namespace for organizing variables which act on events.
@@ -49,6 +37,8 @@ namespace evar
     template<typename T>
     double ntrue(const T & sr) { return sr.ndlp_true; }
     REGISTER_VAR_SCOPE(RegistrationScope::Event, ntrue, ntrue);
+    REGISTER_VAR_STORAGE(RegistrationScope::Event, ntrue, StorageType::Int32);
+    REGISTER_BRANCHES(RegistrationScope::Event, ntrue, "dlp_true");
 
     /**
      * @brief Variable for the number of reco SPINE interactions in the event.
@@ -61,6 +51,8 @@ namespace evar
     template<typename T>
     double nreco(const T & sr) { return sr.ndlp; }
     REGISTER_VAR_SCOPE(RegistrationScope::Event, nreco, nreco);
+    REGISTER_VAR_STORAGE(RegistrationScope::Event, nreco, StorageType::Int32);
+    REGISTER_BRANCHES(RegistrationScope::Event, nreco, "dlp");
 
     /**
      * @brief Variable for the multiplicity of neutrino interactions in the
@@ -83,6 +75,8 @@ namespace evar
         return count;
     }
     REGISTER_VAR_SCOPE(RegistrationScope::Event, nnu, nnu);
+    REGISTER_VAR_STORAGE(RegistrationScope::Event, nnu, StorageType::Int32);
+    REGISTER_BRANCHES(RegistrationScope::Event, nnu, "dlp_true");
 
     /**
      * @brief Variable for the multiplicity of in-time interactions in the
@@ -98,7 +92,7 @@ namespace evar
      * @return double the multiplicity of in-time interactions in the event.
      */
     template<typename T>
-    double nintime(const T & sr, std::vector<double> params={0.0, 1.6})
+    double nintime(const T & sr, const std::vector<double> & params={0.0, 1.6})
     {
         size_t count = 0;
         for(const auto & interaction : sr.dlp_true)
@@ -115,6 +109,8 @@ namespace evar
         return count;
     }
     REGISTER_VAR_SCOPE(RegistrationScope::Event, nintime, nintime);
+    REGISTER_VAR_STORAGE(RegistrationScope::Event, nintime, StorageType::Int32);
+    REGISTER_BRANCHES(RegistrationScope::Event, nintime, "dlp_true");
 
     template<typename T>
     double is_first_in_subrun(const T & sr)
@@ -124,6 +120,8 @@ namespace evar
         return sr.hdr.first_in_subrun;
     }
     REGISTER_VAR_SCOPE(RegistrationScope::Event, is_first_in_subrun, is_first_in_subrun);
+    REGISTER_VAR_STORAGE(RegistrationScope::Event, is_first_in_subrun, StorageType::UInt8);
+    REGISTER_BRANCHES(RegistrationScope::Event, is_first_in_subrun, "hdr");
 
     /**
      * @brief Variable for the POT (Protons on Target) in the event.
@@ -136,6 +134,7 @@ namespace evar
     template<typename T>
     double pot(const T & sr) { return sr.hdr.pot; }
     REGISTER_VAR_SCOPE(RegistrationScope::Event, pot, pot);
+    REGISTER_BRANCHES(RegistrationScope::Event, pot, "hdr");
 
     /**
      * @brief Variable for the POT (Protons on Target) from the spillinfo
@@ -150,18 +149,18 @@ namespace evar
      * @return the total POT from the spillinfo vector in the header of the record.
      */
     template<typename T>
-    double pot_from_spillinfo(const T & sr, std::vector<double> params={})
+    double pot_from_spillinfo(const T & sr, const std::vector<double> & params={})
     {
-        if(params.size() < 1)
-            params.push_back(1.0); // Default scale factor if not provided
+        double scale = (params.size() < 1) ? 1.0 : params.at(0); // Default scale factor if not provided
         double pot = 0;
         for(const auto & spill : sr.hdr.bnbinfo)
         {
-            pot += params.at(0)*spill.TOR875;
+            pot += scale*spill.TOR875;
         }
         return pot;
     }
     REGISTER_VAR_SCOPE(RegistrationScope::Event, pot_from_spillinfo, pot_from_spillinfo);
+    REGISTER_BRANCHES(RegistrationScope::Event, pot_from_spillinfo, "hdr");
 
     /**
      * @brief Variable for the number of generated events (MC only) in the
@@ -175,6 +174,8 @@ namespace evar
     template<typename T>
     double ngenevt(const T & sr) { return sr.hdr.ngenevt; }
     REGISTER_VAR_SCOPE(RegistrationScope::Event, ngenevt, ngenevt);
+    REGISTER_VAR_STORAGE(RegistrationScope::Event, ngenevt, StorageType::Int32);
+    REGISTER_BRANCHES(RegistrationScope::Event, ngenevt, "hdr");
 
     /**
      * @brief Variable for the number of BNB spills in the event.
@@ -187,6 +188,8 @@ namespace evar
     template<typename T>
     double nbnb(const T & sr) { return sr.hdr.bnbinfo.size(); }
     REGISTER_VAR_SCOPE(RegistrationScope::Event, nbnb, nbnb);
+    REGISTER_VAR_STORAGE(RegistrationScope::Event, nbnb, StorageType::Int32);
+    REGISTER_BRANCHES(RegistrationScope::Event, nbnb, "hdr");
 
     /**
      * @brief Variable for the number of NuMI spills in the event.
@@ -199,6 +202,8 @@ namespace evar
     template<typename T>
     double nnumi(const T & sr) { return sr.hdr.numiinfo.size(); }
     REGISTER_VAR_SCOPE(RegistrationScope::Event, nnumi, nnumi);
+    REGISTER_VAR_STORAGE(RegistrationScope::Event, nnumi, StorageType::Int32);
+    REGISTER_BRANCHES(RegistrationScope::Event, nnumi, "hdr");
 
     /**
      * @brief Variable for the number of off-beam BNB gates in the event.
@@ -212,6 +217,8 @@ namespace evar
     template<typename T>
     double noffbeambnb(const T & sr) { return sr.hdr.noffbeambnb; }
     REGISTER_VAR_SCOPE(RegistrationScope::Event, noffbeambnb, noffbeambnb);
+    REGISTER_VAR_STORAGE(RegistrationScope::Event, noffbeambnb, StorageType::Int32);
+    REGISTER_BRANCHES(RegistrationScope::Event, noffbeambnb, "hdr");
 
     /**
      * @brief Variable for the number of off-beam NuMI gates in the event.
@@ -225,6 +232,8 @@ namespace evar
     template<typename T>
     double noffbeamnumi(const T & sr) { return sr.hdr.noffbeamnumi; }
     REGISTER_VAR_SCOPE(RegistrationScope::Event, noffbeamnumi, noffbeamnumi);
+    REGISTER_VAR_STORAGE(RegistrationScope::Event, noffbeamnumi, StorageType::Int32);
+    REGISTER_BRANCHES(RegistrationScope::Event, noffbeamnumi, "hdr");
 
     /**
      * @brief Variable for the time of the global trigger.
@@ -240,6 +249,7 @@ namespace evar
     template<typename T>
     double global_trigger_time(const T & sr) { return sr.hdr.triggerinfo.global_trigger_time; }
     REGISTER_VAR_SCOPE(RegistrationScope::Event, global_trigger_time, global_trigger_time);
+    REGISTER_BRANCHES(RegistrationScope::Event, global_trigger_time, "hdr");
 
     /**
      * @brief Variable for the time of the beam gate in UTC
@@ -253,6 +263,7 @@ namespace evar
     template<typename T>
     double beam_gate_time_abs(const T & sr) { return sr.hdr.triggerinfo.beam_gate_time_abs; }
     REGISTER_VAR_SCOPE(RegistrationScope::Event, beam_gate_time_abs, beam_gate_time_abs);
+    REGISTER_BRANCHES(RegistrationScope::Event, beam_gate_time_abs, "hdr");
 
     /**
      * @brief Variable for the time of the trigger within the beam gate.
@@ -265,6 +276,7 @@ namespace evar
     template<typename T>
     double trigger_within_gate(const T & sr) { return sr.hdr.triggerinfo.trigger_within_gate; }
     REGISTER_VAR_SCOPE(RegistrationScope::Event, trigger_within_gate, trigger_within_gate);
+    REGISTER_BRANCHES(RegistrationScope::Event, trigger_within_gate, "hdr");
 
     /**
      * @brief Variable for the time of the beam gate in the detector time
@@ -278,6 +290,7 @@ namespace evar
     template<typename T>
     double beam_gate_det_time(const T & sr) { return sr.hdr.triggerinfo.beam_gate_det_time; }
     REGISTER_VAR_SCOPE(RegistrationScope::Event, beam_gate_det_time, beam_gate_det_time);
+    REGISTER_BRANCHES(RegistrationScope::Event, beam_gate_det_time, "hdr");
 
     /**
      * @brief Variable for the time of the global trigger in the detector time
@@ -292,6 +305,7 @@ namespace evar
     template<typename T>
     double global_trigger_det_time(const T & sr) { return sr.hdr.triggerinfo.global_trigger_det_time; }
     REGISTER_VAR_SCOPE(RegistrationScope::Event, global_trigger_det_time, global_trigger_det_time);
+    REGISTER_BRANCHES(RegistrationScope::Event, global_trigger_det_time, "hdr");
 
     /**
      * @brief Variable for the number of gates elapsed since the last trigger
@@ -306,6 +320,7 @@ namespace evar
     template<typename T>
     double gate_delta(const T & sr) { return sr.hdr.triggerinfo.gate_delta; }
     REGISTER_VAR_SCOPE(RegistrationScope::Event, gate_delta, gate_delta);
+    REGISTER_BRANCHES(RegistrationScope::Event, gate_delta, "hdr");
 
     /**
      * @brief Variable for time of the flash closest to the trigger time.
@@ -324,7 +339,7 @@ namespace evar
      * @return the time of the flash closest to the trigger time.
      */
     template<typename T>
-    double time_of_flash_closest_to_trigger(const T & sr, std::vector<double> params={0.0})
+    double time_of_flash_closest_to_trigger(const T & sr, const std::vector<double> & params={0.0})
     {
         if(params.size() < 1)
         {
@@ -338,6 +353,7 @@ namespace evar
             return sr.opflashes[closest_flash_index].firsttime + t0;
     }
     REGISTER_VAR_SCOPE(RegistrationScope::Event, time_of_flash_closest_to_trigger, time_of_flash_closest_to_trigger);
+    REGISTER_BRANCHES(RegistrationScope::Event, time_of_flash_closest_to_trigger, "hdr", "opflashes");
 
     /**
      * @brief Variable for time of the flash closest to the trigger time.
@@ -356,7 +372,7 @@ namespace evar
      * @return the time of the flash closest to the trigger time.
      */
     template<typename T>
-    double time_of_flash_closest_to_trigger_rawtime(const T & sr, std::vector<double> params={0.0})
+    double time_of_flash_closest_to_trigger_rawtime(const T & sr, const std::vector<double> & params={0.0})
     {
         if(params.size() < 1)
         {
@@ -370,6 +386,7 @@ namespace evar
             return sr.opflashes[closest_flash_index].time + t0;
     }
     REGISTER_VAR_SCOPE(RegistrationScope::Event, time_of_flash_closest_to_trigger_rawtime, time_of_flash_closest_to_trigger_rawtime);
+    REGISTER_BRANCHES(RegistrationScope::Event, time_of_flash_closest_to_trigger_rawtime, "hdr", "opflashes");
 
     /**
      * @brief Variable (wrapper) for the FoM2 (Figure of Merit 2) in the event.
@@ -392,9 +409,9 @@ namespace evar
     /**
      * @brief Variable for the unfolded event POT (Protons on Target).
      * @details This variable retrieves the unfolded event POT by summing up
-     * the TOR875 values from the BNBInfo vector in the header of the record.
-     * This uses the stored global BNB info to ensure that the POT is bookkept
-     * correctly for each event.
+     * the TOR875 values of the BNB spills assigned to this event. The spills
+     * of the subrun are stored on its first record, and are kept per subrun
+     * by the exposure ledger of the current thread (see @ref ExposureLedger).
      * @tparam T the top-level record.
      * @param sr the StandardRecord to apply the variable on.
      * @return the unfolded event POT in the event.
@@ -402,40 +419,17 @@ namespace evar
     template<typename T>
     double unfolded_event_pot(const T & sr)
     {
-        // If this is the first event in the subrun, we need to reset the
-        // global BNB info.
-        if(sr.hdr.first_in_subrun && global_bnb_event_number != sr.hdr.evt)
-        {
-            global_bnb_info.clear();
-            for(const auto & bnb_info : sr.hdr.bnbinfo)
-            {
-                // Store the event number and the TOR875 value.
-                global_bnb_info.emplace_back((uint32_t)bnb_info.event, (double)bnb_info.TOR875);
-            }
-            global_bnb_event_number = sr.hdr.evt;
-        }
-
-        // Loop over the global BNB info and filter out the events that are not
-        // this one.
-        double pot = 0.0;
-        for(const auto & bnb_info : global_bnb_info)
-        {
-            if(std::get<0>(bnb_info) == sr.hdr.evt)
-            {
-                // Add the TOR875 value to the pot.
-                pot += std::get<1>(bnb_info);
-            }
-        }
-
-        return pot;
+        return ExposureLedger::worker().unfolded(sr).pot;
     }
     REGISTER_VAR_SCOPE(RegistrationScope::Event, unfolded_event_pot, unfolded_event_pot);
+    REGISTER_BRANCHES(RegistrationScope::Event, unfolded_event_pot, "hdr");
 
     /**
      * @brief Variable for the number of unfolded BNB events in the event.
-     * @details This variable counts the number of unfolded BNB events in the
-     * event by checking the global BNB info vector. It is used to ensure that
-     * the number of BNB events is bookkept correctly for each event.
+     * @details This variable counts the number of BNB spills assigned to this
+     * event. The spills of the subrun are stored on its first record, and are
+     * kept per subrun by the exposure ledger of the current thread (see
+     * @ref ExposureLedger).
      * @tparam T the top-level record.
      * @param sr the StandardRecord to apply the variable on.
      * @return the number of unfolded BNB events in the event.
@@ -443,34 +437,10 @@ namespace evar
     template<typename T>
     double unfolded_event_nbnb(const T & sr)
     {
-        // If this is the first event in the subrun, we need to reset the
-        // global BNB info.
-        if(sr.hdr.first_in_subrun && global_bnb_event_number != sr.hdr.evt)
-        {
-            global_bnb_info.clear();
-            for(const auto & bnb_info : sr.hdr.bnbinfo)
-            {
-                // Store the event number and the TOR875 value.
-                global_bnb_info.emplace_back((uint32_t)bnb_info.event, (double)bnb_info.TOR875);
-            }
-            global_bnb_event_number = sr.hdr.evt;
-        }
-
-        // Loop over the global BNB info and filter out the events that are not
-        // this one.
-        size_t nbnbs = 0;
-        for(const auto & bnb_info : global_bnb_info)
-        {
-            if(std::get<0>(bnb_info) == sr.hdr.evt)
-            {
-                // Count the number of BNB events.
-                ++nbnbs;
-            }
-        }
-
-        return nbnbs;
+        return ExposureLedger::worker().unfolded(sr).spills;
     }
     REGISTER_VAR_SCOPE(RegistrationScope::Event, unfolded_event_nbnb, unfolded_event_nbnb);
+    REGISTER_BRANCHES(RegistrationScope::Event, unfolded_event_nbnb, "hdr");
 }
 
 #endif
\ No newline at end of file
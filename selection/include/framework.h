@@ -9,8 +9,18 @@
 #ifndef FRAMEWORK_H
 #define FRAMEWORK_H
 #include <map>
+#include <memory>
 #include <vector>
+#include <array>
 #include <string>
+#include <optional>
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <ostream>
+#include <tuple>
+#include <cstdint>
+#include <algorithm>
 #include <functional>
 #include <stdexcept>
 #include <type_traits>
@@ -18,6 +28,8 @@
 #include "sbnana/CAFAna/Core/MultiVar.h"
 #include "configuration.h"
 
+class TDirectory;
+
 /**
  * @brief Type aliases for the event types used in the framework.
  * @details These type aliases are used to simplify the code and make it
@@ -179,6 +191,117 @@ inline std::function<ValueT(const EventT&)> bind(const std::vector<double>& pars
         return [=](const EventT& e){ return F(e); };
 }
 
+//-----------------------------------------------------------------------------
+// 4) Fast (function pointer) registries
+//-----------------------------------------------------------------------------
+/**
+ * @brief Alias for plain function pointers with signature
+ * ValueT(const EventT&, const std::vector<double>&).
+ * @details This is the statically typed fast path for registered functions.
+ * The function pointer is called directly with the parameter block of the
+ * bound function, avoiding the layers of std::function and the parameter
+ * copies of the factory path.
+ */
+template<typename EventT, typename ValueT>
+using FnPtr = ValueT(*)(const EventT&, const std::vector<double>&);
+
+template<typename EventT>
+using FastCutRegistry = Registry<FnPtr<EventT, bool>>;
+
+template<typename EventT>
+using FastVarRegistry = Registry<FnPtr<EventT, double>>;
+
+template<typename EventT>
+using FastSelectorRegistry = Registry<FnPtr<EventT, size_t>>;
+
+/**
+ * @brief Adapt a function to the fast path signature.
+ * @details This function adapts a function to the uniform signature of the
+ * fast path. It uses std::is_invocable_v to check if the function accepts a
+ * vector of parameters and forwards the parameter block if so. Being a plain
+ * function, its address can be stored as a @ref FnPtr.
+ * @tparam F The function to adapt.
+ * @tparam EventT The type of event: @ref TType or @ref RType.
+ * @tparam ValueT The return type of the function.
+ * @param e The event to apply the function to.
+ * @param pars The parameter block bound to the function.
+ * @return The result of the function.
+ */
+template<auto F, typename EventT, typename ValueT>
+ValueT invoke(const EventT & e, const std::vector<double> & pars)
+{
+    if constexpr(std::is_invocable_v<decltype(F), const EventT&, const std::vector<double>&>)
+        return F(e, pars);
+    else
+        return F(e);
+}
+
+/**
+ * @brief A fast path function bound to its parameter block.
+ * @details This pairs a @ref FnPtr with its parameters. The parameter block
+ * is a std::vector, as the registered functions take their parameters as a
+ * vector: it is allocated once, when the function is bound, and is passed by
+ * reference on each call, so no allocation or copy is made per call.
+ * @tparam EventT The type of event the function is applied to.
+ * @tparam ValueT The return type of the function.
+ */
+template<typename EventT, typename ValueT>
+struct BoundFn
+{
+    FnPtr<EventT, ValueT> fn;   ///< The registered function.
+    std::vector<double> params; ///< The parameter block of the function.
+
+    /**
+     * @brief Apply the bound function to an event.
+     * @param e The event to apply the function to.
+     * @return The result of the function.
+     */
+    ValueT operator()(const EventT & e) const { return fn(e, params); }
+};
+
+/**
+ * @brief A single (possibly inverted) cut bound to its parameter block.
+ * @details The cut is called through the fast path (@ref FnPtr) if it is
+ * registered there, and through the std::function of the factory registry
+ * otherwise (e.g., for cuts that are registered dynamically). This is used
+ * where cuts are applied one at a time (the cutflow, the category
+ * classifier, and the exposure cuts); conjunctions of cuts use the
+ * @ref CutChain.
+ * @tparam EventT The type of object the cut is applied to.
+ */
+template<typename EventT>
+struct BoundCut
+{
+    FnPtr<EventT, bool> fn = nullptr; ///< The registered cut (nullptr for the fallback).
+    std::vector<double> params;       ///< The parameter block of the cut.
+    bool invert = false;              ///< Whether the result is negated.
+    CutFn<EventT> fallback;           ///< The cut of the factory registry (fallback only).
+
+    /**
+     * @brief Apply the cut to an object.
+     * @param e The object to apply the cut to.
+     * @return The (possibly inverted) result of the cut.
+     */
+    bool operator()(const EventT & e) const { return (fn ? fn(e, params) : fallback(e)) != invert; }
+};
+
+/**
+ * @brief Bind a registered cut to its parameters.
+ * @tparam EventT The type of object the cut is applied to.
+ * @param name The full name of the cut in the registry.
+ * @param params The parameters of the cut.
+ * @param invert Whether the result of the cut is negated.
+ * @return The bound cut.
+ * @throw std::runtime_error if the cut is not registered.
+ */
+template<typename EventT>
+BoundCut<EventT> bind_cut(const std::string & name, const std::vector<double> & params, bool invert = false)
+{
+    if(FastCutRegistry<EventT>::instance().is_registered(name))
+        return BoundCut<EventT>{FastCutRegistry<EventT>::instance().get(name), params, invert, nullptr};
+    return BoundCut<EventT>{nullptr, {}, invert, CutFactoryRegistry<EventT>::instance().get(name)(params)};
+}
+
 /**
  * @brief Scope for registration macros
  * @details This enum class defines the scope of registration for cuts and
@@ -196,29 +319,59 @@ namespace
 {                                                                                          \
     const bool _reg_cut_##name = []{                                                       \
         if constexpr((scope)==RegistrationScope::True || (scope)==RegistrationScope::Both) \
+        {                                                                                  \
             CutFactoryRegistry<TType>::instance().register_fn(                             \
                 "true_" #name, bind<+fn<TType>, TType, bool>                               \
             );                                                                             \
+            FastCutRegistry<TType>::instance().register_fn(                                \
+                "true_" #name, &invoke<+fn<TType>, TType, bool>                            \
+            );                                                                             \
+        }                                                                                  \
         if constexpr((scope)==RegistrationScope::Reco || (scope)==RegistrationScope::Both) \
+        {                                                                                  \
             CutFactoryRegistry<RType>::instance().register_fn(                             \
                 "reco_" #name, bind<+fn<RType>, RType, bool>                               \
             );                                                                             \
+            FastCutRegistry<RType>::instance().register_fn(                                \
+                "reco_" #name, &invoke<+fn<RType>, RType, bool>                            \
+            );                                                                             \
+        }                                                                                  \
         if constexpr((scope)==RegistrationScope::TrueParticle || (scope)==RegistrationScope::BothParticle) \
+        {                                                                                  \
             CutFactoryRegistry<TParticleType>::instance().register_fn(                     \
                 "true_particle_" #name, bind<+fn<TParticleType>, TParticleType, bool>      \
             );                                                                             \
+            FastCutRegistry<TParticleType>::instance().register_fn(                        \
+                "true_particle_" #name, &invoke<+fn<TParticleType>, TParticleType, bool>   \
+            );                                                                             \
+        }                                                                                  \
         if constexpr((scope)==RegistrationScope::RecoParticle || (scope)==RegistrationScope::BothParticle) \
+        {                                                                                  \
             CutFactoryRegistry<RParticleType>::instance().register_fn(                     \
                 "reco_particle_" #name, bind<+fn<RParticleType>, RParticleType, bool>      \
             );                                                                             \
+            FastCutRegistry<RParticleType>::instance().register_fn(                        \
+                "reco_particle_" #name, &invoke<+fn<RParticleType>, RParticleType, bool>   \
+            );                                                                             \
+        }                                                                                  \
         if constexpr((scope)==RegistrationScope::Event)                                    \
+        {                                                                                  \
             CutFactoryRegistry<EventType>::instance().register_fn(                         \
                 "event_" #name, bind<+fn<EventType>, EventType, bool>                      \
             );                                                                             \
+            FastCutRegistry<EventType>::instance().register_fn(                            \
+                "event_" #name, &invoke<+fn<EventType>, EventType, bool>                   \
+            );                                                                             \
+        }                                                                                  \
         if constexpr((scope)==RegistrationScope::Spill)                                    \
+        {                                                                                  \
             CutFactoryRegistry<SpillType>::instance().register_fn(                         \
                 "spill_" #name, bind<+fn<SpillType>, SpillType, bool>                      \
             );                                                                             \
+            FastCutRegistry<SpillType>::instance().register_fn(                            \
+                "spill_" #name, &invoke<+fn<SpillType>, SpillType, bool>                   \
+            );                                                                             \
+        }                                                                                  \
         return true;                                                                       \
     }();                                                                                   \
 }                                                                                          \
@@ -230,29 +383,59 @@ namespace
 {                                                                                          \
     const bool _reg_var_##name = []{                                                       \
         if constexpr((scope)==RegistrationScope::True || (scope)==RegistrationScope::Both) \
+        {                                                                                  \
             VarFactoryRegistry<TType>::instance().register_fn(                             \
                 "true_" #name, bind<fn<TType>, TType, double>                              \
             );                                                                             \
+            FastVarRegistry<TType>::instance().register_fn(                                \
+                "true_" #name, &invoke<fn<TType>, TType, double>                           \
+            );                                                                             \
+        }                                                                                  \
         if constexpr((scope)==RegistrationScope::Reco || (scope)==RegistrationScope::Both) \
+        {                                                                                  \
             VarFactoryRegistry<RType>::instance().register_fn(                             \
                 "reco_" #name, bind<fn<RType>, RType, double>                              \
             );                                                                             \
+            FastVarRegistry<RType>::instance().register_fn(                                \
+                "reco_" #name, &invoke<fn<RType>, RType, double>                           \
+            );                                                                             \
+        }                                                                                  \
         if constexpr((scope)==RegistrationScope::MCTruth)                                  \
+        {                                                                                  \
             VarFactoryRegistry<MCTruth>::instance().register_fn(                           \
                 "true_" #name, bind<fn<MCTruth>, MCTruth, double>                          \
             );                                                                             \
+            FastVarRegistry<MCTruth>::instance().register_fn(                              \
+                "true_" #name, &invoke<fn<MCTruth>, MCTruth, double>                       \
+            );                                                                             \
+        }                                                                                  \
         if constexpr((scope)==RegistrationScope::TrueParticle || (scope)==RegistrationScope::BothParticle) \
+        {                                                                                  \
             VarFactoryRegistry<TParticleType>::instance().register_fn(                     \
                 "true_particle_" #name, bind<fn<TParticleType>, TParticleType, double>     \
             );                                                                             \
+            FastVarRegistry<TParticleType>::instance().register_fn(                        \
+                "true_particle_" #name, &invoke<fn<TParticleType>, TParticleType, double>  \
+            );                                                                             \
+        }                                                                                  \
         if constexpr((scope)==RegistrationScope::RecoParticle || (scope)==RegistrationScope::BothParticle) \
+        {                                                                                  \
             VarFactoryRegistry<RParticleType>::instance().register_fn(                     \
                 "reco_particle_" #name, bind<fn<RParticleType>, RParticleType, double>     \
             );                                                                             \
+            FastVarRegistry<RParticleType>::instance().register_fn(                        \
+                "reco_particle_" #name, &invoke<fn<RParticleType>, RParticleType, double>  \
+            );                                                                             \
+        }                                                                                  \
         if constexpr((scope)==RegistrationScope::Event)                                    \
+        {                                                                                  \
             VarFactoryRegistry<EventType>::instance().register_fn(                         \
                 "event_" #name, bind<fn<EventType>, EventType, double>                     \
             );                                                                             \
+            FastVarRegistry<EventType>::instance().register_fn(                            \
+                "event_" #name, &invoke<fn<EventType>, EventType, double>                  \
+            );                                                                             \
+        }                                                                                  \
         return true;                                                                       \
     }();                                                                                   \
 }
@@ -269,6 +452,104 @@ namespace
         SelectorFactoryRegistry<RType>::instance().register_fn(                            \
             "reco_" #name, bind<fn<RType>, RType, size_t>                                  \
         );                                                                                 \
+        FastSelectorRegistry<TType>::instance().register_fn(                               \
+            "true_" #name, &invoke<fn<TType>, TType, size_t>                               \
+        );                                                                                 \
+        FastSelectorRegistry<RType>::instance().register_fn(                               \
+            "reco_" #name, &invoke<fn<RType>, RType, size_t>                               \
+        );                                                                                 \
+        return true;                                                                       \
+    }();                                                                                   \
+}
+
+//-----------------------------------------------------------------------------
+// 5) Output storage types
+//-----------------------------------------------------------------------------
+/**
+ * @brief Storage type of a branch in the output trees.
+ * @details Branch variables are always computed as doubles, but may be stored
+ * with a more compact type. Integer types cannot represent the NaN used for
+ * placeholder values (e.g., no match), which are therefore stored as the
+ * minimum value of the type (int32) or as the maximum value (uint8).
+ */
+enum class StorageType { Double, Float, Int32, UInt8 };
+
+/**
+ * @brief Parse a storage type from its configuration name.
+ * @param name The name of the storage type ("double", "float", "int32", or
+ * "uint8"/"bool").
+ * @return The storage type.
+ * @throw std::runtime_error if the name is not a valid storage type.
+ */
+inline StorageType parse_storage(const std::string & name)
+{
+    if(name == "double") return StorageType::Double;
+    else if(name == "float") return StorageType::Float;
+    else if(name == "int32" || name == "int") return StorageType::Int32;
+    else if(name == "uint8" || name == "bool") return StorageType::UInt8;
+    else throw std::runtime_error("Illegal storage type '" + name + "'.");
+}
+
+/**
+ * @brief Registry of the natural storage types of registered variables.
+ * @details Variables that are integer-valued (e.g., counts, ids, PDG codes)
+ * or boolean flags declare their natural storage type with the
+ * @ref REGISTER_VAR_STORAGE macro. This is used to infer the storage type of
+ * a branch if it is not configured explicitly.
+ */
+using StorageRegistry = Registry<StorageType>;
+
+/**
+ * @brief Get the registry prefixes of the names registered for a scope.
+ * @param scope The scope of the registration.
+ * @return The prefixes of the names registered for the scope.
+ */
+inline std::vector<std::string> scope_prefixes(RegistrationScope scope)
+{
+    switch(scope)
+    {
+        case RegistrationScope::True: return {"true_"};
+        case RegistrationScope::Reco: return {"reco_"};
+        case RegistrationScope::Both: return {"true_", "reco_"};
+        case RegistrationScope::MCTruth: return {"true_"};
+        case RegistrationScope::TrueParticle: return {"true_particle_"};
+        case RegistrationScope::RecoParticle: return {"reco_particle_"};
+        case RegistrationScope::BothParticle: return {"true_particle_", "reco_particle_"};
+        case RegistrationScope::Event: return {"event_"};
+        case RegistrationScope::Spill: return {"spill_"};
+    }
+    return {};
+}
+
+// Register the natural storage type of a variable with scope.
+#define REGISTER_VAR_STORAGE(scope, name, storage)                                         \
+namespace                                                                                  \
+{                                                                                          \
+    const bool _reg_storage_##name = []{                                                   \
+        for(const std::string & prefix : scope_prefixes(scope))                            \
+            StorageRegistry::instance().register_fn(prefix + #name, storage);              \
+        return true;                                                                       \
+    }();                                                                                   \
+}
+
+/**
+ * @brief Registry of the StandardRecord branches read by registered functions.
+ * @details Each entry lists the top-level branches of the StandardRecord
+ * (e.g., "hdr", "dlp", "opflashes") that a function reads, as declared with
+ * the @ref REGISTER_BRANCHES macro. This is used to disable the branches that
+ * no configured function reads (see @ref required_branches). Functions on
+ * interactions and particles only see their own object, so only the
+ * functions of the event scope need to declare their branches.
+ */
+using BranchRegistry = Registry<std::vector<std::string>>;
+
+// Declare the StandardRecord branches read by a function with scope.
+#define REGISTER_BRANCHES(scope, name, ...)                                                \
+namespace                                                                                  \
+{                                                                                          \
+    const bool _reg_branches_##name = []{                                                  \
+        for(const std::string & prefix : scope_prefixes(scope))                            \
+            BranchRegistry::instance().register_fn(prefix + #name, std::vector<std::string>{__VA_ARGS__}); \
         return true;                                                                       \
     }();                                                                                   \
 }
@@ -282,11 +563,1242 @@ namespace
  */
 enum class Mode { True = 0, Reco = 1, Event = 2 };
 
+/**
+ * @brief Parse the operation mode of a selection.
+ * @param mode The name of the mode ("true", "reco", or "event").
+ * @return The operation mode.
+ * @throw std::runtime_error if the name is not a valid mode.
+ */
+Mode parse_mode(const std::string & mode);
+
+/**
+ * @brief Identity of a record.
+ * @details The records processed by each thread are numbered sequentially,
+ * starting from one. The loader advances the sequence number once per
+ * record (spill), before the record is handed to the variables, with
+ * @ref advance_record. This is used to key the per-record caches of the
+ * framework.
+ */
+using RecordKey = uint64_t;
+
+/**
+ * @brief Signal the next record processed by the current thread.
+ * @return The identity of the next record.
+ */
+RecordKey advance_record();
+
+/**
+ * @brief Get the identity of the record processed by the current thread.
+ * @return The identity of the current record.
+ * @throw std::runtime_error if no record has been signalled on the current
+ * thread (see @ref advance_record).
+ */
+RecordKey current_record();
+
+/**
+ * @brief Per-record index of truth <--> reco matches.
+ * @details This class holds the interaction and particle matches of a single
+ * record in both directions (truth to reco and reco to truth). It is built
+ * once per record, on first use, and is shared by all variables, selectors,
+ * and trees evaluated on that record. Interaction matches follow the
+ * convention of the rest of the framework: the first entry of "match_ids" is
+ * used directly as an index into the complementary interaction branch.
+ * Particle matches are resolved by particle id through a flat, sorted lookup
+ * table over all particles in the record. The particle tables are only built
+ * if a particle match is requested.
+ */
+class MatchIndex
+{
+    public:
+        /**
+         * @brief Location of a particle within a record.
+         * @details The location is given as the index of the interaction in
+         * its branch and the position of the particle within the interaction.
+         */
+        struct Location
+        {
+            size_t interaction; ///< Index of the interaction in its branch.
+            size_t particle;    ///< Position of the particle in the interaction.
+        };
+
+        /**
+         * @brief Get the match index for the record.
+         * @details This function returns the match index of the current
+         * thread, rebuilding it if the record differs from the one that was
+         * last indexed.
+         * @param sr The record to retrieve the match index for.
+         * @param with_particles Whether the particle tables are required.
+         * @return A reference to the match index for the record.
+         */
+        static const MatchIndex & get(const EventType & sr, bool with_particles = false);
+
+        /**
+         * @brief Get the reco interaction matched to a true interaction.
+         * @param index The index of the true interaction in dlp_true.
+         * @return The index of the matched reco interaction in dlp (or
+         * kNoMatch).
+         */
+        size_t true_to_reco(size_t index) const { return true_matches_[index]; }
+
+        /**
+         * @brief Get the true interaction matched to a reco interaction.
+         * @param index The index of the reco interaction in dlp.
+         * @return The index of the matched true interaction in dlp_true (or
+         * kNoMatch).
+         */
+        size_t reco_to_true(size_t index) const { return reco_matches_[index]; }
+
+        /**
+         * @brief Get the reco particle matched to a true particle.
+         * @param interaction The index of the true interaction in dlp_true.
+         * @param particle The position of the particle in the interaction.
+         * @return A pointer to the matched reco particle (or nullptr).
+         */
+        const RParticleType * true_to_reco_particle(size_t interaction, size_t particle) const;
+
+        /**
+         * @brief Get the true particle matched to a reco particle.
+         * @param interaction The index of the reco interaction in dlp.
+         * @param particle The position of the particle in the interaction.
+         * @return A pointer to the matched true particle (or nullptr).
+         */
+        const TParticleType * reco_to_true_particle(size_t interaction, size_t particle) const;
+
+    private:
+        /**
+         * @brief Build the interaction matches of the record.
+         * @param sr The record to index.
+         */
+        void build(const EventType & sr);
+
+        /**
+         * @brief Build the particle matches of the record.
+         * @param sr The record to index.
+         */
+        void build_particles(const EventType & sr);
+
+        std::optional<RecordKey> current_;
+        bool particles_built_ = false;
+        std::vector<size_t> true_matches_;
+        std::vector<size_t> reco_matches_;
+        std::vector<size_t> true_offsets_;
+        std::vector<size_t> reco_offsets_;
+        std::vector<const RParticleType *> true_particle_matches_;
+        std::vector<const TParticleType *> reco_particle_matches_;
+        std::vector<std::pair<int64_t, const RParticleType *>> reco_by_id_;
+        std::vector<std::pair<int64_t, const TParticleType *>> true_by_id_;
+};
+
+/**
+ * @brief Identity of a subrun (run, subrun).
+ */
+using SubrunKey = std::pair<int64_t, int64_t>;
+
+/**
+ * @brief Exposure carried by a record (or accumulated over records).
+ * @details For simulation, the POT and livetime (number of generated events)
+ * of the subrun are carried by its first record. For data, each record
+ * carries the BNB spills (and offbeam triggers) since the previous record:
+ * the POT is the TOR875 of the spills passing the spill cuts, the livetime is
+ * the total number of spills and offbeam triggers, and the spill count is the
+ * number of BNB spills passing the spill cuts.
+ */
+struct ExposureCounts
+{
+    double pot = 0;      ///< The protons on target.
+    double livetime = 0; ///< The livetime (generated events or triggers).
+    uint64_t spills = 0; ///< The number of BNB spills passing the spill cuts.
+    uint64_t events = 0; ///< The number of records carrying the exposure.
+
+    /**
+     * @brief Add the exposure of another set of counts.
+     * @param other The counts to add.
+     * @return void
+     */
+    void merge(const ExposureCounts & other);
+};
+
+/**
+ * @brief Accounting of the exposure of a sample.
+ * @details The ledger sums the exposure of each record under its subrun and
+ * event number. Every observation is counted: MC files may reuse the same
+ * (run, subrun, event) header for distinct records, so records sharing a
+ * header are summed and counted as duplicates (see @ref duplicates) rather
+ * than discarded. Each worker (thread or shard) keeps its own ledger of a
+ * disjoint set of records, and the ledgers are combined with @ref merge; the
+ * totals are summed in (run, subrun, event) order, so the result does not
+ * depend on the order of the records or of the merges. A ledger is not
+ * shared between threads.
+ *
+ * The unfolded (per-record) BNB exposure is stored on the first record of
+ * the subrun in some files. The worker ledger (see @ref worker) keeps only
+ * the spills of the current subrun, so its memory does not grow with the
+ * number of subruns. The records of a subrun must therefore be processed by
+ * the same thread after the first record of the subrun and before the first
+ * record of the next subrun, as is the case for the records of a file.
+ */
+class ExposureLedger
+{
+    public:
+        /**
+         * @brief Get the ledger of the current thread.
+         * @details This ledger holds the unfolded spills used by the
+         * unfolded exposure variables.
+         * @return A reference to the ledger of the current thread.
+         */
+        static ExposureLedger & worker();
+
+        /**
+         * @brief Compute the exposure carried by a record.
+         * @param sr The record.
+         * @param spill_cut The spill cut applied to each BNB spill of a data
+         * record (all spills pass if empty).
+         * @return The exposure carried by the record.
+         */
+        static ExposureCounts of(const EventType & sr, const CutFn<SpillType> & spill_cut = CutFn<SpillType>());
+
+        /**
+         * @brief Record the exposure carried by a record.
+         * @details Records without exposure are ignored.
+         * @param sr The record.
+         * @param spill_cut The spill cut applied to each BNB spill of a data
+         * record (all spills pass if empty).
+         * @return void
+         */
+        void observe(const EventType & sr, const CutFn<SpillType> & spill_cut = CutFn<SpillType>());
+
+        /**
+         * @brief Record the exposure of a record by its identity.
+         * @details The exposure of a record whose subrun and event number
+         * have already been recorded is added to the existing record, and
+         * the record is counted as a duplicate.
+         * @param subrun The subrun of the record.
+         * @param event The event number of the record.
+         * @param counts The exposure carried by the record.
+         * @return void
+         */
+        void add(const SubrunKey & subrun, int64_t event, const ExposureCounts & counts);
+
+        /**
+         * @brief Get the unfolded exposure of a record.
+         * @details The BNB spills of the subrun replace those of the previous
+         * subrun when its first record is observed, and the exposure of the
+         * spills assigned to the event number of the record is returned. The
+         * POT is not subject to the spill cuts.
+         * @param sr The record.
+         * @return The unfolded exposure of the record (only the POT and the
+         * spill count are set).
+         */
+        ExposureCounts unfolded(const EventType & sr);
+
+        /**
+         * @brief Merge the exposure of another ledger into this ledger.
+         * @details The ledgers are expected to hold disjoint records. Records
+         * present in both ledgers are summed and counted as duplicates.
+         * @param other The ledger to merge.
+         * @return void
+         */
+        void merge(const ExposureLedger & other);
+
+        /**
+         * @brief Get the number of records sharing the subrun and event number
+         * of an earlier record.
+         * @details Duplicates are expected for MC files which reuse headers,
+         * but indicate double counting if the same input was observed twice.
+         * @return The number of duplicate records.
+         */
+        size_t duplicates() const;
+
+        /**
+         * @brief Get the exposure of each subrun.
+         * @return The exposure of each subrun, in (run, subrun) order.
+         */
+        std::map<SubrunKey, ExposureCounts> subruns() const;
+
+        /**
+         * @brief Get the total exposure.
+         * @return The total exposure over all subruns.
+         */
+        ExposureCounts totals() const;
+
+        /**
+         * @brief Write the exposure of each subrun to a TTree.
+         * @details The TTree has one entry per subrun, in (run, subrun)
+         * order, with the branches "run", "subrun", "pot", "livetime",
+         * "spills", and "events".
+         * @param dir The directory to write the TTree to.
+         * @param name The name of the TTree.
+         * @return void
+         */
+        void write(TDirectory * dir, const std::string & name) const;
+
+    private:
+        std::map<SubrunKey, std::map<int64_t, ExposureCounts>> records_;
+        size_t duplicates_ = 0;
+        std::optional<SubrunKey> unfolded_subrun_;
+        std::vector<std::pair<uint32_t, double>> unfolded_;
+        std::optional<RecordKey> unfolded_key_;
+};
+
+/**
+ * @brief Derived particle quantities held by the @ref ParticleCache.
+ */
+enum class ParticleQuantity : size_t { KE = 0, PID = 1, Primary = 2, Count = 3 };
+
+/**
+ * @brief Per-record cache of derived particle quantities.
+ * @details Some derived quantities of a particle (kinetic energy, PID, and
+ * primary classification) go through the user-configurable scoring functions
+ * and are requested many times per particle by cuts, variables, and selectors
+ * alike. This class caches them once per particle and per record. The values
+ * are kept in contiguous arrays (one per quantity) indexed by the position of
+ * the particle in the record, i.e. its particle id. Each slot remembers the
+ * address of the particle that owns it, so a particle with a duplicate or
+ * otherwise unexpected id is simply computed without caching. The cache is
+ * invalidated in constant time (via a generation counter) when the loader
+ * advances to the next record, which is signalled by @ref advance.
+ * @tparam ParticleT The type of particle (TParticleType or RParticleType).
+ */
+template<typename ParticleT>
+class ParticleCache
+{
+    public:
+        /**
+         * @brief Get the cache instance of the current thread.
+         * @return A reference to the cache instance of the current thread.
+         */
+        static ParticleCache & instance();
+
+        /**
+         * @brief Signal the record being processed.
+         * @details This function invalidates the cache if the record differs
+         * from the one currently cached. The cache is disabled until the
+         * first call to this function.
+         * @param key The identity of the record being processed.
+         */
+        void advance(const RecordKey & key)
+        {
+            if(!current_ || *current_ != key)
+            {
+                current_ = key;
+                ++generation_;
+            }
+        }
+
+        /**
+         * @brief Retrieve a cached quantity, computing it if necessary.
+         * @tparam F The type of the callable computing the quantity.
+         * @param p The particle to retrieve the quantity for.
+         * @param q The quantity to retrieve.
+         * @param compute The callable computing the quantity on a cache miss.
+         * @return The value of the quantity for the particle.
+         */
+        template<typename F>
+        double get(const ParticleT & p, ParticleQuantity q, F && compute)
+        {
+            int64_t id = p.id;
+            if(!current_ || id < 0 || id >= kMaxId)
+                return compute();
+
+            size_t slot(id);
+            if(slot >= owners_.size())
+            {
+                size_t n = std::max<size_t>(slot + 1, 2 * owners_.size());
+                owners_.resize(n, nullptr);
+                owner_stamps_.resize(n, 0);
+                for(size_t i(0); i < (size_t)ParticleQuantity::Count; ++i)
+                {
+                    values_[i].resize(n, 0);
+                    stamps_[i].resize(n, 0);
+                }
+            }
+
+            // Claim the slot for this particle or bail out on a collision.
+            if(owner_stamps_[slot] != generation_)
+            {
+                owners_[slot] = &p;
+                owner_stamps_[slot] = generation_;
+            }
+            else if(owners_[slot] != &p)
+                return compute();
+
+            size_t qi = (size_t)q;
+            if(stamps_[qi][slot] == generation_)
+                return values_[qi][slot];
+            double value = compute();
+            values_[qi][slot] = value;
+            stamps_[qi][slot] = generation_;
+            return value;
+        }
+
+    private:
+        // Ids beyond this are not expected and are not cached.
+        static constexpr int64_t kMaxId = 1 << 20;
+
+        std::optional<RecordKey> current_;
+        uint64_t generation_ = 0;
+        std::vector<const ParticleT *> owners_;
+        std::vector<uint64_t> owner_stamps_;
+        std::vector<double> values_[(size_t)ParticleQuantity::Count];
+        std::vector<uint64_t> stamps_[(size_t)ParticleQuantity::Count];
+};
+
+/**
+ * @brief An axis-aligned box of active volume (cm, detector coordinates).
+ * @details The bounds are kept in double precision, as the boundary checks
+ * are sensitive to the exact (decimal) bounds of the detector.
+ */
+struct DetectorBox
+{
+    double xmin, xmax; ///< The bounds in x.
+    double ymin, ymax; ///< The bounds in y.
+    double zmin, zmax; ///< The bounds in z.
+};
+
+/**
+ * @brief Description of the active volume of a detector.
+ * @details The active volume is the union of up to two boxes (e.g., the two
+ * cryostats of ICARUS). A point is near the boundary of the detector if it
+ * is near the boundary of (or outside) every box, i.e., if it is not inside
+ * any box shrunk by the margin on all sides.
+ */
+struct DetectorDescriptor
+{
+    const char * name;                ///< The name of the detector.
+    std::array<DetectorBox, 2> boxes; ///< The boxes of the active volume.
+    size_t nboxes;                    ///< The number of boxes in use.
+    double margin;                    ///< The margin of the boundary checks.
+
+    /**
+     * @brief Check if a point is near the boundary of the detector.
+     * @param x The x-coordinate of the point.
+     * @param y The y-coordinate of the point.
+     * @param z The z-coordinate of the point.
+     * @return True if the point is within the margin of (or outside) the
+     * active volume.
+     */
+    constexpr bool near_boundary(double x, double y, double z) const
+    {
+        bool near = true;
+        for(size_t i(0); i < nboxes; ++i)
+        {
+            const DetectorBox & b = boxes[i];
+            near = near && (x < b.xmin + margin || x > b.xmax - margin ||
+                            y < b.ymin + margin || y > b.ymax - margin ||
+                            z < b.zmin + margin || z > b.zmax - margin);
+        }
+        return near;
+    }
+};
+
+/**
+ * @brief The active volume of SBND.
+ */
+constexpr DetectorDescriptor kSBND{"sbnd", {{{-201.3, 201.3, -200.008, 200.008, 4.94238, 504.458}}}, 1, 5.0};
+
+/**
+ * @brief The active volume of ICARUS (the TPCs of both cryostats).
+ */
+constexpr DetectorDescriptor kICARUS{"icarus", {{{-358.49, -61.94, -181.86, 134.96, -894.95, 894.95},
+                                                 {61.94, 358.49, -181.86, 134.96, -894.95, 894.95}}}, 2, 5.0};
+
+/**
+ * @brief Get the detector used by the geometry checks.
+ * @details The detector defaults to SBND and is configured once, before any
+ * sample is run (see @ref set_detector).
+ * @return The descriptor of the configured detector.
+ */
+const DetectorDescriptor & active_detector();
+
+/**
+ * @brief Configure the detector used by the geometry checks.
+ * @param name The name of the detector ("sbnd" or "icarus").
+ * @return void
+ * @throw std::runtime_error if the detector is not known.
+ */
+void set_detector(const std::string & name);
+
+/**
+ * @brief Compute the distances of a set of points to a reference point.
+ * @details The batch kernels operate on contiguous (structure-of-arrays)
+ * buffers without branches, so that they vectorize. The inputs are the
+ * (float) coordinates of the StandardRecord, and the results are computed in
+ * double precision, as in the per-particle helpers of @ref utilities.
+ * @param n The number of points.
+ * @param x The x-coordinates of the points.
+ * @param y The y-coordinates of the points.
+ * @param z The z-coordinates of the points.
+ * @param ref The reference point.
+ * @param out The distances (n values).
+ * @return void
+ */
+void batch_distance(size_t n, const float * x, const float * y, const float * z, const std::array<double, 3> & ref, double * out);
+
+/**
+ * @brief Check if a set of points is near the boundary of a detector.
+ * @param n The number of points.
+ * @param x The x-coordinates of the points.
+ * @param y The y-coordinates of the points.
+ * @param z The z-coordinates of the points.
+ * @param detector The detector.
+ * @param out The flags (n values, 1 if near the boundary).
+ * @return void
+ */
+void batch_near_boundary(size_t n, const float * x, const float * y, const float * z, const DetectorDescriptor & detector, uint8_t * out);
+
+/**
+ * @brief Compute the transverse components of a set of momenta.
+ * @details The transverse component is taken with respect to the beam
+ * direction: the z-axis for BNB, or the direction from the NuMI target to
+ * the start point of each particle (see @ref utilities::transverse_momentum).
+ * @param n The number of particles.
+ * @param p The x, y, and z components of the momenta.
+ * @param start The x, y, and z coordinates of the start points.
+ * @param numi Whether the beam is NuMI.
+ * @param out The x, y, and z components of the transverse momenta.
+ * @return void
+ */
+void batch_transverse(size_t n, const std::array<const float *, 3> & p, const std::array<const float *, 3> & start, bool numi, const std::array<double *, 3> & out);
+
+/**
+ * @brief Structure-of-arrays geometry of the particles of an interaction.
+ * @details The start and end points and the momenta of all particles of an
+ * interaction are gathered into contiguous buffers, indexed by the position
+ * of the particle in the interaction, and the geometry kernels are run once
+ * over the full interaction. The gathered inputs are stored as floats (the
+ * type of the StandardRecord), and the derived quantities as doubles. The
+ * transverse momenta are only computed if requested (see
+ * @ref GeometryCache::get).
+ */
+struct ParticleGeometry
+{
+    std::array<std::vector<float>, 3> start;      ///< The start points.
+    std::array<std::vector<float>, 3> end;        ///< The end points.
+    std::array<std::vector<float>, 3> momentum;   ///< The momenta.
+    std::array<std::vector<double>, 3> transverse; ///< The transverse momenta.
+    std::vector<double> vertex_distance;          ///< The distances of the start points to the vertex.
+    std::vector<uint8_t> start_near_boundary;     ///< Whether the start points are near the boundary.
+    std::vector<uint8_t> end_near_boundary;       ///< Whether the end points are near the boundary.
+    bool transverse_built = false;                ///< Whether the transverse momenta are computed.
+    bool transverse_numi = false;                 ///< The beam of the transverse momenta.
+};
+
+/**
+ * @brief Per-record cache of the @ref ParticleGeometry of each interaction.
+ * @details The geometry of an interaction is built on first use in a record
+ * and shared by all cuts, variables, and selectors evaluated on it. The
+ * buffers are re-used between records, and the cache is invalidated when the
+ * loader advances to the next record, which is signalled by @ref advance (as
+ * for the @ref ParticleCache). Until then, the geometry is rebuilt on each
+ * request.
+ * @tparam InteractionT The type of interaction (TType or RType).
+ */
+template<typename InteractionT>
+class GeometryCache
+{
+    public:
+        /**
+         * @brief Get the cache instance of the current thread.
+         * @return A reference to the cache instance of the current thread.
+         */
+        static GeometryCache & instance();
+
+        /**
+         * @brief Signal the record being processed.
+         * @param key The identity of the record being processed.
+         */
+        void advance(const RecordKey & key);
+
+        /**
+         * @brief Get the geometry of an interaction, building it if necessary.
+         * @param obj The interaction.
+         * @param with_transverse Whether the transverse momenta are required.
+         * @param numi Whether the beam is NuMI (for the transverse momenta).
+         * @return A reference to the geometry of the interaction, valid until
+         * the cache advances to the next record (or, before the first record
+         * is signalled, until the next call).
+         */
+        const ParticleGeometry & get(const InteractionT & obj, bool with_transverse = false, bool numi = false);
+
+    private:
+        /**
+         * @brief Build the geometry of an interaction.
+         * @param obj The interaction.
+         * @param geometry The geometry to fill.
+         */
+        static void build(const InteractionT & obj, ParticleGeometry & geometry);
+
+        std::optional<RecordKey> current_;
+        size_t used_ = 0;
+        std::deque<std::pair<const InteractionT *, ParticleGeometry>> entries_;
+        ParticleGeometry scratch_;
+};
+
+/**
+ * @brief Configuration of the adaptive ordering of cuts.
+ * @details The adaptive ordering is opt-in and configured per tree. When
+ * enabled, each cut is evaluated unconditionally over the first @ref records
+ * records to measure its pass fraction and its average cost. The conjunction
+ * is then reordered to minimize the expected cost per object. If @ref retune
+ * is non-zero, the measurement is repeated every @ref retune records.
+ */
+struct AdaptiveCutOrder
+{
+    bool enabled = false; ///< Whether the adaptive ordering is enabled.
+    size_t records = 1000; ///< Number of records in each profiling window.
+    size_t retune = 0;     ///< Period (in records) of the re-tuning (0 = never).
+};
+
+/**
+ * @brief Counters for a single profiled function.
+ * @details The counters belong to a single selection pass (i.e., a single
+ * sample and tree), so they are only ever updated from one thread. The wall
+ * time is measured on a sample of the calls (every @ref period calls) to keep
+ * the overhead of the instrumentation low.
+ */
+struct ProfileCounter
+{
+    std::string scope;   ///< The scope of the function ("<sample>/<tree>").
+    std::string kind;    ///< The kind of function (e.g., "reco_cut", "var").
+    std::string name;    ///< The name of the function.
+    uint64_t period = 1; ///< The sampling period of the timing.
+    uint64_t calls = 0;  ///< The number of calls.
+    uint64_t passes = 0; ///< The number of passing calls (cuts, selectors).
+    uint64_t timed = 0;  ///< The number of timed calls.
+    double time = 0;     ///< The accumulated wall time of the timed calls (s).
+
+    /**
+     * @brief Call a function, counting (and possibly timing) the call.
+     * @tparam F The type of the function.
+     * @tparam Args The types of the arguments of the function.
+     * @param f The function to call.
+     * @param args The arguments of the function.
+     * @return The result of the function.
+     */
+    template<typename F, typename... Args>
+    auto measure(const F & f, const Args &... args) -> decltype(f(args...))
+    {
+        if(calls++ % period != 0)
+            return f(args...);
+        auto start = std::chrono::steady_clock::now();
+        auto result = f(args...);
+        time += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        ++timed;
+        return result;
+    }
+
+    /**
+     * @brief Estimate the total wall time spent in the function.
+     * @return The average time of the timed calls scaled to all calls (s).
+     */
+    double total_time() const { return timed ? time * calls / timed : 0.0; }
+};
+
+/**
+ * @brief Registry of the profiling counters of all cuts and variables.
+ * @details The profiling mode is switched on from the [general] block of the
+ * configuration before the selections are constructed. The cuts, variables,
+ * and selectors bound by @ref SelectionPass and @ref construct are then
+ * wrapped with a @ref ProfileCounter, and a per-sample, per-tree report is
+ * emitted at the end of the analysis.
+ */
+class Profiler
+{
+    public:
+        /**
+         * @brief Get the singleton instance of the Profiler.
+         * @return Reference to the singleton instance.
+         */
+        static Profiler & instance();
+
+        /**
+         * @brief Enable the profiling mode.
+         * @param period The sampling period of the timing (in calls).
+         */
+        void enable(size_t period = 1);
+
+        /**
+         * @brief Check if the profiling mode is enabled.
+         * @return True if the profiling mode is enabled.
+         */
+        bool enabled() const { return enabled_; }
+
+        /**
+         * @brief Create the counters for a function.
+         * @param scope The scope of the function ("<sample>/<tree>").
+         * @param kind The kind of function (e.g., "reco_cut", "var").
+         * @param name The name of the function.
+         * @return Pointer to the counters, which remain valid for the
+         * lifetime of the Profiler.
+         */
+        ProfileCounter * counter(const std::string & scope, const std::string & kind, const std::string & name);
+
+        /**
+         * @brief Print the per-sample, per-tree report.
+         * @details The functions of each scope are listed in decreasing order
+         * of the (estimated) total time spent in the function.
+         * @param out The stream to print the report to.
+         */
+        void report(std::ostream & out) const;
+
+        /**
+         * @brief Write the counters to a TTree ("profile") in a directory.
+         * @param dir The directory to write the TTree to.
+         */
+        void write(TDirectory * dir) const;
+
+        /**
+         * @brief Write the counters to a JSON file.
+         * @param path The path of the JSON file.
+         * @throw std::runtime_error if the file cannot be opened.
+         */
+        void write_json(const std::string & path) const;
+
+    private:
+        bool enabled_ = false;
+        size_t period_ = 1;
+        std::deque<ProfileCounter> counters_;
+        mutable std::mutex mutex_;
+};
+
+/**
+ * @brief A function wrapped with profiling counters.
+ * @details The result of the function is passed through unchanged. Calls of
+ * cuts (bool) pass if the cut passes, and calls of selectors (size_t) pass if
+ * a particle is selected.
+ * @tparam F The type of the wrapped function.
+ */
+template<typename F>
+struct ProfiledFn
+{
+    F fn;                     ///< The wrapped function.
+    ProfileCounter * counter; ///< The counters of the function.
+
+    /**
+     * @brief Apply the wrapped function to an object.
+     * @tparam EventT The type of the object.
+     * @param e The object to apply the function to.
+     * @return The result of the function.
+     */
+    template<typename EventT>
+    auto operator()(const EventT & e) const
+    {
+        auto result = counter->measure(fn, e);
+        if constexpr(std::is_same_v<decltype(result), bool>)
+            counter->passes += result;
+        else if constexpr(std::is_same_v<decltype(result), size_t>)
+            counter->passes += (result != kNoMatch);
+        return result;
+    }
+};
+
+/**
+ * @brief Pass a function to a callable, wrapping it with profiling counters
+ * if the profiling mode is enabled.
+ * @details An empty @p scope disables the profiling of the function. This is
+ * used for functions that are not bound to a single sample (see
+ * @ref compile).
+ * @tparam Fn The type of the function.
+ * @tparam G The type of the callable receiving the function.
+ * @param scope The scope of the function ("<sample>/<tree>").
+ * @param kind The kind of function (e.g., "var", "selector").
+ * @param name The name of the function.
+ * @param fn The function.
+ * @param g The callable receiving the (wrapped) function.
+ * @return The result of @p g.
+ */
+template<typename Fn, typename G>
+auto with_profile(const std::string & scope, const std::string & kind, const std::string & name, const Fn & fn, G && g)
+{
+    if(Profiler::instance().enabled() && !scope.empty())
+        return g(ProfiledFn<Fn>{fn, Profiler::instance().counter(scope, kind, name)});
+    else
+        return g(fn);
+}
+
+/**
+ * @brief A conjunction of cuts applied to a single type of object.
+ * @details This class holds a list of named cut functions which are combined
+ * with a logical "and". The cuts are stored as a flat array of records of the
+ * form {function pointer, parameter block, invert} which are evaluated in a
+ * single loop (see @ref BoundFn for the parameter block). Cuts which are not available on the fast path (e.g., cuts
+ * that are registered dynamically) fall back to a std::function. By default,
+ * the cuts are applied in the configured order with short-circuiting. If the
+ * adaptive ordering is enabled, the order is determined from the measured
+ * pass fraction and cost of each cut. This is only valid because the chain is
+ * a pure conjunction: the result does not depend on the order in which the
+ * cuts are applied.
+ * @tparam T The type of object the cuts are applied to.
+ */
+template<typename T>
+class CutChain
+{
+    public:
+        /**
+         * @brief Add a registered cut to the end of the chain.
+         * @details The cut is looked up in the fast registry first, falling
+         * back to the factory registry if it is not found.
+         * @param cut_name The full name of the cut in the registry.
+         * @param params The parameters of the cut.
+         * @param invert Whether the result of the cut is negated.
+         * @throw std::runtime_error if the cut is not registered.
+         */
+        void add(const std::string & cut_name, const std::vector<double> & params, bool invert);
+
+        /**
+         * @brief Add an arbitrary cut function to the end of the chain.
+         * @param name The name of the cut (used for logging).
+         * @param fn The cut function.
+         */
+        void add(const std::string & name, CutFn<T> fn);
+
+        /**
+         * @brief Check if the chain contains any cuts.
+         * @return True if the chain is empty, false otherwise.
+         */
+        bool empty() const { return records_.empty(); }
+
+        /**
+         * @brief Enable the adaptive ordering of the chain.
+         * @param adaptive The configuration of the adaptive ordering.
+         * @param label A label identifying the chain in the log.
+         */
+        void configure(const AdaptiveCutOrder & adaptive, const std::string & label);
+
+        /**
+         * @brief Signal the start of a new record.
+         * @details This function advances the record counter used by the
+         * adaptive ordering, reordering the chain at the end of a profiling
+         * window.
+         */
+        void next_record();
+
+        /**
+         * @brief Attach profiling counters to each cut of the chain.
+         * @param scope The scope of the chain ("<sample>/<tree>").
+         * @param kind The kind of cuts in the chain (e.g., "reco_cut").
+         */
+        void instrument(const std::string & scope, const std::string & kind);
+
+        /**
+         * @brief Apply the chain of cuts to an object.
+         * @param obj The object to apply the cuts to.
+         * @return True if the object passes all cuts, false otherwise.
+         */
+        bool operator()(const T & obj)
+        {
+            if(profiling_)
+                return profile(obj);
+            if(instrumented_)
+                return count(obj);
+            for(size_t i(0); i < records_.size(); ++i)
+            {
+                const Record & r = records_[i];
+                if((r.fn ? r.fn(obj, r.params) : entries_[i].fallback(obj)) == r.invert)
+                    return false;
+            }
+            return true;
+        }
+
+    private:
+        /**
+         * @brief The hot data of a single cut in the chain.
+         */
+        struct Record
+        {
+            FnPtr<T, bool> fn;          ///< The cut (nullptr for the fallback).
+            std::vector<double> params; ///< The parameter block of the cut.
+            bool invert;                ///< Whether the result is negated.
+        };
+
+        /**
+         * @brief The cold data of a single cut in the chain, with its
+         * measured statistics.
+         */
+        struct Entry
+        {
+            std::string name;
+            CutFn<T> fallback;
+            size_t calls = 0;
+            size_t passes = 0;
+            double time = 0;
+            ProfileCounter * counter = nullptr;
+        };
+
+        /**
+         * @brief Apply the chain while measuring the statistics of each cut.
+         * @param obj The object to apply the cuts to.
+         * @return True if the object passes all cuts, false otherwise.
+         */
+        bool profile(const T & obj);
+
+        /**
+         * @brief Apply the chain while updating the profiling counters.
+         * @param obj The object to apply the cuts to.
+         * @return True if the object passes all cuts, false otherwise.
+         */
+        bool count(const T & obj);
+
+        /**
+         * @brief Reorder the chain using the measured statistics.
+         */
+        void reorder();
+
+        std::vector<Record> records_;
+        std::vector<Entry> entries_;
+        AdaptiveCutOrder adaptive_;
+        std::string label_;
+        bool profiling_ = false;
+        bool instrumented_ = false;
+        size_t records_seen_ = 0;
+};
+
+/**
+ * @brief A candidate interaction that passes the selection of a tree.
+ * @details This struct records a single interaction in the broadcast branch
+ * (dlp_true for "true" mode, dlp for "reco" mode) that passes the selection
+ * of the tree. The match id is cached so that branch variables do not need
+ * to re-derive it. The particle range is only populated once a particle-level
+ * branch variable requests it (see @ref SelectionPass::evaluate).
+ */
+struct SelectionCandidate
+{
+    size_t index;   ///< Index of the interaction in the broadcast branch.
+    size_t match;   ///< Index of the matched interaction (or kNoMatch).
+    bool strict;    ///< Passes the complementary cuts without the data "escape".
+    size_t pbegin;  ///< Start of the passing particle range (see @ref SelectionResult::particles).
+    size_t pend;    ///< End of the passing particle range.
+};
+
+/**
+ * @brief The result of the selection pass on a single record.
+ * @details This struct holds the outcome of applying the full cut chain of a
+ * tree to a single record. All branch variables of the tree read from this
+ * object instead of re-applying the cuts themselves.
+ */
+struct SelectionResult
+{
+    bool event_passed = false;                  ///< Result of the event (and spill) cuts.
+    bool particles_evaluated = false;           ///< Whether the particle cuts have been applied.
+    std::vector<SelectionCandidate> candidates; ///< Passing interactions in branch order.
+    std::vector<size_t> particles;              ///< Flat list of passing particle positions.
+};
+
+/**
+ * @brief Classifier implementing the "true_category" variable.
+ * @details Each [category] block defines a category as a conjunction of true
+ * interaction cuts, and an interaction is assigned to the first category
+ * (in configured order) whose cuts it passes. The categories typically share
+ * most of their cuts, so the distinct (cut, parameters) predicates are
+ * collected once and each category is stored as a pair of bitmasks: the
+ * predicates it requires and their required values (an inverted cut requires
+ * the predicate to fail). The bitmasks are split into 64-bit words, so there
+ * is no limit on the number of distinct predicates. During the classification, each predicate is
+ * evaluated at most once per interaction and only when first needed. A
+ * category is skipped without evaluating anything if it conflicts with the
+ * predicates that are already known.
+ */
+class CategoryClassifier
+{
+    public:
+        /**
+         * @brief Constructor for the CategoryClassifier class.
+         * @param categories Vector of [category] subtables, each with a list
+         * of "cuts" subtables with fields:
+         *        - name:       string (base cut name, "!" prefix to invert)
+         *        - parameters: array of floats (parameters for the cut)
+         * @throw std::runtime_error if a cut is not registered.
+         */
+        CategoryClassifier(const std::vector<cfg::ConfigurationTable> & categories);
+
+        /**
+         * @brief Classify a true interaction.
+         * @details This function is safe to call concurrently, as all the
+         * per-interaction state is local.
+         * @param e The true interaction to classify.
+         * @return The index of the first matching category, or NaN if no
+         * category matches.
+         */
+        double classify(const TType & e) const;
+
+    private:
+        /**
+         * @brief A single category.
+         */
+        struct Category
+        {
+            std::vector<uint64_t> require;  ///< The mask of required predicates (one word per 64 predicates).
+            std::vector<uint64_t> value;    ///< The required values of the predicates.
+            std::vector<size_t> predicates; ///< The required predicates, in configured order.
+            bool satisfiable = true;        ///< False if the category requires a predicate to both pass and fail.
+        };
+
+        std::vector<BoundCut<TType>> predicates_;
+        std::vector<Category> categories_;
+        size_t words_ = 1; ///< The number of 64-bit words of each bitmask.
+};
+
+/**
+ * @brief Single-pass cutflow of the cuts of a tree.
+ * @details The cutflow records how many events, interactions, particles, and
+ * how much exposure survive each successive cut of the [[tree.cut]] list, in
+ * configured order, during the normal pass over the sample. Stage k of the
+ * cutflow counts the objects surviving the first k cuts (stage 0 counts all
+ * objects). Cuts are applied following the same rules as @ref SelectionPass:
+ * - Event and spill cuts apply to the record. Spill cuts are not applied on
+ * MC.
+ * - Interaction cuts of the broadcast type apply to the interaction, and
+ * complementary cuts to its match (an interaction without a match fails the
+ * complementary cuts on MC, and ignores them on data).
+ * - Particle cuts of the broadcast type apply to the particles of the
+ * interaction. They do not remove interactions or events.
+ * An event survives a stage if it passes the event and spill cuts of the
+ * stage and, once an interaction cut has been applied, if at least one of its
+ * interactions survives the stage. The exposure of an event is counted as in
+ * the exposure trees: the POT of the subrun (on its first event) for MC, and
+ * the POT of the spills passing the spill cuts for data. For MC, the counts
+ * of interactions, particles, and events are additionally broken down by the
+ * "true_category" variable (if configured), using -1 for interactions that
+ * are not matched or not categorized.
+ */
+class Cutflow
+{
+    public:
+        /**
+         * @brief Constructor for the Cutflow class.
+         * @param cuts Vector of [[tree.cut]] subtables defining the stages.
+         * @param mode The mode of the main loop of the tree.
+         * @param ismc A boolean indicating whether the data is MC (true) or
+         * not (false).
+         * @throw std::runtime_error if a cut has an illegal type or is not
+         * registered.
+         */
+        Cutflow(const std::vector<cfg::ConfigurationTable> & cuts, Mode mode, bool ismc);
+
+        /**
+         * @brief Accumulate the cutflow for a single record.
+         * @param sr The record to accumulate the cutflow for.
+         * @param matches The interaction match lookup of the record (null in
+         * the event mode, which has no interaction loop).
+         */
+        void fill(const EventType & sr, const MatchIndex * matches);
+
+        /**
+         * @brief Write the cutflow as TTrees to a directory.
+         * @details The TTree "<name>_cutflow" contains one entry per stage
+         * with the surviving events, interactions, particles, and exposure.
+         * For MC with categories, the TTree "<name>_cutflow_category"
+         * contains one entry per stage and category.
+         * @param dir The directory to write the TTrees to.
+         * @param name The name of the tree the cutflow belongs to.
+         */
+        void write(TDirectory * dir, const std::string & name) const;
+
+    private:
+        /**
+         * @brief The level at which a cut is applied.
+         */
+        enum class Level { Event, Spill, True, Reco, TrueParticle, RecoParticle };
+
+        /**
+         * @brief A single stage of the cutflow.
+         */
+        struct Stage
+        {
+            std::string name; ///< The name of the cut (with "!" if inverted).
+            Level level;      ///< The level at which the cut is applied.
+            size_t index;     ///< The index of the cut in its typed list.
+        };
+
+        /**
+         * @brief The surviving counts of a single stage.
+         */
+        struct Counts
+        {
+            double events = 0;
+            double interactions = 0;
+            double particles = 0;
+            double exposure = 0;
+        };
+
+        /**
+         * @brief Add an object to the counts of the leading stages.
+         * @param counts The counts of each stage.
+         * @param passed The number of leading stages passed by the object.
+         * @param field The field of the counts to increment.
+         * @param value The value to add.
+         */
+        static void add(std::vector<Counts> & counts, size_t passed, double Counts::* field, double value = 1);
+
+        Mode mode_;
+        bool ismc_;
+        std::vector<Stage> stages_;
+        std::vector<BoundCut<EventType>> event_cuts_;
+        std::vector<BoundCut<SpillType>> spill_cuts_;
+        std::vector<BoundCut<TType>> true_cuts_;
+        std::vector<BoundCut<RType>> reco_cuts_;
+        std::vector<BoundCut<TParticleType>> true_particle_cuts_;
+        std::vector<BoundCut<RParticleType>> reco_particle_cuts_;
+        std::optional<VarFn<TType>> category_;
+        std::vector<Counts> counts_;
+        std::map<int64_t, std::vector<Counts>> category_counts_;
+        size_t first_interaction_;
+};
+
+/**
+ * @brief A single parsed [[tree.cut]] subtable.
+ * @details The cut subtables of a tree are parsed once (see @ref parse_cuts)
+ * and shared by the selection passes of all samples.
+ */
+struct CutSpec
+{
+    std::string name;           ///< The base name of the cut (without "!").
+    std::string type;           ///< The type of the cut (e.g., "true", "spill").
+    std::vector<double> params; ///< The parameters of the cut.
+    bool invert = false;        ///< Whether the cut is inverted.
+};
+
+/**
+ * @brief Parse the [[tree.cut]] subtables of a tree.
+ * @param cuts Vector of [[tree.cut]] subtables with fields:
+ *        - name:       string (base cut name, "!" prefix to invert)
+ *        - type:       string ("true", "reco", "true_particle",
+ *                      "reco_particle", "event", or "spill")
+ *        - parameters: array of floats (parameters for the cut)
+ * @return The parsed cuts, in configured order.
+ * @throw std::runtime_error if a cut has no type or an illegal type.
+ */
+std::vector<CutSpec> parse_cuts(const std::vector<cfg::ConfigurationTable> & cuts);
+
+/**
+ * @brief Check if the function implementing a cut is registered.
+ * @details Spill cuts are only available on the fast path. All other cuts
+ * may be registered on either the fast path or the factory path.
+ * @param cut The parsed cut.
+ * @return True if the cut is registered.
+ */
+bool is_registered(const CutSpec & cut);
+
+/**
+ * @brief Tree-level selection pass shared by all branches of a tree.
+ * @details This class owns the full cut chain of a single tree (event, spill,
+ * interaction, complementary, and particle cuts) and applies it once per
+ * record. The result is cached and keyed on the identity of the record, so
+ * the first branch variable evaluated on a record triggers the selection and
+ * every subsequent branch variable of the same tree re-uses the result.
+ * Particle-level cuts are only applied if a particle-level branch variable
+ * requests them.
+ */
+class SelectionPass
+{
+    public:
+        /**
+         * @brief Constructor for the SelectionPass class.
+         * @details This constructor parses the [[tree.cut]] subtables and
+         * retrieves the configured cut functions from the registries.
+         * @param cuts Vector of [[tree.cut]] subtables with fields:
+         *        - name:       string (base cut name, "!" prefix to invert)
+         *        - type:       string ("true", "reco", "true_particle",
+         *                      "reco_particle", "event", or "spill")
+         *        - parameters: array of floats (parameters for the cut)
+         * @param mode The mode to use for the main loop ("true", "reco", or
+         * "event").
+         * @param ismc A boolean indicating whether the data is MC (true) or
+         * not (false).
+         * @param name The name of the selection (used for logging).
+         * @param adaptive The configuration of the adaptive cut ordering.
+         * @throw std::runtime_error if the mode or a cut type is illegal, or
+         * if a function is not registered.
+         */
+        SelectionPass(const std::vector<cfg::ConfigurationTable> & cuts,
+                      const std::string & mode,
+                      const bool ismc = true,
+                      const std::string & name = "",
+                      const AdaptiveCutOrder & adaptive = AdaptiveCutOrder());
+
+        /**
+         * @brief Constructor for the SelectionPass class from parsed cuts.
+         * @details This constructor retrieves the cut functions of the
+         * (pre-parsed) cuts from the registries. This allows the cuts of a
+         * tree to be parsed once and shared by the selection passes of all
+         * samples.
+         * @param cuts The parsed cuts (see @ref parse_cuts).
+         * @param mode The mode to use for the main loop.
+         * @param ismc A boolean indicating whether the data is MC (true) or
+         * not (false).
+         * @param name The name of the selection (used for logging).
+         * @param adaptive The configuration of the adaptive cut ordering.
+         * @throw std::runtime_error if a function is not registered.
+         */
+        SelectionPass(const std::vector<CutSpec> & cuts,
+                      Mode mode,
+                      const bool ismc = true,
+                      const std::string & name = "",
+                      const AdaptiveCutOrder & adaptive = AdaptiveCutOrder());
+
+        /**
+         * @brief Apply the selection to the record (if not already done).
+         * @details This function applies the event cut and the interaction
+         * cuts to the record, caching the result. If @p with_particles is
+         * set, the particle-level cuts are also applied to the particles of
+         * each strictly passing candidate.
+         * @param sr The record to apply the selection to.
+         * @param with_particles Whether to also apply the particle cuts.
+         * @return A reference to the cached result of the selection.
+         */
+        const SelectionResult & evaluate(const EventType & sr, bool with_particles = false);
+
+        /**
+         * @brief Get the operation mode of the selection.
+         * @return The operation mode of the selection.
+         */
+        Mode mode() const { return mode_; }
+
+        /**
+         * @brief Check if the selection is applied to MC.
+         * @return True if the selection is applied to MC, false otherwise.
+         */
+        bool ismc() const { return ismc_; }
+
+        /**
+         * @brief Get the name of the selection.
+         * @return The name of the selection ("<sample>/<tree>").
+         */
+        const std::string & name() const { return name_; }
+
+        /**
+         * @brief Attach a cutflow that is accumulated on each new record.
+         * @param cutflow The cutflow to accumulate.
+         */
+        void attach(const std::shared_ptr<Cutflow> & cutflow) { cutflow_ = cutflow; }
+
+    private:
+        /**
+         * @brief Apply the particle cuts to all strictly passing candidates.
+         * @param sr The record to apply the particle cuts to.
+         */
+        void evaluate_particles(const EventType & sr);
+
+        Mode mode_;
+        bool ismc_;
+        std::string name_;
+        CutChain<TType> true_cut_;
+        CutChain<RType> reco_cut_;
+        CutChain<TParticleType> true_particle_cut_;
+        CutChain<RParticleType> reco_particle_cut_;
+        CutChain<EventType> event_cut_;
+        std::optional<RecordKey> current_;
+        SelectionResult result_;
+        std::shared_ptr<Cutflow> cutflow_;
+};
+
 /**
  * @brief Build a single SpillMultiVar for a single branch variable.
  * @details Applies the sequence of Cuts from @p cuts to select events, then
  * computes the variable as defined by @p var. Handles "true" and "reco" types
  * by prefixing the branch name and selecting the appropriate event types.
+ * This builds a private @ref SelectionPass for the variable; trees with many
+ * branches should share a single SelectionPass across all branches instead.
  * @param cuts Vector of [[tree.cut]] subtables with fields:
  *        - name:       string (base cut name)
  *        - type:       string ("true" or "reco")
@@ -307,44 +1819,91 @@ NamedSpillMultiVar construct(const std::vector<cfg::ConfigurationTable> & cuts,
                              const std::string & override_type = "",
                              const bool ismc = true);
 
+/**
+ * @brief Build a single SpillMultiVar for a single branch variable using a
+ * shared selection pass.
+ * @details Computes the variable as defined by @p var on the objects selected
+ * by @p selection. The selection is applied once per record regardless of the
+ * number of branch variables sharing it.
+ * @param selection The selection pass shared by all branches of the tree.
+ * @param var [[tree.variable]] subtable with fields:
+ *        - name:       string (base variable name)
+ *        - type:       string ("true" or "reco")
+ *        - parameters: array of floats (parameters for the variable)
+ * @param override_type The type to use for the variable ("true" or "reco").
+ * @return A NamedSpillMultiVar object that computes the variable on the
+ * selected objects.
+ * @throw std::runtime_error if a function is not registered.
+ */
+NamedSpillMultiVar construct(const std::shared_ptr<SelectionPass> & selection,
+                             const cfg::ConfigurationTable & var,
+                             const std::string & override_type = "");
+
+/**
+ * @brief A branch variable that is bound to a selection pass.
+ * @details The variable (and its selector) are resolved from the registries
+ * once, after which the binder produces the SpillMultiVar of the branch for
+ * the selection pass of each sample.
+ */
+using VarBinder = std::function<ana::SpillMultiVar(const std::shared_ptr<SelectionPass> &)>;
+using NamedVarBinder = std::pair<std::string, VarBinder>;
+
+/**
+ * @brief Resolve a single branch variable into a reusable binder.
+ * @details This performs all of the work of @ref construct that does not
+ * depend on the sample: the full name of the branch is derived and the
+ * variable (and selector) are retrieved from the registries. The binder may
+ * be applied to any selection pass with the same @p mode.
+ * @param var [[tree.variable]] subtable with fields:
+ *        - name:       string (base variable name)
+ *        - type:       string ("true" or "reco")
+ *        - parameters: array of floats (parameters for the variable)
+ * @param mode The mode of the selection pass the binder is applied to.
+ * @param override_type The type to use for the variable ("true" or "reco").
+ * @param scope The scope of the profiling counters ("<sample>/<tree>"). An
+ * empty scope disables the profiling of the variable.
+ * @return The full name of the branch and its binder.
+ * @throw std::runtime_error if the variable type is illegal or a function is
+ * not registered.
+ */
+NamedVarBinder compile(const cfg::ConfigurationTable & var,
+                       Mode mode,
+                       const std::string & override_type = "",
+                       const std::string & scope = "");
+
 /**
  * @brief Helper method for constructing a SpillMultiVar object.
  * @details This function is used to construct a SpillMultiVar object from
- * the parameter Cut and Variable objects. It is intended to be called by the
- * @ref construct function.
+ * the shared selection pass and the branch variable. It is intended to be
+ * called by the @ref construct function.
  * @tparam CutsOn The type (TType or RType) that the cut is applied to. This
  * also determines which type of object is iterated over in the loop. E.g.,
  * if CutsOn is TType, the loop iterates over the true events and applies
  * the cuts on truth information.
- * @tparam CompsOn The type (TType or RType) that is complementary to CutsOn
- * and is used to partition the events. This can be used, for example, to set
- * a truth cut on reco events passing the CutsOn cuts.
- * @tparam PCutsOn The type (TParticleType or RParticleType) that the cuts are
- * applied to at the single-particle level. This is applied if and only if the
- * VarOn type is a particle type (TParticleType or RParticleType). Additionally,
- * this is restricted to be the same "truth" type as CutsOn, i.e., if CutsOn is
- * TType, then PCutsOn must be TParticleType.
  * @tparam VarOn The type (TType or RType) that the variable is applied to.
- * @param cuts The callable that implements the cuts on the broadcast branch.
- * @param comps The callable that implements the cuts on the selected branch.
- * This is wrapped by std::optional to allow for the case where no
- * complementary cuts are applied.
- * @param pcuts The callable that implements the cuts on the single-particles.
+ * @tparam VarT The type of the callable implementing the variable. This is
+ * either a @ref VarFn or a @ref BoundFn (fast path).
+ * @param selection The selection pass shared by all branches of the tree.
  * @param var The callable that implements the variable on the selected branch.
- * @param event_cut The callable that implements the event cut.
- * @param ismc A boolean indicating whether the data is MC (true) or not (false).
- * @return A SpillMultiVar object that applies the cuts and computes the variable.
+ * @return A SpillMultiVar object that computes the variable on the selected
+ * objects.
  */
-template<typename CutsOn, typename CompsOn, typename PCutsOn, typename VarOn>
+template<typename CutsOn, typename VarOn, typename VarT = VarFn<VarOn>>
 ana::SpillMultiVar spill_multivar_helper(
-    const CutFn<CutsOn> & cuts,
-    const std::optional<CutFn<CompsOn>> & comps,
-    const CutFn<PCutsOn> & pcuts,
-    const VarFn<VarOn> & var,
-    const CutFn<EventType> & event_cut,
-    const bool ismc = true
+    const std::shared_ptr<SelectionPass> & selection,
+    const VarT & var
 );
 
+/**
+ * @brief Helper method for constructing a SpillMultiVar object when run in the
+ * "event" mode using a shared selection pass.
+ * @param selection The selection pass shared by all branches of the tree.
+ * @param var The callable that implements the event variable.
+ * @return A SpillMultiVar object that computes the event variable on events
+ * passing the selection.
+ */
+ana::SpillMultiVar spill_multivar_helper(const std::shared_ptr<SelectionPass> & selection, const VarFn<EventType> & var);
+
 /**
  * @brief Helper method for constructing a SpillMultiVar object when run in the
  * "event" mode.
@@ -358,6 +1917,19 @@ ana::SpillMultiVar spill_multivar_helper(
  */
 ana::SpillMultiVar spill_multivar_helper(const CutFn<EventType> & cut, const VarFn<EventType> & var);
 
+/**
+ * @brief Compose the cuts that decrement the exposure for a given set of
+ * cuts.
+ * @details The cuts with "decrements_exposure" are combined into a single
+ * event cut (applied to the record) and a single spill cut (applied to each
+ * BNB spill of a data record, see @ref ExposureLedger::of). Both pass if no
+ * cut decrements the exposure.
+ * @param cuts The cuts that are applied in the selection.
+ * @return The event cut and the spill cut.
+ * @throw std::runtime_error if a cut has an illegal type.
+ */
+std::pair<CutFn<EventType>, CutFn<SpillType>> construct_exposure_cuts(const std::vector<cfg::ConfigurationTable> & cuts);
+
 /**
  * @brief Helper method for constructing a set of SpillMultiVar objects that
  * track the exposure information for a given set of cuts.
@@ -371,4 +1943,24 @@ ana::SpillMultiVar spill_multivar_helper(const CutFn<EventType> & cut, const Var
  */
 std::vector<NamedSpillMultiVar> construct_exposure_vars(const std::vector<cfg::ConfigurationTable> & cuts);
 
+/**
+ * @brief Resolve the storage type of a branch variable.
+ * @details The storage type is taken from the "storage" field of the branch
+ * configuration if present. Otherwise, if @p infer is true, the natural
+ * storage type of the registered variable (see @ref StorageRegistry) is used.
+ * Branches with a selector use the storage type of the particle variable.
+ * All other branches use @p fallback.
+ * @param var The branch configuration.
+ * @param type The (resolved) type of the branch variable.
+ * @param fallback The storage type of branches without a configured or
+ * registered storage type.
+ * @param infer Whether to use the registered storage types.
+ * @return The storage type of the branch.
+ * @throw std::runtime_error if the configured storage type is invalid.
+ */
+StorageType branch_storage(const cfg::ConfigurationTable & var,
+                           const std::string & type,
+                           StorageType fallback,
+                           bool infer);
+
 #endif // FRAMEWORK_H
\ No newline at end of file
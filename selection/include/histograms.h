@@ -0,0 +1,435 @@
+/**
+ * @file histograms.h
+ * @brief Header file for the direct histogram output of the trees.
+ * @details Many configurations only feed fixed-binning plots, for which the
+ * flat trees are read back and binned later. The [[tree.histogram]] blocks
+ * of a tree declare 1D or 2D histograms of its branches, optionally weighted
+ * by another branch and split by the value of a third (e.g., the true
+ * category). The histograms are filled during the same pass as the tree,
+ * from the same (bound) branch variables, and written as TH1D/TH2D objects
+ * next to the tree. The tree itself may be omitted from the output.
+ * @author mueller@fnal.gov
+ */
+#ifndef HISTOGRAMS_H
+#define HISTOGRAMS_H
+#include <map>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <optional>
+#include <algorithm>
+#include <stdexcept>
+
+#include "sbnana/CAFAna/Core/MultiVar.h"
+#include "sbnanaobj/StandardRecord/Proxy/SRProxy.h"
+#include "TDirectory.h"
+#include "TH1D.h"
+#include "TH2D.h"
+
+#include "configuration.h"
+#include "framework.h"
+#include "loader.h"
+
+/**
+ * @namespace ana
+ * @brief Namespace for the Analysis class and related functions.
+ * @details The ana namespace contains the Analysis class, which is designed
+ * to streamline the running of multiple samples through CAFAna. The namespace
+ * is also used to organize analysis-related functions and variables within
+ * CAFAna.
+ */
+namespace ana
+{
+    /**
+     * @brief A single axis of a histogram.
+     * @details The bins are either uniform ("bins" = [n, low, high]) or given
+     * by their edges ("edges" = [e0, e1, ..., en]). Bin zero is the underflow
+     * and bin n+1 the overflow, as in ROOT.
+     */
+    struct HistogramAxis
+    {
+        std::string branch;        ///< The branch of the tree on the axis.
+        std::vector<double> edges; ///< The edges of the bins.
+        bool uniform = false;      ///< Whether the bins are uniform.
+
+        /**
+         * @brief Get the number of (regular) bins.
+         * @return The number of bins.
+         */
+        size_t bins() const { return edges.size() - 1; }
+
+        /**
+         * @brief Find the bin of a value.
+         * @details NaN values are placed in the underflow bin.
+         * @param value The value.
+         * @return The bin of the value (0 for underflow, n+1 for overflow).
+         */
+        size_t find(double value) const
+        {
+            if(!(value >= edges.front()))
+                return 0;
+            if(value >= edges.back())
+                return bins() + 1;
+            if(uniform)
+                return std::min(bins(), (size_t)((value - edges.front()) / (edges.back() - edges.front()) * bins())) + 1;
+            return std::upper_bound(edges.begin(), edges.end(), value) - edges.begin();
+        }
+    };
+
+    /**
+     * @brief The declaration of a histogram of a tree.
+     */
+    struct HistogramSpec
+    {
+        std::string name;             ///< The name of the histogram.
+        HistogramAxis x;              ///< The x-axis.
+        std::optional<HistogramAxis> y; ///< The (optional) y-axis.
+        std::string weight;           ///< The (optional) branch of the weights.
+        std::string split;            ///< The (optional) branch to split by.
+        std::optional<double> pot;    ///< The (optional) POT to normalize to.
+    };
+
+    /**
+     * @brief Parse a single axis of a [[tree.histogram]] block.
+     * @param table The [[tree.histogram]] block.
+     * @param prefix The prefix of the fields of the axis ("x" or "y").
+     * @return The axis.
+     * @throw std::runtime_error if the binning is missing or invalid.
+     */
+    HistogramAxis parse_axis(const cfg::ConfigurationTable & table, const std::string & prefix)
+    {
+        HistogramAxis axis;
+        axis.branch = table.get_string_field(prefix);
+        if(table.has_field(prefix + "bins"))
+        {
+            std::vector<double> bins = table.get_double_vector(prefix + "bins");
+            if(bins.size() != 3 || bins[0] < 1 || bins[0] != std::floor(bins[0]) || !(bins[2] > bins[1]))
+                throw std::runtime_error("The " + prefix + "bins field must be [n, low, high] with n >= 1 and high > low.");
+            size_t n = bins[0];
+            for(size_t i(0); i <= n; ++i)
+                axis.edges.push_back(bins[1] + (bins[2] - bins[1]) * i / n);
+            axis.uniform = true;
+        }
+        else if(table.has_field(prefix + "edges"))
+        {
+            axis.edges = table.get_double_vector(prefix + "edges");
+            if(axis.edges.size() < 2 || !std::is_sorted(axis.edges.begin(), axis.edges.end())
+               || std::adjacent_find(axis.edges.begin(), axis.edges.end()) != axis.edges.end())
+                throw std::runtime_error("The " + prefix + "edges field must have at least two strictly increasing edges.");
+        }
+        else
+            throw std::runtime_error("The " + prefix + " axis requires either " + prefix + "bins or " + prefix + "edges.");
+        return axis;
+    }
+
+    /**
+     * @brief Parse the [[tree.histogram]] blocks of a tree.
+     * @details Each block has the fields:
+     *        - name:            string (name of the histogram)
+     *        - x:               string (branch on the x-axis)
+     *        - xbins or xedges: [n, low, high] or the bin edges
+     *        - y:               string (optional, branch on the y-axis)
+     *        - ybins or yedges: the binning of the y-axis (if y is set)
+     *        - weight:          string (optional, branch of the weights)
+     *        - split:           string (optional, branch to split by, e.g.
+     *                           the true category)
+     *        - pot:             double (optional, POT to normalize to)
+     * @param tables The [[tree.histogram]] blocks.
+     * @return The parsed histograms.
+     * @throw std::runtime_error if a block is invalid.
+     */
+    std::vector<HistogramSpec> parse_histograms(const std::vector<cfg::ConfigurationTable> & tables)
+    {
+        std::vector<HistogramSpec> specs;
+        for(const auto & table : tables)
+        {
+            HistogramSpec spec;
+            spec.name = table.get_string_field("name");
+            try
+            {
+                spec.x = parse_axis(table, "x");
+                if(table.has_field("y"))
+                    spec.y = parse_axis(table, "y");
+                spec.weight = table.get_string_field("weight", "");
+                spec.split = table.get_string_field("split", "");
+                if(table.has_field("pot"))
+                {
+                    spec.pot = table.get_double_field("pot");
+                    if(!(*spec.pot > 0))
+                        throw std::runtime_error("The pot field must be positive.");
+                }
+            }
+            catch(const std::runtime_error & e)
+            {
+                throw std::runtime_error("Invalid histogram " + spec.name + ": " + e.what());
+            }
+            specs.push_back(spec);
+        }
+        return specs;
+    }
+
+    /**
+     * @brief Share the values of a branch variable between a tree and its
+     * histograms.
+     * @details The histograms of a tree are filled by a record observer,
+     * which runs before the SpectrumLoader hands the record to the tree (see
+     * @ref RecordSpectrumLoader::HandleRecord). The returned variable keeps
+     * the values of the last record (see @ref current_record), so that the
+     * tree reuses the values computed for the histograms instead of
+     * evaluating the variable a second time. The variable must only be
+     * evaluated by the thread running its sample.
+     * @param var The branch variable.
+     * @return The branch variable with its values shared per record.
+     */
+    SpillMultiVar shared_var(const SpillMultiVar & var)
+    {
+        struct Values
+        {
+            RecordKey record = 0;       ///< The record of the values (zero if none).
+            std::vector<double> values; ///< The values of the variable.
+        };
+        auto values = std::make_shared<Values>();
+        return SpillMultiVar([var, values](const caf::Proxy<caf::StandardRecord> * sr)
+        {
+            RecordKey record = current_record();
+            if(values->record != record)
+            {
+                values->values = var(sr);
+                values->record = record;
+            }
+            return values->values;
+        });
+    }
+
+    /**
+     * @class HistogramSet
+     * @brief Class filling the histograms of a tree for a single sample.
+     * @details The histograms are accumulated in plain arrays (the sum of the
+     * weights and of their squares in each bin) by a record observer that is
+     * added to the loader of the sample, so no ROOT object is touched by the
+     * thread running the sample. The values of the branch variables of each
+     * record are paired entry by entry (one entry per selected object). When
+     * the tree is also written, its branch variables are shared with the
+     * histograms (see @ref shared_var), so each is evaluated once per
+     * record. The ROOT histograms are created when the set is written.
+     *
+     * The observer also keeps the exposure ledger of the tree, which counts
+     * the exposure of the records passing the cuts of the tree that
+     * decrement the exposure (see @ref construct_exposure_cuts), as in the
+     * "<tree>_exposure" TTree. The POT-normalized histograms are scaled with
+     * this exposure.
+     */
+    class HistogramSet
+    {
+        public:
+            HistogramSet(const std::string & tree, const std::vector<HistogramSpec> & specs, const std::map<std::string, SpillMultiVar> & vars,
+                         const std::pair<CutFn<EventType>, CutFn<SpillType>> & exposure_cuts);
+            RecordObserver observer() const;
+            ExposureCounts exposure() const;
+            void write(TDirectory * dir) const;
+        private:
+            /**
+             * @brief The accumulated contents of a single histogram.
+             */
+            struct Contents
+            {
+                std::vector<double> sumw;  ///< The sum of the weights in each bin.
+                std::vector<double> sumw2; ///< The sum of the squared weights in each bin.
+                double entries = 0;        ///< The number of entries.
+            };
+
+            /**
+             * @brief The state of a single histogram.
+             */
+            struct Filler
+            {
+                HistogramSpec spec;
+                SpillMultiVar x, y, weight, split;
+                std::map<int64_t, Contents> contents; ///< The contents of each split value.
+            };
+
+            static void fill(Filler & f, const caf::Proxy<caf::StandardRecord> * sr);
+            std::string tree;
+            std::shared_ptr<std::vector<Filler>> fillers;
+            std::pair<CutFn<EventType>, CutFn<SpillType>> exposure_cuts;
+            std::shared_ptr<ExposureLedger> ledger;
+    };
+
+    /**
+     * @brief Constructor for the HistogramSet class.
+     * @param tree The name of the tree.
+     * @param specs The histograms of the tree.
+     * @param vars The (bound) branch variables of the tree, by branch name.
+     * @param exposure_cuts The event and spill cuts of the tree that
+     * decrement the exposure.
+     * @return A new instance of the HistogramSet class.
+     * @throw std::runtime_error if a histogram refers to an unknown branch.
+     */
+    HistogramSet::HistogramSet(const std::string & tree, const std::vector<HistogramSpec> & specs, const std::map<std::string, SpillMultiVar> & vars,
+                               const std::pair<CutFn<EventType>, CutFn<SpillType>> & exposure_cuts)
+        : tree(tree), fillers(std::make_shared<std::vector<Filler>>()), exposure_cuts(exposure_cuts), ledger(std::make_shared<ExposureLedger>())
+    {
+        // An unset branch is replaced by an empty variable.
+        auto lookup = [&](const std::string & spec, const std::string & branch) -> SpillMultiVar
+        {
+            if(branch.empty())
+                return SpillMultiVar([](const caf::Proxy<caf::StandardRecord> *) { return std::vector<double>(); });
+            auto it = vars.find(branch);
+            if(it == vars.end())
+                throw std::runtime_error("Histogram " + spec + " of tree " + tree + " refers to unknown branch " + branch + ".");
+            return it->second;
+        };
+        for(const HistogramSpec & spec : specs)
+        {
+            fillers->push_back(Filler{spec, lookup(spec.name, spec.x.branch), lookup(spec.name, spec.y ? spec.y->branch : ""),
+                                      lookup(spec.name, spec.weight), lookup(spec.name, spec.split), {}});
+        }
+    }
+
+    /**
+     * @brief Fill a single histogram with the entries of a record.
+     * @details Split values are rounded to the nearest integer, and NaN split
+     * values are assigned to -1 (as for the uncategorized interactions of the
+     * cutflow).
+     * @param f The histogram.
+     * @param sr The record.
+     * @return void
+     * @throw std::runtime_error if the branches have different numbers of
+     * entries.
+     */
+    void HistogramSet::fill(Filler & f, const caf::Proxy<caf::StandardRecord> * sr)
+    {
+        std::vector<double> xs = f.x(sr);
+        if(xs.empty())
+            return;
+        std::vector<double> ys, ws, ss;
+        if(f.spec.y)
+            ys = f.y(sr);
+        if(!f.spec.weight.empty())
+            ws = f.weight(sr);
+        if(!f.spec.split.empty())
+            ss = f.split(sr);
+        if((f.spec.y && ys.size() != xs.size()) || (!f.spec.weight.empty() && ws.size() != xs.size())
+           || (!f.spec.split.empty() && ss.size() != xs.size()))
+            throw std::runtime_error("The branches of histogram " + f.spec.name + " have different numbers of entries.");
+
+        size_t nx = f.spec.x.bins() + 2;
+        size_t ny = f.spec.y ? f.spec.y->bins() + 2 : 1;
+        for(size_t i(0); i < xs.size(); ++i)
+        {
+            int64_t key = ss.empty() ? 0 : (std::isnan(ss[i]) ? -1 : (int64_t)std::llround(ss[i]));
+            Contents & c = f.contents[key];
+            if(c.sumw.empty())
+            {
+                c.sumw.assign(nx * ny, 0);
+                c.sumw2.assign(nx * ny, 0);
+            }
+            size_t bin = f.spec.x.find(xs[i]) + (f.spec.y ? nx * f.spec.y->find(ys[i]) : 0);
+            double w = ws.empty() ? 1.0 : ws[i];
+            c.sumw[bin] += w;
+            c.sumw2[bin] += w * w;
+            c.entries += 1;
+        }
+    }
+
+    /**
+     * @brief Get the record observer that fills the histograms on each
+     * record.
+     * @details The observer also records the exposure of the records
+     * passing the exposure cuts of the tree.
+     * @return The observer filling the histograms.
+     */
+    RecordObserver HistogramSet::observer() const
+    {
+        return [fillers = fillers, cuts = exposure_cuts, ledger = ledger](const caf::SRSpillProxy & sr)
+        {
+            if(!cuts.first || cuts.first(sr))
+                ledger->observe(sr, cuts.second);
+            for(Filler & f : *fillers)
+                fill(f, &sr);
+        };
+    }
+
+    /**
+     * @brief Get the exposure of the tree.
+     * @return The total exposure of the records passing the exposure cuts of
+     * the tree.
+     */
+    ExposureCounts HistogramSet::exposure() const
+    {
+        return ledger->totals();
+    }
+
+    /**
+     * @brief Write the histograms to a directory.
+     * @details Each histogram is written as "<tree>_<name>" (the sum over all
+     * split values) and, if split, as "<tree>_<name>_<split>_<value>" for each
+     * split value (with "none" for -1). If a POT is configured for the
+     * histogram, the histograms are scaled from the exposure of the tree (see
+     * @ref exposure) to that POT. A histogram with a configured POT is
+     * written unscaled (with a warning) if the exposure of the tree is zero.
+     * @param dir The directory to write the histograms to.
+     * @return void
+     */
+    void HistogramSet::write(TDirectory * dir) const
+    {
+        double pot = exposure().pot;
+        dir->cd();
+        for(const Filler & f : *fillers)
+        {
+            const HistogramSpec & spec = f.spec;
+            size_t nx = spec.x.bins() + 2;
+            size_t ny = spec.y ? spec.y->bins() + 2 : 1;
+            double scale = (spec.pot && pot > 0) ? *spec.pot / pot : 1.0;
+            if(spec.pot && !(pot > 0))
+                std::cerr << "Warning: Histogram " << spec.name << " of tree " << tree << " is normalized to " << *spec.pot
+                          << " POT, but the exposure of the tree is zero. Writing it unscaled." << std::endl;
+
+            // Write a single histogram.
+            auto write_one = [&](const std::string & name, const Contents & c)
+            {
+                std::string title = spec.name + ";" + spec.x.branch + (spec.y ? ";" + spec.y->branch : std::string());
+                TH1 * h = spec.y ? (TH1 *)new TH2D(name.c_str(), title.c_str(), spec.x.bins(), spec.x.edges.data(), spec.y->bins(), spec.y->edges.data())
+                                 : (TH1 *)new TH1D(name.c_str(), title.c_str(), spec.x.bins(), spec.x.edges.data());
+                h->Sumw2();
+                for(size_t by(0); by < ny; ++by)
+                {
+                    for(size_t bx(0); bx < nx; ++bx)
+                    {
+                        size_t bin = bx + nx * by;
+                        int global = spec.y ? h->GetBin(bx, by) : (int)bx;
+                        if(!c.sumw.empty())
+                        {
+                            h->SetBinContent(global, scale * c.sumw[bin]);
+                            h->SetBinError(global, scale * std::sqrt(c.sumw2[bin]));
+                        }
+                    }
+                }
+                h->SetEntries(c.entries);
+                h->Write();
+                delete h;
+            };
+
+            Contents total;
+            total.sumw.assign(nx * ny, 0);
+            total.sumw2.assign(nx * ny, 0);
+            for(const auto & [key, c] : f.contents)
+            {
+                for(size_t b(0); b < nx * ny; ++b)
+                {
+                    total.sumw[b] += c.sumw[b];
+                    total.sumw2[b] += c.sumw2[b];
+                }
+                total.entries += c.entries;
+            }
+            write_one(tree + "_" + spec.name, total);
+            if(spec.split.empty())
+                continue;
+            for(const auto & [key, c] : f.contents)
+                write_one(tree + "_" + spec.name + "_" + spec.split + "_" + (key < 0 ? std::string("none") : std::to_string(key)), c);
+        }
+    }
+}
+#endif // HISTOGRAMS_H
@@ -0,0 +1,328 @@
+/**
+ * @file incremental.h
+ * @brief Header file for the incremental (cached) execution of the analysis.
+ * @details During the development of an analysis, a typical iteration changes
+ * a single tree (e.g., a cut or a branch) and then reruns the full selection
+ * over every file of every sample. In the incremental mode, the output of
+ * each tree for each input file is stored as a fragment in a cache directory.
+ * The fragment is keyed by a hash of the fully resolved definition of the
+ * tree (and of the build of the selection, see @ref MEDULLA_BUILD_ID) and by
+ * the identity of the input file (path, size, and modification time, see
+ * @ref file_key). On a rerun, only the trees whose definition changed and
+ * the files which are new or modified are processed. The fragments are then
+ * merged into the usual "events/<sample>/<tree>" layout of the output file.
+ * @author mueller@fnal.gov
+ */
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+#include <vector>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <cstdint>
+#include <stdexcept>
+#include <iostream>
+#include <filesystem>
+
+#include "TFile.h"
+#include "TTree.h"
+#include "TDirectory.h"
+#include "TFileMerger.h"
+#include "TSystem.h"
+
+#include "configuration.h"
+#include "shards.h"
+
+/**
+ * @brief The identifier of the build of the selection.
+ * @details The identifier is part of the key of each fragment, so that the
+ * fragments of another build (which may have different cuts or variables)
+ * are not reused. It is set by CMake to the "git describe" of the source
+ * tree, or else to the time at which the selection was compiled.
+ */
+#ifndef MEDULLA_BUILD_ID
+#define MEDULLA_BUILD_ID __DATE__ " " __TIME__
+#endif
+
+/**
+ * @namespace ana
+ * @brief Namespace for the Analysis class and related functions.
+ * @details The ana namespace contains the Analysis class, which is designed
+ * to streamline the running of multiple samples through CAFAna. The namespace
+ * is also used to organize analysis-related functions and variables within
+ * CAFAna.
+ */
+namespace ana
+{
+    /**
+     * @brief Calculate the (64-bit FNV-1a) hash of a string.
+     * @param s The string to hash.
+     * @return The hash of the string as a 16 character hexadecimal string.
+     */
+    std::string hash_string(const std::string & s)
+    {
+        uint64_t h = 14695981039346656037ull;
+        for(unsigned char c : s)
+        {
+            h ^= c;
+            h *= 1099511628211ull;
+        }
+        std::ostringstream ss;
+        ss << std::hex << std::setw(16) << std::setfill('0') << h;
+        return ss.str();
+    }
+
+    /**
+     * @brief Get the key identifying the current version of an input file.
+     * @details Files are identified by their (absolute) path, size, and
+     * modification time, so that a file that is replaced or modified gets a
+     * new key. The size and modification time of files that are not on the
+     * local filesystem (e.g., XRootD URLs) are queried through ROOT.
+     * @param path The path of the input file.
+     * @return The key of the input file.
+     * @throw std::runtime_error if the size and modification time of a
+     * remote file cannot be queried (the file cannot be cached).
+     */
+    std::string file_key(const std::string & path)
+    {
+        namespace fs = std::filesystem;
+        std::error_code ec;
+        std::ostringstream ss;
+        if(fs::is_regular_file(path, ec))
+        {
+            ss << fs::absolute(path, ec).string() << '|' << fs::file_size(path, ec) << '|'
+               << fs::last_write_time(path, ec).time_since_epoch().count();
+        }
+        else
+        {
+            FileStat_t stat;
+            if(gSystem->GetPathInfo(path.c_str(), stat) != 0)
+                throw std::runtime_error("Could not query the size and modification time of " + path + ", so its results cannot be cached.");
+            ss << path << '|' << stat.fSize << '|' << stat.fMtime;
+        }
+        return hash_string(ss.str());
+    }
+
+    /**
+     * @class ResultCache
+     * @brief Class to manage the per-file results of the trees in the
+     * incremental mode.
+     * @details The fragment of a tree for an input file is stored as
+     * "<dir>/<sample>/<tree>-<hash>/<file>.root", where "hash" is the hash of
+     * the definition of the tree and of the build of the selection and "file"
+     * is the key of the input file (see @ref file_key). Each fragment holds the tree (and its exposure and
+     * cutflow trees, if configured) for the single input file, under the same
+     * "events/<sample>" directory as the output file. The trees that are not
+     * cached are run as usual, but with one sample per input file, after
+     * which their results are split into fragments (see @ref store), in
+     * bounded batches of files. The
+     * fragments of the current configuration are finally merged into the
+     * output file (see @ref merge).
+     */
+    class ResultCache
+    {
+        public:
+            ResultCache(const std::string & dir, const cfg::ConfigurationTable & config);
+            std::string scratch() const;
+            std::string fragment(const std::string & sample, const cfg::ConfigurationTable & tree, bool is_sim, const std::string & file);
+            bool cached(const std::string & fragment) const;
+            void book(const std::string & source, const std::string & sample, const std::string & tree, const std::string & fragment);
+            size_t pending() const;
+            void store();
+            void merge(const std::string & output, int compression) const;
+        private:
+            /**
+             * @brief A fragment that is produced by the current run.
+             */
+            struct Pending
+            {
+                std::string source;   ///< The name of the (per-file) sample in the scratch output.
+                std::string sample;   ///< The name of the sample.
+                std::string tree;     ///< The name of the tree.
+                std::string fragment; ///< The path of the fragment.
+            };
+            std::string dir;
+            std::string common;
+            std::vector<std::string> fragments;
+            std::vector<Pending> pending_fragments;
+    };
+
+    /**
+     * @brief Constructor for the ResultCache class.
+     * @details The common part of the definition of every tree is collected
+     * from the configuration: the "parameters" and "category" blocks and the
+     * general fields that change the contents of the trees ("fsthresh",
+     * "primfn", "pidfn", "default_storage", "infer_storage", and "detector"),
+     * along with the identifier of the build (see @ref MEDULLA_BUILD_ID).
+     * The cache directory is created if it does not exist.
+     * @param dir The path of the cache directory.
+     * @param config The configuration of the analysis.
+     * @return A new instance of the ResultCache class.
+     * @throw std::runtime_error if the cache directory cannot be created.
+     */
+    ResultCache::ResultCache(const std::string & dir, const cfg::ConfigurationTable & config)
+        : dir(dir)
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(dir, ec);
+        if(ec)
+            throw std::runtime_error("Could not create cache directory " + dir + " (" + ec.message() + ").");
+
+        std::ostringstream ss;
+        ss << "build=" << MEDULLA_BUILD_ID << '\n';
+        for(const char * key : {"parameters", "category", "general.fsthresh", "general.primfn", "general.pidfn", "general.default_storage", "general.infer_storage", "general.detector"})
+            ss << key << '=' << config.serialize(key) << '\n';
+        common = ss.str();
+    }
+
+    /**
+     * @brief Get the name of the scratch output of the trees that are run.
+     * @details The scratch output is written by the Analysis class (which
+     * appends the ".root" extension) and is split into fragments by
+     * @ref store.
+     * @return The name of the scratch output.
+     */
+    std::string ResultCache::scratch() const
+    {
+        return dir + "/scratch";
+    }
+
+    /**
+     * @brief Get the path of the fragment of a tree for an input file.
+     * @details The fragment is recorded as part of the output of the current
+     * configuration, which is merged by @ref merge.
+     * @param sample The name of the sample.
+     * @param tree The configuration of the tree.
+     * @param is_sim Whether the sample is a simulation sample.
+     * @param file The path of the input file.
+     * @return The path of the fragment.
+     */
+    std::string ResultCache::fragment(const std::string & sample, const cfg::ConfigurationTable & tree, bool is_sim, const std::string & file)
+    {
+        std::ostringstream ss;
+        ss << common << "ismc=" << is_sim << '\n' << tree.serialize() << '\n';
+        std::string path = dir + "/" + sample + "/" + tree.get_string_field("name") + "-" + hash_string(ss.str()) + "/" + file_key(file) + ".root";
+        fragments.push_back(path);
+        return path;
+    }
+
+    /**
+     * @brief Check if a fragment is present in the cache.
+     * @param fragment The path of the fragment (see @ref fragment).
+     * @return True if the fragment is present.
+     */
+    bool ResultCache::cached(const std::string & fragment) const
+    {
+        std::error_code ec;
+        return std::filesystem::is_regular_file(fragment, ec);
+    }
+
+    /**
+     * @brief Book a fragment that is produced by the current run.
+     * @param source The name of the (per-file) sample that runs the tree.
+     * @param sample The name of the sample.
+     * @param tree The name of the tree.
+     * @param fragment The path of the fragment (see @ref fragment).
+     * @return void
+     */
+    void ResultCache::book(const std::string & source, const std::string & sample, const std::string & tree, const std::string & fragment)
+    {
+        pending_fragments.push_back({source, sample, tree, fragment});
+    }
+
+    /**
+     * @brief Get the number of fragments that are produced by the current
+     * run.
+     * @return The number of booked fragments.
+     */
+    size_t ResultCache::pending() const
+    {
+        return pending_fragments.size();
+    }
+
+    /**
+     * @brief Split the scratch output into the booked fragments.
+     * @details The tree and its exposure ("<tree>_exposure") and cutflow
+     * ("<tree>_cutflow", "<tree>_cutflow_category") trees are copied from the
+     * directory of the per-file sample to the fragment. A fragment is written
+     * even if the tree has no output (e.g., a simulation-only tree), so that
+     * it is not run again. Each fragment is written to a temporary file that
+     * is renamed once complete, so an interrupted run never leaves a partial
+     * fragment in the cache. The scratch output is removed afterwards.
+     * @return void
+     * @throw std::runtime_error if the scratch output cannot be opened or a
+     * fragment cannot be written.
+     */
+    void ResultCache::store()
+    {
+        std::string path = scratch() + ".root";
+        TFile * in = TFile::Open(path.c_str(), "READ");
+        if(!in || in->IsZombie())
+            throw std::runtime_error("Could not open scratch output " + path + ".");
+
+        for(const Pending & p : pending_fragments)
+        {
+            std::filesystem::create_directories(std::filesystem::path(p.fragment).parent_path());
+            std::string tmp = p.fragment + ".tmp";
+            TFile * out = new TFile(tmp.c_str(), "RECREATE");
+            if(out->IsZombie())
+                throw std::runtime_error("Could not create cache fragment " + tmp + ".");
+            TDirectory * dst = out->mkdir("events")->mkdir(p.sample.c_str());
+            TDirectory * src = in->GetDirectory(("events/" + p.source).c_str());
+            for(const std::string & name : {p.tree, p.tree + "_exposure", p.tree + "_cutflow", p.tree + "_cutflow_category"})
+            {
+                TTree * tree = src ? src->Get<TTree>(name.c_str()) : nullptr;
+                if(!tree)
+                    continue;
+                dst->cd();
+                TTree * copy = tree->CloneTree(-1, "fast");
+                copy->Write();
+                delete copy;
+            }
+            out->Close();
+            delete out;
+            std::filesystem::rename(tmp, p.fragment);
+        }
+        in->Close();
+        delete in;
+        std::filesystem::remove(path);
+        pending_fragments.clear();
+    }
+
+    /**
+     * @brief Merge the fragments of the current configuration into the
+     * output file.
+     * @details The fragments are merged in the order in which they were
+     * requested (see @ref fragment), i.e., by sample, then by input file in
+     * the order of the files of the sample. The trees of each sample are
+     * therefore concatenated in the same order as in a non-incremental run.
+     * The cutflow TTrees of the fragments are summed per stage (and
+     * category) afterwards (see @ref sum_cutflows).
+     * @param output The path of the output file.
+     * @param compression The compression settings of the output file (a
+     * negative value keeps the ROOT default).
+     * @return void
+     * @throw std::runtime_error if a fragment cannot be opened or the merge
+     * fails.
+     */
+    void ResultCache::merge(const std::string & output, int compression) const
+    {
+        if(fragments.empty())
+            throw std::runtime_error("No cached results to merge into " + output + ".");
+
+        TFileMerger merger(false);
+        bool opened = compression >= 0 ? merger.OutputFile(output.c_str(), "RECREATE", compression) : merger.OutputFile(output.c_str(), "RECREATE");
+        if(!opened)
+            throw std::runtime_error("Could not create output file " + output + ".");
+        for(const std::string & fragment : fragments)
+        {
+            if(!merger.AddFile(fragment.c_str(), false))
+                throw std::runtime_error("Could not open cache fragment " + fragment + ".");
+        }
+        std::cout << "Merging " << fragments.size() << " cached fragments into " << output << "." << std::endl;
+        if(!merger.Merge())
+            throw std::runtime_error("Failed to merge cached fragments into " + output + ".");
+        sum_cutflows(output);
+    }
+}
+#endif // INCREMENTAL_H
@@ -0,0 +1,180 @@
+/**
+ * @file io.h
+ * @brief Header file for the I/O tuning of the input files.
+ * @details The input files are often read over XRootD, where each read of a
+ * basket blocks the selection loop for a network round trip. The TTreeCache
+ * of the StandardRecord tree of each input file can be sized and restricted
+ * to the branches that the selection reads (the branches of the pruning
+ * manifest, see @ref required_branches), so that the baskets of each cluster
+ * are fetched in a single vectored read. The cache can also be filled
+ * asynchronously by ROOT while the current cluster is processed, and the next
+ * input file can be opened in the background while the current input file is
+ * processed.
+ * @author mueller@fnal.gov
+ */
+#ifndef IO_H
+#define IO_H
+#include <set>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <optional>
+#include <algorithm>
+
+#include "TEnv.h"
+#include "TFile.h"
+#include "TTree.h"
+
+#include "configuration.h"
+
+/**
+ * @namespace ana
+ * @brief Namespace for the Analysis class and related functions.
+ * @details The ana namespace contains the Analysis class, which is designed
+ * to streamline the running of multiple samples through CAFAna. The namespace
+ * is also used to organize analysis-related functions and variables within
+ * CAFAna.
+ */
+namespace ana
+{
+    /**
+     * @brief The configuration of the I/O tuning of the input files.
+     */
+    struct IOOptions
+    {
+        std::optional<int64_t> cache_size;   ///< The size of the TTreeCache (bytes).
+        int64_t learn_entries = 0;           ///< The entries of the learning phase (zero to use the branch manifest only).
+        bool prefetch = false;               ///< Whether to prefetch asynchronously.
+
+        /**
+         * @brief Check if any of the I/O tuning is enabled.
+         * @return True if the input trees must be tuned.
+         */
+        bool enabled() const { return cache_size || learn_entries > 0 || prefetch; }
+    };
+
+    /**
+     * @brief Parse the I/O fields of the [general] block.
+     * @details The fields are:
+     *        - tree_cache_size:          double (size of the TTreeCache in MB;
+     *                                    default: the ROOT default)
+     *        - tree_cache_learn_entries: int (entries over which the cached
+     *                                    branches are learned; default 0)
+     *        - prefetch:                 bool (asynchronous prefetching of the
+     *                                    cache and of the next input file;
+     *                                    default false)
+     * @param config The configuration of the analysis.
+     * @return The configuration of the I/O tuning.
+     * @throw cfg::ConfigurationError if a field is invalid.
+     */
+    IOOptions parse_io(const cfg::ConfigurationTable & config)
+    {
+        IOOptions options;
+        if(config.has_field("general.tree_cache_size"))
+        {
+            double size = config.get_double_field("general.tree_cache_size");
+            if(size < 0)
+                throw cfg::ConfigurationError("The tree_cache_size field must not be negative.");
+            options.cache_size = (int64_t)(size * 1024 * 1024);
+        }
+        if(config.has_field("general.tree_cache_learn_entries"))
+        {
+            options.learn_entries = config.get_int_field("general.tree_cache_learn_entries");
+            if(options.learn_entries < 0)
+                throw cfg::ConfigurationError("The tree_cache_learn_entries field must not be negative.");
+        }
+        options.prefetch = config.get_bool_field("general.prefetch", false);
+        if(options.prefetch)
+        {
+            // The prefetching thread is created with the cache, so this
+            // must be set before any input file is opened.
+            gEnv->SetValue("TFile.AsyncPrefetching", 1);
+        }
+        return options;
+    }
+
+    /**
+     * @brief Configure the TTreeCache of a StandardRecord tree.
+     * @details The cache is (re)created with the configured size. If the
+     * branches read by the selection are known, they are added to the cache
+     * (with their sub-branches and size branches) and, unless a learning
+     * phase is configured, the learning phase is skipped. Otherwise the cached
+     * branches are learned by ROOT over the configured number of entries.
+     * @param tree The StandardRecord tree ("recTree").
+     * @param options The configuration of the I/O tuning.
+     * @param branches The top-level branches of the StandardRecord that are
+     * read (no value if unknown).
+     * @return void
+     */
+    void tune_tree(TTree * tree, const IOOptions & options, const std::optional<std::set<std::string>> & branches)
+    {
+        if(options.prefetch)
+            tree->SetCacheSize(0);
+        tree->SetCacheSize(options.cache_size.value_or(-1));
+        if(options.learn_entries > 0)
+            tree->SetCacheLearnEntries(options.learn_entries);
+        if(!branches)
+            return;
+        for(const std::string & branch : *branches)
+        {
+            tree->AddBranchToCache(("rec." + branch + "*").c_str(), true);
+            std::string count = "rec.n" + branch;
+            if(tree->GetBranch(count.c_str()))
+                tree->AddBranchToCache(count.c_str(), true);
+        }
+        if(options.learn_entries == 0)
+            tree->StopCacheLearningPhase();
+    }
+
+    /**
+     * @brief An input file opened in the background (see @ref prefetch_next).
+     */
+    struct PrefetchedFile
+    {
+        std::string url;                    ///< The URL of the file.
+        TFileOpenHandle * handle = nullptr; ///< The handle of the asynchronous open.
+    };
+
+    /**
+     * @brief Open the file following the current input file in the
+     * background.
+     * @details The asynchronous open of ROOT is used, which is picked up by
+     * the (synchronous) open of the same URL by the SpectrumLoader. Only
+     * remote files are prefetched, as the open of a local file is cheap.
+     * @param files The input files in the order in which they are read.
+     * @param current The index of the current input file.
+     * @return The file opened in the background (no handle if there is no
+     * next file or it is local).
+     */
+    PrefetchedFile prefetch_next(const std::vector<std::string> & files, size_t current)
+    {
+        PrefetchedFile prefetched;
+        if(current + 1 >= files.size())
+            return prefetched;
+        const std::string & next = files[current + 1];
+        if(next.find("://") != std::string::npos && next.rfind("file://", 0) != 0)
+        {
+            prefetched.url = next;
+            prefetched.handle = TFile::AsyncOpen(next.c_str());
+        }
+        return prefetched;
+    }
+
+    /**
+     * @brief Release a file opened in the background.
+     * @details The handle is consumed (and deleted) by ROOT when the
+     * SpectrumLoader opens the same URL. A handle which is still pending
+     * (e.g., the file was not opened by the SpectrumLoader) is consumed here,
+     * and the file is closed.
+     * @param prefetched The file opened in the background (reset by this
+     * function).
+     * @return void
+     */
+    void release_prefetch(PrefetchedFile & prefetched)
+    {
+        if(prefetched.handle && TFile::GetAsyncOpenStatus(prefetched.url.c_str()) != TFile::kAOSNotAsync)
+            delete TFile::Open(prefetched.handle);
+        prefetched = PrefetchedFile();
+    }
+}
+#endif // IO_H
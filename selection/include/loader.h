@@ -0,0 +1,134 @@
+/**
+ * @file loader.h
+ * @brief Header file for the SpectrumLoader used by the framework.
+ * @details The per-record caches of the framework (the match index, the
+ * particle and geometry caches, and the selection pass of each tree) are
+ * keyed by the identity of the record being processed (see @ref RecordKey).
+ * The identity is a sequence number that is advanced by the loader once per
+ * record, before the record is handed to the variables, so every loader
+ * that runs the selection must derive from the @ref RecordSpectrumLoader.
+ * The loader also calls the record observers (see @ref RecordObserver), which
+ * see every record but produce no output.
+ * @author mueller@fnal.gov
+ */
+#ifndef LOADER_H
+#define LOADER_H
+#include <atomic>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <functional>
+
+#include "sbnana/CAFAna/Core/SpectrumLoader.h"
+#include "sbnanaobj/StandardRecord/Proxy/SRProxy.h"
+
+#include "framework.h"
+
+/**
+ * @namespace ana
+ * @brief Namespace for the Analysis class and related functions.
+ * @details The ana namespace contains the Analysis class, which is designed
+ * to streamline the running of multiple samples through CAFAna. The namespace
+ * is also used to organize analysis-related functions and variables within
+ * CAFAna.
+ */
+namespace ana
+{
+    /**
+     * @brief An observer of the records handled by a loader.
+     * @details Observers are used for the bookkeeping of a sample (e.g., the
+     * exposure ledger, the progress counters, and the histograms), which
+     * needs to see every record regardless of the cuts of the trees.
+     */
+    using RecordObserver = std::function<void(const caf::SRSpillProxy &)>;
+
+    /**
+     * @brief Exception thrown by a loader that has been aborted (see
+     * @ref RecordSpectrumLoader::Abort).
+     */
+    struct LoaderAborted : public std::runtime_error
+    {
+        LoaderAborted() : std::runtime_error("The loader was aborted.") {}
+    };
+
+    /**
+     * @class RecordSpectrumLoader
+     * @brief A SpectrumLoader which signals each record to the framework.
+     * @details The sequence number of the records processed by the current
+     * thread is advanced (see @ref advance_record) before each record is
+     * handled by the SpectrumLoader. The observers of the loader (see
+     * @ref AddObserver) are then called, in the order in which they were
+     * added, on the thread running the loader. A loader can be aborted from
+     * another thread (see @ref Abort).
+     */
+    class RecordSpectrumLoader : public SpectrumLoader
+    {
+        public:
+            RecordSpectrumLoader(const std::string & wildcard);
+            RecordSpectrumLoader(const std::vector<std::string> & files);
+            void AddObserver(RecordObserver observer);
+            void Abort();
+        protected:
+            void HandleRecord(caf::SRSpillProxy * sr) override;
+        private:
+            std::vector<RecordObserver> observers;
+            std::atomic<bool> aborted{false};
+    };
+
+    /**
+     * @brief Constructor for the RecordSpectrumLoader class.
+     * @param wildcard The path (or wildcard) of the input files.
+     * @return A new instance of the RecordSpectrumLoader class.
+     */
+    RecordSpectrumLoader::RecordSpectrumLoader(const std::string & wildcard)
+        : SpectrumLoader(wildcard) {}
+
+    /**
+     * @brief Constructor for the RecordSpectrumLoader class.
+     * @param files The paths of the input files.
+     * @return A new instance of the RecordSpectrumLoader class.
+     */
+    RecordSpectrumLoader::RecordSpectrumLoader(const std::vector<std::string> & files)
+        : SpectrumLoader(files) {}
+
+    /**
+     * @brief Add an observer that is called on every record.
+     * @details Observers must be added before the loader is run.
+     * @param observer The observer.
+     * @return void
+     */
+    void RecordSpectrumLoader::AddObserver(RecordObserver observer)
+    {
+        observers.push_back(std::move(observer));
+    }
+
+    /**
+     * @brief Abort the loader.
+     * @details The loader stops at the next record it handles by throwing a
+     * @ref LoaderAborted exception out of its Go() method. This is safe to
+     * call from any thread.
+     * @return void
+     */
+    void RecordSpectrumLoader::Abort()
+    {
+        aborted = true;
+    }
+
+    /**
+     * @brief Signal a record to the framework, call the observers, and
+     * handle the record.
+     * @param sr The record.
+     * @return void
+     * @throw LoaderAborted if the loader has been aborted.
+     */
+    void RecordSpectrumLoader::HandleRecord(caf::SRSpillProxy * sr)
+    {
+        if(aborted)
+            throw LoaderAborted();
+        advance_record();
+        for(const RecordObserver & observer : observers)
+            observer(*sr);
+        SpectrumLoader::HandleRecord(sr);
+    }
+}
+#endif // LOADER_H
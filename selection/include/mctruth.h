@@ -61,6 +61,7 @@ namespace mctruth
     template<typename T>
         double pdg(const T & obj) { return obj.pdg; }
     REGISTER_VAR_SCOPE(RegistrationScope::MCTruth, pdg, pdg);
+    REGISTER_VAR_STORAGE(RegistrationScope::MCTruth, pdg, StorageType::Int32);
 
     /**
      * @brief Variable for the PDG code of the parent of the neutrino.
@@ -73,6 +74,7 @@ namespace mctruth
     template<typename T>
         double parent_pdg(const T & obj) { return obj.parent_pdg; }
     REGISTER_VAR_SCOPE(RegistrationScope::MCTruth, parent_pdg, parent_pdg);
+    REGISTER_VAR_STORAGE(RegistrationScope::MCTruth, parent_pdg, StorageType::Int32);
 
     /**
      * @brief Variable for the true neutrino current value.
@@ -85,6 +87,7 @@ namespace mctruth
     template<typename T>
         double cc(const T & obj) { return obj.iscc; }
     REGISTER_VAR_SCOPE(RegistrationScope::MCTruth, cc, cc);
+    REGISTER_VAR_STORAGE(RegistrationScope::MCTruth, cc, StorageType::UInt8);
 
     /**
      * @brief Variable for the interaction mode of the interaction.
@@ -98,6 +101,7 @@ namespace mctruth
     template<typename T>
         double interaction_mode(const T & obj) { return obj.genie_mode; }
     REGISTER_VAR_SCOPE(RegistrationScope::MCTruth, interaction_mode, interaction_mode);
+    REGISTER_VAR_STORAGE(RegistrationScope::MCTruth, interaction_mode, StorageType::Int32);
 
     /**
      * @brief Variable for the interaction type of the interaction.
@@ -111,5 +115,6 @@ namespace mctruth
     template<typename T>
         double interaction_type(const T & obj) { return obj.genie_inttype; }
     REGISTER_VAR_SCOPE(RegistrationScope::MCTruth, interaction_type, interaction_type);
+    REGISTER_VAR_STORAGE(RegistrationScope::MCTruth, interaction_type, StorageType::Int32);
 } // namespace mctruth
 #endif
\ No newline at end of file
@@ -0,0 +1,312 @@
+/**
+ * @file output.h
+ * @brief Header file for the typed, compressed writing of the output trees.
+ * @details The ana::Tree class stores every branch as a double and offers no
+ * control over the basket size. This file provides a writer that converts the
+ * branches of an ana::Tree to their configured storage type (see
+ * @ref StorageType) and applies the configured basket size when the Tree is
+ * written to the output file. The compression of the output file is set on
+ * the file itself. Integer storage types are only used for branches whose
+ * values fit the type; other branches fall back to a wider type.
+ * @author mueller@fnal.gov
+ */
+#ifndef OUTPUT_H
+#define OUTPUT_H
+#include <map>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <atomic>
+#include <iostream>
+#include <stdexcept>
+
+#include "sbnana/CAFAna/Core/Tree.h"
+
+#include "TDirectory.h"
+#include "TFile.h"
+#include "TSystem.h"
+#include "TTree.h"
+#include "TBranch.h"
+#include "TLeaf.h"
+#include "TKey.h"
+#include "TIterator.h"
+#include "Compression.h"
+
+#include "framework.h"
+
+/**
+ * @namespace ana
+ * @brief Namespace for the Analysis class and related functions.
+ * @details The ana namespace contains the Analysis class, which is designed
+ * to streamline the running of multiple samples through CAFAna. The namespace
+ * is also used to organize analysis-related functions and variables within
+ * CAFAna.
+ */
+namespace ana
+{
+    /**
+     * @struct OutputOptions
+     * @brief Struct to store the configuration of the output file.
+     * @details The compression settings follow the ROOT convention
+     * (100 * algorithm + level). A negative value keeps the ROOT default. A
+     * basket size of zero keeps the ROOT default.
+     */
+    struct OutputOptions
+    {
+        int compression = -1;
+        int basket_size = 0;
+    };
+
+    /**
+     * @brief Get the ROOT compression settings for an algorithm and level.
+     * @param algorithm The name of the compression algorithm ("ZLIB", "LZMA",
+     * "LZ4", or "ZSTD").
+     * @param level The compression level (1-9).
+     * @return The ROOT compression settings.
+     * @throw std::runtime_error if the algorithm is not supported.
+     */
+    int compression_settings(const std::string & algorithm, int level)
+    {
+        using Algorithm = ROOT::RCompressionSetting::EAlgorithm;
+        if(algorithm == "ZLIB") return ROOT::CompressionSettings(Algorithm::kZLIB, level);
+        else if(algorithm == "LZMA") return ROOT::CompressionSettings(Algorithm::kLZMA, level);
+        else if(algorithm == "LZ4") return ROOT::CompressionSettings(Algorithm::kLZ4, level);
+        else if(algorithm == "ZSTD") return ROOT::CompressionSettings(Algorithm::kZSTD, level);
+        else throw std::runtime_error("Illegal compression algorithm '" + algorithm + "' (expected ZLIB, LZMA, LZ4, or ZSTD).");
+    }
+
+    /**
+     * @brief Copy a TTree to a directory, converting its double branches to
+     * their configured storage type.
+     * @details Only TTrees with single-valued branches of basic types are
+     * converted. Branches without a configured storage type and branches
+     * which are not doubles (e.g., Run/Subrun/Evt) keep their type. NaN values
+     * of integer branches are stored as the minimum value (int32) or the
+     * maximum value (uint8) of the type. Before the conversion, the values of
+     * each integer branch are checked: a uint8 branch with a value outside of
+     * [0, 254] is stored as an int32, and an int32 branch with a value outside
+     * of (INT32_MIN, INT32_MAX] is stored as a double. Branches with
+     * non-integral values are stored as doubles. The sentinel values are
+     * excluded from the range so that they remain unambiguous. TTrees of any
+     * other layout are copied unchanged.
+     * @param in The TTree to copy.
+     * @param dir The directory to write the TTree to.
+     * @param storage The storage type of each branch (by name).
+     * @param options The configuration of the output file.
+     * @return void
+     */
+    void write_typed_tree(TTree * in, TDirectory * dir, const std::map<std::string, StorageType> & storage, const OutputOptions & options)
+    {
+        static const std::map<std::string, char> codes = {
+            {"Double_t", 'D'}, {"Float_t", 'F'}, {"Int_t", 'I'}, {"UInt_t", 'i'},
+            {"Long64_t", 'L'}, {"ULong64_t", 'l'}, {"Short_t", 'S'}, {"UShort_t", 's'},
+            {"Char_t", 'B'}, {"UChar_t", 'b'}, {"Bool_t", 'O'}
+        };
+
+        /**
+         * @brief A single column of the TTree.
+         * @details The input buffer is large enough for any basic type. The
+         * output buffers are only used if the column is converted.
+         */
+        struct Column
+        {
+            std::string name;
+            char code;
+            StorageType type;
+            alignas(8) unsigned char in[8];
+            float f;
+            int32_t i;
+            uint8_t u;
+            bool fits_int32;
+            bool fits_uint8;
+        };
+
+        std::vector<Column> columns;
+        TObjArray * branches = in->GetListOfBranches();
+        columns.reserve(branches->GetEntries());
+        for(int b = 0; b < branches->GetEntries(); ++b)
+        {
+            TBranch * branch = (TBranch *)branches->At(b);
+            TLeaf * leaf = (branch->IsA() == TBranch::Class() && branch->GetNleaves() == 1) ? (TLeaf *)branch->GetListOfLeaves()->At(0) : nullptr;
+            auto it = leaf ? codes.find(leaf->GetTypeName()) : codes.end();
+            if(!leaf || leaf->GetLen() != 1 || it == codes.end())
+            {
+                // Unsupported layout: copy the TTree unchanged.
+                std::cerr << "Warning: TTree " << in->GetName() << " has an unsupported branch layout (" << branch->GetName() << "). Storing without conversion." << std::endl;
+                dir->cd();
+                TTree * copy = in->CloneTree(-1, "fast");
+                if(options.basket_size > 0)
+                    copy->SetBasketSize("*", options.basket_size);
+                copy->Write();
+                delete copy;
+                return;
+            }
+            auto st = storage.find(branch->GetName());
+            StorageType type = (it->second == 'D' && st != storage.end()) ? st->second : StorageType::Double;
+            columns.push_back(Column{branch->GetName(), it->second, type, {}, 0, 0, 0, true, true});
+        }
+
+        // Check that the values of the integer branches fit their type.
+        bool integer = false;
+        for(Column & c : columns)
+        {
+            in->SetBranchAddress(c.name.c_str(), (void *)c.in);
+            integer = integer || c.type == StorageType::Int32 || c.type == StorageType::UInt8;
+        }
+        for(Long64_t entry = 0; integer && entry < in->GetEntries(); ++entry)
+        {
+            in->GetEntry(entry);
+            for(Column & c : columns)
+            {
+                if(c.type != StorageType::Int32 && c.type != StorageType::UInt8)
+                    continue;
+                double v;
+                std::memcpy(&v, c.in, sizeof(double));
+                if(std::isnan(v))
+                    continue;
+                if(v != std::nearbyint(v))
+                    c.fits_int32 = c.fits_uint8 = false;
+                c.fits_int32 = c.fits_int32 && v > std::numeric_limits<int32_t>::min() && v <= std::numeric_limits<int32_t>::max();
+                c.fits_uint8 = c.fits_uint8 && v >= 0 && v < std::numeric_limits<uint8_t>::max();
+            }
+        }
+        for(Column & c : columns)
+        {
+            StorageType type = c.type;
+            if(c.type == StorageType::UInt8 && !c.fits_uint8)
+                c.type = c.fits_int32 ? StorageType::Int32 : StorageType::Double;
+            else if(c.type == StorageType::Int32 && !c.fits_int32)
+                c.type = StorageType::Double;
+            if(c.type != type)
+                std::cerr << "Warning: branch " << c.name << " of TTree " << in->GetName() << " has values that do not fit "
+                          << (type == StorageType::UInt8 ? "uint8" : "int32") << ". Storing as "
+                          << (c.type == StorageType::Int32 ? "int32" : "double") << "." << std::endl;
+        }
+
+        // Bind the output buffers.
+        dir->cd();
+        TTree * out = new TTree(in->GetName(), in->GetTitle());
+        for(Column & c : columns)
+        {
+            if(c.code == 'D' && c.type == StorageType::Float)
+                out->Branch(c.name.c_str(), &c.f, (c.name + "/F").c_str());
+            else if(c.code == 'D' && c.type == StorageType::Int32)
+                out->Branch(c.name.c_str(), &c.i, (c.name + "/I").c_str());
+            else if(c.code == 'D' && c.type == StorageType::UInt8)
+                out->Branch(c.name.c_str(), &c.u, (c.name + "/b").c_str());
+            else
+                out->Branch(c.name.c_str(), (void *)c.in, (c.name + "/" + c.code).c_str());
+        }
+        if(options.basket_size > 0)
+            out->SetBasketSize("*", options.basket_size);
+
+        // Copy the entries, converting the values.
+        for(Long64_t entry = 0; entry < in->GetEntries(); ++entry)
+        {
+            in->GetEntry(entry);
+            for(Column & c : columns)
+            {
+                if(c.code != 'D' || c.type == StorageType::Double)
+                    continue;
+                double v;
+                std::memcpy(&v, c.in, sizeof(double));
+                if(c.type == StorageType::Float)
+                    c.f = (float)v;
+                else if(c.type == StorageType::Int32)
+                    c.i = std::isnan(v) ? std::numeric_limits<int32_t>::min() : (int32_t)std::llround(v);
+                else
+                    c.u = std::isnan(v) ? std::numeric_limits<uint8_t>::max() : (uint8_t)std::llround(v);
+            }
+            out->Fill();
+        }
+        in->ResetBranchAddresses();
+        out->Write();
+        delete out;
+    }
+
+    /**
+     * @brief Copy the contents of a directory, converting the TTrees.
+     * @param src The directory to copy.
+     * @param dst The directory to copy to.
+     * @param storage The storage type of each branch (by name).
+     * @param options The configuration of the output file.
+     * @return void
+     */
+    void copy_typed(TDirectory * src, TDirectory * dst, const std::map<std::string, StorageType> & storage, const OutputOptions & options)
+    {
+        TIter next(src->GetListOfKeys());
+        while(TKey * key = (TKey *)next())
+        {
+            // Only the latest cycle of each object.
+            if(src->GetKey(key->GetName())->GetCycle() != key->GetCycle())
+                continue;
+            TObject * obj = key->ReadObj();
+            if(TTree * tree = dynamic_cast<TTree *>(obj))
+            {
+                write_typed_tree(tree, dst, storage, options);
+                delete tree;
+            }
+            else if(TDirectory * subdir = dynamic_cast<TDirectory *>(obj))
+                copy_typed(subdir, dst->mkdir(subdir->GetName()), storage, options);
+            else
+            {
+                dst->WriteTObject(obj, key->GetName());
+                delete obj;
+            }
+        }
+    }
+
+    /**
+     * @brief Write an ana::Tree to a directory with typed branches.
+     * @details If every branch is stored as a double and no basket size is
+     * configured, the Tree is written directly. Otherwise, the Tree is
+     * first written to a scratch file in the temporary directory (a
+     * TMemFile would hold a second, in-memory copy of the Tree next to the
+     * Tree itself) and then copied to the directory with its branches
+     * converted. The scratch file is removed afterwards.
+     * @param tree The Tree to write.
+     * @param dir The directory to write the Tree to.
+     * @param storage The storage type of each branch (by name).
+     * @param options The configuration of the output file.
+     * @return void
+     * @throw std::runtime_error if the scratch file cannot be created.
+     */
+    void write_tree(const ana::Tree & tree, TDirectory * dir, const std::map<std::string, StorageType> & storage, const OutputOptions & options)
+    {
+        bool typed = options.basket_size > 0;
+        for(const auto & [name, type] : storage)
+            typed = typed || type != StorageType::Double;
+        if(!typed)
+        {
+            tree.SaveTo(dir);
+            return;
+        }
+
+        static std::atomic<int> counter{0};
+        std::string path = std::string(gSystem->TempDirectory()) + "/medulla_scratch_"
+                         + std::to_string(gSystem->GetPid()) + "_" + std::to_string(counter++) + ".root";
+        TFile * scratch = TFile::Open(path.c_str(), "RECREATE");
+        if(!scratch || scratch->IsZombie())
+        {
+            delete scratch;
+            throw std::runtime_error("Unable to create the scratch file " + path + ".");
+        }
+        try
+        {
+            tree.SaveTo(scratch);
+            copy_typed(scratch, dir, storage, options);
+        }
+        catch(...)
+        {
+            delete scratch;
+            gSystem->Unlink(path.c_str());
+            throw;
+        }
+        delete scratch;
+        gSystem->Unlink(path.c_str());
+    }
+}
+#endif // OUTPUT_H
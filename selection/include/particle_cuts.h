@@ -80,7 +80,7 @@ namespace pcuts
      * @return true if the particle has a size above the threshold.
      */
     template<class T>
-    bool size_cut(const T & p, std::vector<double> params={20.0,})
+    bool size_cut(const T & p, const std::vector<double> & params={20.0,})
     {
         if(params.size() != 1)
             throw std::invalid_argument("size_cut requires exactly one parameter: the minimum number of spacepoints.");
@@ -108,8 +108,9 @@ namespace pcuts
      * @brief Check if the particle is throughgoing.
      * @details This function checks if the particle is throughgoing. A
      * throughgoing particle is defined as a particle which has both ends
-     * of the track near the boundary of the detector. This is only applicable
-     * to tracks as it is somewhat nonsensical for showers.
+     * of the track near the boundary of the detector (see
+     * @ref active_detector). This is only applicable to tracks as it is
+     * somewhat nonsensical for showers.
      * @tparam T the type of particle (true or reco).
      * @param p the particle to check.
      * @return true if the particle is throughgoing.
@@ -117,9 +118,9 @@ namespace pcuts
     template<class T>
     bool throughgoing(const T & p)
     {
-        utilities::three_vector start_point = {p.start_point[0], p.start_point[1], p.start_point[2]};
-        utilities::three_vector end_point = {p.end_point[0], p.end_point[1], p.end_point[2]};
-        return pvars::pid(p) > 1 && utilities::near_boundary(start_point) && utilities::near_boundary(end_point);
+        const DetectorDescriptor & detector = active_detector();
+        return pvars::pid(p) > 1 && detector.near_boundary(p.start_point[0], p.start_point[1], p.start_point[2])
+                                 && detector.near_boundary(p.end_point[0], p.end_point[1], p.end_point[2]);
     }
     REGISTER_CUT_SCOPE(RegistrationScope::BothParticle, throughgoing, throughgoing);
 
@@ -135,7 +136,7 @@ namespace pcuts
      * a photon.
      */
     template<class T>
-    bool is_pid(const T & p, std::vector<double> params={0.0,})
+    bool is_pid(const T & p, const std::vector<double> & params={0.0,})
     {
         return pvars::pid(p) == static_cast<size_t>(params[0]);
     }
@@ -155,7 +156,7 @@ namespace pcuts
      * @return true if the particle is of the given semantic type.
      */
     template<class T>
-    bool is_semantic_type(const T & p, std::vector<double> params={0.0,})
+    bool is_semantic_type(const T & p, const std::vector<double> & params={0.0,})
     {
         if(params.size() != 1)
             throw std::invalid_argument("is_semantic_type requires exactly one parameter: the semantic type to check against.");
@@ -11,13 +11,7 @@
 #ifndef PARTICLE_UTILITIES_H
 #define PARTICLE_UTILITIES_H
 
-#define MARGIN 5.0
-#define SBND_XMIN -201.3
-#define SBND_XMAX  201.3
-#define SBND_YMIN -200.008
-#define SBND_YMAX  200.008
-#define SBND_ZMIN  4.94238
-#define SBND_ZMAX  504.458
+#include "framework.h"
 
 namespace utilities
 {
@@ -79,7 +73,7 @@ namespace utilities
      */
     double magnitude(const three_vector & a)
     {
-        return std::sqrt(std::pow(std::get<0>(a), 2) + std::pow(std::get<1>(a), 2) + std::pow(std::get<2>(a), 2));
+        return std::sqrt(dot_product(a, a));
     }
 
     /**
@@ -126,16 +120,13 @@ namespace utilities
      * @details This function determines if a point is near a boundary of the
      * detector by checking if the point is within a certain distance of any
      * of the boundaries of the detector. The boundaries of the detector are
-     * defined by preprocessor macros which specify the minimum and maximum
-     * values of the x, y, and z coordinates of the detector.
+     * given by the configured detector descriptor (see @ref active_detector).
      * @param vtx the position of the point as a tuple (three-vector).
      * @return true if the point is near a boundary, false otherwise.
      */
     bool near_boundary(const three_vector & vtx)
     {
-        return std::get<0>(vtx) < SBND_XMIN + MARGIN || std::get<0>(vtx) > SBND_XMAX - MARGIN ||
-               std::get<1>(vtx) < SBND_YMIN + MARGIN || std::get<1>(vtx) > SBND_YMAX - MARGIN ||
-               std::get<2>(vtx) < SBND_ZMIN + MARGIN || std::get<2>(vtx) > SBND_ZMAX - MARGIN;
+        return active_detector().near_boundary(std::get<0>(vtx), std::get<1>(vtx), std::get<2>(vtx));
     }
 
     /**
@@ -168,6 +159,24 @@ namespace utilities
         return subtract(p, std::make_tuple(scale*std::get<0>(unit), scale*std::get<1>(unit), scale*std::get<2>(unit)));
     }
 
+    /**
+     * @brief Retrieves the transverse momentum of a particle from the
+     * geometry of its interaction.
+     * @details The transverse momenta of all particles of the interaction are
+     * computed at once on first use in the record (see @ref GeometryCache),
+     * with respect to the same beam direction as in
+     * @ref transverse_momentum.
+     * @param geometry the geometry of the interaction (with the transverse
+     * momenta).
+     * @param index the position of the particle in the interaction.
+     * @return the transverse momentum (three-vector) of the particle as a
+     * tuple.
+     */
+    three_vector transverse_momentum(const ParticleGeometry & geometry, size_t index)
+    {
+        return std::make_tuple(geometry.transverse[0][index], geometry.transverse[1][index], geometry.transverse[2][index]);
+    }
+
     /**
      * @brief Calculates the longitudinal component of the particle's momentum.
      * @details The longitudinal component of the momentum is calculated with
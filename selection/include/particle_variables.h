@@ -15,6 +15,7 @@
 #define PION_MASS 139.57039
 #define PROTON_MASS 938.2720813
 
+#include "framework.h"
 #include "include/particle_utilities.h"
 #include "scorers.h"
 
@@ -41,6 +42,8 @@ namespace pvars
      * @tparam T the type of particle (true or reco).
      * @param p the particle to apply the variable on.
      * @return the primary classification of the particle.
+     * @note The value is cached per particle and per record (see
+     * @ref ParticleCache).
      */
     template<class T>
     double primary_classification(const T & p)
@@ -48,9 +51,10 @@ namespace pvars
         if constexpr (std::is_same_v<T, caf::SRParticleTruthDLPProxy>)
             return p.is_primary ? 1 : 0;
         else
-            return (*primfn)(p);
+            return ParticleCache<T>::instance().get(p, ParticleQuantity::Primary, [&p]() { return (*primfn)(p); });
     }
     REGISTER_VAR_SCOPE(RegistrationScope::BothParticle, primary_classification, primary_classification);
+    REGISTER_VAR_STORAGE(RegistrationScope::BothParticle, primary_classification, StorageType::UInt8);
     
     /**
      * @brief Variable for the particle's PID.
@@ -61,6 +65,8 @@ namespace pvars
      * @tparam T the type of particle (true or reco).
      * @param p the particle to apply the variable on.
      * @return the PID of the particle.
+     * @note The value is cached per particle and per record (see
+     * @ref ParticleCache).
      */
     template<class T>
     double pid(const T & p)
@@ -68,9 +74,10 @@ namespace pvars
         if constexpr (std::is_same_v<T, caf::SRParticleTruthDLPProxy>)
             return p.pid;
         else
-            return (*pidfn)(p);
+            return ParticleCache<T>::instance().get(p, ParticleQuantity::PID, [&p]() { return (*pidfn)(p); });
     }
     REGISTER_VAR_SCOPE(RegistrationScope::BothParticle, pid, pid);
+    REGISTER_VAR_STORAGE(RegistrationScope::BothParticle, pid, StorageType::Int32);
 
     /**
      * @brief Variable for the semantic type of the particle.
@@ -89,6 +96,7 @@ namespace pvars
         return p.shape;
     }
     REGISTER_VAR_SCOPE(RegistrationScope::BothParticle, semantic_type, semantic_type);
+    REGISTER_VAR_STORAGE(RegistrationScope::BothParticle, semantic_type, StorageType::Int32);
 
     /**
      * @brief Variable for the best-match IoU of the particle.
@@ -121,6 +129,7 @@ namespace pvars
     template<class T>
     double containment(const T & p) { return p.is_contained; }
     REGISTER_VAR_SCOPE(RegistrationScope::BothParticle, containment, containment);
+    REGISTER_VAR_STORAGE(RegistrationScope::BothParticle, containment, StorageType::UInt8);
 
     /**
      * @brief Variable for the mass of the particle.
@@ -229,26 +238,30 @@ namespace pvars
      * @tparam T the type of particle (true or reco).
      * @param p the particle to apply the variable on.
      * @return the starting kinetic energy of the particle.
+     * @note The value is cached per particle and per record (see
+     * @ref ParticleCache).
      */
     template<class T>
     double ke(const T & p)
     {
-        double energy(0);
-        if constexpr (std::is_same_v<T, caf::SRParticleTruthDLPProxy>)
-        {
-            energy = p.energy_init - mass(p);
-        }
-        else
-        {
-            if(pvars::pid(p) < 2) [[likely]]
-                energy += calo_ke(p);
+        return ParticleCache<T>::instance().get(p, ParticleQuantity::KE, [&p]() {
+            double energy(0);
+            if constexpr (std::is_same_v<T, caf::SRParticleTruthDLPProxy>)
+            {
+                energy = p.energy_init - mass(p);
+            }
             else
             {
-                if(p.is_contained) energy += csda_ke(p);
-                else energy += mcs_ke(p);
+                if(pvars::pid(p) < 2) [[likely]]
+                    energy += calo_ke(p);
+                else
+                {
+                    if(p.is_contained) energy += csda_ke(p);
+                    else energy += mcs_ke(p);
+                }
             }
-        }
-        return energy;
+            return energy;
+        });
     }
     REGISTER_VAR_SCOPE(RegistrationScope::BothParticle, ke, ke);
 
@@ -0,0 +1,318 @@
+/**
+ * @file plan.h
+ * @brief Header file for the compiled selection plan of the analysis.
+ * @details The [[tree]] blocks of the configuration do not depend on the
+ * sample they are run on, except through a few properties of the sample
+ * (e.g., whether it is a simulation sample). The SelectionPlan parses and
+ * validates every tree once, before any sample is loaded, and resolves the
+ * cuts, branch variables, and selectors from the registries. The trees are
+ * then instantiated for each sample from the plan, which only creates the
+ * per-sample state (the selection pass and the cutflow).
+ * @author mueller@fnal.gov
+ */
+#ifndef PLAN_H
+#define PLAN_H
+#include <vector>
+#include <string>
+#include <map>
+#include <set>
+#include <memory>
+#include <stdexcept>
+#include <algorithm>
+
+#include "configuration.h"
+#include "framework.h"
+#include "analysis.h"
+#include "histograms.h"
+
+/**
+ * @namespace ana
+ * @brief Namespace for the Analysis class and related functions.
+ * @details The ana namespace contains the Analysis class, which is designed
+ * to streamline the running of multiple samples through CAFAna. The namespace
+ * is also used to organize analysis-related functions and variables within
+ * CAFAna.
+ */
+namespace ana
+{
+    /**
+     * @brief A single branch of a compiled tree.
+     * @details Branches of the "both" and "both_particle" types are expanded
+     * into one branch for each of their two types.
+     */
+    struct BranchPlan
+    {
+        cfg::ConfigurationTable var; ///< The [[tree.branch]] subtable.
+        std::string type;            ///< The (resolved) type of the branch.
+        std::string name;            ///< The full name of the branch.
+        VarBinder binder;            ///< The resolved variable of the branch.
+        StorageType storage;         ///< The storage type of the branch.
+    };
+
+    /**
+     * @brief A single compiled tree.
+     */
+    struct TreePlan
+    {
+        cfg::ConfigurationTable table;                ///< The [[tree]] table.
+        std::string name;                             ///< The name of the tree.
+        Mode mode;                                    ///< The mode of the main loop.
+        std::vector<cfg::ConfigurationTable> cuts;    ///< The [[tree.cut]] subtables.
+        std::vector<CutSpec> cut_specs;               ///< The parsed cuts.
+        AdaptiveCutOrder adaptive;                    ///< The adaptive cut ordering.
+        bool sim_only;                                ///< Whether the tree is simulation-only.
+        bool cutflow;                                 ///< Whether to accumulate the cutflow.
+        bool add_exposure;                            ///< Whether to add the exposure tree.
+        std::vector<BranchPlan> branches;             ///< The branches of the tree.
+        std::vector<NamedSpillMultiVar> exposure;     ///< The exposure variables.
+        std::vector<HistogramSpec> histograms;        ///< The histograms of the tree.
+        bool histograms_only;                         ///< Whether to write only the histograms.
+    };
+
+    /**
+     * @class SelectionPlan
+     * @brief Class holding the compiled trees of the configuration.
+     * @details All trees are compiled when the plan is constructed, and every
+     * unknown cut, variable, or selector name (and every other error of the
+     * tree definitions) is collected and reported at once. The branch
+     * variables are bound to the selection pass of each sample by
+     * @ref book. As the profiling counters are kept per sample, the branch
+     * variables are re-resolved for each sample if the profiling mode is
+     * enabled.
+     */
+    class SelectionPlan
+    {
+        public:
+            SelectionPlan(const cfg::ConfigurationTable & config, StorageType default_storage, bool infer_storage);
+            const std::vector<TreePlan> & trees() const;
+            void book(Analysis & analysis, const std::string & sample, const std::string & label, bool ismc, const TreePlan & tree) const;
+        private:
+            TreePlan compile_tree(const cfg::ConfigurationTable & tree, std::vector<std::string> & errors) const;
+            StorageType default_storage;
+            bool infer_storage;
+            std::vector<TreePlan> plans;
+    };
+
+    /**
+     * @brief Constructor for the SelectionPlan class.
+     * @param config The configuration of the analysis.
+     * @param default_storage The storage type of branches without a
+     * configured or registered storage type.
+     * @param infer_storage Whether to use the registered storage types.
+     * @return A new instance of the SelectionPlan class.
+     * @throw cfg::ConfigurationError if any tree is invalid, listing all of
+     * the errors of all trees.
+     */
+    SelectionPlan::SelectionPlan(const cfg::ConfigurationTable & config, StorageType default_storage, bool infer_storage)
+        : default_storage(default_storage), infer_storage(infer_storage)
+    {
+        std::vector<std::string> errors;
+        for(const auto & tree : config.get_subtables("tree"))
+            plans.push_back(compile_tree(tree, errors));
+
+        if(!errors.empty())
+        {
+            std::string message = "Invalid selection configuration (" + std::to_string(errors.size()) + " errors):";
+            for(const std::string & error : errors)
+                message += "\n\t" + error;
+            throw cfg::ConfigurationError(message);
+        }
+    }
+
+    /**
+     * @brief Get the compiled trees.
+     * @return The compiled trees, in configured order.
+     */
+    const std::vector<TreePlan> & SelectionPlan::trees() const
+    {
+        return plans;
+    }
+
+    /**
+     * @brief Compile a single tree.
+     * @details The errors of the tree are appended to @p errors instead of
+     * being thrown, so that all errors of the configuration can be reported
+     * together.
+     * @param tree The [[tree]] table.
+     * @param errors The list of errors of the configuration.
+     * @return The compiled tree.
+     */
+    TreePlan SelectionPlan::compile_tree(const cfg::ConfigurationTable & tree, std::vector<std::string> & errors) const
+    {
+        TreePlan plan;
+        plan.table = tree;
+        plan.name = tree.get_string_field("name");
+        plan.cuts = tree.get_subtables("cut");
+        plan.sim_only = tree.get_bool_field("sim_only");
+        plan.cutflow = tree.get_bool_field("cutflow", false);
+        plan.add_exposure = tree.get_bool_field("add_exposure", false);
+        plan.histograms_only = tree.get_bool_field("histograms_only", false);
+
+        // Configure the (optional) adaptive ordering of the cuts.
+        plan.adaptive.enabled = tree.get_bool_field("adaptive_cut_order", false);
+        for(const auto & [field, value] : {std::make_pair("adaptive_cut_records", &plan.adaptive.records), std::make_pair("adaptive_cut_retune", &plan.adaptive.retune)})
+        {
+            if(!tree.has_field(field))
+                continue;
+            int64_t n = tree.get_int_field(field);
+            if(n < 0)
+                errors.push_back(plan.name + ": The " + field + " field must not be negative.");
+            else
+                *value = (size_t)n;
+        }
+
+        // The branches cannot be resolved without a valid mode.
+        try
+        {
+            plan.mode = parse_mode(tree.get_string_field("mode"));
+        }
+        catch(const std::runtime_error & e)
+        {
+            errors.push_back(plan.name + ": " + e.what());
+            return plan;
+        }
+
+        // Parse the cuts and check that each is registered.
+        try
+        {
+            plan.cut_specs = parse_cuts(plan.cuts);
+            for(const CutSpec & cut : plan.cut_specs)
+            {
+                if(!is_registered(cut))
+                    errors.push_back(plan.name + ": Cut " + cut.type + "_" + cut.name + " is not registered.");
+            }
+            if(plan.add_exposure)
+                plan.exposure = construct_exposure_vars(plan.cuts);
+        }
+        catch(const std::runtime_error & e)
+        {
+            errors.push_back(plan.name + ": " + e.what());
+        }
+
+        // Resolve the branch variables. The "both" types are expanded into
+        // one branch for each of their two types.
+        for(const auto & var : tree.get_subtables("branch"))
+        {
+            std::string type = var.get_string_field("type");
+            std::vector<std::string> types;
+            if(type == "both")
+                types = {"true", "reco"};
+            else if(type == "both_particle")
+                types = {"true_particle", "reco_particle"};
+            else if(type == "true" || type == "reco" || type == "mctruth"
+                    || type == "true_particle" || type == "reco_particle" || type == "event")
+                types = {type};
+            else
+            {
+                errors.push_back("Illegal variable type '" + type + "' for branch " + plan.name + ":" + var.get_string_field("name"));
+                continue;
+            }
+
+            for(const std::string & t : types)
+            {
+                try
+                {
+                    NamedVarBinder binder = compile(var, plan.mode, t);
+                    plan.branches.push_back(BranchPlan{var, t, binder.first, binder.second, branch_storage(var, t, default_storage, infer_storage)});
+                }
+                catch(const std::runtime_error & e)
+                {
+                    errors.push_back(plan.name + ":" + var.get_string_field("name") + ": " + e.what());
+                }
+            }
+        }
+
+        // Parse the histograms and check that their branches are defined.
+        try
+        {
+            if(tree.has_field("histogram"))
+                plan.histograms = parse_histograms(tree.get_subtables("histogram"));
+        }
+        catch(const std::runtime_error & e)
+        {
+            errors.push_back(plan.name + ": " + e.what());
+        }
+        for(const HistogramSpec & spec : plan.histograms)
+        {
+            for(const std::string & name : {spec.x.branch, spec.y ? spec.y->branch : std::string(), spec.weight, spec.split})
+            {
+                auto match = [&name](const BranchPlan & branch) { return branch.name == name; };
+                if(!name.empty() && std::none_of(plan.branches.begin(), plan.branches.end(), match))
+                    errors.push_back(plan.name + ": Histogram " + spec.name + " refers to unknown branch " + name + ".");
+            }
+        }
+        if(plan.histograms_only && plan.histograms.empty())
+            errors.push_back(plan.name + ": The histograms_only flag requires at least one [[tree.histogram]] block.");
+        return plan;
+    }
+
+    /**
+     * @brief Book a compiled tree (with its cutflow, exposure tree, and
+     * histograms, if configured) for a sample of the analysis.
+     * @details The histograms are filled from the same (bound) branch
+     * variables as the tree, whose values are shared per record (see
+     * @ref shared_var). If the tree is configured to write only its
+     * histograms, the tree itself is not booked.
+     * @param analysis The analysis to book the tree in.
+     * @param sample The name of the sample in the analysis.
+     * @param label The name of the sample used for logging and profiling.
+     * @param ismc Whether the sample is a simulation sample.
+     * @param tree The compiled tree.
+     * @return void
+     */
+    void SelectionPlan::book(Analysis & analysis, const std::string & sample, const std::string & label, bool ismc, const TreePlan & tree) const
+    {
+        // The selection is applied once per record and shared by all
+        // branch variables of the tree.
+        std::string selection_name = label + "/" + tree.name;
+        auto selection = std::make_shared<SelectionPass>(tree.cut_specs, tree.mode, ismc, selection_name, tree.adaptive);
+
+        // Accumulate the (optional) cutflow of the tree during the same pass.
+        if(tree.cutflow && (ismc || !tree.sim_only))
+        {
+            auto cutflow = std::make_shared<Cutflow>(tree.cuts, tree.mode, ismc);
+            selection->attach(cutflow);
+            analysis.AddCutflowForSample(sample, tree.name, cutflow);
+        }
+
+        std::map<std::string, SpillMultiVar> vars_map;
+        std::map<std::string, StorageType> storage_map;
+        std::set<std::string> shared;
+        bool profile = Profiler::instance().enabled();
+        for(const BranchPlan & branch : tree.branches)
+        {
+            const VarBinder & binder = profile ? compile(branch.var, tree.mode, branch.type, selection_name).second : branch.binder;
+            vars_map.try_emplace(branch.name, binder(selection));
+            storage_map.try_emplace(branch.name, branch.storage);
+        }
+        bool histograms = !tree.histograms.empty() && (ismc || !tree.sim_only);
+        if(histograms && !tree.histograms_only)
+        {
+            for(const HistogramSpec & spec : tree.histograms)
+            {
+                for(const std::string & name : {spec.x.branch, spec.y ? spec.y->branch : std::string(), spec.weight, spec.split})
+                {
+                    auto it = vars_map.find(name);
+                    if(it != vars_map.end() && shared.insert(name).second)
+                        it->second = shared_var(it->second);
+                }
+            }
+        }
+        if(!tree.histograms_only)
+            analysis.AddTreeForSample(sample, tree.name, vars_map, tree.sim_only, storage_map);
+
+        // Fill the (optional) histograms of the tree during the same pass.
+        if(histograms)
+            analysis.AddHistogramsForSample(sample, tree.name, std::make_shared<HistogramSet>(tree.name, tree.histograms, vars_map, construct_exposure_cuts(tree.cuts)));
+
+        // Add the exposure tree.
+        if(tree.add_exposure)
+        {
+            std::map<std::string, SpillMultiVar> exposure_vars_map;
+            for(const auto & exposure_var : tree.exposure)
+                exposure_vars_map.try_emplace(exposure_var.first, exposure_var.second);
+            analysis.AddTreeForSample(sample, tree.name + "_exposure", exposure_vars_map, tree.sim_only);
+        }
+    }
+}
+#endif // PLAN_H
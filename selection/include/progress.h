@@ -0,0 +1,567 @@
+/**
+ * @file progress.h
+ * @brief Header file for the live progress reporting of the selection.
+ * @details A multi-hour run of the selection otherwise gives no indication of
+ * its progress, so that a stalled (e.g., XRootD) read cannot be told apart
+ * from a slow computation. The progress of each sample (records,
+ * interactions, and bytes read, with their rates, the current input file, and
+ * the split of the time between I/O and computation) is reported periodically
+ * by a background thread, both in human-readable form on stdout and, if
+ * configured, as a stream of JSON lines that a batch monitoring system can
+ * scrape. The counters of each sample are only updated by the thread running
+ * the sample, so the reporting works with concurrent samples.
+ * @author mueller@fnal.gov
+ */
+#ifndef PROGRESS_H
+#define PROGRESS_H
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <condition_variable>
+
+#include "sbnana/CAFAna/Core/MultiVar.h"
+#include "sbnanaobj/StandardRecord/Proxy/SRProxy.h"
+#include "TFile.h"
+
+#include "configuration.h"
+#include "loader.h"
+
+/**
+ * @namespace ana
+ * @brief Namespace for the Analysis class and related functions.
+ * @details The ana namespace contains the Analysis class, which is designed
+ * to streamline the running of multiple samples through CAFAna. The namespace
+ * is also used to organize analysis-related functions and variables within
+ * CAFAna.
+ */
+namespace ana
+{
+    /**
+     * @brief The configuration of the progress reporting.
+     */
+    struct ProgressOptions
+    {
+        double interval = 60;  ///< The reporting interval (s); zero disables the reporting.
+        std::string metrics;   ///< The path of the JSON lines stream (empty to disable).
+        size_t sampling = 16;  ///< The period (in records) of the compute time measurement.
+    };
+
+    /**
+     * @brief Parse the progress fields of the [general] block.
+     * @details The fields are "progress_interval" (seconds, default 60, zero
+     * disables the reporting), "progress_metrics" (path of the JSON lines
+     * stream, default disabled), and "progress_sampling" (records, default
+     * 16).
+     * @param config The configuration of the analysis.
+     * @return The configuration of the progress reporting.
+     * @throw cfg::ConfigurationError if a field is invalid.
+     */
+    ProgressOptions parse_progress(const cfg::ConfigurationTable & config)
+    {
+        ProgressOptions options;
+        if(config.has_field("general.progress_interval"))
+            options.interval = config.get_double_field("general.progress_interval");
+        options.metrics = config.get_string_field("general.progress_metrics", "");
+        if(config.has_field("general.progress_sampling"))
+        {
+            int64_t sampling = config.get_int_field("general.progress_sampling");
+            if(sampling < 1)
+                throw cfg::ConfigurationError("The progress_sampling field must be positive.");
+            options.sampling = sampling;
+        }
+        if(options.interval < 0)
+            throw cfg::ConfigurationError("The progress_interval field must not be negative.");
+        if(options.interval == 0 && !options.metrics.empty())
+            throw cfg::ConfigurationError("The progress_metrics field requires a positive progress_interval.");
+        return options;
+    }
+
+    /**
+     * @class SampleProgress
+     * @brief Class holding the progress counters of a single sample.
+     * @details The counters are written by the thread running the sample
+     * (through the loader, see @ref MonitoredSpectrumLoader, and the observer
+     * and timing wrappers booked by the Analysis) and read by the reporting
+     * thread. The time of the loop is measured between consecutive records.
+     * The time spent in the variables of the trees is measured on one record
+     * out of every "sampling" records; the remainder of the loop time is
+     * attributed to I/O (the reading and decompression of the records, and
+     * the overhead of the loader).
+     */
+    class SampleProgress
+    {
+        public:
+            /**
+             * @brief A snapshot of the counters.
+             */
+            struct Snapshot
+            {
+                int state = 0;            ///< 0 (pending), 1 (running), or 2 (done).
+                uint64_t records = 0;     ///< The number of records.
+                uint64_t interactions = 0;///< The number of (reco) interactions.
+                uint64_t bytes = 0;       ///< The number of bytes read.
+                uint64_t files = 0;       ///< The number of completed input files.
+                double loop = 0;          ///< The time of the sampled records (s).
+                double compute = 0;       ///< The compute time of the sampled records (s).
+                double elapsed = 0;       ///< The time since the start of the sample (s).
+                std::string file;         ///< The current input file.
+            };
+
+            SampleProgress(const std::string & name, size_t sampling);
+            const std::string & name() const;
+            void begin();
+            void finish();
+            void open_file(TFile * file);
+            void close_file();
+            void record(const caf::Proxy<caf::StandardRecord> & sr);
+            bool sampled() const;
+            void add_compute(std::chrono::steady_clock::duration d);
+            Snapshot snapshot() const;
+
+        private:
+            using Clock = std::chrono::steady_clock;
+            std::string name_;
+            size_t sampling_;
+
+            // Written by the thread running the sample only.
+            TFile * file_ = nullptr;
+            uint64_t file_bytes_ = 0;
+            bool sampled_ = false;
+            std::optional<Clock::time_point> last_;
+
+            // Shared with the reporting thread.
+            std::atomic<int> state_{0};
+            std::atomic<uint64_t> records_{0};
+            std::atomic<uint64_t> interactions_{0};
+            std::atomic<uint64_t> bytes_{0};
+            std::atomic<uint64_t> files_{0};
+            std::atomic<int64_t> loop_ns_{0};
+            std::atomic<int64_t> compute_ns_{0};
+            std::atomic<int64_t> start_ns_{0};
+            std::atomic<int64_t> end_ns_{0};
+            mutable std::mutex file_mutex_;
+            std::string file_name_;
+    };
+
+    /**
+     * @brief Constructor for the SampleProgress class.
+     * @param name The name of the sample.
+     * @param sampling The period (in records) of the compute time
+     * measurement.
+     * @return A new instance of the SampleProgress class.
+     */
+    SampleProgress::SampleProgress(const std::string & name, size_t sampling)
+        : name_(name), sampling_(sampling) {}
+
+    /**
+     * @brief Get the name of the sample.
+     * @return The name of the sample.
+     */
+    const std::string & SampleProgress::name() const
+    {
+        return name_;
+    }
+
+    /**
+     * @brief Mark the start of the sample.
+     * @return void
+     */
+    void SampleProgress::begin()
+    {
+        start_ns_ = Clock::now().time_since_epoch().count();
+        state_ = 1;
+    }
+
+    /**
+     * @brief Mark the end of the sample.
+     * @return void
+     */
+    void SampleProgress::finish()
+    {
+        end_ns_ = Clock::now().time_since_epoch().count();
+        state_ = 2;
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        file_name_.clear();
+    }
+
+    /**
+     * @brief Signal the input file being read.
+     * @param file The input file.
+     * @return void
+     */
+    void SampleProgress::open_file(TFile * file)
+    {
+        file_ = file;
+        file_bytes_ = 0;
+        last_.reset();
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        file_name_ = file->GetName();
+    }
+
+    /**
+     * @brief Signal the end of the input file being read.
+     * @return void
+     */
+    void SampleProgress::close_file()
+    {
+        if(file_)
+            bytes_ += (uint64_t)file_->GetBytesRead() - file_bytes_;
+        file_ = nullptr;
+        file_bytes_ = 0;
+        last_.reset();
+        ++files_;
+    }
+
+    /**
+     * @brief Count a record.
+     * @details The loop time since the previous record is attributed to the
+     * previous record, and is accumulated if that record was sampled. The
+     * bytes read from the current file are updated. The interactions are
+     * counted from the "ndlp" branch, which is read even if the interaction
+     * branches are pruned.
+     * @param sr The record.
+     * @return void
+     */
+    void SampleProgress::record(const caf::Proxy<caf::StandardRecord> & sr)
+    {
+        Clock::time_point now = Clock::now();
+        if(last_ && sampled_)
+            loop_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(now - *last_).count();
+        last_ = now;
+
+        uint64_t n = records_++;
+        sampled_ = (n % sampling_ == 0);
+        interactions_ += sr.ndlp;
+        if(file_)
+        {
+            uint64_t read = file_->GetBytesRead();
+            bytes_ += read - file_bytes_;
+            file_bytes_ = read;
+        }
+    }
+
+    /**
+     * @brief Check if the compute time of the current record is measured.
+     * @return True if the current record is sampled.
+     */
+    bool SampleProgress::sampled() const
+    {
+        return sampled_;
+    }
+
+    /**
+     * @brief Add to the compute time of the sampled records.
+     * @param d The compute time.
+     * @return void
+     */
+    void SampleProgress::add_compute(std::chrono::steady_clock::duration d)
+    {
+        compute_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+    }
+
+    /**
+     * @brief Get a snapshot of the counters.
+     * @return The snapshot of the counters.
+     */
+    SampleProgress::Snapshot SampleProgress::snapshot() const
+    {
+        Snapshot s;
+        s.state = state_;
+        s.records = records_;
+        s.interactions = interactions_;
+        s.bytes = bytes_;
+        s.files = files_;
+        s.loop = loop_ns_ * 1e-9;
+        s.compute = compute_ns_ * 1e-9;
+        if(s.state > 0)
+        {
+            int64_t end = (s.state == 2) ? end_ns_.load() : Clock::now().time_since_epoch().count();
+            s.elapsed = std::chrono::duration<double>(Clock::duration(end - start_ns_.load())).count();
+        }
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        s.file = file_name_;
+        return s;
+    }
+
+    /**
+     * @brief Wrap a SpillMultiVar to measure its compute time on the sampled
+     * records of a sample.
+     * @param var The variable to wrap.
+     * @param progress The progress of the sample.
+     * @return The wrapped variable.
+     */
+    SpillMultiVar timed_var(const SpillMultiVar & var, const std::shared_ptr<SampleProgress> & progress)
+    {
+        return SpillMultiVar([var, progress](const caf::Proxy<caf::StandardRecord> * sr) -> std::vector<double>
+        {
+            if(!progress->sampled())
+                return var(sr);
+            auto start = std::chrono::steady_clock::now();
+            std::vector<double> values = var(sr);
+            progress->add_compute(std::chrono::steady_clock::now() - start);
+            return values;
+        });
+    }
+
+    /**
+     * @brief Wrap a record observer to measure its compute time on the
+     * sampled records of a sample.
+     * @param observer The observer to wrap.
+     * @param progress The progress of the sample.
+     * @return The wrapped observer.
+     */
+    RecordObserver timed_observer(const RecordObserver & observer, const std::shared_ptr<SampleProgress> & progress)
+    {
+        return [observer, progress](const caf::SRSpillProxy & sr)
+        {
+            if(!progress->sampled())
+            {
+                observer(sr);
+                return;
+            }
+            auto start = std::chrono::steady_clock::now();
+            observer(sr);
+            progress->add_compute(std::chrono::steady_clock::now() - start);
+        };
+    }
+
+    /**
+     * @brief Create the record observer that counts the records of a sample.
+     * @param progress The progress of the sample.
+     * @return The observer.
+     */
+    RecordObserver progress_observer(const std::shared_ptr<SampleProgress> & progress)
+    {
+        return [progress](const caf::SRSpillProxy & sr)
+        {
+            progress->record(sr);
+        };
+    }
+
+    /**
+     * @class ProgressMonitor
+     * @brief Class reporting the progress of the samples of the analysis.
+     * @details The reporting thread is started by @ref start and prints one
+     * line per running sample every interval. Each line reports the totals
+     * and the rates over the last interval. If configured, the same
+     * information is appended as one JSON object per line to the metrics
+     * stream (which is flushed after each report). A final report of each
+     * sample is emitted when it finishes.
+     */
+    class ProgressMonitor
+    {
+        public:
+            ProgressMonitor(const ProgressOptions & options);
+            ~ProgressMonitor();
+            std::shared_ptr<SampleProgress> sample(const std::string & name);
+            std::shared_ptr<SampleProgress> find(const std::string & name) const;
+            void start();
+            void stop();
+            void finished(const std::string & name);
+        private:
+            void report(const SampleProgress & sample, const SampleProgress::Snapshot & s, double interval);
+            void run();
+            ProgressOptions options;
+            std::map<std::string, std::shared_ptr<SampleProgress>> samples;
+            std::map<std::string, std::pair<SampleProgress::Snapshot, std::chrono::steady_clock::time_point>> last;
+            std::ofstream metrics;
+            std::thread thread;
+            std::mutex mutex;
+            std::condition_variable cv;
+            bool stopping = false;
+    };
+
+    /**
+     * @brief Constructor for the ProgressMonitor class.
+     * @param options The configuration of the progress reporting.
+     * @return A new instance of the ProgressMonitor class.
+     * @throw std::runtime_error if the metrics stream cannot be opened.
+     */
+    ProgressMonitor::ProgressMonitor(const ProgressOptions & options)
+        : options(options)
+    {
+        if(!options.metrics.empty())
+        {
+            metrics.open(options.metrics, std::ios::app);
+            if(!metrics)
+                throw std::runtime_error("Could not open progress metrics output " + options.metrics + ".");
+        }
+    }
+
+    /**
+     * @brief Destructor for the ProgressMonitor class.
+     * @details The reporting thread is stopped if it is still running.
+     */
+    ProgressMonitor::~ProgressMonitor()
+    {
+        stop();
+    }
+
+    /**
+     * @brief Create the progress of a sample.
+     * @param name The name of the sample.
+     * @return The progress of the sample.
+     */
+    std::shared_ptr<SampleProgress> ProgressMonitor::sample(const std::string & name)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto & progress = samples[name];
+        if(!progress)
+            progress = std::make_shared<SampleProgress>(name, options.sampling);
+        return progress;
+    }
+
+    /**
+     * @brief Find the progress of a sample.
+     * @param name The name of the sample.
+     * @return The progress of the sample, or nullptr if the sample is not
+     * monitored.
+     */
+    std::shared_ptr<SampleProgress> ProgressMonitor::find(const std::string & name) const
+    {
+        auto it = samples.find(name);
+        return (it == samples.end()) ? nullptr : it->second;
+    }
+
+    /**
+     * @brief Start the reporting thread.
+     * @return void
+     */
+    void ProgressMonitor::start()
+    {
+        if(options.interval <= 0 || thread.joinable())
+            return;
+        stopping = false;
+        thread = std::thread(&ProgressMonitor::run, this);
+    }
+
+    /**
+     * @brief Stop the reporting thread.
+     * @return void
+     */
+    void ProgressMonitor::stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_all();
+        if(thread.joinable())
+            thread.join();
+    }
+
+    /**
+     * @brief Emit the final report of a sample.
+     * @param name The name of the sample.
+     * @return void
+     */
+    void ProgressMonitor::finished(const std::string & name)
+    {
+        std::shared_ptr<SampleProgress> progress = find(name);
+        if(!progress || options.interval <= 0)
+            return;
+        progress->finish();
+        std::lock_guard<std::mutex> lock(mutex);
+        SampleProgress::Snapshot s = progress->snapshot();
+        last[name] = {SampleProgress::Snapshot(), std::chrono::steady_clock::now()};
+        report(*progress, s, s.elapsed);
+    }
+
+    /**
+     * @brief Report the progress of a single sample.
+     * @details The rates are computed over the last interval (or over the
+     * full sample for the final report). Must be called with the mutex held.
+     * @param sample The sample.
+     * @param s The snapshot of the counters.
+     * @param interval The duration of the interval (s).
+     * @return void
+     */
+    void ProgressMonitor::report(const SampleProgress & sample, const SampleProgress::Snapshot & s, double interval)
+    {
+        const SampleProgress::Snapshot & p = last[sample.name()].first;
+        double dt = std::max(interval, 1e-9);
+        double records = (s.records - p.records) / dt;
+        double interactions = (s.interactions - p.interactions) / dt;
+        double bytes = (s.bytes - p.bytes) / dt;
+        double loop = s.loop - p.loop;
+        double compute = (loop > 0) ? std::min(1.0, (s.compute - p.compute) / loop) : 0.0;
+        const char * state = (s.state == 2) ? "done" : "running";
+
+        std::ostringstream line;
+        line << std::fixed << std::setprecision(1)
+             << "[progress] " << sample.name() << " (" << state << ", " << s.elapsed << " s): "
+             << s.records << " records (" << records << "/s), "
+             << s.interactions << " interactions (" << interactions << "/s), "
+             << s.bytes / 1e6 << " MB read (" << bytes / 1e6 << " MB/s), "
+             << "I/O " << 100 * (1 - compute) << "% / compute " << 100 * compute << "%, "
+             << s.files << " files done";
+        if(!s.file.empty())
+            line << ", reading " << s.file;
+        std::cout << line.str() << std::endl;
+
+        if(metrics.is_open())
+        {
+            auto quote = [](const std::string & str) {
+                std::string q("\"");
+                for(char c : str)
+                {
+                    if(c == '"' || c == '\\') q += '\\';
+                    q += c;
+                }
+                return q + "\"";
+            };
+            double time = std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+            metrics << std::fixed << std::setprecision(3)
+                    << "{\"time\": " << time
+                    << ", \"sample\": " << quote(sample.name())
+                    << ", \"state\": " << quote(state)
+                    << ", \"elapsed\": " << s.elapsed
+                    << ", \"records\": " << s.records
+                    << ", \"records_per_s\": " << records
+                    << ", \"interactions\": " << s.interactions
+                    << ", \"interactions_per_s\": " << interactions
+                    << ", \"bytes_read\": " << s.bytes
+                    << ", \"bytes_per_s\": " << bytes
+                    << ", \"io_fraction\": " << 1 - compute
+                    << ", \"compute_fraction\": " << compute
+                    << ", \"files_done\": " << s.files
+                    << ", \"file\": " << quote(s.file) << "}" << std::endl;
+        }
+        last[sample.name()] = {s, std::chrono::steady_clock::now()};
+    }
+
+    /**
+     * @brief The loop of the reporting thread.
+     * @return void
+     */
+    void ProgressMonitor::run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto interval = std::chrono::duration<double>(options.interval);
+        while(!cv.wait_for(lock, interval, [this]() { return stopping; }))
+        {
+            auto now = std::chrono::steady_clock::now();
+            for(const auto & [name, progress] : samples)
+            {
+                SampleProgress::Snapshot s = progress->snapshot();
+                if(s.state != 1)
+                    continue;
+                auto it = last.find(name);
+                double dt = (it == last.end()) ? s.elapsed : std::chrono::duration<double>(now - it->second.second).count();
+                report(*progress, s, dt);
+            }
+        }
+    }
+}
+#endif // PROGRESS_H
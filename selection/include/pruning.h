@@ -0,0 +1,288 @@
+/**
+ * @file pruning.h
+ * @brief Header file for the pruning of the StandardRecord branches that are
+ * read from the input files.
+ * @details By default, every branch of the StandardRecord is available to the
+ * configured functions, even though a typical configuration only reads the
+ * interactions ("dlp" and "dlp_true"), the header ("hdr"), and occasionally
+ * the neutrino truth ("mc"). The branches read by the configured functions
+ * are collected from the compiled selection plan, and all other branches are
+ * disabled on the input trees. Disabled branches are neither decompressed
+ * nor (for remote files) transferred. The same branches are the (only)
+ * branches of the TTreeCache if the I/O is tuned (see @ref tune_tree).
+ * @author mueller@fnal.gov
+ */
+#ifndef PRUNING_H
+#define PRUNING_H
+#include <set>
+#include <vector>
+#include <string>
+#include <optional>
+#include <algorithm>
+#include <iostream>
+
+#include "sbnana/CAFAna/Core/SpectrumLoader.h"
+#include "TFile.h"
+#include "TTree.h"
+
+#include "framework.h"
+#include "plan.h"
+#include "progress.h"
+#include "loader.h"
+#include "io.h"
+
+/**
+ * @namespace ana
+ * @brief Namespace for the Analysis class and related functions.
+ * @details The ana namespace contains the Analysis class, which is designed
+ * to streamline the running of multiple samples through CAFAna. The namespace
+ * is also used to organize analysis-related functions and variables within
+ * CAFAna.
+ */
+namespace ana
+{
+    /**
+     * @brief Collect the StandardRecord branches read by the trees of a
+     * sample.
+     * @details The header is always read (e.g., for the exposure and the
+     * identity of the record), as is the number of reco interactions (for
+     * the progress monitor, see @ref SampleProgress). The interaction loops read both interaction
+     * branches, from which all cuts, variables, and selectors on interactions
+     * and particles take their object. Neutrino truth variables read the
+     * "mc" branch, which is never read for data. Functions of the event scope
+     * may read any branch, so they must declare their branches with the
+     * @ref REGISTER_BRANCHES macro. Simulation-only trees are ignored for
+     * data.
+     * @param plan The compiled selection plan.
+     * @param ismc Whether the sample is a simulation sample.
+     * @return The branches read by the trees of the sample, or no value if
+     * an event function does not declare its branches (i.e., no branch can
+     * safely be disabled).
+     */
+    std::optional<std::set<std::string>> required_branches(const SelectionPlan & plan, bool ismc)
+    {
+        std::set<std::string> branches{"hdr", "ndlp"};
+        std::vector<std::string> undeclared;
+
+        // Add the declared branches of an event function.
+        auto declare = [&](const std::string & name)
+        {
+            if(BranchRegistry::instance().is_registered(name))
+            {
+                for(const std::string & branch : BranchRegistry::instance().get(name))
+                    branches.insert(branch);
+            }
+            else
+                undeclared.push_back(name);
+        };
+
+        for(const TreePlan & tree : plan.trees())
+        {
+            if(tree.sim_only && !ismc)
+                continue;
+            if(tree.mode != Mode::Event)
+                branches.insert({"dlp", "dlp_true"});
+
+            for(const CutSpec & cut : tree.cut_specs)
+            {
+                if(cut.type == "event")
+                    declare("event_" + cut.name);
+                else if(cut.type != "spill")
+                    branches.insert({"dlp", "dlp_true"});
+            }
+            for(const BranchPlan & branch : tree.branches)
+            {
+                if(branch.type == "event")
+                    declare("event_" + branch.var.get_string_field("name"));
+                else if(branch.type == "mctruth")
+                    branches.insert("mc");
+            }
+        }
+
+        if(!undeclared.empty())
+        {
+            std::cout << "Branch pruning is disabled: the following event functions do not declare their branches:";
+            for(const std::string & name : undeclared)
+                std::cout << " " << name;
+            std::cout << std::endl;
+            return std::nullopt;
+        }
+        if(!ismc)
+            branches.erase("mc");
+        return branches;
+    }
+
+    /**
+     * @brief Disable all branches of a StandardRecord tree except the
+     * listed ones.
+     * @details A listed branch is enabled together with all of its
+     * sub-branches and, for vector branches, the "n<branch>" size branch.
+     * Listed branches which are not present in the tree are ignored.
+     * @param tree The StandardRecord tree ("recTree").
+     * @param branches The top-level branches of the StandardRecord to keep.
+     * @return void
+     */
+    void prune_branches(TTree * tree, const std::set<std::string> & branches)
+    {
+        tree->SetBranchStatus("*", 0);
+        for(const std::string & branch : branches)
+        {
+            std::string name = "rec." + branch;
+            if(tree->GetBranch(name.c_str()))
+                tree->SetBranchStatus((name + "*").c_str(), 1);
+            std::string count = "rec.n" + branch;
+            if(tree->GetBranch(count.c_str()))
+                tree->SetBranchStatus(count.c_str(), 1);
+        }
+    }
+
+    /**
+     * @class PrunedSpectrumLoader
+     * @brief A SpectrumLoader which only reads a subset of the StandardRecord
+     * branches.
+     * @details The branches of the StandardRecord tree of each input file are
+     * pruned (see @ref prune_branches) and its TTreeCache is tuned (see
+     * @ref tune_tree) before the file is handled by the SpectrumLoader. The
+     * tree is owned by the file, so the SpectrumLoader retrieves the same
+     * (pruned) tree. If configured, the next input file is opened in the
+     * background (see @ref prefetch_next). Each record is signalled to the
+     * framework (see @ref RecordSpectrumLoader).
+     */
+    class PrunedSpectrumLoader : public RecordSpectrumLoader
+    {
+        public:
+            PrunedSpectrumLoader(const std::string & wildcard, const std::optional<std::set<std::string>> & branches, const IOOptions & io = {});
+            PrunedSpectrumLoader(const std::vector<std::string> & files, const std::optional<std::set<std::string>> & branches, const IOOptions & io = {});
+            ~PrunedSpectrumLoader();
+        protected:
+            void HandleFile(TFile * f, Progress * prog = 0) override;
+        private:
+            std::vector<std::string> files;
+            std::optional<std::set<std::string>> branches;
+            IOOptions io;
+            size_t next_file = 0;
+            PrefetchedFile prefetched;
+    };
+
+    /**
+     * @brief Constructor for the PrunedSpectrumLoader class.
+     * @details The next input file is not prefetched for a wildcard, so the
+     * wildcards of the samples are expanded into a list of files when the
+     * prefetching is enabled (see @ref expand_paths).
+     * @param wildcard The path (or wildcard) of the input files.
+     * @param branches The top-level branches of the StandardRecord to read
+     * (all branches if empty).
+     * @param io The configuration of the I/O tuning.
+     * @return A new instance of the PrunedSpectrumLoader class.
+     */
+    PrunedSpectrumLoader::PrunedSpectrumLoader(const std::string & wildcard, const std::optional<std::set<std::string>> & branches, const IOOptions & io)
+        : RecordSpectrumLoader(wildcard), branches(branches), io(io) {}
+
+    /**
+     * @brief Constructor for the PrunedSpectrumLoader class.
+     * @param files The paths of the input files.
+     * @param branches The top-level branches of the StandardRecord to read
+     * (all branches if empty).
+     * @param io The configuration of the I/O tuning.
+     * @return A new instance of the PrunedSpectrumLoader class.
+     */
+    PrunedSpectrumLoader::PrunedSpectrumLoader(const std::vector<std::string> & files, const std::optional<std::set<std::string>> & branches, const IOOptions & io)
+        : RecordSpectrumLoader(files), files(files), branches(branches), io(io) {}
+
+    /**
+     * @brief Destructor for the PrunedSpectrumLoader class.
+     * @details A file which is still being opened in the background is
+     * released (see @ref release_prefetch).
+     */
+    PrunedSpectrumLoader::~PrunedSpectrumLoader()
+    {
+        release_prefetch(prefetched);
+    }
+
+    /**
+     * @brief Prune and tune the StandardRecord tree of an input file and
+     * handle the file.
+     * @details The input file is located in the list of files by its name,
+     * falling back to the position following the previous input file (the
+     * name of an opened file may differ from its URL). The file following it
+     * is then opened in the background, and the previous background open
+     * (which is consumed by the open of the input file) is released.
+     * @param f The input file.
+     * @param prog The progress indicator of the SpectrumLoader.
+     * @return void
+     */
+    void PrunedSpectrumLoader::HandleFile(TFile * f, Progress * prog)
+    {
+        TTree * tree = f->Get<TTree>("recTree");
+        if(tree && branches)
+            prune_branches(tree, *branches);
+        if(tree && io.enabled())
+            tune_tree(tree, io, branches);
+        if(io.prefetch)
+        {
+            auto it = std::find(files.begin() + std::min(next_file, files.size()), files.end(), f->GetName());
+            size_t current = (it != files.end()) ? (size_t)(it - files.begin()) : next_file;
+            next_file = current + 1;
+            release_prefetch(prefetched);
+            prefetched = prefetch_next(files, current);
+        }
+        RecordSpectrumLoader::HandleFile(f, prog);
+    }
+
+    /**
+     * @class MonitoredSpectrumLoader
+     * @brief A SpectrumLoader which reports the input file being read to the
+     * progress of its sample.
+     * @details The StandardRecord branches may also be pruned and the I/O
+     * tuned, as in the @ref PrunedSpectrumLoader.
+     */
+    class MonitoredSpectrumLoader : public PrunedSpectrumLoader
+    {
+        public:
+            MonitoredSpectrumLoader(const std::string & wildcard, const std::optional<std::set<std::string>> & branches, std::shared_ptr<SampleProgress> progress, const IOOptions & io = {});
+            MonitoredSpectrumLoader(const std::vector<std::string> & files, const std::optional<std::set<std::string>> & branches, std::shared_ptr<SampleProgress> progress, const IOOptions & io = {});
+        protected:
+            void HandleFile(TFile * f, Progress * prog = 0) override;
+        private:
+            std::shared_ptr<SampleProgress> progress;
+    };
+
+    /**
+     * @brief Constructor for the MonitoredSpectrumLoader class.
+     * @param wildcard The path (or wildcard) of the input files.
+     * @param branches The top-level branches of the StandardRecord to read
+     * (all branches if empty).
+     * @param progress The progress of the sample.
+     * @param io The configuration of the I/O tuning.
+     * @return A new instance of the MonitoredSpectrumLoader class.
+     */
+    MonitoredSpectrumLoader::MonitoredSpectrumLoader(const std::string & wildcard, const std::optional<std::set<std::string>> & branches, std::shared_ptr<SampleProgress> progress, const IOOptions & io)
+        : PrunedSpectrumLoader(wildcard, branches, io), progress(progress) {}
+
+    /**
+     * @brief Constructor for the MonitoredSpectrumLoader class.
+     * @param files The paths of the input files.
+     * @param branches The top-level branches of the StandardRecord to read
+     * (all branches if empty).
+     * @param progress The progress of the sample.
+     * @param io The configuration of the I/O tuning.
+     * @return A new instance of the MonitoredSpectrumLoader class.
+     */
+    MonitoredSpectrumLoader::MonitoredSpectrumLoader(const std::vector<std::string> & files, const std::optional<std::set<std::string>> & branches, std::shared_ptr<SampleProgress> progress, const IOOptions & io)
+        : PrunedSpectrumLoader(files, branches, io), progress(progress) {}
+
+    /**
+     * @brief Handle an input file, reporting it to the progress of the
+     * sample.
+     * @param f The input file.
+     * @param prog The progress indicator of the SpectrumLoader.
+     * @return void
+     */
+    void MonitoredSpectrumLoader::HandleFile(TFile * f, Progress * prog)
+    {
+        progress->open_file(f);
+        PrunedSpectrumLoader::HandleFile(f, prog);
+        progress->close_file();
+    }
+}
+#endif // PRUNING_H
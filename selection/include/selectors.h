@@ -63,7 +63,8 @@ namespace selectors
      * @details The longest track is defined as the track with the longest
      * length, which is calculated upstream in SPINE. The particle instance is
      * required to have a semantic type of 1 (track) and have a start point
-     * within 6 cm of the interaction vertex.
+     * within 6 cm of the interaction vertex. The distances to the vertex are
+     * taken from the geometry of the interaction (see @ref GeometryCache).
      * @tparam T the type of interaction (true or reco).
      * @param obj the interaction to operate on.
      * @return the index of the longest track.
@@ -73,16 +74,13 @@ namespace selectors
     {
         double longest_length(0);
         size_t index(kNoMatch);
+        const ParticleGeometry & geometry = GeometryCache<T>::instance().get(obj);
         for(size_t i(0); i < obj.particles.size(); ++i)
         {
             const auto & p = obj.particles[i];
 
             // Distance between interaction vertex and particle start.
-            double vertex_distance = std::sqrt(
-                std::pow(pvars::start_x(p) - obj.vertex[0], 2) +
-                std::pow(pvars::start_y(p) - obj.vertex[1], 2) +
-                std::pow(pvars::start_z(p) - obj.vertex[2], 2)
-            );
+            double vertex_distance = geometry.vertex_distance[i];
 
             // Skip particles that are not tracks or are too far from the
             // interaction vertex.
@@ -106,7 +104,9 @@ namespace selectors
      * @details The second longest track is defined as the track with the
      * second longest length, which is calculated upstream in SPINE. The
      * particle instance is required to have a semantic type of 1 (track) and
-     * have a start point within 6 cm of the interaction vertex.
+     * have a start point within 6 cm of the interaction vertex. The distances
+     * to the vertex are taken from the geometry of the interaction (see
+     * @ref GeometryCache).
      * @tparam T the type of interaction (true or reco).
      * @param obj the interaction to operate on.
      * @return the index of the second longest track.
@@ -117,16 +117,13 @@ namespace selectors
         double longest_length(0);
         double second_longest_length(0);
         size_t index(kNoMatch), second_index(kNoMatch);
+        const ParticleGeometry & geometry = GeometryCache<T>::instance().get(obj);
         for(size_t i(0); i < obj.particles.size(); ++i)
         {
             const auto & p = obj.particles[i];
 
             // Distance between interaction vertex and particle start.
-            double vertex_distance = std::sqrt(
-                std::pow(pvars::start_x(p) - obj.vertex[0], 2) +
-                std::pow(pvars::start_y(p) - obj.vertex[1], 2) +
-                std::pow(pvars::start_z(p) - obj.vertex[2], 2)
-            );
+            double vertex_distance = geometry.vertex_distance[i];
 
             // Skip particles that are not tracks or are too far from the
             // interaction vertex.
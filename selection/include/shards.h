@@ -0,0 +1,314 @@
+/**
+ * @file shards.h
+ * @brief Header file for the sharded (file-level) execution of the analysis.
+ * @details A single large sample (e.g., thousands of CAF files behind one
+ * glob or list) can be split into a number of shards, each of which processes
+ * a deterministic subset of the input files. The shards can be run as
+ * independent jobs (e.g., on a grid job array), and their outputs are then
+ * combined by the merge step, which produces the same layout as a
+ * single-process run of the full sample.
+ * @author mueller@fnal.gov
+ */
+#ifndef SHARDS_H
+#define SHARDS_H
+#include <map>
+#include <set>
+#include <vector>
+#include <string>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+#include <iostream>
+#include <glob.h>
+
+#include "TFile.h"
+#include "TTree.h"
+#include "TKey.h"
+#include "TDirectory.h"
+#include "TFileMerger.h"
+
+/**
+ * @namespace ana
+ * @brief Namespace for the Analysis class and related functions.
+ * @details The ana namespace contains the Analysis class, which is designed
+ * to streamline the running of multiple samples through CAFAna. The namespace
+ * is also used to organize analysis-related functions and variables within
+ * CAFAna.
+ */
+namespace ana
+{
+    /**
+     * @struct ShardSpec
+     * @brief Struct to store the shard that the current process runs.
+     * @details A shard is identified by its index and the total number of
+     * shards. The default (index 0 of 1 shard) processes all input files.
+     */
+    struct ShardSpec
+    {
+        size_t index = 0;
+        size_t count = 1;
+
+        /**
+         * @brief Check if the process runs a proper subset of the files.
+         * @return True if the input files are split across more than one
+         * shard.
+         */
+        bool enabled() const { return count > 1; }
+
+        /**
+         * @brief Get the suffix identifying the shard in output file names.
+         * @return The suffix "_shard<index>of<count>".
+         */
+        std::string suffix() const { return "_shard" + std::to_string(index) + "of" + std::to_string(count); }
+    };
+
+    /**
+     * @brief Parse a shard specification of the form "i/N".
+     * @details The index is zero-based, i.e., the valid shards of a job split
+     * into N shards are 0/N through (N-1)/N.
+     * @param spec The shard specification.
+     * @return The parsed shard specification.
+     * @throw std::runtime_error if the specification is malformed.
+     */
+    ShardSpec parse_shard(const std::string & spec)
+    {
+        size_t pos = spec.find('/');
+        ShardSpec shard;
+        try
+        {
+            if(pos == std::string::npos)
+                throw std::invalid_argument(spec);
+            size_t end_index, end_count;
+            shard.index = std::stoul(spec.substr(0, pos), &end_index);
+            shard.count = std::stoul(spec.substr(pos + 1), &end_count);
+            if(end_index != pos || end_count != spec.size() - pos - 1)
+                throw std::invalid_argument(spec);
+        }
+        catch(const std::logic_error &)
+        {
+            throw std::runtime_error("Malformed shard specification '" + spec + "' (expected 'i/N').");
+        }
+        if(shard.count == 0 || shard.index >= shard.count)
+            throw std::runtime_error("Invalid shard specification '" + spec + "' (expected 0 <= i < N).");
+        return shard;
+    }
+
+    /**
+     * @brief Expand the configured paths of a sample into a list of files.
+     * @details Glob patterns are resolved against the local filesystem (in
+     * the sorted order of glob), and paths which match no local files (e.g.,
+     * XRootD URLs) are kept as-is. The order of the configured paths is
+     * preserved.
+     * @param paths The configured paths of the sample.
+     * @return The input files of the sample.
+     */
+    std::vector<std::string> expand_paths(const std::vector<std::string> & paths)
+    {
+        std::vector<std::string> files;
+        for(const std::string & path : paths)
+        {
+            glob_t matches;
+            if(glob(path.c_str(), 0, nullptr, &matches) == 0)
+            {
+                for(size_t i = 0; i < matches.gl_pathc; ++i)
+                    files.push_back(matches.gl_pathv[i]);
+            }
+            else
+                files.push_back(path);
+            globfree(&matches);
+        }
+        return files;
+    }
+
+    /**
+     * @brief Select the subset of the input files processed by a shard.
+     * @details The configured paths are expanded (see @ref expand_paths) and
+     * sorted, so that the list of files is independent of the order in which
+     * the filesystem returns them. The files are then assigned to the shards
+     * in a round-robin fashion, which balances the number of files per shard.
+     * @param paths The configured paths of the sample.
+     * @param shard The shard to select the files for.
+     * @return The files processed by the shard, which may be empty if there
+     * are fewer files than shards.
+     */
+    std::vector<std::string> shard_files(const std::vector<std::string> & paths, const ShardSpec & shard)
+    {
+        std::vector<std::string> files = expand_paths(paths);
+        std::sort(files.begin(), files.end());
+        files.erase(std::unique(files.begin(), files.end()), files.end());
+
+        std::vector<std::string> selected;
+        for(size_t i = shard.index; i < files.size(); i += shard.count)
+            selected.push_back(files[i]);
+        return selected;
+    }
+
+    /**
+     * @brief Sum the concatenated entries of a merged cutflow TTree.
+     * @details The merge of the TTrees concatenates the cutflow of each
+     * input, i.e., it holds one entry per stage (and category) for each
+     * input. The counts (and exposure) of the entries of the same stage (and
+     * category) are summed, and the TTree is replaced by a TTree with the
+     * layout written by @ref Cutflow::write (one entry per stage, by
+     * category for the "<tree>_cutflow_category" TTree).
+     * @param dir The directory of the cutflow TTree.
+     * @param name The name of the cutflow TTree.
+     * @param categorized Whether the cutflow TTree is broken down by
+     * category.
+     * @return void
+     * @throw std::runtime_error if the inputs disagree on the cut of a
+     * stage.
+     */
+    void sum_cutflow(TDirectory * dir, const std::string & name, bool categorized)
+    {
+        struct Row
+        {
+            std::string cut;
+            double events = 0, interactions = 0, particles = 0, exposure = 0;
+        };
+        std::map<std::pair<Long64_t, int>, Row> rows;
+
+        TTree * tree = dir->Get<TTree>(name.c_str());
+        if(!tree)
+            return;
+        int stage;
+        std::string * cut = nullptr;
+        Long64_t category(0);
+        double events, interactions, particles, exposure(0);
+        tree->SetBranchAddress("stage", &stage);
+        tree->SetBranchAddress("cut", &cut);
+        tree->SetBranchAddress("events", &events);
+        tree->SetBranchAddress("interactions", &interactions);
+        tree->SetBranchAddress("particles", &particles);
+        if(categorized)
+            tree->SetBranchAddress("category", &category);
+        else
+            tree->SetBranchAddress("exposure", &exposure);
+        for(Long64_t i = 0; i < tree->GetEntries(); ++i)
+        {
+            tree->GetEntry(i);
+            auto [it, inserted] = rows.try_emplace(std::make_pair(category, stage));
+            Row & row = it->second;
+            if(inserted)
+                row.cut = *cut;
+            else if(row.cut != *cut)
+                throw std::runtime_error("Inconsistent cutflow " + name + " (stage " + std::to_string(stage) + " is cut '" + row.cut + "' and '" + *cut + "').");
+            row.events += events;
+            row.interactions += interactions;
+            row.particles += particles;
+            row.exposure += exposure;
+        }
+        delete tree;
+        delete cut;
+        dir->Delete((name + ";*").c_str());
+
+        dir->cd();
+        std::string scut;
+        TTree * summed = new TTree(name.c_str(), name.c_str());
+        summed->Branch("stage", &stage);
+        summed->Branch("cut", &scut);
+        if(categorized)
+            summed->Branch("category", &category);
+        summed->Branch("events", &events);
+        summed->Branch("interactions", &interactions);
+        summed->Branch("particles", &particles);
+        if(!categorized)
+            summed->Branch("exposure", &exposure);
+        for(const auto & [key, row] : rows)
+        {
+            category = key.first;
+            stage = key.second;
+            scut = row.cut;
+            events = row.events;
+            interactions = row.interactions;
+            particles = row.particles;
+            exposure = row.exposure;
+            summed->Fill();
+        }
+        summed->Write();
+        delete summed;
+    }
+
+    /**
+     * @brief Sum the merged cutflow TTrees of a directory (recursively).
+     * @details The cutflow TTrees are identified by their "_cutflow" and
+     * "_cutflow_category" suffixes (see @ref sum_cutflow).
+     * @param dir The directory of the merged output.
+     * @return void
+     * @throw std::runtime_error if the inputs disagree on the cut of a
+     * stage.
+     */
+    void sum_cutflows(TDirectory * dir)
+    {
+        auto ends_with = [](const std::string & s, const std::string & suffix)
+        {
+            return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+        };
+
+        // Collect the names first, as the cutflows are replaced in place.
+        std::set<std::string> subdirs, cutflows;
+        TIter next(dir->GetListOfKeys());
+        while(TKey * key = (TKey *)next())
+        {
+            std::string cls(key->GetClassName()), name(key->GetName());
+            if(cls == "TDirectoryFile" || cls == "TDirectory")
+                subdirs.insert(name);
+            else if(cls == "TTree" && (ends_with(name, "_cutflow") || ends_with(name, "_cutflow_category")))
+                cutflows.insert(name);
+        }
+        for(const std::string & name : cutflows)
+            sum_cutflow(dir, name, ends_with(name, "_cutflow_category"));
+        for(const std::string & name : subdirs)
+            sum_cutflows(dir->GetDirectory(name.c_str()));
+    }
+
+    /**
+     * @brief Sum the merged cutflow TTrees of an output file.
+     * @param path The path of the merged output file.
+     * @return void
+     * @throw std::runtime_error if the file cannot be opened or the inputs
+     * disagree on the cut of a stage.
+     */
+    void sum_cutflows(const std::string & path)
+    {
+        TFile * f = TFile::Open(path.c_str(), "UPDATE");
+        if(!f || f->IsZombie())
+            throw std::runtime_error("Could not reopen merged output file " + path + ".");
+        sum_cutflows(f);
+        f->Close();
+        delete f;
+    }
+
+    /**
+     * @brief Merge the outputs of the shards into a single output file.
+     * @details The TTrees of each shard (including the exposure trees) are
+     * concatenated and written to the output file under the same directory
+     * structure ("events/<sample>/<tree>") as a single-process run. Histograms
+     * are summed, and the concatenated cutflow TTrees are summed per stage
+     * (and category) afterwards (see @ref sum_cutflows).
+     * @param output The path of the merged output file.
+     * @param inputs The paths of the shard output files.
+     * @return void
+     * @throw std::runtime_error if an input cannot be opened or the merge
+     * fails.
+     */
+    void merge_shards(const std::string & output, const std::vector<std::string> & inputs)
+    {
+        if(inputs.empty())
+            throw std::runtime_error("No shard outputs to merge into " + output + ".");
+
+        TFileMerger merger(false);
+        if(!merger.OutputFile(output.c_str(), "RECREATE"))
+            throw std::runtime_error("Could not create merged output file " + output + ".");
+        for(const std::string & input : inputs)
+        {
+            if(!merger.AddFile(input.c_str(), false))
+                throw std::runtime_error("Could not open shard output " + input + ".");
+        }
+        std::cout << "Merging " << inputs.size() << " shard outputs into " << output << "." << std::endl;
+        if(!merger.Merge())
+            throw std::runtime_error("Failed to merge shard outputs into " + output + ".");
+        sum_cutflows(output);
+    }
+}
+#endif // SHARDS_H
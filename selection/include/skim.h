@@ -0,0 +1,836 @@
+/**
+ * @file skim.h
+ * @brief Header file for the skim mode of the analysis.
+ * @details Most records fail the early, stable cuts of a selection (e.g.,
+ * spill quality, trigger window, or a loose fiducial cut). In the skim mode,
+ * the cuts of the [skim] block are applied to each input file, and only the
+ * passing StandardRecords are written to a new CAF file with the same layout
+ * (structured or flat) as the input. The exposure is preserved: the exposure histograms and
+ * auxiliary trees of the input are copied as-is, and failing records which
+ * carry exposure (the first record of each subrun, and data records with
+ * spill or offbeam information) are kept with their interactions removed.
+ * Later iterations on the selection can then run over the (much smaller)
+ * skimmed files, provided their trees apply (at least) the cuts of the skim.
+ * @author mueller@fnal.gov
+ */
+#ifndef SKIM_H
+#define SKIM_H
+#include <map>
+#include <set>
+#include <vector>
+#include <string>
+#include <memory>
+#include <iostream>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include <filesystem>
+
+#include "sbnana/CAFAna/Core/SpectrumLoader.h"
+#include "sbnanaobj/StandardRecord/Proxy/SRProxy.h"
+#include "sbnanaobj/StandardRecord/StandardRecord.h"
+#include "TFile.h"
+#include "TTree.h"
+#include "TLeaf.h"
+#include "TLeafC.h"
+#include "TKey.h"
+
+#include "configuration.h"
+#include "framework.h"
+#include "loader.h"
+
+/**
+ * @namespace ana
+ * @brief Namespace for the Analysis class and related functions.
+ * @details The ana namespace contains the Analysis class, which is designed
+ * to streamline the running of multiple samples through CAFAna. The namespace
+ * is also used to organize analysis-related functions and variables within
+ * CAFAna.
+ */
+namespace ana
+{
+    /**
+     * @brief The configuration of the skim.
+     */
+    struct SkimOptions
+    {
+        std::string output;              ///< The output directory of the skimmed files.
+        Mode mode = Mode::Reco;          ///< The mode of the interaction loop.
+        std::vector<CutSpec> cuts;       ///< The parsed cuts of the skim.
+        bool drop_interactions = false;  ///< Whether to drop the failing interactions.
+    };
+
+    /**
+     * @brief The result of the skim for a single record (entry) of an input
+     * file.
+     */
+    struct SkimRecord
+    {
+        int64_t run = 0;                  ///< The run number of the record.
+        int64_t subrun = 0;               ///< The subrun number of the record.
+        int64_t event = 0;                ///< The event number of the record.
+        bool passed = false;              ///< Whether the record passed the skim.
+        bool exposure = false;            ///< Whether the record carries exposure.
+        std::vector<size_t> interactions; ///< The positions of the passing interactions.
+    };
+
+    /**
+     * @brief Parse the [skim] block of the configuration.
+     * @details The [skim] block has the fields:
+     *        - output:            string (output directory)
+     *        - mode:              string ("true", "reco", or "event";
+     *                             default "reco")
+     *        - drop_interactions: bool (default false)
+     *        - cut:               array of [[skim.cut]] subtables, in the
+     *                             same format as [[tree.cut]]
+     * @param config The configuration of the analysis.
+     * @return The configuration of the skim.
+     * @throw cfg::ConfigurationError if the block is missing or invalid, or
+     * if a cut is not registered.
+     */
+    SkimOptions parse_skim(const cfg::ConfigurationTable & config)
+    {
+        if(!config.has_field("skim"))
+            throw cfg::ConfigurationError("The skim mode requires a [skim] block.");
+
+        SkimOptions options;
+        options.output = config.get_string_field("skim.output");
+        options.drop_interactions = config.get_bool_field("skim.drop_interactions", false);
+        try
+        {
+            options.mode = parse_mode(config.get_string_field("skim.mode", "reco"));
+            if(config.has_field("skim.cut"))
+                options.cuts = parse_cuts(config.get_subtables("skim.cut"));
+        }
+        catch(const std::runtime_error & e)
+        {
+            throw cfg::ConfigurationError(std::string("Invalid [skim] block: ") + e.what());
+        }
+        for(const CutSpec & cut : options.cuts)
+        {
+            if(!is_registered(cut))
+                throw cfg::ConfigurationError("Invalid [skim] block: Cut " + cut.type + "_" + cut.name + " is not registered.");
+        }
+        return options;
+    }
+
+    /**
+     * @brief Check if a failing record must be kept for its exposure.
+     * @details The exposure of MC is stored on the first record of each
+     * subrun, and the exposure of data on each record (the spills and offbeam
+     * triggers since the previous record).
+     * @tparam T The type of the record (the StandardRecord or its proxy).
+     * @param rec The record.
+     * @return True if the record carries exposure.
+     */
+    template<typename T>
+    bool carries_exposure(const T & rec)
+    {
+        return rec.hdr.first_in_subrun || rec.hdr.bnbinfo.size() > 0 || rec.hdr.numiinfo.size() > 0
+               || rec.hdr.noffbeambnb > 0 || rec.hdr.noffbeamnumi > 0;
+    }
+
+    /**
+     * @brief Keep only the listed interactions of a collection and update
+     * the matches of the other collection.
+     * @details The interaction matches are positional, so the kept
+     * interactions are renumbered (along with the interaction id of their
+     * particles) and the match ids of the other collection are remapped (or
+     * removed, along with their overlaps, if the match was dropped). The
+     * particle matches are resolved by particle id, which is unchanged.
+     * @tparam T The type of the interactions to prune.
+     * @tparam U The type of the interactions matched to @p interactions.
+     * @param interactions The interactions to prune.
+     * @param matched The interactions matched to @p interactions.
+     * @param keep The (sorted) positions of the interactions to keep.
+     * @return void
+     */
+    template<typename T, typename U>
+    void keep_interactions(std::vector<T> & interactions, std::vector<U> & matched, const std::vector<size_t> & keep)
+    {
+        std::map<int64_t, int64_t> remap;
+        std::vector<T> kept;
+        kept.reserve(keep.size());
+        for(size_t index : keep)
+        {
+            remap[index] = kept.size();
+            kept.push_back(interactions[index]);
+            kept.back().id = remap[index];
+            for(auto & p : kept.back().particles)
+                p.interaction_id = remap[index];
+        }
+        interactions.swap(kept);
+
+        for(U & m : matched)
+        {
+            bool overlaps = m.match_overlaps.size() == m.match_ids.size();
+            size_t n(0);
+            for(size_t k(0); k < m.match_ids.size(); ++k)
+            {
+                auto it = remap.find(m.match_ids[k]);
+                if(it == remap.end())
+                    continue;
+                m.match_ids[n] = it->second;
+                if(overlaps)
+                    m.match_overlaps[n] = m.match_overlaps[k];
+                ++n;
+            }
+            m.match_ids.resize(n);
+            if(overlaps)
+                m.match_overlaps.resize(n);
+        }
+    }
+
+    /**
+     * @class FlatRecordEditor
+     * @brief Class removing rows of the vectors of the current entry of a
+     * flat CAF tree.
+     * @details In the flat CAF format, each vector of the StandardRecord
+     * ("<path>", e.g. "rec.dlp") is stored as one array leaf per field
+     * ("<path>.<field>", or "<path>" for a vector of a primitive type) with
+     * one element per row of the vector in the entry. The rows of a nested
+     * vector are stored contiguously for all rows of its parent, with the
+     * number of rows per parent row in "<path>..length" and their offsets in
+     * "<path>..idx" (array leaves of the parent, or a scalar leaf for a
+     * top-level vector). The editor removes rows by compacting the buffers of
+     * the leaves in place, which are shared with the skimmed tree (see
+     * TTree::CloneTree), and then rewrites the lengths, offsets, and counts of
+     * the arrays. Removing a row of a vector removes the rows of its nested
+     * vectors.
+     */
+    class FlatRecordEditor
+    {
+        public:
+            FlatRecordEditor(TTree * tree);
+            bool has(const std::string & collection) const;
+            double value(const std::string & leaf, size_t index = 0) const;
+            void set(const std::string & leaf, double value);
+            size_t rows(const std::string & collection) const;
+            void begin();
+            void clear(const std::string & collection);
+            void keep_interactions(const std::string & interactions, const std::string & matched, const std::vector<size_t> & keep);
+            void commit();
+        private:
+            /**
+             * @brief A (possibly nested) vector of the StandardRecord.
+             */
+            struct Collection
+            {
+                std::string path;                ///< The path of the vector (e.g., "rec.dlp.particles").
+                std::string parent;              ///< The path of the enclosing vector (empty if top-level).
+                size_t depth = 0;                ///< The number of enclosing vectors.
+                TLeaf * length = nullptr;        ///< The "..length" leaf.
+                TLeaf * index = nullptr;         ///< The "..idx" leaf (if any).
+                std::vector<TLeaf *> fields;     ///< The array leaves with one element per row.
+                std::set<TLeaf *> counts;        ///< The count leaves of the fields.
+                std::vector<std::string> irregular; ///< The leaves of the vector that cannot be compacted.
+                std::vector<size_t> offsets;     ///< The first row of each parent row (current entry).
+                std::vector<char> mask;          ///< Whether each row is kept (current entry).
+            };
+
+            static void set_value(TLeaf * leaf, size_t index, double value);
+            TLeaf * leaf(const std::string & name) const;
+            Collection & collection(const std::string & path);
+            std::map<std::string, TLeaf *> leaves;
+            std::map<std::string, Collection> collections;
+            std::vector<Collection *> order;
+    };
+
+    /**
+     * @brief Constructor for the FlatRecordEditor class.
+     * @details The vectors are found from their "..length" leaves, and each
+     * other leaf is assigned to the innermost vector that encloses it.
+     * @param tree The flat CAF tree ("recTree").
+     * @return A new instance of the FlatRecordEditor class.
+     */
+    FlatRecordEditor::FlatRecordEditor(TTree * tree)
+    {
+        TIter next(tree->GetListOfLeaves());
+        while(TLeaf * l = (TLeaf *)next())
+            leaves[l->GetName()] = l;
+
+        // The vectors and their length and offset leaves.
+        const std::string length_suffix("..length"), index_suffix("..idx");
+        auto ends_with = [](const std::string & name, const std::string & suffix)
+        {
+            return name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+        };
+        for(const auto & [name, l] : leaves)
+        {
+            if(ends_with(name, length_suffix))
+            {
+                Collection & c = collections[name.substr(0, name.size() - length_suffix.size())];
+                c.path = name.substr(0, name.size() - length_suffix.size());
+                c.length = l;
+            }
+        }
+        for(const auto & [name, l] : leaves)
+        {
+            if(ends_with(name, index_suffix))
+            {
+                auto it = collections.find(name.substr(0, name.size() - index_suffix.size()));
+                if(it != collections.end())
+                    it->second.index = l;
+            }
+        }
+
+        // The innermost vector enclosing a path (excluding the path itself).
+        auto enclosing = [this](const std::string & path, bool inclusive) -> Collection *
+        {
+            Collection * best = nullptr;
+            for(auto & [p, c] : collections)
+            {
+                bool encloses = (inclusive && path == p) || path.rfind(p + ".", 0) == 0;
+                if(encloses && (!best || p.size() > best->path.size()))
+                    best = &c;
+            }
+            return best;
+        };
+        for(auto & [path, c] : collections)
+        {
+            if(Collection * parent = enclosing(path, false))
+                c.parent = parent->path;
+        }
+        for(auto & [path, c] : collections)
+        {
+            for(std::string p = c.parent; !p.empty(); p = collections.at(p).parent)
+                ++c.depth;
+            order.push_back(&c);
+        }
+        std::stable_sort(order.begin(), order.end(), [](const Collection * a, const Collection * b) { return a->depth < b->depth; });
+
+        // Assign the leaves to the vectors. The length and offset leaves of
+        // a nested vector are fields of its parent.
+        for(const auto & [name, l] : leaves)
+        {
+            Collection * owner = nullptr;
+            size_t dots = name.find("..");
+            if(dots != std::string::npos)
+            {
+                auto it = collections.find(name.substr(0, dots));
+                if(it == collections.end() || it->second.parent.empty())
+                    continue;
+                if(l != it->second.length && l != it->second.index)
+                    continue;
+                owner = &collections.at(it->second.parent);
+            }
+            else
+                owner = enclosing(name, true);
+            if(!owner)
+                continue;
+            if(l->GetLeafCount() && !dynamic_cast<TLeafC *>(l))
+            {
+                owner->fields.push_back(l);
+                owner->counts.insert(l->GetLeafCount());
+            }
+            else
+                owner->irregular.push_back(name);
+        }
+    }
+
+    /**
+     * @brief Check if the tree has a vector.
+     * @param collection The path of the vector.
+     * @return True if the tree has the vector.
+     */
+    bool FlatRecordEditor::has(const std::string & collection) const
+    {
+        return collections.find(collection) != collections.end();
+    }
+
+    /**
+     * @brief Get a leaf by name.
+     * @param name The name of the leaf.
+     * @return The leaf (nullptr if the tree has no such leaf).
+     */
+    TLeaf * FlatRecordEditor::leaf(const std::string & name) const
+    {
+        auto it = leaves.find(name);
+        return it == leaves.end() ? nullptr : it->second;
+    }
+
+    /**
+     * @brief Get a vector by path.
+     * @param path The path of the vector.
+     * @return The vector.
+     * @throw std::runtime_error if the tree has no such vector.
+     */
+    FlatRecordEditor::Collection & FlatRecordEditor::collection(const std::string & path)
+    {
+        auto it = collections.find(path);
+        if(it == collections.end())
+            throw std::runtime_error("The flat CAF tree has no vector " + path + ".");
+        return it->second;
+    }
+
+    /**
+     * @brief Get the value of an element of a leaf of the current entry.
+     * @param name The name of the leaf.
+     * @param index The index of the element.
+     * @return The value of the element.
+     * @throw std::runtime_error if the tree has no such leaf.
+     */
+    double FlatRecordEditor::value(const std::string & name, size_t index) const
+    {
+        TLeaf * l = leaf(name);
+        if(!l)
+            throw std::runtime_error("The flat CAF tree has no leaf " + name + ".");
+        return l->GetValue(index);
+    }
+
+    /**
+     * @brief Set the value of a scalar leaf of the current entry.
+     * @details Leaves that are not in the tree are ignored.
+     * @param name The name of the leaf.
+     * @param value The value.
+     * @return void
+     */
+    void FlatRecordEditor::set(const std::string & name, double value)
+    {
+        if(TLeaf * l = leaf(name))
+            set_value(l, 0, value);
+    }
+
+    /**
+     * @brief Set the value of an element of a leaf in its buffer.
+     * @param leaf The leaf.
+     * @param index The index of the element.
+     * @param value The value.
+     * @return void
+     * @throw std::runtime_error if the type of the leaf is not supported.
+     */
+    void FlatRecordEditor::set_value(TLeaf * leaf, size_t index, double value)
+    {
+        std::string type = leaf->GetTypeName();
+        void * data = leaf->GetValuePointer();
+        if(type == "Int_t")           ((Int_t *)data)[index] = (Int_t)value;
+        else if(type == "UInt_t")     ((UInt_t *)data)[index] = (UInt_t)value;
+        else if(type == "Long64_t")   ((Long64_t *)data)[index] = (Long64_t)value;
+        else if(type == "ULong64_t")  ((ULong64_t *)data)[index] = (ULong64_t)value;
+        else if(type == "Long_t")     ((Long_t *)data)[index] = (Long_t)value;
+        else if(type == "ULong_t")    ((ULong_t *)data)[index] = (ULong_t)value;
+        else if(type == "Short_t")    ((Short_t *)data)[index] = (Short_t)value;
+        else if(type == "UShort_t")   ((UShort_t *)data)[index] = (UShort_t)value;
+        else if(type == "Char_t")     ((Char_t *)data)[index] = (Char_t)value;
+        else if(type == "UChar_t")    ((UChar_t *)data)[index] = (UChar_t)value;
+        else if(type == "Bool_t")     ((Bool_t *)data)[index] = value != 0;
+        else if(type == "Float_t")    ((Float_t *)data)[index] = (Float_t)value;
+        else if(type == "Double_t")   ((Double_t *)data)[index] = value;
+        else
+            throw std::runtime_error("Unsupported type " + type + " of leaf " + leaf->GetName() + ".");
+    }
+
+    /**
+     * @brief Get the number of (kept) rows of a vector in the current entry.
+     * @param collection The path of the vector.
+     * @return The number of rows (zero if the tree has no such vector).
+     */
+    size_t FlatRecordEditor::rows(const std::string & collection) const
+    {
+        auto it = collections.find(collection);
+        if(it == collections.end())
+            return 0;
+        return std::count(it->second.mask.begin(), it->second.mask.end(), 1);
+    }
+
+    /**
+     * @brief Index the rows of the vectors of the current entry.
+     * @details This must be called after the entry is read and before any
+     * edit. All rows are kept until they are removed.
+     * @return void
+     * @throw std::runtime_error if the offsets or the sizes of the arrays do
+     * not match the lengths of the vectors.
+     */
+    void FlatRecordEditor::begin()
+    {
+        for(Collection * c : order)
+        {
+            if(c->parent.empty())
+                c->offsets = {0, (size_t)c->length->GetValue()};
+            else
+            {
+                const Collection & parent = collections.at(c->parent);
+                size_t nparent = parent.mask.size();
+                c->offsets.assign(nparent + 1, 0);
+                for(size_t i(0); i < nparent; ++i)
+                {
+                    if(c->index && (size_t)c->index->GetValue(i) != c->offsets[i])
+                        throw std::runtime_error("The rows of " + c->path + " are not contiguous.");
+                    c->offsets[i + 1] = c->offsets[i] + (size_t)c->length->GetValue(i);
+                }
+            }
+            size_t n = c->offsets.back();
+            c->mask.assign(n, 1);
+            for(TLeaf * f : c->fields)
+            {
+                if((size_t)f->GetLen() != n * f->GetLenStatic())
+                    throw std::runtime_error("The size of leaf " + std::string(f->GetName()) + " does not match the length of " + c->path + ".");
+            }
+        }
+    }
+
+    /**
+     * @brief Remove all rows of a top-level vector.
+     * @details Vectors that are not in the tree are ignored.
+     * @param collection The path of the vector.
+     * @return void
+     */
+    void FlatRecordEditor::clear(const std::string & collection)
+    {
+        auto it = collections.find(collection);
+        if(it != collections.end())
+            std::fill(it->second.mask.begin(), it->second.mask.end(), 0);
+    }
+
+    /**
+     * @brief Keep only the listed interactions of a vector and update the
+     * matches of the other vector.
+     * @details This is the flat equivalent of @ref keep_interactions. The
+     * "id" of the kept interactions and the "interaction_id" of the rows of
+     * their nested vectors (the particles) are renumbered, and the
+     * "match_ids" (and, if aligned, the "match_overlaps") of the matched
+     * vector are remapped or removed.
+     * @param interactions The path of the interactions to prune.
+     * @param matched The path of the interactions matched to
+     * @p interactions (ignored if not in the tree).
+     * @param keep The (sorted) positions of the interactions to keep.
+     * @return void
+     * @throw std::runtime_error if a position is out of range.
+     */
+    void FlatRecordEditor::keep_interactions(const std::string & interactions, const std::string & matched, const std::vector<size_t> & keep)
+    {
+        Collection & c = collection(interactions);
+        std::map<int64_t, int64_t> remap;
+        std::fill(c.mask.begin(), c.mask.end(), 0);
+        for(size_t index : keep)
+        {
+            if(index >= c.mask.size())
+                throw std::runtime_error("Interaction " + std::to_string(index) + " of " + interactions + " is out of range.");
+            c.mask[index] = 1;
+            remap.emplace(index, remap.size());
+        }
+
+        // Renumber the interactions and their nested rows.
+        if(TLeaf * id = leaf(interactions + ".id"))
+        {
+            for(const auto & [before, after] : remap)
+                set_value(id, before, after);
+        }
+        for(Collection * nested : order)
+        {
+            TLeaf * id = leaf(nested->path + ".interaction_id");
+            if(nested->parent != interactions || !id)
+                continue;
+            for(const auto & [before, after] : remap)
+            {
+                for(size_t r = nested->offsets[before]; r < nested->offsets[before + 1]; ++r)
+                    set_value(id, r, after);
+            }
+        }
+
+        // Remap (or remove) the matches of the other interactions.
+        auto ids = collections.find(matched + ".match_ids");
+        TLeaf * values = leaf(matched + ".match_ids");
+        if(ids == collections.end() || !values)
+            return;
+        Collection & m = ids->second;
+        for(size_t r(0); r < m.mask.size(); ++r)
+        {
+            auto it = remap.find((int64_t)values->GetValue(r));
+            if(it == remap.end())
+                m.mask[r] = 0;
+            else
+                set_value(values, r, it->second);
+        }
+        auto overlaps = collections.find(matched + ".match_overlaps");
+        if(overlaps != collections.end() && overlaps->second.offsets == m.offsets)
+            overlaps->second.mask = m.mask;
+    }
+
+    /**
+     * @brief Apply the removal of the rows to the buffers of the leaves.
+     * @details The removal of a row is propagated to the rows of its nested
+     * vectors, the lengths of the nested vectors are updated, the arrays are
+     * compacted, and the offsets and counts are rewritten.
+     * @return void
+     * @throw std::runtime_error if a vector with removed rows has a leaf
+     * that cannot be compacted.
+     */
+    void FlatRecordEditor::commit()
+    {
+        // Propagate the removals to the nested vectors (parents first).
+        for(Collection * c : order)
+        {
+            if(c->parent.empty())
+                continue;
+            const Collection & parent = collections.at(c->parent);
+            for(size_t i(0); i < parent.mask.size(); ++i)
+            {
+                if(!parent.mask[i])
+                    std::fill(c->mask.begin() + c->offsets[i], c->mask.begin() + c->offsets[i + 1], 0);
+            }
+        }
+
+        // Update the lengths of the nested vectors (at the original rows of
+        // their parents).
+        for(Collection * c : order)
+        {
+            if(c->parent.empty())
+                continue;
+            for(size_t i(0); i + 1 < c->offsets.size(); ++i)
+                set_value(c->length, i, std::count(c->mask.begin() + c->offsets[i], c->mask.begin() + c->offsets[i + 1], 1));
+        }
+
+        // Compact the arrays of the vectors with removed rows.
+        for(Collection * c : order)
+        {
+            if(std::find(c->mask.begin(), c->mask.end(), 0) == c->mask.end())
+                continue;
+            if(!c->irregular.empty())
+                throw std::runtime_error("Cannot remove rows of " + c->path + ": unsupported leaf " + c->irregular.front() + ".");
+            for(TLeaf * f : c->fields)
+            {
+                size_t size = f->GetLenStatic() * f->GetLenType();
+                char * data = (char *)f->GetValuePointer();
+                size_t n(0);
+                for(size_t r(0); r < c->mask.size(); ++r)
+                {
+                    if(!c->mask[r])
+                        continue;
+                    if(n != r)
+                        std::memmove(data + n * size, data + r * size, size);
+                    ++n;
+                }
+            }
+        }
+
+        // Rewrite the offsets and the counts.
+        for(Collection * c : order)
+        {
+            size_t kept = std::count(c->mask.begin(), c->mask.end(), 1);
+            if(c->parent.empty())
+                set_value(c->length, 0, kept);
+            else if(c->index)
+            {
+                size_t offset(0);
+                for(size_t i(0); i < rows(c->parent); ++i)
+                {
+                    set_value(c->index, i, offset);
+                    offset += (size_t)c->length->GetValue(i);
+                }
+            }
+            for(TLeaf * count : c->counts)
+                set_value(count, 0, kept);
+        }
+    }
+
+    /**
+     * @class SkimSelection
+     * @brief Class applying the cuts of the skim to the records of a single
+     * input file.
+     * @details The selection is evaluated by a record observer that is added
+     * to the loader of the file (see @ref RecordObserver). The loader handles
+     * the records in the order of the entries of the file, so the result of
+     * each record is stored by entry. Records are not identified by their
+     * header, which is not unique in every file.
+     */
+    class SkimSelection
+    {
+        public:
+            SkimSelection(const SkimOptions & options, bool ismc, const std::string & name);
+            RecordObserver observer() const;
+            const std::vector<SkimRecord> & records() const;
+        private:
+            Mode mode;
+            std::shared_ptr<SelectionPass> selection;
+            std::shared_ptr<std::vector<SkimRecord>> results;
+    };
+
+    /**
+     * @brief Constructor for the SkimSelection class.
+     * @param options The configuration of the skim.
+     * @param ismc Whether the sample is a simulation sample.
+     * @param name The name of the selection (used for logging).
+     * @return A new instance of the SkimSelection class.
+     */
+    SkimSelection::SkimSelection(const SkimOptions & options, bool ismc, const std::string & name)
+        : mode(options.mode),
+          selection(std::make_shared<SelectionPass>(options.cuts, options.mode, ismc, name)),
+          results(std::make_shared<std::vector<SkimRecord>>()) {}
+
+    /**
+     * @brief Get the record observer that evaluates the skim on each record.
+     * @details A record passes if it passes the event (and spill) cuts and,
+     * unless the mode is "event", has at least one passing interaction.
+     * @return The observer evaluating the skim.
+     */
+    RecordObserver SkimSelection::observer() const
+    {
+        return [selection = selection, results = results, mode = mode](const caf::SRSpillProxy & sr)
+        {
+            SkimRecord record;
+            record.run = sr.hdr.run;
+            record.subrun = sr.hdr.subrun;
+            record.event = sr.hdr.evt;
+            record.exposure = carries_exposure(sr);
+            const SelectionResult & result = selection->evaluate(sr);
+            if(result.event_passed && (mode == Mode::Event || !result.candidates.empty()))
+            {
+                record.passed = true;
+                for(const auto & c : result.candidates)
+                    record.interactions.push_back(c.index);
+            }
+            results->push_back(std::move(record));
+        };
+    }
+
+    /**
+     * @brief Get the result of the skim for each record.
+     * @return The results, in the order of the entries of the file.
+     */
+    const std::vector<SkimRecord> & SkimSelection::records() const
+    {
+        return *results;
+    }
+
+    /**
+     * @brief Skim a single input file.
+     * @details The cuts are evaluated in a first pass over the file with a
+     * SpectrumLoader. The StandardRecord tree is then copied, in a second
+     * pass, keeping the passing entries (and the failing entries which carry
+     * exposure, with their interactions removed). If configured, the
+     * failing interactions of the passing records are removed. Both the
+     * structured (a "rec" object branch) and the flat CAF formats are
+     * supported; the vectors of flat CAF files are edited with a
+     * @ref FlatRecordEditor. All other top-level objects (e.g., the exposure
+     * histograms) are copied as-is. The output is written to a temporary file
+     * which is renamed once complete.
+     * @param input The path of the input file.
+     * @param output The path of the skimmed file.
+     * @param options The configuration of the skim.
+     * @param ismc Whether the sample is a simulation sample.
+     * @param name The name of the skim (used for logging).
+     * @return void
+     * @throw std::runtime_error if the input file or its StandardRecord tree
+     * cannot be read, if the entries of the tree do not match the records of
+     * the first pass, or if the output file cannot be written.
+     */
+    void skim_file(const std::string & input, const std::string & output, const SkimOptions & options, bool ismc, const std::string & name)
+    {
+        // First pass: evaluate the skim on each record.
+        SkimSelection skim(options, ismc, name);
+        {
+            RecordSpectrumLoader loader(input);
+            loader.AddObserver(skim.observer());
+            loader.Go();
+        }
+        const std::vector<SkimRecord> & records = skim.records();
+
+        // Second pass: copy the passing entries.
+        TFile * in = TFile::Open(input.c_str(), "READ");
+        if(!in || in->IsZombie())
+            throw std::runtime_error("Could not open input file " + input + ".");
+        TTree * tree = in->Get<TTree>("recTree");
+        if(!tree)
+            throw std::runtime_error("Could not find the recTree of " + input + ".");
+        if(tree->GetEntries() != (Long64_t)records.size())
+            throw std::runtime_error("The recTree of " + input + " has " + std::to_string(tree->GetEntries()) + " entries, but "
+                                     + std::to_string(records.size()) + " records were skimmed.");
+        caf::StandardRecord * rec = nullptr;
+        std::unique_ptr<FlatRecordEditor> editor;
+        TBranch * branch = tree->GetBranch("rec");
+        if(branch && std::string(branch->GetClassName()) == "caf::StandardRecord")
+            tree->SetBranchAddress("rec", &rec);
+        else
+            editor = std::make_unique<FlatRecordEditor>(tree);
+
+        std::filesystem::create_directories(std::filesystem::path(output).parent_path());
+        std::string tmp = output + ".tmp";
+        TFile * out = new TFile(tmp.c_str(), "RECREATE");
+        if(out->IsZombie())
+            throw std::runtime_error("Could not create skimmed file " + tmp + ".");
+        out->SetCompressionSettings(in->GetCompressionSettings());
+        TTree * skimmed = tree->CloneTree(0);
+
+        bool drop = options.drop_interactions && options.mode != Mode::Event;
+        std::string pruned = options.mode == Mode::True ? "dlp_true" : "dlp";
+        std::string matched = options.mode == Mode::True ? "dlp" : "dlp_true";
+        size_t nkept(0), nexposure(0);
+        for(Long64_t i = 0; i < tree->GetEntries(); ++i)
+        {
+            const SkimRecord & record = records[i];
+            if(!record.passed && !record.exposure)
+                continue;
+            tree->GetEntry(i);
+
+            // The entries must be those handled by the first pass.
+            int64_t run = rec ? (int64_t)rec->hdr.run : (int64_t)editor->value("rec.hdr.run");
+            int64_t subrun = rec ? (int64_t)rec->hdr.subrun : (int64_t)editor->value("rec.hdr.subrun");
+            int64_t event = rec ? (int64_t)rec->hdr.evt : (int64_t)editor->value("rec.hdr.evt");
+            if(run != record.run || subrun != record.subrun || event != record.event)
+                throw std::runtime_error("Entry " + std::to_string(i) + " of " + input + " does not match the record of the first pass.");
+
+            if(rec)
+            {
+                if(record.passed && drop && options.mode == Mode::Reco)
+                    keep_interactions(rec->dlp, rec->dlp_true, record.interactions);
+                else if(record.passed && drop)
+                    keep_interactions(rec->dlp_true, rec->dlp, record.interactions);
+                else if(!record.passed)
+                {
+                    rec->dlp.clear();
+                    rec->dlp_true.clear();
+                }
+                rec->ndlp = rec->dlp.size();
+                rec->ndlp_true = rec->dlp_true.size();
+            }
+            else
+            {
+                editor->begin();
+                if(record.passed && drop)
+                    editor->keep_interactions("rec." + pruned, "rec." + matched, record.interactions);
+                else if(!record.passed)
+                {
+                    editor->clear("rec.dlp");
+                    editor->clear("rec.dlp_true");
+                }
+                editor->commit();
+                editor->set("rec.ndlp", editor->rows("rec.dlp"));
+                editor->set("rec.ndlp_true", editor->rows("rec.dlp_true"));
+            }
+            if(record.passed)
+                ++nkept;
+            else
+                ++nexposure;
+            skimmed->Fill();
+        }
+        skimmed->Write();
+
+        // Copy the other top-level objects (once per name).
+        std::set<std::string> copied{"recTree"};
+        TIter next(in->GetListOfKeys());
+        while(TKey * key = (TKey *)next())
+        {
+            if(!copied.insert(key->GetName()).second)
+                continue;
+            TObject * obj = key->ReadObj();
+            out->cd();
+            if(TTree * t = dynamic_cast<TTree *>(obj))
+            {
+                TTree * copy = t->CloneTree(-1, "fast");
+                copy->Write();
+            }
+            else
+                obj->Write(key->GetName());
+        }
+
+        std::cout << "Skimmed " << input << ": kept " << nkept << " of " << tree->GetEntries() << " records (and "
+                  << nexposure << " records for their exposure only)." << std::endl;
+        out->Close();
+        delete out;
+        in->Close();
+        delete in;
+        std::filesystem::rename(tmp, output);
+    }
+}
+#endif // SKIM_H
@@ -149,6 +149,30 @@ void write_event(caf::StandardRecord * rec, int64_t run, int64_t subrun,
  */
 std::vector<row_t> read_event_data(const std::string & name);
 
+/**
+ * @brief Read the table data from the TTree at the specified path.
+ * @details This function reads all numeric branches of a TTree without the
+ * (Run, Subrun, Evt) metadata, such as the cutflow TTrees. Non-numeric
+ * branches (e.g., the cut names) are skipped.
+ * @param name The name of the TTree to read from.
+ * @return std::vector<row_t> A vector of rows, one per entry of the TTree.
+ */
+std::vector<row_t> read_table_data(const std::string & name);
+
+/**
+ * @brief Check a single value against its expected value.
+ * @details The result is printed in the same format as the conditions of
+ * @ref match_conditions, along with the expected and observed values if the
+ * check fails.
+ * @param label The label of the check.
+ * @param value The observed value.
+ * @param expected The expected value.
+ * @param tolerance The absolute tolerance of the check (default is exact).
+ * @return bool True if the check passed, false otherwise.
+ */
+bool check_value(const std::string & label, double value, double expected,
+                 double tolerance = 0.0);
+
 /**
  * @brief Match the (Run, Subrun, Evt) metadata between a row_t object and a
  * condition_t object.
@@ -56,6 +56,7 @@ namespace vars
     template<class T>
     double neutrino_id(const T & obj) { return obj.nu_id; }
     REGISTER_VAR_SCOPE(RegistrationScope::True, neutrino_id, neutrino_id);
+    REGISTER_VAR_STORAGE(RegistrationScope::True, neutrino_id, StorageType::Int32);
 
     /**
      * @brief Variable for the interaction ID.
@@ -71,6 +72,7 @@ namespace vars
     template<class T>
     double interaction_id(const T & obj) { return obj.id; }
     REGISTER_VAR_SCOPE(RegistrationScope::Both, interaction_id, interaction_id);
+    REGISTER_VAR_STORAGE(RegistrationScope::Both, interaction_id, StorageType::Int32);
 
     /**
      * @brief Variable for the best-match IoU of the interaction.
@@ -103,6 +105,7 @@ namespace vars
     template<class T>
     double containment(const T & obj) { return cuts::containment_cut(obj); }
     REGISTER_VAR_SCOPE(RegistrationScope::Both, containment, containment);
+    REGISTER_VAR_STORAGE(RegistrationScope::Both, containment, StorageType::UInt8);
 
     /**
      * @brief Variable for the fiducial volume status of the interaction.
@@ -113,6 +116,7 @@ namespace vars
     template<class T>
     double fiducial(const T & obj) { return cuts::fiducial_cut(obj); }
     REGISTER_VAR_SCOPE(RegistrationScope::Both, fiducial, fiducial);
+    REGISTER_VAR_STORAGE(RegistrationScope::Both, fiducial, StorageType::UInt8);
 
     /**
      * @brief Variable for total visible energy of interaction.
@@ -380,15 +384,13 @@ namespace vars
     double dpT(const T & obj)
     {
         utilities::three_vector pt = {0, 0, 0};
-        for(const auto & p : obj.particles)
+        const ParticleGeometry & geometry = GeometryCache<T>::instance().get(obj, true, BEAM_IS_NUMI);
+        for(size_t i(0); i < obj.particles.size(); ++i)
         {
-            if(pcuts::final_state_signal(p))
+            if(pcuts::final_state_signal(obj.particles[i]))
             {
                 // Sum up the transverse momentum of all final state particles
-                utilities::three_vector momentum = {pvars::px(p), pvars::py(p), pvars::pz(p)};
-                utilities::three_vector vtx = {pvars::start_x(p), pvars::start_y(p), pvars::start_z(p)};
-                utilities::three_vector this_pt = utilities::transverse_momentum(momentum, vtx);
-                pt = utilities::add(pt, this_pt);
+                pt = utilities::add(pt, utilities::transverse_momentum(geometry, i));
             }
         }
         return utilities::magnitude(pt);
@@ -417,24 +419,22 @@ namespace vars
         utilities::three_vector l_pt = {0, 0, 0};
         utilities::three_vector p_pt = {0, 0, 0};
         double l_ke(0), p_ke(0);
-        for(const auto & p : obj.particles)
+        const ParticleGeometry & geometry = GeometryCache<T>::instance().get(obj, true, BEAM_IS_NUMI);
+        for(size_t i(0); i < obj.particles.size(); ++i)
         {
+            const auto & p = obj.particles[i];
             if(pcuts::final_state_signal(p))
             {
                 // Find the leading charged lepton and proton
                 if((pvars::pid(p) == pvars::kElectron || pvars::pid(p) == pvars::kMuon) && pvars::ke(p) > l_ke)
                 {
                     l_ke = pvars::ke(p);
-                    utilities::three_vector momentum = {pvars::px(p), pvars::py(p), pvars::pz(p)};
-                    utilities::three_vector vtx = {pvars::start_x(p), pvars::start_y(p), pvars::start_z(p)};
-                    l_pt = utilities::transverse_momentum(momentum, vtx);
+                    l_pt = utilities::transverse_momentum(geometry, i);
                 }
                 else if(pvars::pid(p) == pvars::kProton && pvars::ke(p) > p_ke)
                 {
                     p_ke = pvars::ke(p);
-                    utilities::three_vector momentum = {pvars::px(p), pvars::py(p), pvars::pz(p)};
-                    utilities::three_vector vtx = {pvars::start_x(p), pvars::start_y(p), pvars::start_z(p)};
-                    p_pt = utilities::transverse_momentum(momentum, vtx);
+                    p_pt = utilities::transverse_momentum(geometry, i);
                 }
             }
         }
@@ -465,15 +465,15 @@ namespace vars
     {
         utilities::three_vector lepton_pt = {0, 0, 0};
         utilities::three_vector hadronic_pt = {0, 0, 0};
-        for(const auto & p : obj.particles)
+        const ParticleGeometry & geometry = GeometryCache<T>::instance().get(obj, true, BEAM_IS_NUMI);
+        for(size_t i(0); i < obj.particles.size(); ++i)
         {
+            const auto & p = obj.particles[i];
             if(pcuts::final_state_signal(p))
             {
                 // There should only be one lepton, so replace the lepton
                 // transverse momentum if the particle is a lepton.
-                utilities::three_vector momentum = {pvars::px(p), pvars::py(p), pvars::pz(p)};
-                utilities::three_vector vtx = {pvars::start_x(p), pvars::start_y(p), pvars::start_z(p)};
-                utilities::three_vector this_pt = utilities::transverse_momentum(momentum, vtx);
+                utilities::three_vector this_pt = utilities::transverse_momentum(geometry, i);
                 if(pvars::pid(p) == pvars::kElectron || pvars::pid(p) == pvars::kMuon)
                     lepton_pt = this_pt;
                 // The total hadronic system is treated as a single object.
@@ -504,15 +504,15 @@ namespace vars
     {
         utilities::three_vector lepton_pt = {0, 0, 0};
         utilities::three_vector total_pt = {0, 0, 0};
-        for(const auto & p : obj.particles)
+        const ParticleGeometry & geometry = GeometryCache<T>::instance().get(obj, true, BEAM_IS_NUMI);
+        for(size_t i(0); i < obj.particles.size(); ++i)
         {
+            const auto & p = obj.particles[i];
             if(pcuts::final_state_signal(p))
             {
                 // There should only be one lepton, so replace the lepton
                 // transverse momentum if the particle is a lepton.
-                utilities::three_vector momentum = {pvars::px(p), pvars::py(p), pvars::pz(p)};
-                utilities::three_vector vtx = {pvars::start_x(p), pvars::start_y(p), pvars::start_z(p)};
-                utilities::three_vector this_pt = utilities::transverse_momentum(momentum, vtx);
+                utilities::three_vector this_pt = utilities::transverse_momentum(geometry, i);
                 if(pvars::pid(p) == pvars::kElectron || pvars::pid(p) == pvars::kMuon)
                     lepton_pt = this_pt;
                 total_pt = utilities::add(total_pt, this_pt);
@@ -682,7 +682,7 @@ namespace vars
      * @return the multiplicity of primary photons in the interaction.
      */
     template<class T>
-    double photon_multiplicity(const T & obj, std::vector<double> params={25.0,})
+    double photon_multiplicity(const T & obj, const std::vector<double> & params={25.0,})
     {
         size_t count(0);
         for(const auto & p : obj.particles)
@@ -710,7 +710,7 @@ namespace vars
      * @return the multiplicity of primary electrons in the interaction.
      */
     template<class T>
-    double electron_multiplicity(const T & obj, std::vector<double> params={25.0,})
+    double electron_multiplicity(const T & obj, const std::vector<double> & params={25.0,})
     {
         size_t count(0);
         for(const auto & p : obj.particles)
@@ -738,7 +738,7 @@ namespace vars
      * @return the multiplicity of primary muons in the interaction.
      */
     template<class T>
-    double muon_multiplicity(const T & obj, std::vector<double> params={25.0,})
+    double muon_multiplicity(const T & obj, const std::vector<double> & params={25.0,})
     {
         size_t count(0);
         for(const auto & p : obj.particles)
@@ -766,7 +766,7 @@ namespace vars
      * @return the multiplicity of primary pions in the interaction.
      */
     template<class T>
-    double pion_multiplicity(const T & obj, std::vector<double> params={25.0,})
+    double pion_multiplicity(const T & obj, const std::vector<double> & params={25.0,})
     {
         size_t count(0);
         for(const auto & p : obj.particles)
@@ -794,7 +794,7 @@ namespace vars
      * @return the multiplicity of primary protons in the interaction.
      */
     template<class T>
-    double proton_multiplicity(const T & obj, std::vector<double> params={25.0,})
+    double proton_multiplicity(const T & obj, const std::vector<double> & params={25.0,})
     {
         size_t count(0);
         for(const auto & p : obj.particles)
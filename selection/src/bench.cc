@@ -0,0 +1,368 @@
+/**
+ * @file bench.cc
+ * @brief Synthetic-load benchmark of the SPINE analysis framework.
+ * @details This file contains the main function of the benchmark. The
+ * benchmark reuses the generators of the framework test library (see
+ * @ref test.h) to synthesize CAF files of a configurable size and particle
+ * multiplicity, and runs the selection (the `medulla` executable) with a
+ * standard configuration over the synthetic files. The throughput (events/s),
+ * the peak resident memory, and the time spent in each stage of the selection
+ * (from the profiling mode of the framework) are reported as JSON, so that
+ * throughput regressions can be caught before deploying a new tag.
+ * @author mueller@fnal.gov
+ */
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <array>
+#include <random>
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include <toml++/toml.h>
+
+#include "sbnanaobj/StandardRecord/StandardRecord.h"
+#include "sbnanaobj/StandardRecord/SRInteractionDLP.h"
+#include "sbnanaobj/StandardRecord/SRInteractionTruthDLP.h"
+#include "sbnanaobj/StandardRecord/SRParticleDLP.h"
+#include "sbnanaobj/StandardRecord/SRParticleTruthDLP.h"
+
+#include "TFile.h"
+#include "TTree.h"
+#include "TH1F.h"
+
+#include "test.h"
+
+/**
+ * @struct GeneratorOptions
+ * @brief Struct to store the configuration of the synthetic CAF file.
+ * @details The number of interactions per event and the number of particles
+ * of each type (photon, electron, muon, pion, proton) per interaction are
+ * drawn from Poisson distributions with the configured means. Each
+ * interaction is independently flash matched, contained, and matched to its
+ * true interaction with the configured probabilities.
+ */
+struct GeneratorOptions
+{
+    int64_t events = 100000;
+    double interactions = 4.0;
+    std::array<double, 5> multiplicity = {1.0, 0.5, 1.0, 1.0, 2.0};
+    double flash_matched = 0.5;
+    double contained = 0.5;
+    double matched = 0.8;
+    uint64_t seed = 12345;
+};
+
+/**
+ * @brief Parse a comma-separated list of the mean particle multiplicities.
+ * @param spec The list of multiplicities (photon, electron, muon, pion,
+ * proton).
+ * @return The mean particle multiplicities.
+ * @throw std::runtime_error if the list does not have five entries.
+ */
+std::array<double, 5> parse_multiplicity(const std::string & spec)
+{
+    std::array<double, 5> multiplicity;
+    std::stringstream ss(spec);
+    std::string item;
+    size_t n(0);
+    while(std::getline(ss, item, ','))
+    {
+        if(n == multiplicity.size())
+            throw std::runtime_error("Malformed multiplicity '" + spec + "' (expected five comma-separated values).");
+        multiplicity[n++] = std::stod(item);
+    }
+    if(n != multiplicity.size())
+        throw std::runtime_error("Malformed multiplicity '" + spec + "' (expected five comma-separated values).");
+    return multiplicity;
+}
+
+/**
+ * @brief Generate a synthetic CAF file.
+ * @details The events are built with the generators of the framework test
+ * library. The vertex of each interaction is drawn uniformly in a box that
+ * covers the active volume of the detectors, and the kinetic energies of the
+ * particles are scaled by a random factor, so that the cuts of a realistic
+ * selection see a mix of passing and failing candidates.
+ * @param path The path of the synthetic CAF file.
+ * @param options The configuration of the synthetic CAF file.
+ * @return void
+ */
+void generate(const std::string & path, const GeneratorOptions & options)
+{
+    std::mt19937_64 rng(options.seed);
+    std::poisson_distribution<int64_t> ninteractions(options.interactions);
+    std::vector<std::poisson_distribution<int64_t>> nparticles;
+    for(double m : options.multiplicity)
+        nparticles.emplace_back(m);
+    std::bernoulli_distribution flash_matched(options.flash_matched), contained(options.contained), matched(options.matched);
+    std::uniform_real_distribution<double> x(-200.0, 200.0), y(-200.0, 200.0), z(0.0, 500.0), scale(0.25, 4.0);
+
+    TFile f(path.c_str(), "RECREATE");
+    TH1F * pot = new TH1F("TotalPOT", "TotalPOT", 1, 0, 1);
+    TH1F * nevt = new TH1F("TotalEvents", "TotalEvents", 1, 0, 1);
+    TTree * t = new TTree("recTree", "Standard Record Tree");
+    caf::StandardRecord * rec = new caf::StandardRecord();
+    t->Branch("rec", &rec);
+
+    for(int64_t e(0); e < options.events; ++e)
+    {
+        int64_t poffset(0);
+        int64_t n = std::max<int64_t>(ninteractions(rng), 1);
+        for(int64_t i(0); i < n; ++i)
+        {
+            multiplicity_t mult;
+            for(size_t k(0); k < mult.size(); ++k)
+                mult[k] = nparticles[k](rng);
+            bool fm = flash_matched(rng);
+            rec->dlp.push_back(generate_interaction<caf::SRInteractionDLP>(i, poffset, mult, fm));
+            rec->dlp_true.push_back(generate_interaction<caf::SRInteractionTruthDLP>(i, 0, mult, fm));
+            caf::SRInteractionDLP & reco = rec->dlp.back();
+            caf::SRInteractionTruthDLP & truth = rec->dlp_true.back();
+            poffset += reco.particles.size();
+
+            double vertex[3] = {x(rng), y(rng), z(rng)};
+            for(size_t k(0); k < 3; ++k)
+            {
+                reco.vertex[k] = vertex[k];
+                truth.vertex[k] = vertex[k];
+            }
+            for(size_t p(0); p < reco.particles.size(); ++p)
+            {
+                double s = scale(rng);
+                reco.particles[p].ke *= s;
+                reco.particles[p].csda_ke *= s;
+                reco.particles[p].mcs_ke *= s;
+                reco.particles[p].calo_ke *= s;
+                truth.particles[p].ke *= s;
+                truth.particles[p].energy_init *= s;
+            }
+            if(contained(rng))
+                mark_contained(&reco, &truth);
+            if(matched(rng))
+            {
+                pair(reco, truth);
+                for(size_t p(0); p < reco.particles.size(); ++p)
+                    pair(reco.particles[p], truth.particles[p]);
+            }
+        }
+        write_event(rec, 1, e / 1000, e % 1000, pot, nevt, t);
+        if((e + 1) % 100000 == 0 || e + 1 == options.events)
+            std::cout << "\r\033[KGenerated " << e + 1 << " of " << options.events << " events." << std::flush;
+    }
+    std::cout << std::endl;
+
+    f.cd();
+    pot->Write();
+    nevt->Write();
+    t->Write();
+    f.Close();
+    delete rec;
+}
+
+/**
+ * @brief Count the events of the synthetic CAF files.
+ * @param paths The paths of the synthetic CAF files.
+ * @return The total number of events.
+ * @throw std::runtime_error if a file cannot be opened or has no
+ * "TotalEvents" histogram.
+ */
+double count_events(const std::vector<std::string> & paths)
+{
+    double events(0);
+    for(const std::string & path : paths)
+    {
+        TFile * f = TFile::Open(path.c_str(), "READ");
+        TH1F * nevt = f ? f->Get<TH1F>("TotalEvents") : nullptr;
+        if(!nevt)
+            throw std::runtime_error("Could not read the TotalEvents histogram of " + path + ".");
+        events += nevt->GetEntries();
+        f->Close();
+        delete f;
+    }
+    return events;
+}
+
+/**
+ * @brief Run the selection over the synthetic CAF files and report the
+ * results.
+ * @details The configuration is rewritten so that every enabled sample reads
+ * the synthetic CAF files, the output is written next to the report, and
+ * the profiling mode is enabled. The incremental mode is disabled, as it
+ * would skip the work that is being measured. The selection is then run as
+ * a child process, whose wall time and peak resident memory are measured.
+ * The report contains the throughput, the peak resident memory, and the
+ * per-stage profile of the selection.
+ * @param medulla The path of the `medulla` executable.
+ * @param config The path of the configuration file.
+ * @param inputs The paths of the synthetic CAF files.
+ * @param report The path of the report (without the ".json" extension).
+ * @return The exit code of the selection.
+ * @throw std::runtime_error if the configuration cannot be parsed or the
+ * selection cannot be started.
+ */
+int run(const std::string & medulla, const std::string & config, const std::vector<std::string> & inputs, const std::string & report)
+{
+    // Rewrite the configuration for the synthetic CAF files.
+    toml::table table;
+    try
+    {
+        table = toml::parse_file(config);
+    }
+    catch(const std::exception & e)
+    {
+        throw std::runtime_error("Failed to parse configuration file: " + std::string(e.what()));
+    }
+    toml::array paths;
+    for(const std::string & input : inputs)
+        paths.push_back(input);
+    size_t nsamples(0);
+    if(toml::array * samples = table["sample"].as_array())
+    {
+        for(toml::node & node : *samples)
+        {
+            toml::table * sample = node.as_table();
+            if(!sample || (*sample)["disable"].value_or(false))
+                continue;
+            sample->insert_or_assign("path", paths);
+            ++nsamples;
+        }
+    }
+    if(nsamples == 0)
+        throw std::runtime_error("No enabled samples in configuration file " + config + ".");
+    if(!table["general"].as_table())
+        table.insert("general", toml::table{});
+    toml::table & general = *table["general"].as_table();
+    general.insert_or_assign("output", report);
+    general.insert_or_assign("profile", true);
+    general.erase("cache_dir");
+
+    std::string bench_config = report + ".toml";
+    std::ofstream bench_file(bench_config);
+    bench_file << table << std::endl;
+    bench_file.close();
+
+    // Run the selection and measure the wall time and peak memory.
+    double events = count_events(inputs) * nsamples;
+    auto start = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if(pid < 0)
+        throw std::runtime_error("Could not start " + medulla + ".");
+    if(pid == 0)
+    {
+        execl(medulla.c_str(), medulla.c_str(), bench_config.c_str(), (char *)nullptr);
+        std::cerr << "Error: Could not execute " << medulla << "." << std::endl;
+        _exit(127);
+    }
+    int status(0);
+    waitpid(pid, &status, 0);
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    struct rusage usage;
+    getrusage(RUSAGE_CHILDREN, &usage);
+    int code = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+
+    // Write the report.
+    std::ifstream profile_file(report + "_profile.json");
+    std::stringstream profile;
+    if(profile_file)
+        profile << profile_file.rdbuf();
+    std::ofstream out(report + ".json");
+    out << "{" << std::endl
+        << "  \"config\": \"" << config << "\"," << std::endl
+        << "  \"exit_code\": " << code << "," << std::endl
+        << "  \"samples\": " << nsamples << "," << std::endl
+        << "  \"events\": " << (int64_t)events << "," << std::endl
+        << "  \"wall_time\": " << wall << "," << std::endl
+        << "  \"events_per_second\": " << (wall > 0 ? events / wall : 0.0) << "," << std::endl
+        << "  \"peak_rss_kb\": " << usage.ru_maxrss << "," << std::endl
+        << "  \"stages\": " << (profile.str().empty() ? "[]" : profile.str()) << std::endl
+        << "}" << std::endl;
+
+    std::cout << "Processed " << (int64_t)events << " events in " << wall << " s ("
+              << (wall > 0 ? events / wall : 0.0) << " events/s, peak RSS "
+              << usage.ru_maxrss / 1024 << " MB)." << std::endl;
+    std::cout << "Report written to " << report << ".json." << std::endl;
+    return code;
+}
+
+/**
+ * @brief Main function of the benchmark.
+ * @param argc The number of command line arguments.
+ * @param argv The command line arguments. The modes are:
+ * - `--generate <file.root> [--events N] [--interactions M]
+ *   [--multiplicity g,e,mu,pi,p] [--seed S]`: Generate a synthetic CAF file.
+ * - `--run <config.toml> <file.root...> [--medulla <path>]
+ *   [--report <name>]`: Run the selection over the synthetic CAF files and
+ *   write the report to `<name>.json` (default "medulla_bench").
+ * @return int The exit code of the program. Returns 0 on success, non-zero
+ * on failure.
+ */
+int main(int argc, char * argv[])
+{
+    std::string mode = argc > 2 ? argv[1] : "";
+    if(mode != "--generate" && mode != "--run")
+    {
+        std::cerr << "Usage: " << argv[0] << " --generate <file.root> [--events N] [--interactions M] [--multiplicity g,e,mu,pi,p] [--seed S]" << std::endl;
+        std::cerr << "       " << argv[0] << " --run <config.toml> <file.root...> [--medulla <path>] [--report <name>]" << std::endl;
+        return 1;
+    }
+
+    try
+    {
+        if(mode == "--generate")
+        {
+            GeneratorOptions options;
+            for(int i = 3; i < argc; ++i)
+            {
+                std::string arg(argv[i]);
+                if(i + 1 >= argc)
+                    throw std::runtime_error("Missing value for argument '" + arg + "'.");
+                if(arg == "--events")
+                    options.events = std::stoll(argv[++i]);
+                else if(arg == "--interactions")
+                    options.interactions = std::stod(argv[++i]);
+                else if(arg == "--multiplicity")
+                    options.multiplicity = parse_multiplicity(argv[++i]);
+                else if(arg == "--seed")
+                    options.seed = std::stoull(argv[++i]);
+                else
+                    throw std::runtime_error("Unrecognized argument '" + arg + "'.");
+            }
+            generate(argv[2], options);
+            return 0;
+        }
+
+        // The default executable is the medulla next to the benchmark.
+        std::string self(argv[0]);
+        std::string medulla = (self.find('/') == std::string::npos ? std::string(".") : self.substr(0, self.rfind('/'))) + "/medulla";
+        std::string report = "medulla_bench";
+        std::vector<std::string> inputs;
+        for(int i = 3; i < argc; ++i)
+        {
+            std::string arg(argv[i]);
+            if(arg == "--medulla" && i + 1 < argc)
+                medulla = argv[++i];
+            else if(arg == "--report" && i + 1 < argc)
+                report = argv[++i];
+            else if(arg.rfind("--", 0) == 0)
+                throw std::runtime_error("Unrecognized argument '" + arg + "'.");
+            else
+                inputs.push_back(arg);
+        }
+        if(inputs.empty())
+            throw std::runtime_error("No synthetic CAF files to run over.");
+        return run(medulla, argv[2], inputs, report);
+    }
+    catch(const std::exception & e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
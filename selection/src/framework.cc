@@ -7,12 +7,24 @@
  * @author mueller@fnal.gov
  */
 #include <map>
+#include <tuple>
+#include <memory>
 #include <string>
+#include <chrono>
+#include <limits>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <numeric>
+#include <iostream>
+#include <algorithm>
 #include <functional>
 #include <stdexcept>
 
 #include "sbnana/CAFAna/Core/MultiVar.h"
 #include "sbnanaobj/StandardRecord/Proxy/SRProxy.h"
+#include "TDirectory.h"
+#include "TTree.h"
 
 #include "framework.h"
 #include "configuration.h"
@@ -59,400 +71,1488 @@ ValueT Registry<ValueT>::get(const std::string & name)
     return registry_[name];
 }
 
-// Build a single SpillMultiVar for a single branch variable.
-NamedSpillMultiVar construct(const std::vector<cfg::ConfigurationTable> & cuts,
-                             const cfg::ConfigurationTable & var,
-                             const std::string & mode,
-                             const std::string & override_type,
-                             const bool ismc)
+// The sequence number of the record processed by the current thread.
+static thread_local RecordKey record_sequence = 0;
+
+// Signal the next record processed by the current thread.
+RecordKey advance_record()
 {
-    /**
-     * @brief Determine the type of the cuts.
-     * @details The type of the first cut is used to determine the type of the
-     * cuts, and therefore whether the selection is applied in a loop over true
-     * or reco events. This type is used to branch the code into the appropriate
-     * path. First, we check if the mode is a valid option. If not, we throw an
-     * exception.
-     */
-    Mode exec_mode;
-    if(mode == "true") exec_mode = Mode::True;
-    else if(mode == "reco") exec_mode = Mode::Reco;
-    else if(mode == "event") exec_mode = Mode::Event;
-    else throw std::runtime_error("Illegal mode '" + mode + "' for variable " + var.get_string_field("name"));
-
-    std::vector<CutFn<TType>> true_cut_functions;
-    std::vector<CutFn<RType>> reco_cut_functions;
-    std::vector<CutFn<TParticleType>> true_particle_cut_functions;
-    std::vector<CutFn<RParticleType>> reco_particle_cut_functions;
-    std::vector<CutFn<EventType>> event_cut_functions;
-    for(const auto & cut : cuts)
+    return ++record_sequence;
+}
+
+// Get the identity of the record processed by the current thread.
+RecordKey current_record()
+{
+    if(record_sequence == 0)
+        throw std::runtime_error("No record has been signalled to the framework on this thread (see advance_record).");
+    return record_sequence;
+}
+
+// Get the match index for the record.
+const MatchIndex & MatchIndex::get(const EventType & sr, bool with_particles)
+{
+    // One index per thread: each loader processes its records sequentially.
+    static thread_local MatchIndex index;
+    RecordKey k = current_record();
+    if(!index.current_ || *index.current_ != k)
     {
-        // Retrieve the cut name and check for negation.
-        std::string name = cut.get_string_field("name");
-        bool invert = false;
-        if(name.at(0) == '!')
+        index.current_ = k;
+        index.build(sr);
+    }
+    if(with_particles && !index.particles_built_)
+        index.build_particles(sr);
+    return index;
+}
+
+// Build the interaction matches of the record.
+void MatchIndex::build(const EventType & sr)
+{
+    particles_built_ = false;
+    true_matches_.clear();
+    reco_matches_.clear();
+    true_matches_.reserve(sr.dlp_true.size());
+    reco_matches_.reserve(sr.dlp.size());
+    for(auto const & i : sr.dlp_true)
+        true_matches_.push_back((i.match_ids.size() > 0) ? (size_t)i.match_ids[0] : kNoMatch);
+    for(auto const & i : sr.dlp)
+        reco_matches_.push_back((i.match_ids.size() > 0) ? (size_t)i.match_ids[0] : kNoMatch);
+}
+
+// Build the particle matches of the record.
+void MatchIndex::build_particles(const EventType & sr)
+{
+    // Flat lookup tables of the particles by id. The stable sort keeps the
+    // first particle for duplicate ids.
+    auto by_id = [](const auto & a, const auto & b) { return a.first < b.first; };
+    reco_by_id_.clear();
+    reco_offsets_.clear();
+    for(auto const & i : sr.dlp)
+    {
+        reco_offsets_.push_back(reco_by_id_.size());
+        for(auto const & j : i.particles)
+            reco_by_id_.emplace_back((int64_t)j.id, &j);
+    }
+    reco_offsets_.push_back(reco_by_id_.size());
+    std::stable_sort(reco_by_id_.begin(), reco_by_id_.end(), by_id);
+
+    true_by_id_.clear();
+    true_offsets_.clear();
+    for(auto const & i : sr.dlp_true)
+    {
+        true_offsets_.push_back(true_by_id_.size());
+        for(auto const & j : i.particles)
+            true_by_id_.emplace_back((int64_t)j.id, &j);
+    }
+    true_offsets_.push_back(true_by_id_.size());
+    std::stable_sort(true_by_id_.begin(), true_by_id_.end(), by_id);
+
+    // Resolve the match of each particle using the lookup tables.
+    auto find = [](const auto & table, const auto & p) -> decltype(table.front().second) {
+        if(p.match_ids.size() == 0) return nullptr;
+        int64_t id = p.match_ids[0];
+        auto it = std::lower_bound(table.begin(), table.end(), id, [](const auto & a, int64_t b) { return a.first < b; });
+        return (it != table.end() && it->first == id) ? it->second : nullptr;
+    };
+    true_particle_matches_.clear();
+    true_particle_matches_.reserve(true_offsets_.back());
+    for(auto const & i : sr.dlp_true)
+    {
+        for(auto const & j : i.particles)
+            true_particle_matches_.push_back(find(reco_by_id_, j));
+    }
+    reco_particle_matches_.clear();
+    reco_particle_matches_.reserve(reco_offsets_.back());
+    for(auto const & i : sr.dlp)
+    {
+        for(auto const & j : i.particles)
+            reco_particle_matches_.push_back(find(true_by_id_, j));
+    }
+    particles_built_ = true;
+}
+
+// Get the reco particle matched to a true particle.
+const RParticleType * MatchIndex::true_to_reco_particle(size_t interaction, size_t particle) const
+{
+    return true_particle_matches_[true_offsets_[interaction] + particle];
+}
+
+// Get the true particle matched to a reco particle.
+const TParticleType * MatchIndex::reco_to_true_particle(size_t interaction, size_t particle) const
+{
+    return reco_particle_matches_[reco_offsets_[interaction] + particle];
+}
+
+// Add the exposure of another set of counts.
+void ExposureCounts::merge(const ExposureCounts & other)
+{
+    pot += other.pot;
+    livetime += other.livetime;
+    spills += other.spills;
+    events += other.events;
+}
+
+// Get the ledger of the current thread.
+ExposureLedger & ExposureLedger::worker()
+{
+    static thread_local ExposureLedger ledger;
+    return ledger;
+}
+
+// Compute the exposure carried by a record.
+ExposureCounts ExposureLedger::of(const EventType & sr, const CutFn<SpillType> & spill_cut)
+{
+    ExposureCounts counts;
+    if(sr.hdr.ismc)
+    {
+        if(sr.hdr.first_in_subrun)
         {
-            invert = true;
-            name = name.substr(1); // Remove the negation character.
+            counts.pot = sr.hdr.pot;
+            counts.livetime = sr.hdr.ngenevt;
         }
-         
-        if(!cut.has_field("type"))
-            throw std::runtime_error("Cut " + name + " does not have a type field.");
-        if(cut.get_string_field("type") == "true")
+    }
+    else
+    {
+        for(const auto & bnb : sr.hdr.bnbinfo)
+        {
+            if(spill_cut && !spill_cut(bnb))
+                continue;
+            counts.pot += bnb.TOR875;
+            ++counts.spills;
+        }
+        counts.livetime = sr.hdr.bnbinfo.size() + sr.hdr.numiinfo.size() + sr.hdr.noffbeambnb + sr.hdr.noffbeamnumi;
+    }
+    counts.events = (counts.pot != 0 || counts.livetime != 0) ? 1 : 0;
+    return counts;
+}
+
+// Record the exposure carried by a record.
+void ExposureLedger::observe(const EventType & sr, const CutFn<SpillType> & spill_cut)
+{
+    ExposureCounts counts = of(sr, spill_cut);
+    if(counts.events == 0)
+        return;
+    add(SubrunKey(sr.hdr.run, sr.hdr.subrun), (int64_t)sr.hdr.evt, counts);
+}
+
+// Record the exposure of a record by its identity.
+void ExposureLedger::add(const SubrunKey & subrun, int64_t event, const ExposureCounts & counts)
+{
+    auto [it, inserted] = records_[subrun].try_emplace(event, counts);
+    if(!inserted)
+    {
+        it->second.merge(counts);
+        ++duplicates_;
+    }
+}
+
+// Get the unfolded exposure of a record.
+ExposureCounts ExposureLedger::unfolded(const EventType & sr)
+{
+    SubrunKey subrun(sr.hdr.run, sr.hdr.subrun);
+    if(sr.hdr.first_in_subrun)
+    {
+        // Replace the spills of the previous subrun once per (first) record.
+        RecordKey k = current_record();
+        if(!unfolded_key_ || *unfolded_key_ != k)
+        {
+            unfolded_.clear();
+            for(const auto & bnb : sr.hdr.bnbinfo)
+                unfolded_.emplace_back((uint32_t)bnb.event, (double)bnb.TOR875);
+            unfolded_subrun_ = subrun;
+            unfolded_key_ = k;
+        }
+    }
+
+    ExposureCounts counts;
+    if(unfolded_subrun_ != subrun)
+        return counts;
+    for(const auto & [event, pot] : unfolded_)
+    {
+        if(event == sr.hdr.evt)
+        {
+            counts.pot += pot;
+            ++counts.spills;
+        }
+    }
+    return counts;
+}
+
+// Merge the exposure of another ledger into this ledger.
+void ExposureLedger::merge(const ExposureLedger & other)
+{
+    for(const auto & [subrun, records] : other.records_)
+    {
+        for(const auto & [event, counts] : records)
+            add(subrun, event, counts);
+    }
+    duplicates_ += other.duplicates_;
+}
+
+// Get the number of records sharing the subrun and event number of an earlier record.
+size_t ExposureLedger::duplicates() const
+{
+    return duplicates_;
+}
+
+// Get the exposure of each subrun.
+std::map<SubrunKey, ExposureCounts> ExposureLedger::subruns() const
+{
+    std::map<SubrunKey, ExposureCounts> result;
+    for(const auto & [subrun, records] : records_)
+    {
+        ExposureCounts & counts = result[subrun];
+        for(const auto & [event, c] : records)
+            counts.merge(c);
+    }
+    return result;
+}
+
+// Get the total exposure.
+ExposureCounts ExposureLedger::totals() const
+{
+    ExposureCounts counts;
+    for(const auto & [subrun, c] : subruns())
+        counts.merge(c);
+    return counts;
+}
+
+// Write the exposure of each subrun to a TTree.
+void ExposureLedger::write(TDirectory * dir, const std::string & name) const
+{
+    dir->cd();
+    Long64_t run, subrun;
+    double pot, livetime;
+    ULong64_t spills, events;
+
+    TTree * tree = new TTree(name.c_str(), name.c_str());
+    tree->Branch("run", &run);
+    tree->Branch("subrun", &subrun);
+    tree->Branch("pot", &pot);
+    tree->Branch("livetime", &livetime);
+    tree->Branch("spills", &spills);
+    tree->Branch("events", &events);
+    for(const auto & [key, counts] : subruns())
+    {
+        run = key.first;
+        subrun = key.second;
+        pot = counts.pot;
+        livetime = counts.livetime;
+        spills = counts.spills;
+        events = counts.events;
+        tree->Fill();
+    }
+    tree->Write();
+    delete tree;
+}
+
+// Get the cache instance of the current thread.
+template<typename ParticleT>
+ParticleCache<ParticleT> & ParticleCache<ParticleT>::instance()
+{
+    static thread_local ParticleCache cache;
+    return cache;
+}
+
+// The detector used by the geometry checks.
+static const DetectorDescriptor * configured_detector = &kSBND;
+
+// Get the detector used by the geometry checks.
+const DetectorDescriptor & active_detector()
+{
+    return *configured_detector;
+}
+
+// Configure the detector used by the geometry checks.
+void set_detector(const std::string & name)
+{
+    for(const DetectorDescriptor * d : {&kSBND, &kICARUS})
+    {
+        if(name == d->name)
+        {
+            configured_detector = d;
+            return;
+        }
+    }
+    throw std::runtime_error("Unknown detector '" + name + "' (expected 'sbnd' or 'icarus').");
+}
+
+// Compute the distances of a set of points to a reference point.
+void batch_distance(size_t n, const float * x, const float * y, const float * z, const std::array<double, 3> & ref, double * out)
+{
+    for(size_t i = 0; i < n; ++i)
+    {
+        double dx = x[i] - ref[0];
+        double dy = y[i] - ref[1];
+        double dz = z[i] - ref[2];
+        out[i] = std::sqrt(dx*dx + dy*dy + dz*dz);
+    }
+}
+
+// Check if a set of points is near the boundary of a detector.
+void batch_near_boundary(size_t n, const float * x, const float * y, const float * z, const DetectorDescriptor & detector, uint8_t * out)
+{
+    std::fill(out, out + n, 1);
+    for(size_t b = 0; b < detector.nboxes; ++b)
+    {
+        const DetectorBox & box = detector.boxes[b];
+        const double xmin = box.xmin + detector.margin, xmax = box.xmax - detector.margin;
+        const double ymin = box.ymin + detector.margin, ymax = box.ymax - detector.margin;
+        const double zmin = box.zmin + detector.margin, zmax = box.zmax - detector.margin;
+        for(size_t i = 0; i < n; ++i)
+        {
+            uint8_t near = (x[i] < xmin) | (x[i] > xmax) | (y[i] < ymin) | (y[i] > ymax) | (z[i] < zmin) | (z[i] > zmax);
+            out[i] &= near;
+        }
+    }
+}
+
+// Compute the transverse components of a set of momenta.
+void batch_transverse(size_t n, const std::array<const float *, 3> & p, const std::array<const float *, 3> & start, bool numi, const std::array<double *, 3> & out)
+{
+    if(!numi)
+    {
+        // The beam is along the z-axis.
+        std::copy(p[0], p[0] + n, out[0]);
+        std::copy(p[1], p[1] + n, out[1]);
+        std::fill(out[2], out[2] + n, 0.0);
+        return;
+    }
+
+    // The beam points from the NuMI target (cm) to the start point.
+    for(size_t i = 0; i < n; ++i)
+    {
+        double ux = 31512.0380 + start[0][i];
+        double uy = 3364.4912 + start[1][i];
+        double uz = 73363.2532 + start[2][i];
+        double inv = 1.0 / std::sqrt(ux*ux + uy*uy + uz*uz);
+        ux *= inv;
+        uy *= inv;
+        uz *= inv;
+        double scale = p[0][i]*ux + p[1][i]*uy + p[2][i]*uz;
+        out[0][i] = p[0][i] - scale*ux;
+        out[1][i] = p[1][i] - scale*uy;
+        out[2][i] = p[2][i] - scale*uz;
+    }
+}
+
+// Get the cache instance of the current thread.
+template<typename InteractionT>
+GeometryCache<InteractionT> & GeometryCache<InteractionT>::instance()
+{
+    static thread_local GeometryCache cache;
+    return cache;
+}
+
+// Signal the record being processed.
+template<typename InteractionT>
+void GeometryCache<InteractionT>::advance(const RecordKey & key)
+{
+    if(!current_ || *current_ != key)
+    {
+        current_ = key;
+        used_ = 0;
+    }
+}
+
+// Get the geometry of an interaction, building it if necessary.
+template<typename InteractionT>
+const ParticleGeometry & GeometryCache<InteractionT>::get(const InteractionT & obj, bool with_transverse, bool numi)
+{
+    ParticleGeometry * geometry = nullptr;
+    if(!current_)
+    {
+        build(obj, scratch_);
+        geometry = &scratch_;
+    }
+    else
+    {
+        for(size_t i = 0; i < used_ && !geometry; ++i)
+        {
+            if(entries_[i].first == &obj)
+                geometry = &entries_[i].second;
+        }
+        if(!geometry)
+        {
+            if(used_ == entries_.size())
+                entries_.emplace_back();
+            entries_[used_].first = &obj;
+            geometry = &entries_[used_++].second;
+            build(obj, *geometry);
+        }
+    }
+
+    if(with_transverse && (!geometry->transverse_built || geometry->transverse_numi != numi))
+    {
+        size_t n = geometry->momentum[0].size();
+        for(auto & v : geometry->transverse)
+            v.resize(n);
+        batch_transverse(n, {geometry->momentum[0].data(), geometry->momentum[1].data(), geometry->momentum[2].data()},
+                         {geometry->start[0].data(), geometry->start[1].data(), geometry->start[2].data()}, numi,
+                         {geometry->transverse[0].data(), geometry->transverse[1].data(), geometry->transverse[2].data()});
+        geometry->transverse_built = true;
+        geometry->transverse_numi = numi;
+    }
+    return *geometry;
+}
+
+// Build the geometry of an interaction.
+template<typename InteractionT>
+void GeometryCache<InteractionT>::build(const InteractionT & obj, ParticleGeometry & geometry)
+{
+    // Gather the particles into the buffers (re-using their capacity).
+    size_t n = obj.particles.size();
+    for(size_t k = 0; k < 3; ++k)
+    {
+        geometry.start[k].resize(n);
+        geometry.end[k].resize(n);
+        geometry.momentum[k].resize(n);
+    }
+    for(size_t i = 0; i < n; ++i)
+    {
+        const auto & p = obj.particles[i];
+        for(size_t k = 0; k < 3; ++k)
         {
-            std::string cut_name = "true_" + name;
+            geometry.start[k][i] = p.start_point[k];
+            geometry.end[k][i] = p.end_point[k];
+            geometry.momentum[k][i] = p.momentum[k];
+        }
+    }
+    geometry.transverse_built = false;
+
+    // Run the kernels over the full interaction.
+    geometry.vertex_distance.resize(n);
+    geometry.start_near_boundary.resize(n);
+    geometry.end_near_boundary.resize(n);
+    std::array<double, 3> vertex{obj.vertex[0], obj.vertex[1], obj.vertex[2]};
+    batch_distance(n, geometry.start[0].data(), geometry.start[1].data(), geometry.start[2].data(), vertex, geometry.vertex_distance.data());
+    batch_near_boundary(n, geometry.start[0].data(), geometry.start[1].data(), geometry.start[2].data(), active_detector(), geometry.start_near_boundary.data());
+    batch_near_boundary(n, geometry.end[0].data(), geometry.end[1].data(), geometry.end[2].data(), active_detector(), geometry.end_near_boundary.data());
+}
+
+// Get the singleton instance of the Profiler.
+Profiler & Profiler::instance()
+{
+    static Profiler instance;
+    return instance;
+}
+
+// Enable the profiling mode.
+void Profiler::enable(size_t period)
+{
+    enabled_ = true;
+    period_ = std::max<size_t>(1, period);
+}
+
+// Create the counters for a function.
+ProfileCounter * Profiler::counter(const std::string & scope, const std::string & kind, const std::string & name)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    counters_.push_back(ProfileCounter{scope, kind, name, period_});
+    return &counters_.back();
+}
+
+// Print the per-sample, per-tree report.
+void Profiler::report(std::ostream & out) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<std::string, std::vector<const ProfileCounter *>> scopes;
+    for(const ProfileCounter & c : counters_)
+        scopes[c.scope].push_back(&c);
+
+    for(auto & [scope, counters] : scopes)
+    {
+        std::stable_sort(counters.begin(), counters.end(), [](const ProfileCounter * a, const ProfileCounter * b) {
+            return a->total_time() > b->total_time();
+        });
+        out << "Profile for " << scope << ":" << std::endl;
+        out << std::left << std::setw(18) << "  kind" << std::setw(48) << "name"
+            << std::right << std::setw(14) << "calls" << std::setw(10) << "pass"
+            << std::setw(12) << "ns/call" << std::setw(12) << "total [s]" << std::endl;
+        for(const ProfileCounter * c : counters)
+        {
+            out << std::left << "  " << std::setw(16) << c->kind << std::setw(48) << c->name
+                << std::right << std::setw(14) << c->calls;
+            if(c->kind == "var")
+                out << std::setw(10) << "-";
+            else
+                out << std::setw(10) << std::fixed << std::setprecision(3) << (c->calls ? (double)c->passes / c->calls : 0.0);
+            out << std::setw(12) << std::fixed << std::setprecision(1) << (c->timed ? 1e9 * c->time / c->timed : 0.0)
+                << std::setw(12) << std::fixed << std::setprecision(3) << c->total_time() << std::endl;
+            out.unsetf(std::ios::fixed);
+        }
+    }
+}
+
+// Write the counters to a TTree in a directory.
+void Profiler::write(TDirectory * dir) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    dir->cd();
+    TTree * tree = new TTree("profile", "profile");
+    std::string scope, kind, name;
+    ULong64_t calls, passes;
+    double time, total;
+    tree->Branch("scope", &scope);
+    tree->Branch("kind", &kind);
+    tree->Branch("name", &name);
+    tree->Branch("calls", &calls);
+    tree->Branch("passes", &passes);
+    tree->Branch("time", &time);
+    tree->Branch("total_time", &total);
+    for(const ProfileCounter & c : counters_)
+    {
+        scope = c.scope;
+        kind = c.kind;
+        name = c.name;
+        calls = c.calls;
+        passes = c.passes;
+        time = c.timed ? c.time / c.timed : 0.0;
+        total = c.total_time();
+        tree->Fill();
+    }
+    tree->Write();
+    delete tree;
+}
+
+// Write the counters to a JSON file.
+void Profiler::write_json(const std::string & path) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::ofstream out(path);
+    if(!out)
+        throw std::runtime_error("Could not open profile output " + path + ".");
+
+    auto quote = [](const std::string & str) {
+        std::string q("\"");
+        for(char c : str)
+        {
+            if(c == '"' || c == '\\') q += '\\';
+            q += c;
+        }
+        return q + "\"";
+    };
+    out << "[" << std::endl;
+    for(size_t i(0); i < counters_.size(); ++i)
+    {
+        const ProfileCounter & c = counters_[i];
+        out << "  {\"scope\": " << quote(c.scope)
+            << ", \"kind\": " << quote(c.kind)
+            << ", \"name\": " << quote(c.name)
+            << ", \"calls\": " << c.calls
+            << ", \"passes\": " << c.passes
+            << ", \"time\": " << (c.timed ? c.time / c.timed : 0.0)
+            << ", \"total_time\": " << c.total_time() << "}"
+            << (i + 1 < counters_.size() ? "," : "") << std::endl;
+    }
+    out << "]" << std::endl;
+}
+
+// Add a registered cut to the end of the chain.
+template<typename T>
+void CutChain<T>::add(const std::string & cut_name, const std::vector<double> & params, bool invert)
+{
+    std::string label = (invert ? "!" : "") + cut_name;
+    if(FastCutRegistry<T>::instance().is_registered(cut_name))
+    {
+        records_.push_back(Record{FastCutRegistry<T>::instance().get(cut_name), params, invert});
+        entries_.push_back(Entry{label, nullptr});
+    }
+    else
+    {
+        auto factory = CutFactoryRegistry<T>::instance().get(cut_name);
+        records_.push_back(Record{nullptr, {}, invert});
+        entries_.push_back(Entry{label, factory(params)});
+    }
+}
+
+// Add an arbitrary cut function to the end of the chain.
+template<typename T>
+void CutChain<T>::add(const std::string & name, CutFn<T> fn)
+{
+    records_.push_back(Record{nullptr, {}, false});
+    entries_.push_back(Entry{name, std::move(fn)});
+}
+
+// Enable the adaptive ordering of the chain.
+template<typename T>
+void CutChain<T>::configure(const AdaptiveCutOrder & adaptive, const std::string & label)
+{
+    adaptive_ = adaptive;
+    label_ = label;
+    records_seen_ = 0;
+
+    // Reordering a single cut is pointless.
+    profiling_ = adaptive_.enabled && entries_.size() > 1 && adaptive_.records > 0;
+}
+
+// Signal the start of a new record.
+template<typename T>
+void CutChain<T>::next_record()
+{
+    if(!adaptive_.enabled || entries_.size() < 2 || adaptive_.records == 0)
+        return;
+    ++records_seen_;
+    if(profiling_ && records_seen_ > adaptive_.records)
+    {
+        // End of the profiling window.
+        reorder();
+        profiling_ = false;
+        records_seen_ = 1;
+    }
+    else if(!profiling_ && adaptive_.retune > 0 && records_seen_ > adaptive_.retune)
+    {
+        // Start of a new profiling window.
+        for(auto & e : entries_)
+        {
+            e.calls = 0;
+            e.passes = 0;
+            e.time = 0;
+        }
+        profiling_ = true;
+        records_seen_ = 1;
+    }
+}
+
+// Attach profiling counters to each cut of the chain.
+template<typename T>
+void CutChain<T>::instrument(const std::string & scope, const std::string & kind)
+{
+    for(auto & e : entries_)
+        e.counter = Profiler::instance().counter(scope, kind, e.name);
+    instrumented_ = !entries_.empty();
+}
+
+// Apply the chain while updating the profiling counters.
+template<typename T>
+bool CutChain<T>::count(const T & obj)
+{
+    for(size_t i(0); i < records_.size(); ++i)
+    {
+        const Record & r = records_[i];
+        Entry & e = entries_[i];
+        bool pass = e.counter->measure([&r, &e](const T & o) { return r.fn ? r.fn(o, r.params) : e.fallback(o); }, obj) != r.invert;
+        e.counter->passes += pass;
+        if(!pass)
+            return false;
+    }
+    return true;
+}
+
+// Apply the chain while measuring the statistics of each cut.
+template<typename T>
+bool CutChain<T>::profile(const T & obj)
+{
+    // While profiling, every cut is applied so that the pass fractions are
+    // not biased by the order of the conjunction.
+    bool result(true);
+    for(size_t i(0); i < records_.size(); ++i)
+    {
+        const Record & r = records_[i];
+        Entry & e = entries_[i];
+        auto start = std::chrono::steady_clock::now();
+        bool pass = (r.fn ? r.fn(obj, r.params) : e.fallback(obj)) != r.invert;
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        e.time += elapsed;
+        ++e.calls;
+        e.passes += pass;
+        if(e.counter)
+        {
+            ++e.counter->calls;
+            ++e.counter->timed;
+            e.counter->time += elapsed;
+            e.counter->passes += pass;
+        }
+        result = result && pass;
+    }
+    return result;
+}
+
+// Reorder the chain using the measured statistics.
+template<typename T>
+void CutChain<T>::reorder()
+{
+    /**
+     * @brief Rank the cuts by expected cost.
+     * @details For a conjunction of independent cuts, the expected cost is
+     * minimized by applying the cuts in increasing order of c / (1 - p),
+     * where c is the average cost of the cut and p is its pass fraction.
+     * Cuts which reject nothing are placed last (ordered by cost), and cuts
+     * which were never called keep their configured order.
+     */
+    auto rank = [this](size_t i) -> std::tuple<int, double> {
+        const Entry & e = entries_[i];
+        if(e.calls == 0) return std::make_tuple(2, 0.0);
+        double cost = e.time / e.calls;
+        double rejection = 1.0 - (double)e.passes / e.calls;
+        return rejection > 0 ? std::make_tuple(0, cost / rejection) : std::make_tuple(1, cost);
+    };
+    std::vector<std::tuple<int, double>> ranks(entries_.size());
+    std::vector<size_t> order(entries_.size());
+    for(size_t i(0); i < entries_.size(); ++i)
+        ranks[i] = rank(i);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&ranks](size_t a, size_t b) { return ranks[a] < ranks[b]; });
+
+    // Permute the records so that the hot loop remains a flat scan.
+    std::vector<Record> records;
+    std::vector<Entry> entries;
+    for(size_t i : order)
+    {
+        records.push_back(std::move(records_[i]));
+        entries.push_back(std::move(entries_[i]));
+    }
+    records_ = std::move(records);
+    entries_ = std::move(entries);
+
+    // Log the order actually used.
+    std::cout << "Adaptive cut order for " << label_ << ":";
+    for(const Entry & e : entries_)
+    {
+        std::cout << " " << e.name << " (pass " << (e.calls ? (double)e.passes / e.calls : 0.0)
+                  << ", " << (e.calls ? 1e9 * e.time / e.calls : 0.0) << " ns)";
+    }
+    std::cout << std::endl;
+}
+
+// Constructor for the CategoryClassifier class.
+CategoryClassifier::CategoryClassifier(const std::vector<cfg::ConfigurationTable> & categories)
+{
+    std::map<std::pair<std::string, std::vector<double>>, size_t> index;
+    std::vector<std::vector<std::pair<size_t, bool>>> requirements;
+    for(const auto & category : categories)
+    {
+        requirements.emplace_back();
+        for(const auto & cut : category.get_subtables("cuts"))
+        {
+            // Retrieve the cut name and check for negation.
+            std::string name = cut.get_string_field("name");
+            bool invert = false;
+            if(name.at(0) == '!')
+            {
+                invert = true;
+                name = name.substr(1); // Remove the negation character.
+            }
+            name = "true_" + name;
+
+            // Load parameters (if any) for the cut.
             std::vector<double> params;
             if(cut.has_field("parameters"))
                 params = cut.get_double_vector("parameters");
-            auto factory = CutFactoryRegistry<TType>::instance().get(cut_name);
-            if(invert)
+
+            // Re-use the predicate if it is shared with a previous cut.
+            auto [it, inserted] = index.try_emplace(std::make_pair(name, params), predicates_.size());
+            if(inserted)
+                predicates_.push_back(bind_cut<TType>(name, params));
+            requirements.back().emplace_back(it->second, !invert);
+        }
+    }
+
+    // Build the bitmasks once the number of distinct predicates is known.
+    words_ = std::max<size_t>(1, (predicates_.size() + 63) / 64);
+    for(const auto & requirement : requirements)
+    {
+        Category c;
+        c.require.assign(words_, 0);
+        c.value.assign(words_, 0);
+        for(const auto & [p, pass] : requirement)
+        {
+            uint64_t bit = uint64_t(1) << (p % 64);
+            if(c.require[p / 64] & bit)
             {
-                // If the cut is inverted, we need to negate the function.
-                auto fn = factory(params);
-                true_cut_functions.push_back([fn](const TType & e) { return !fn(e); });
+                // A repeated predicate must have the same required value.
+                c.satisfiable = c.satisfiable && (((c.value[p / 64] & bit) != 0) == pass);
+                continue;
             }
-            else
-                // Otherwise, we just add the function as is.
-                true_cut_functions.push_back(factory(params));
+            c.require[p / 64] |= bit;
+            if(pass)
+                c.value[p / 64] |= bit;
+            c.predicates.push_back(p);
         }
-        else if(cut.get_string_field("type") == "reco")
+        categories_.push_back(std::move(c));
+    }
+}
+
+// Classify a true interaction.
+double CategoryClassifier::classify(const TType & e) const
+{
+    // The known predicates and their results. Up to 256 predicates are kept
+    // on the stack.
+    uint64_t local[8] = {};
+    std::vector<uint64_t> heap;
+    uint64_t * known = local;
+    if(words_ > 4)
+    {
+        heap.assign(2 * words_, 0);
+        known = heap.data();
+    }
+    uint64_t * results = known + words_;
+
+    for(size_t i(0); i < categories_.size(); ++i)
+    {
+        const Category & c = categories_[i];
+        if(!c.satisfiable)
+            continue;
+        bool conflict = false;
+        for(size_t w(0); w < words_ && !conflict; ++w)
+            conflict = ((results[w] ^ c.value[w]) & c.require[w] & known[w]) != 0;
+        if(conflict)
+            continue;
+
+        // Evaluate the predicates that are not yet known, stopping at the
+        // first one with the wrong value.
+        bool passed = true;
+        for(size_t p : c.predicates)
         {
-            std::string cut_name = "reco_" + name;
-            std::vector<double> params;
-            if(cut.has_field("parameters"))
-                params = cut.get_double_vector("parameters");
-            auto factory = CutFactoryRegistry<RType>::instance().get(cut_name);
-            if(invert)
+            size_t w = p / 64;
+            uint64_t bit = uint64_t(1) << (p % 64);
+            if(!(known[w] & bit))
             {
-                // If the cut is inverted, we need to negate the function.
-                auto fn = factory(params);
-                reco_cut_functions.push_back([fn](const RType & e) { return !fn(e); });
+                known[w] |= bit;
+                if(predicates_[p](e))
+                    results[w] |= bit;
             }
-            else
-                // Otherwise, we just add the function as is.
-                reco_cut_functions.push_back(factory(params));
+            if((results[w] & bit) != (c.value[w] & bit))
+            {
+                passed = false;
+                break;
+            }
+        }
+        if(passed)
+            return i;
+    }
+    return std::numeric_limits<double>::quiet_NaN(); // No category matched.
+}
+
+// Constructor for the Cutflow class.
+Cutflow::Cutflow(const std::vector<cfg::ConfigurationTable> & cuts, Mode mode, bool ismc)
+    : mode_(mode), ismc_(ismc), first_interaction_(cuts.size())
+{
+    for(const auto & cut : cuts)
+    {
+        // Retrieve the cut name and check for negation.
+        std::string cut_base = cut.get_string_field("name");
+        bool invert = false;
+        if(cut_base.at(0) == '!')
+        {
+            invert = true;
+            cut_base = cut_base.substr(1); // Remove the negation character.
         }
-        else if(cut.get_string_field("type") == "true_particle")
+        std::string label = cut.get_string_field("name");
+
+        // Load parameters (if any) for the cut.
+        std::vector<double> params;
+        if(cut.has_field("parameters"))
+            params = cut.get_double_vector("parameters");
+
+        std::string type = cut.get_string_field("type");
+        if(type == "event")
         {
-            std::string cut_name = "true_particle_" + name;
-            std::vector<double> params;
-            if(cut.has_field("parameters"))
-                params = cut.get_double_vector("parameters");
-            auto factory = CutFactoryRegistry<TParticleType>::instance().get(cut_name);
-            if(invert)
+            stages_.push_back(Stage{label, Level::Event, event_cuts_.size()});
+            event_cuts_.push_back(bind_cut<EventType>("event_" + cut_base, params, invert));
+        }
+        else if(type == "spill")
+        {
+            stages_.push_back(Stage{label, Level::Spill, spill_cuts_.size()});
+            spill_cuts_.push_back(bind_cut<SpillType>("spill_" + cut_base, params, invert));
+        }
+        else if(type == "true")
+        {
+            stages_.push_back(Stage{label, Level::True, true_cuts_.size()});
+            true_cuts_.push_back(bind_cut<TType>("true_" + cut_base, params, invert));
+        }
+        else if(type == "reco")
+        {
+            stages_.push_back(Stage{label, Level::Reco, reco_cuts_.size()});
+            reco_cuts_.push_back(bind_cut<RType>("reco_" + cut_base, params, invert));
+        }
+        else if(type == "true_particle")
+        {
+            stages_.push_back(Stage{label, Level::TrueParticle, true_particle_cuts_.size()});
+            true_particle_cuts_.push_back(bind_cut<TParticleType>("true_particle_" + cut_base, params, invert));
+        }
+        else if(type == "reco_particle")
+        {
+            stages_.push_back(Stage{label, Level::RecoParticle, reco_particle_cuts_.size()});
+            reco_particle_cuts_.push_back(bind_cut<RParticleType>("reco_particle_" + cut_base, params, invert));
+        }
+        else
+        {
+            throw std::runtime_error("Illegal cut type '" + type + "' for cut " + label);
+        }
+
+        // Interaction cuts are only applied in the interaction loops.
+        if(first_interaction_ == cuts.size() && mode_ != Mode::Event && (type == "true" || type == "reco"))
+            first_interaction_ = stages_.size() - 1;
+    }
+
+    // The category breakdown is only available for MC.
+    if(ismc_ && VarFactoryRegistry<TType>::instance().is_registered("true_category"))
+        category_ = VarFactoryRegistry<TType>::instance().get("true_category")(std::vector<double>{});
+
+    counts_.resize(stages_.size() + 1);
+}
+
+// Add an object to the counts of the leading stages.
+void Cutflow::add(std::vector<Counts> & counts, size_t passed, double Counts::* field, double value)
+{
+    for(size_t k(0); k <= passed; ++k)
+        counts[k].*field += value;
+}
+
+// Accumulate the cutflow for a single record.
+void Cutflow::fill(const EventType & sr, const MatchIndex * matches)
+{
+    const size_t n = stages_.size();
+
+    /**
+     * @brief Apply the event and spill cuts.
+     * @details The event survives the leading stages up to the first failing
+     * event or spill cut. The exposure is only decremented by the event cuts
+     * on the record, as the spill cuts are applied to each spill below.
+     */
+    size_t event_passed(n), exposure_passed(n);
+    for(size_t k(0); k < n && exposure_passed == n; ++k)
+    {
+        const Stage & s = stages_[k];
+        if(s.level == Level::Event && !event_cuts_[s.index](sr))
+        {
+            event_passed = std::min(event_passed, k);
+            exposure_passed = k;
+        }
+        else if(s.level == Level::Spill && !ismc_ && !spill_cuts_[s.index](sr.hdr.spillbnbinfo))
+            event_passed = std::min(event_passed, k);
+    }
+
+    // Accumulate the exposure of the record.
+    if(ismc_)
+    {
+        if(sr.hdr.first_in_subrun)
+            add(counts_, exposure_passed, &Counts::exposure, (double)sr.hdr.pot);
+    }
+    else
+    {
+        for(const auto & bnb : sr.hdr.bnbinfo)
+        {
+            size_t spill_passed(exposure_passed);
+            for(size_t k(0); k < spill_passed; ++k)
             {
-                // If the cut is inverted, we need to negate the function.
-                auto fn = factory(params);
-                true_particle_cut_functions.push_back([fn](const TParticleType & e) { return !fn(e); });
+                const Stage & s = stages_[k];
+                if(s.level == Level::Spill && !spill_cuts_[s.index](bnb))
+                    spill_passed = k;
             }
-            else
-                // Otherwise, we just add the function as is.
-                true_particle_cut_functions.push_back(factory(params));
+            add(counts_, spill_passed, &Counts::exposure, (double)bnb.TOR875);
         }
-        else if(cut.get_string_field("type") == "reco_particle")
+    }
+
+    /**
+     * @brief Apply the interaction and particle cuts.
+     * @details A generic loop over the broadcast interactions of the mode.
+     * The complementary cuts are applied to the match of the interaction,
+     * and only the particle cuts of the broadcast type are applied (as in
+     * @ref SelectionPass).
+     */
+    size_t interaction_passed(std::min(event_passed, first_interaction_));
+    std::map<int64_t, size_t> category_passed;
+    auto loop = [&](const auto & interactions, auto broadcast, auto complement, auto particle_level,
+                    const auto & cuts, const auto & complement_cuts, const auto & particle_cuts,
+                    const auto & match_of, const auto & complement_of)
+    {
+        for(size_t idx(0); idx < interactions.size(); ++idx)
         {
-            std::string cut_name = "reco_particle_" + name;
-            std::vector<double> params;
-            if(cut.has_field("parameters"))
-                params = cut.get_double_vector("parameters");
-            auto factory = CutFactoryRegistry<RParticleType>::instance().get(cut_name);
-            if(invert)
+            const auto & interaction = interactions[idx];
+            size_t match = match_of(idx);
+            size_t passed(event_passed);
+            for(size_t k(0); k < passed; ++k)
+            {
+                const Stage & s = stages_[k];
+                if(s.level == broadcast && !cuts[s.index](interaction))
+                    passed = k;
+                else if(s.level == complement && ismc_ && (match == kNoMatch || !complement_cuts[s.index](complement_of(match))))
+                    passed = k;
+            }
+            add(counts_, passed, &Counts::interactions);
+            interaction_passed = std::max(interaction_passed, passed);
+
+            // Category of the (true) interaction.
+            int64_t category(-1);
+            if(category_)
+            {
+                const TType * t = (mode_ == Mode::True) ? &sr.dlp_true[idx] : (match != kNoMatch ? &sr.dlp_true[match] : nullptr);
+                double value = t ? (*category_)(*t) : std::numeric_limits<double>::quiet_NaN();
+                if(!std::isnan(value))
+                    category = (int64_t)value;
+                auto & counts = category_counts_[category];
+                counts.resize(n + 1);
+                add(counts, passed, &Counts::interactions);
+                auto it = category_passed.find(category);
+                if(it == category_passed.end())
+                    category_passed.emplace(category, passed);
+                else
+                    it->second = std::max(it->second, passed);
+            }
+
+            // Apply the particle cuts to the particles of the interaction.
+            for(const auto & p : interaction.particles)
             {
-                // If the cut is inverted, we need to negate the function.
-                auto fn = factory(params);
-                reco_particle_cut_functions.push_back([fn](const RParticleType & e) { return !fn(e); });
+                size_t ppassed(passed);
+                for(size_t k(0); k < ppassed; ++k)
+                {
+                    const Stage & s = stages_[k];
+                    if(s.level == particle_level && !particle_cuts[s.index](p))
+                        ppassed = k;
+                }
+                add(counts_, ppassed, &Counts::particles);
+                if(category_)
+                    add(category_counts_[category], ppassed, &Counts::particles);
             }
-            else
-                // Otherwise, we just add the function as is.
-                reco_particle_cut_functions.push_back(factory(params));
         }
-        else if(cut.get_string_field("type") == "event")
+    };
+    if(mode_ == Mode::True)
+    {
+        loop(sr.dlp_true, Level::True, Level::Reco, Level::TrueParticle, true_cuts_, reco_cuts_, true_particle_cuts_,
+             [matches](size_t i) { return matches->true_to_reco(i); },
+             [&sr](size_t m) -> const RType & { return sr.dlp[m]; });
+    }
+    else if(mode_ == Mode::Reco)
+    {
+        loop(sr.dlp, Level::Reco, Level::True, Level::RecoParticle, reco_cuts_, true_cuts_, reco_particle_cuts_,
+             [matches](size_t i) { return matches->reco_to_true(i); },
+             [&sr](size_t m) -> const TType & { return sr.dlp_true[m]; });
+    }
+    else
+        interaction_passed = event_passed;
+
+    // Accumulate the surviving events.
+    add(counts_, interaction_passed, &Counts::events);
+    for(const auto & [category, passed] : category_passed)
+        add(category_counts_[category], passed, &Counts::events);
+}
+
+// Write the cutflow as TTrees to a directory.
+void Cutflow::write(TDirectory * dir, const std::string & name) const
+{
+    dir->cd();
+    int stage;
+    std::string cut;
+    Long64_t category;
+    double events, interactions, particles, exposure;
+
+    TTree * tree = new TTree((name + "_cutflow").c_str(), (name + "_cutflow").c_str());
+    tree->Branch("stage", &stage);
+    tree->Branch("cut", &cut);
+    tree->Branch("events", &events);
+    tree->Branch("interactions", &interactions);
+    tree->Branch("particles", &particles);
+    tree->Branch("exposure", &exposure);
+    for(size_t k(0); k < counts_.size(); ++k)
+    {
+        stage = k;
+        cut = (k == 0) ? "none" : stages_[k - 1].name;
+        events = counts_[k].events;
+        interactions = counts_[k].interactions;
+        particles = counts_[k].particles;
+        exposure = counts_[k].exposure;
+        tree->Fill();
+    }
+    tree->Write();
+    delete tree;
+
+    if(!category_)
+        return;
+    tree = new TTree((name + "_cutflow_category").c_str(), (name + "_cutflow_category").c_str());
+    tree->Branch("stage", &stage);
+    tree->Branch("cut", &cut);
+    tree->Branch("category", &category);
+    tree->Branch("events", &events);
+    tree->Branch("interactions", &interactions);
+    tree->Branch("particles", &particles);
+    for(const auto & [c, counts] : category_counts_)
+    {
+        for(size_t k(0); k < counts.size(); ++k)
         {
-            std::string cut_name = "event_" + name;
-            std::vector<double> params;
-            if(cut.has_field("parameters"))
-                params = cut.get_double_vector("parameters");
-            auto factory = CutFactoryRegistry<EventType>::instance().get(cut_name);
-            if(invert)
-            {
-                // If the cut is inverted, we need to negate the function.
-                auto fn = factory(params);
-                event_cut_functions.push_back([fn](const EventType & e) { return !fn(e); });
-            }
-            else
-                // Otherwise, we just add the function as is.
-                event_cut_functions.push_back(factory(params));
+            stage = k;
+            cut = (k == 0) ? "none" : stages_[k - 1].name;
+            category = c;
+            events = counts[k].events;
+            interactions = counts[k].interactions;
+            particles = counts[k].particles;
+            tree->Fill();
+        }
+    }
+    tree->Write();
+    delete tree;
+}
+
+// Parse the operation mode of a selection.
+Mode parse_mode(const std::string & mode)
+{
+    if(mode == "true") return Mode::True;
+    else if(mode == "reco") return Mode::Reco;
+    else if(mode == "event") return Mode::Event;
+    else throw std::runtime_error("Illegal mode '" + mode + "' for selection.");
+}
+
+// Parse the [[tree.cut]] subtables of a tree.
+std::vector<CutSpec> parse_cuts(const std::vector<cfg::ConfigurationTable> & cuts)
+{
+    std::vector<CutSpec> specs;
+    for(const auto & cut : cuts)
+    {
+        // Retrieve the cut name and check for negation.
+        CutSpec spec;
+        spec.name = cut.get_string_field("name");
+        if(spec.name.at(0) == '!')
+        {
+            spec.invert = true;
+            spec.name = spec.name.substr(1); // Remove the negation character.
         }
-        else if(cut.get_string_field("type") == "spill")
+
+        if(!cut.has_field("type"))
+            throw std::runtime_error("Cut " + spec.name + " does not have a type field.");
+        spec.type = cut.get_string_field("type");
+        if(spec.type != "true" && spec.type != "reco" && spec.type != "true_particle"
+           && spec.type != "reco_particle" && spec.type != "event" && spec.type != "spill")
+            throw std::runtime_error("Illegal cut type '" + spec.type + "' for cut " + cut.get_string_field("name"));
+
+        // Load parameters (if any) for the cut.
+        if(cut.has_field("parameters"))
+            spec.params = cut.get_double_vector("parameters");
+        specs.push_back(spec);
+    }
+    return specs;
+}
+
+// Check if the function implementing a cut is registered.
+bool is_registered(const CutSpec & cut)
+{
+    std::string name = cut.type + "_" + cut.name;
+    if(cut.type == "true")
+        return FastCutRegistry<TType>::instance().is_registered(name) || CutFactoryRegistry<TType>::instance().is_registered(name);
+    else if(cut.type == "reco")
+        return FastCutRegistry<RType>::instance().is_registered(name) || CutFactoryRegistry<RType>::instance().is_registered(name);
+    else if(cut.type == "true_particle")
+        return FastCutRegistry<TParticleType>::instance().is_registered(name) || CutFactoryRegistry<TParticleType>::instance().is_registered(name);
+    else if(cut.type == "reco_particle")
+        return FastCutRegistry<RParticleType>::instance().is_registered(name) || CutFactoryRegistry<RParticleType>::instance().is_registered(name);
+    else if(cut.type == "event")
+        return FastCutRegistry<EventType>::instance().is_registered(name) || CutFactoryRegistry<EventType>::instance().is_registered(name);
+    else if(cut.type == "spill")
+        return FastCutRegistry<SpillType>::instance().is_registered(name);
+    return false;
+}
+
+// Constructor for the SelectionPass class.
+SelectionPass::SelectionPass(const std::vector<cfg::ConfigurationTable> & cuts,
+                             const std::string & mode,
+                             const bool ismc,
+                             const std::string & name,
+                             const AdaptiveCutOrder & adaptive)
+    : SelectionPass(parse_cuts(cuts), parse_mode(mode), ismc, name, adaptive) {}
+
+// Constructor for the SelectionPass class from parsed cuts.
+SelectionPass::SelectionPass(const std::vector<CutSpec> & cuts,
+                             Mode mode,
+                             const bool ismc,
+                             const std::string & name,
+                             const AdaptiveCutOrder & adaptive)
+    : mode_(mode), ismc_(ismc), name_(name)
+{
+    for(const auto & cut : cuts)
+    {
+        if(cut.type == "true")
+            true_cut_.add("true_" + cut.name, cut.params, cut.invert);
+        else if(cut.type == "reco")
+            reco_cut_.add("reco_" + cut.name, cut.params, cut.invert);
+        else if(cut.type == "true_particle")
+            true_particle_cut_.add("true_particle_" + cut.name, cut.params, cut.invert);
+        else if(cut.type == "reco_particle")
+            reco_particle_cut_.add("reco_particle_" + cut.name, cut.params, cut.invert);
+        else if(cut.type == "event")
+            event_cut_.add("event_" + cut.name, cut.params, cut.invert);
+        else if(cut.type == "spill")
         {
-            std::string cut_name = "spill_" + name;
-            std::vector<double> params;
-            if(cut.has_field("parameters"))
-                params = cut.get_double_vector("parameters");
-            auto factory = CutFactoryRegistry<SpillType>::instance().get(cut_name);
+            std::string cut_name = "spill_" + cut.name;
+            std::string label = (cut.invert ? "!" : "") + cut_name;
+            BoundFn<SpillType, bool> spill_fn{FastCutRegistry<SpillType>::instance().get(cut_name), cut.params};
 
-            // Transform this to a simple event-level cut.
-            auto fn = [factory, params](const EventType & e) {
+            // Transform this to a simple event-level cut. The spill cut is
+            // not applied (nor inverted) on MC, so the inversion is handled
+            // here rather than by the chain.
+            event_cut_.add(label, [spill_fn, invert = cut.invert](const EventType & e) {
                 if(!e.hdr.ismc)
-                    return factory(params)(e.hdr.spillbnbinfo);
+                    return spill_fn(e.hdr.spillbnbinfo) != invert;
                 else
                     return true; // If it's MC, we don't apply the spill cut.
-            };
-            if(invert)
-            {
-                // If the cut is inverted, we need to negate the function.
-                event_cut_functions.push_back([fn](const EventType & e) {
-                    if(!e.hdr.ismc)
-                        return !fn(e);
-                    else
-                        return true; // If it's MC, we don't invert.
-                });
-            }
-            else
-                // Otherwise, we just add the function as is.
-                event_cut_functions.push_back(fn);
+            });
         }
         else
         {
-            throw std::runtime_error("Illegal cut type '" + cut.get_string_field("type") + "' for cut " + cut.get_string_field("name"));
+            throw std::runtime_error("Illegal cut type '" + cut.type + "' for cut " + cut.name);
         }
     }
 
-    /**
-     * @brief Compose a common cut function.
-     * @details This function composes a common cut function from the
-     * subtables of the cuts vector. This is a logical "and" of all
-     * configured cuts constructed using std::all_of.
-     */
-    auto true_cut = [true_cut_functions](const TType & e) -> bool {
-        return std::all_of(true_cut_functions.begin(), true_cut_functions.end(), [&e](auto & f) { return f(e); });
-    };
-    auto reco_cut = [reco_cut_functions](const RType & e) -> bool {
-        return std::all_of(reco_cut_functions.begin(), reco_cut_functions.end(), [&e](auto & f) { return f(e); });
-    };
-    auto true_particle_cut = [true_particle_cut_functions](const TParticleType & e) -> bool {
-        return std::all_of(true_particle_cut_functions.begin(), true_particle_cut_functions.end(), [&e](auto & f) { return f(e); });
-    };
-    auto reco_particle_cut = [reco_particle_cut_functions](const RParticleType & e) -> bool {
-        return std::all_of(reco_particle_cut_functions.begin(), reco_particle_cut_functions.end(), [&e](auto & f) { return f(e); });
-    };
-    auto event_cut = [event_cut_functions](const EventType & e) -> bool {
-        return std::all_of(event_cut_functions.begin(), event_cut_functions.end(), [&e](auto & f) { return f(e); });
-    };
+    // Enable the adaptive ordering of the cuts (if configured).
+    if(adaptive.enabled)
+    {
+        true_cut_.configure(adaptive, name + ":true");
+        reco_cut_.configure(adaptive, name + ":reco");
+        true_particle_cut_.configure(adaptive, name + ":true_particle");
+        reco_particle_cut_.configure(adaptive, name + ":reco_particle");
+        event_cut_.configure(adaptive, name + ":event");
+    }
+
+    // Attach the profiling counters (if enabled).
+    if(Profiler::instance().enabled())
+    {
+        true_cut_.instrument(name, "true_cut");
+        reco_cut_.instrument(name, "reco_cut");
+        true_particle_cut_.instrument(name, "true_particle_cut");
+        reco_particle_cut_.instrument(name, "reco_particle_cut");
+        event_cut_.instrument(name, "event_cut");
+    }
+}
 
-    if(exec_mode == Mode::True)
+// Apply the selection to the record (if not already done).
+const SelectionResult & SelectionPass::evaluate(const EventType & sr, bool with_particles)
+{
+    RecordKey k = current_record();
+    if(!current_ || *current_ != k)
     {
+        current_ = k;
+        ParticleCache<TParticleType>::instance().advance(k);
+        ParticleCache<RParticleType>::instance().advance(k);
+        GeometryCache<TType>::instance().advance(k);
+        GeometryCache<RType>::instance().advance(k);
+        true_cut_.next_record();
+        reco_cut_.next_record();
+        true_particle_cut_.next_record();
+        reco_particle_cut_.next_record();
+        event_cut_.next_record();
+        // The event mode has no interaction loop, and the interaction
+        // branches may be pruned (see required_branches).
+        const MatchIndex * matches = (mode_ == Mode::Event) ? nullptr : &MatchIndex::get(sr);
+        if(cutflow_)
+            cutflow_->fill(sr, matches);
+        result_.event_passed = false;
+        result_.particles_evaluated = false;
+        result_.candidates.clear();
+        result_.particles.clear();
+
         /**
-         * @brief Read the branch variable configuration.
-         * @details This function constructs the branch variable from the TOML
-         * configuration of the variable. The variable name is used to retrieve the
-         * function from the registry.
+         * @brief Apply the cuts to the record.
+         * @details Each type of cut is a logical "and" of all configured cuts
+         * of that type (see @ref CutChain). The event cut is applied first
+         * and short-circuits the selection of interactions.
          */
-        std::string var_name = var.get_string_field("name");
-        std::string var_type = (override_type.empty() ? var.get_string_field("type") : override_type);
-        std::vector<double> varPars;
-        if(var.has_field("parameters"))
-            varPars = var.get_double_vector("parameters");
-
-        if(var_type == "true" || (var.has_field("selector") && var_type == "true_particle"))
+        result_.event_passed = event_cut_(sr);
+        if(result_.event_passed && mode_ == Mode::True)
         {
-            if(var.has_field("selector"))
+            // Iterate over the true interactions.
+            for(size_t n(0); n < sr.dlp_true.size(); ++n)
             {
-                // Full name for the variable.
-                std::string full_name = "true_" + var.get_string_field("selector") + "_" + var_name;
+                auto const & i = sr.dlp_true[n];
+                if(!true_cut_(i))
+                    continue;
 
-                // Retrieve the selector function.
-                std::string selector_name = "true_" + var.get_string_field("selector");
-                auto selector_factory = SelectorFactoryRegistry<TType>::instance().get(selector_name);
-                auto selector = selector_factory(std::vector<double>{});
-                                
-                // Retrieve the particle-level variable function.
-                var_name = "true_particle_" + var_name;
-                auto factory = VarFactoryRegistry<TParticleType>::instance().get(var_name);
-                auto var_fn = factory(varPars);
-                
-                VarFn<TType> var_fn_with_selector = [var_fn, selector](const TType & e) -> double
+                // Check for match and apply the complementary cuts.
+                size_t match_id = matches->true_to_reco(n);
+                if(reco_cut_.empty() || (match_id != kNoMatch && reco_cut_(sr.dlp[match_id])))
                 {
-                    // Apply the selector to the event.
-                    size_t idx = selector(e);
-                    if(idx == kNoMatch) return kNoMatchValue; // No match found.
-                    // Apply the variable function to the selected particle.
-                    return var_fn(e.particles[idx]);
-                };
-                return std::make_pair(full_name, spill_multivar_helper<TType, RType, TParticleType, TType>(
-                    true_cut,
-                    reco_cut_functions.empty() ? std::nullopt : std::optional<CutFn<RType>>(reco_cut),
-                    true_particle_cut,
-                    var_fn_with_selector,
-                    event_cut,
-                    ismc));
-            }
-            else
-            {
-                var_name = "true_" + var_name;
-                auto factory = VarFactoryRegistry<TType>::instance().get(var_name);
-                auto var_fn = factory(varPars);
-                return std::make_pair(var_name, spill_multivar_helper<TType, RType, TParticleType, TType>(
-                    true_cut,
-                    reco_cut_functions.empty() ? std::nullopt : std::optional<CutFn<RType>>(reco_cut),
-                    true_particle_cut,
-                    var_fn,
-                    event_cut,
-                    ismc));
+                    result_.candidates.push_back(SelectionCandidate{n, match_id, true, 0, 0});
+                }
             }
         }
-        
-        else if(var_type == "reco" || (var.has_field("selector") && var_type == "reco_particle"))
+        else if(result_.event_passed && mode_ == Mode::Reco)
         {
-            if(var.has_field("selector"))
+            // Iterate over the reco interactions.
+            for(size_t n(0); n < sr.dlp.size(); ++n)
             {
-                // Full name for the variable.
-                std::string full_name = "reco_" + var.get_string_field("selector") + "_" + var_name;
+                auto const & i = sr.dlp[n];
+                if(!reco_cut_(i))
+                    continue;
 
-                // Retrieve the selector function.
-                std::string selector_name = "reco_" + var.get_string_field("selector");
-                auto selector_factory = SelectorFactoryRegistry<RType>::instance().get(selector_name);
-                auto selector = selector_factory(std::vector<double>{});
-                                
-                // Retrieve the particle-level variable function.
-                var_name = "reco_particle_" + var_name;
-                auto factory = VarFactoryRegistry<RParticleType>::instance().get(var_name);
-                auto var_fn = factory(varPars);
-                
-                VarFn<RType> var_fn_with_selector = [var_fn, selector](const RType & e) -> double
-                {
-                    // Apply the selector to the event.
-                    size_t idx = selector(e);
-                    if(idx == kNoMatch) return kNoMatchValue; // No match found.
-                    // Apply the variable function to the selected particle.
-                    return var_fn(e.particles[idx]);
-                };
-                return std::make_pair(full_name, spill_multivar_helper<TType, RType, TParticleType, RType>(
-                    true_cut,
-                    reco_cut_functions.empty() ? std::nullopt : std::optional<CutFn<RType>>(reco_cut),
-                    true_particle_cut,
-                    var_fn_with_selector,
-                    event_cut,
-                    ismc));
+                // Check for match and apply the complementary cuts. Data has
+                // no truth information, so non-particle variables are filled
+                // regardless of the complementary cuts (the "strict" flag
+                // preserves this distinction for particle variables).
+                size_t match_id = matches->reco_to_true(n);
+                bool strict = true_cut_.empty() || (match_id != kNoMatch && true_cut_(sr.dlp_true[match_id]));
+                if(strict || !ismc_)
+                    result_.candidates.push_back(SelectionCandidate{n, match_id, strict, 0, 0});
             }
-            else
-            {
-                var_name = "reco_" + var_name;
-                auto factory = VarFactoryRegistry<RType>::instance().get(var_name);
-                auto var_fn = factory(varPars);
-                return std::make_pair(var_name, spill_multivar_helper<TType, RType, TParticleType, RType>(
-                    true_cut,
-                    reco_cut_functions.empty() ? std::nullopt : std::optional<CutFn<RType>>(reco_cut),
-                    true_particle_cut,
-                    var_fn,
-                    event_cut,
-                    ismc));
-            }
-        }
-        else if(var_type == "mctruth")
-        {
-            var_name = "true_" + var_name;
-            auto factory = VarFactoryRegistry<MCTruth>::instance().get(var_name);
-            auto var_fn = factory(varPars);
-            return std::make_pair(var_name, spill_multivar_helper<TType, RType, TParticleType, MCTruth>(
-                true_cut,
-                reco_cut_functions.empty() ? std::nullopt : std::optional<CutFn<RType>>(reco_cut),
-                true_particle_cut,
-                var_fn,
-                event_cut,
-                ismc));
-        }
-        else if(var_type == "true_particle")
-        {
-            var_name = "true_particle_" + var_name;
-            auto factory = VarFactoryRegistry<TParticleType>::instance().get(var_name);
-            auto var_fn = factory(varPars);
-            return std::make_pair(var_name, spill_multivar_helper<TType, RType, TParticleType, TParticleType>(
-                true_cut,
-                reco_cut_functions.empty() ? std::nullopt : std::optional<CutFn<RType>>(reco_cut),
-                true_particle_cut,
-                var_fn,
-                event_cut,
-                ismc));
         }
-        else if(var_type == "reco_particle")
+    }
+
+    if(with_particles && !result_.particles_evaluated)
+        evaluate_particles(sr);
+
+    return result_;
+}
+
+// Apply the particle cuts to all strictly passing candidates.
+void SelectionPass::evaluate_particles(const EventType & sr)
+{
+    for(auto & c : result_.candidates)
+    {
+        c.pbegin = result_.particles.size();
+        if(c.strict && mode_ == Mode::True)
         {
-            var_name = "reco_particle_" + var_name;
-            auto factory = VarFactoryRegistry<RParticleType>::instance().get(var_name);
-            auto var_fn = factory(varPars);
-            return std::make_pair(var_name, spill_multivar_helper<TType, RType, TParticleType, RParticleType>(
-                true_cut,
-                reco_cut_functions.empty() ? std::nullopt : std::optional<CutFn<RType>>(reco_cut),
-                true_particle_cut,
-                var_fn,
-                event_cut,
-                ismc));
+            auto const & particles = sr.dlp_true[c.index].particles;
+            for(size_t j(0); j < particles.size(); ++j)
+            {
+                auto const & p = particles[j];
+                if(true_particle_cut_(p))
+                    result_.particles.push_back(j);
+            }
         }
-        else
+        else if(c.strict && mode_ == Mode::Reco)
         {
-            throw std::runtime_error("Illegal variable type '" + var_type + "' for variable " + var_name);
+            auto const & particles = sr.dlp[c.index].particles;
+            for(size_t j(0); j < particles.size(); ++j)
+            {
+                auto const & p = particles[j];
+                if(reco_particle_cut_(p))
+                    result_.particles.push_back(j);
+            }
         }
+        c.pend = result_.particles.size();
     }
-    else if(exec_mode == Mode::Reco)
-    {
-        /**
-         * @brief Read the branch variable configuration.
-         * @details This function constructs the branch variable from the TOML
-         * configuration of the variable. The variable name is used to retrieve the
-         * function from the registry.
-         */
-        std::string var_name = var.get_string_field("name");
-        std::string var_type = (override_type.empty() ? var.get_string_field("type") : override_type);
-        std::vector<double> varPars;
-        if(var.has_field("parameters"))
-            varPars = var.get_double_vector("parameters");
+    result_.particles_evaluated = true;
+}
+
+// Build a single SpillMultiVar for a single branch variable.
+NamedSpillMultiVar construct(const std::vector<cfg::ConfigurationTable> & cuts,
+                             const cfg::ConfigurationTable & var,
+                             const std::string & mode,
+                             const std::string & override_type,
+                             const bool ismc)
+{
+    return construct(std::make_shared<SelectionPass>(cuts, mode, ismc), var, override_type);
+}
+
+/**
+ * @brief Bind a registered variable and pass it to a callable.
+ * @details The variable is looked up in the fast registry first, falling back
+ * to the factory registry (e.g., for the dynamically registered
+ * "true_category") if it is not found. As the two paths have different types,
+ * the bound variable is passed to @p f instead of being returned.
+ * If the profiling mode is enabled, the variable is wrapped with profiling
+ * counters (see @ref with_profile).
+ * @tparam EventT The type of object the variable is applied to.
+ * @tparam F The type of the callable receiving the bound variable.
+ * @param scope The scope of the variable ("<sample>/<tree>").
+ * @param name The full name of the variable in the registry.
+ * @param params The parameters of the variable.
+ * @param f The callable receiving the bound variable.
+ * @return The result of @p f.
+ */
+template<typename EventT, typename F>
+auto with_var(const std::string & scope, const std::string & name, const std::vector<double> & params, F && f)
+{
+    if(FastVarRegistry<EventT>::instance().is_registered(name))
+        return with_profile(scope, "var", name, BoundFn<EventT, double>{FastVarRegistry<EventT>::instance().get(name), params}, f);
+    else
+        return with_profile(scope, "var", name, VarFactoryRegistry<EventT>::instance().get(name)(params), f);
+}
+
+/**
+ * @brief Bind a registered selector and particle variable and pass the
+ * composed interaction variable to a callable.
+ * @details The selector picks a single particle from the interaction, and the
+ * particle variable is applied to it. Both are looked up in the fast
+ * registries first, falling back to the factory registries.
+ * @tparam EventT The type of interaction the selector is applied to.
+ * @tparam ParticleT The type of particle the variable is applied to.
+ * @tparam F The type of the callable receiving the composed variable.
+ * @param scope The scope of the variable ("<sample>/<tree>").
+ * @param selector_name The full name of the selector in the registry.
+ * @param name The full name of the particle variable in the registry.
+ * @param params The parameters of the particle variable.
+ * @param f The callable receiving the composed variable.
+ * @return The result of @p f.
+ */
+template<typename EventT, typename ParticleT, typename F>
+auto with_selected_var(const std::string & scope, const std::string & selector_name, const std::string & name, const std::vector<double> & params, F && f)
+{
+    return with_var<ParticleT>(scope, name, params, [&](const auto & pvar_fn) {
+        auto compose = [&](const auto & selector) {
+            auto var_fn = [pvar_fn, selector](const EventT & e) -> double
+            {
+                // Apply the selector to the event.
+                size_t idx = selector(e);
+                if(idx == kNoMatch) return kNoMatchValue; // No match found.
+                // Apply the variable function to the selected particle.
+                return pvar_fn(e.particles[idx]);
+            };
+            return f(var_fn);
+        };
+        if(FastSelectorRegistry<EventT>::instance().is_registered(selector_name))
+            return with_profile(scope, "selector", selector_name, BoundFn<EventT, size_t>{FastSelectorRegistry<EventT>::instance().get(selector_name), {}}, compose);
+        else
+            return with_profile(scope, "selector", selector_name, SelectorFactoryRegistry<EventT>::instance().get(selector_name)(std::vector<double>{}), compose);
+    });
+}
+
+// Build a single SpillMultiVar for a single branch variable using a shared
+// selection pass.
+NamedSpillMultiVar construct(const std::shared_ptr<SelectionPass> & selection,
+                             const cfg::ConfigurationTable & var,
+                             const std::string & override_type)
+{
+    NamedVarBinder binder = compile(var, selection->mode(), override_type, selection->name());
+    return std::make_pair(binder.first, binder.second(selection));
+}
+
+// Resolve a single branch variable into a reusable binder.
+NamedVarBinder compile(const cfg::ConfigurationTable & var,
+                       Mode mode,
+                       const std::string & override_type,
+                       const std::string & scope)
+{
+    /**
+     * @brief Read the branch variable configuration.
+     * @details This function constructs the branch variable from the TOML
+     * configuration of the variable. The variable name is used to retrieve the
+     * function from the registry.
+     */
+    std::string var_name = var.get_string_field("name");
+    std::string var_type = (override_type.empty() ? var.get_string_field("type") : override_type);
+    std::vector<double> varPars;
+    if(var.has_field("parameters"))
+        varPars = var.get_double_vector("parameters");
+
+    /**
+     * @brief Build the binder for the bound variable.
+     * @details The loop type (true or reco) is determined by the mode of the
+     * selection, and the variable type by the type of the bound variable.
+     * The bound variable is captured by value, so the binder can be applied
+     * to the selection pass of any sample.
+     */
+    auto helper = [mode](auto var_on, const auto & var_fn) -> VarBinder {
+        using VarOn = typename decltype(var_on)::type;
+        using VarT = std::decay_t<decltype(var_fn)>;
+        if(mode == Mode::True)
+            return [var_fn](const std::shared_ptr<SelectionPass> & selection) { return spill_multivar_helper<TType, VarOn, VarT>(selection, var_fn); };
+        else
+            return [var_fn](const std::shared_ptr<SelectionPass> & selection) { return spill_multivar_helper<RType, VarOn, VarT>(selection, var_fn); };
+    };
 
+    if(mode == Mode::True || mode == Mode::Reco)
+    {
         if(var_type == "true" || (var.has_field("selector") && var_type == "true_particle"))
         {
             if(var.has_field("selector"))
             {
                 // Full name for the variable.
                 std::string full_name = "true_" + var.get_string_field("selector") + "_" + var_name;
-
-                // Retrieve the selector function.
-                std::string selector_name = "true_" + var.get_string_field("selector");
-                auto selector_factory = SelectorFactoryRegistry<TType>::instance().get(selector_name);
-                auto selector = selector_factory(std::vector<double>{});
-                                
-                // Retrieve the particle-level variable function.
-                var_name = "true_particle_" + var_name;
-                auto factory = VarFactoryRegistry<TParticleType>::instance().get(var_name);
-                auto var_fn = factory(varPars);
-                
-                VarFn<TType> var_fn_with_selector = [var_fn, selector](const TType & e) -> double
-                {
-                    // Apply the selector to the event.
-                    size_t idx = selector(e);
-                    if(idx == kNoMatch) return kNoMatchValue; // No match found.
-                    // Apply the variable function to the selected particle.
-                    return var_fn(e.particles[idx]);
-                };
-                return std::make_pair(full_name, spill_multivar_helper<RType, TType, TParticleType, TType>(
-                    reco_cut,
-                    true_cut_functions.empty() ? std::nullopt : std::optional<CutFn<TType>>(true_cut),
-                    true_particle_cut,
-                    var_fn_with_selector,
-                    event_cut,
-                    ismc));
-            }
-            else
-            {
-                var_name = "true_" + var_name;
-                auto factory = VarFactoryRegistry<TType>::instance().get(var_name);
-                auto var_fn = factory(varPars);
-                return std::make_pair(var_name, spill_multivar_helper<RType, TType, TParticleType, TType>(
-                    reco_cut,
-                    true_cut_functions.empty() ? std::nullopt : std::optional<CutFn<TType>>(true_cut),
-                    true_particle_cut,
-                    var_fn,
-                    event_cut,
-                    ismc));
+                return with_selected_var<TType, TParticleType>(scope, "true_" + var.get_string_field("selector"), "true_particle_" + var_name, varPars, [&](const auto & var_fn) {
+                    return NamedVarBinder(full_name, helper(std::common_type<TType>{}, var_fn));
+                });
             }
+            var_name = "true_" + var_name;
+            return with_var<TType>(scope, var_name, varPars, [&](const auto & var_fn) {
+                return NamedVarBinder(var_name, helper(std::common_type<TType>{}, var_fn));
+            });
         }
         else if(var_type == "reco" || (var.has_field("selector") && var_type == "reco_particle"))
         {
@@ -460,85 +1560,35 @@ NamedSpillMultiVar construct(const std::vector<cfg::ConfigurationTable> & cuts,
             {
                 // Full name for the variable.
                 std::string full_name = "reco_" + var.get_string_field("selector") + "_" + var_name;
-
-                // Retrieve the selector function.
-                std::string selector_name = "reco_" + var.get_string_field("selector");
-                auto selector_factory = SelectorFactoryRegistry<RType>::instance().get(selector_name);
-                auto selector = selector_factory(std::vector<double>{});
-
-                // Retrieve the particle-level variable function.
-                var_name = "reco_particle_" + var_name;
-                auto factory = VarFactoryRegistry<RParticleType>::instance().get(var_name);
-                auto var_fn = factory(varPars);
-
-                VarFn<RType> var_fn_with_selector = [var_fn, selector](const RType & e) -> double
-                {
-                    // Apply the selector to the event.
-                    size_t idx = selector(e);
-                    if(idx == kNoMatch) return kNoMatchValue; // No match found.
-                    // Apply the variable function to the selected particle.
-                    return var_fn(e.particles[idx]);
-                };
-                return std::make_pair(full_name, spill_multivar_helper<RType, TType, RParticleType, RType>(
-                    reco_cut,
-                    true_cut_functions.empty() ? std::nullopt : std::optional<CutFn<TType>>(true_cut),
-                    reco_particle_cut,
-                    var_fn_with_selector,
-                    event_cut,
-                    ismc));
-            }
-            else
-            {
-                var_name = "reco_" + var_name;
-                auto factory = VarFactoryRegistry<RType>::instance().get(var_name);
-                auto var_fn = factory(varPars);
-                return std::make_pair(var_name, spill_multivar_helper<RType, TType, TParticleType, RType>(
-                    reco_cut,
-                    true_cut_functions.empty() ? std::nullopt : std::optional<CutFn<TType>>(true_cut),
-                    true_particle_cut,
-                    var_fn,
-                    event_cut,
-                    ismc));
+                return with_selected_var<RType, RParticleType>(scope, "reco_" + var.get_string_field("selector"), "reco_particle_" + var_name, varPars, [&](const auto & var_fn) {
+                    return NamedVarBinder(full_name, helper(std::common_type<RType>{}, var_fn));
+                });
             }
+            var_name = "reco_" + var_name;
+            return with_var<RType>(scope, var_name, varPars, [&](const auto & var_fn) {
+                return NamedVarBinder(var_name, helper(std::common_type<RType>{}, var_fn));
+            });
         }
         else if(var_type == "mctruth")
         {
             var_name = "true_" + var_name;
-            auto factory = VarFactoryRegistry<MCTruth>::instance().get(var_name);
-            auto var_fn = factory(varPars);
-            return std::make_pair(var_name, spill_multivar_helper<RType, TType, TParticleType, MCTruth>(
-                reco_cut,
-                true_cut_functions.empty() ? std::nullopt : std::optional<CutFn<TType>>(true_cut),
-                true_particle_cut,
-                var_fn,
-                event_cut,
-                ismc));
+            return with_var<MCTruth>(scope, var_name, varPars, [&](const auto & var_fn) {
+                return NamedVarBinder(var_name, helper(std::common_type<MCTruth>{}, var_fn));
+            });
         }
         else if(var_type == "true_particle")
         {
             var_name = "true_particle_" + var_name;
-            auto factory = VarFactoryRegistry<TParticleType>::instance().get(var_name);
-            auto var_fn = factory(varPars);
-            return std::make_pair(var_name, spill_multivar_helper<RType, TType, RParticleType, TParticleType>(
-                reco_cut,
-                true_cut_functions.empty() ? std::nullopt : std::optional<CutFn<TType>>(true_cut),
-                reco_particle_cut,
-                var_fn,
-                event_cut,
-                ismc));
+            return with_var<TParticleType>(scope, var_name, varPars, [&](const auto & var_fn) {
+                return NamedVarBinder(var_name, helper(std::common_type<TParticleType>{}, var_fn));
+            });
         }
         else if(var_type == "reco_particle")
         {
             var_name = "reco_particle_" + var_name;
-            auto factory = VarFactoryRegistry<RParticleType>::instance().get(var_name);
-            auto var_fn = factory(varPars);
-            return std::make_pair(var_name, spill_multivar_helper<RType, TType, RParticleType, RParticleType>(
-                reco_cut,
-                true_cut_functions.empty() ? std::nullopt : std::optional<CutFn<TType>>(true_cut),
-                reco_particle_cut,
-                var_fn,
-                event_cut,
-                ismc));
+            return with_var<RParticleType>(scope, var_name, varPars, [&](const auto & var_fn) {
+                return NamedVarBinder(var_name, helper(std::common_type<RParticleType>{}, var_fn));
+            });
         }
         else
         {
@@ -547,24 +1597,14 @@ NamedSpillMultiVar construct(const std::vector<cfg::ConfigurationTable> & cuts,
     }
     else
     {
-        /**
-         * @brief Read the branch variable configuration.
-         * @details This function constructs the branch variable from the TOML
-         * configuration of the variable. The variable name is used to retrieve the
-         * function from the registry.
-         */
-        std::string var_name = var.get_string_field("name");
-        std::string var_type = (override_type.empty() ? var.get_string_field("type") : override_type);
-        std::vector<double> varPars;
-        if(var.has_field("parameters"))
-            varPars = var.get_double_vector("parameters");
-
         if(var_type == "event")
         {
             var_name = "event_" + var_name;
             auto factory = VarFactoryRegistry<EventType>::instance().get(var_name);
-            auto var_fn = factory(varPars);
-            return std::make_pair(var_name, spill_multivar_helper(event_cut, var_fn));
+            return with_profile(scope, "var", var_name, factory(varPars), [&](const auto & var_fn) {
+                VarFn<EventType> event_fn(var_fn);
+                return NamedVarBinder(var_name, [event_fn](const std::shared_ptr<SelectionPass> & selection) { return spill_multivar_helper(selection, event_fn); });
+            });
         }
         else
         {
@@ -574,86 +1614,50 @@ NamedSpillMultiVar construct(const std::vector<cfg::ConfigurationTable> & cuts,
 }
 
 // Helper method for constructing a SpillMultiVar object.
-template<typename CutsOn, typename CompsOn, typename PCutsOn, typename VarOn>
+template<typename CutsOn, typename VarOn, typename VarT>
 ana::SpillMultiVar spill_multivar_helper(
-    const CutFn<CutsOn> & cuts,
-    const std::optional<CutFn<CompsOn>> & comps,
-    const CutFn<PCutsOn> & pcuts,
-    const VarFn<VarOn> & var,
-    const CutFn<EventType> & event_cut,
-    const bool ismc
+    const std::shared_ptr<SelectionPass> & selection,
+    const VarT & var
 )
 {
-    return ana::SpillMultiVar([comps, cuts, pcuts, var, ismc, event_cut](const caf::Proxy<caf::StandardRecord> * sr) -> std::vector<double>
+    return ana::SpillMultiVar([selection, var](const caf::Proxy<caf::StandardRecord> * sr) -> std::vector<double>
     {
         std::vector<double> values;
+        constexpr bool is_particle_var = std::is_same_v<VarOn, TParticleType> || std::is_same_v<VarOn, RParticleType>;
 
-        // Check if this event passes the event cut.
-        if(!event_cut(*sr)) return values;
+        // Retrieve the (shared) result of the selection on this record.
+        const SelectionResult & result = selection->evaluate(*sr, is_particle_var);
+        if(!result.event_passed) return values;
+        const bool ismc = selection->ismc();
 
         // Case: configuration parameter "mode" is set to "true."
         if constexpr (std::is_same_v<CutsOn, TType>)
         {
             // Case: the variable type is a particle type.
-            // If the variable is of the "particle" type, we need to build a
-            // lookup table of matches.
-            std::map<caf::Proxy<int64_t>, const caf::Proxy<caf::SRParticleDLP> *> particles;
-            if constexpr (std::is_same_v<VarOn, TParticleType> || std::is_same_v<VarOn, RParticleType>)
-            {
-                for(auto const& i : sr->dlp)
-                {
-                    for(auto const& j : i.particles)
-                    {
-                        particles.insert(std::make_pair(j.id, &j));
-                    }
-                }
-            }
+            // If the variable is of the "particle" type, we need the lookup
+            // table of particle matches (shared by all variables).
+            const MatchIndex & matches = MatchIndex::get(*sr, std::is_same_v<VarOn, RParticleType>);
 
-            // Iterate over the true interactions.
-            for(auto const& i : sr->dlp_true)
+            // Iterate over the selected true interactions.
+            for(auto const & c : result.candidates)
             {
-                // Check for match
-                size_t match_id = (i.match_ids.size() > 0) ? (size_t)i.match_ids[0] : kNoMatch;
-
+                auto const & i = sr->dlp_true[c.index];
                 if constexpr(std::is_same_v<VarOn, RType>)
-                {
-                    if(cuts(i) && (!comps || (match_id != kNoMatch && (*comps)(sr->dlp[match_id]))))                    
-                    {
-                        values.push_back(match_id != kNoMatch ? var(sr->dlp[match_id]) : kNoMatchValue);
-                    }
-                }
+                    values.push_back(c.match != kNoMatch ? var(sr->dlp[c.match]) : kNoMatchValue);
                 else if constexpr(std::is_same_v<VarOn, TType>)
-                {
-                    if(cuts(i) && (!comps || (match_id != kNoMatch && (*comps)(sr->dlp[match_id]))))
-                    {
-                        values.push_back(var(i));
-                    }
-                }
+                    values.push_back(var(i));
                 else if constexpr(std::is_same_v<VarOn, MCTruth>)
+                    values.push_back(i.nu_id >= 0 ? var(sr->mc.nu[i.nu_id]) : kNoMatchValue);
+                else if constexpr(is_particle_var)
                 {
-                    if(cuts(i) && (!comps || (match_id != kNoMatch && (*comps)(sr->dlp[match_id]))))
-                    {
-                        values.push_back(i.nu_id >= 0 ? var(sr->mc.nu[i.nu_id]) : kNoMatchValue);
-                    }
-                }
-                else if constexpr(std::is_same_v<VarOn, TParticleType> || std::is_same_v<VarOn, RParticleType>)
-                {
-                    if(cuts(i) && (!comps || (match_id != kNoMatch && (*comps)(sr->dlp[match_id]))))
+                    for(size_t n(c.pbegin); n < c.pend; ++n)
                     {
-                        for(auto const & j : i.particles)
+                        if constexpr(std::is_same_v<VarOn, TParticleType>)
+                            values.push_back(var(i.particles[result.particles[n]]));
+                        else if constexpr(std::is_same_v<VarOn, RParticleType>)
                         {
-                            if(pcuts(j))
-                            {
-                                if constexpr(std::is_same_v<VarOn, TParticleType>)
-                                    values.push_back(var(j));
-                                else if constexpr(std::is_same_v<VarOn, RParticleType>)
-                                {
-                                    if(j.match_ids.size() > 0 && particles.find(j.match_ids[0]) != particles.end())
-                                        values.push_back(var(*particles[j.match_ids[0]]));
-                                    else
-                                        values.push_back(kNoMatchValue); // No match found.
-                                }
-                            }
+                            const RParticleType * match = matches.true_to_reco_particle(c.index, result.particles[n]);
+                            values.push_back(match ? var(*match) : kNoMatchValue);
                         }
                     }
                 }
@@ -664,73 +1668,42 @@ ana::SpillMultiVar spill_multivar_helper(
         else if constexpr(std::is_same_v<CutsOn, RType>)
         {
             // Case: the variable type is a particle type.
-            // If the variable is of the "particle" type, we need to build a
-            // lookup table of matches.
-            std::map<caf::Proxy<int64_t>, const caf::Proxy<caf::SRParticleTruthDLP> *> particles;
-            if constexpr (std::is_same_v<VarOn, TParticleType> || std::is_same_v<VarOn, RParticleType>)
-            {
-                for(auto const& i : sr->dlp_true)
-                {
-                    for(auto const& j : i.particles)
-                    {
-                        particles.insert(std::make_pair(j.id, &j));
-                    }
-                }
-            }
+            // If the variable is of the "particle" type, we need the lookup
+            // table of particle matches (shared by all variables).
+            const MatchIndex & matches = MatchIndex::get(*sr, std::is_same_v<VarOn, TParticleType>);
 
-            // Iterate over the reco interactions.
-            for(auto const& i : sr->dlp)
+            // Iterate over the selected reco interactions.
+            for(auto const & c : result.candidates)
             {
-                // Check for match
-                size_t match_id = (i.match_ids.size() > 0) ? (size_t)i.match_ids[0] : kNoMatch;
-
+                auto const & i = sr->dlp[c.index];
                 if constexpr(std::is_same_v<VarOn, TType>)
-                {
-                    if(cuts(i) && (!comps || (match_id != kNoMatch && (*comps)(sr->dlp_true[match_id])) || !ismc))
-                    {
-                        values.push_back(ismc && match_id != kNoMatch ? var(sr->dlp_true[match_id]) : kNoMatchValue);
-                    }
-                }
+                    values.push_back(ismc && c.match != kNoMatch ? var(sr->dlp_true[c.match]) : kNoMatchValue);
                 else if constexpr(std::is_same_v<VarOn, RType>)
+                    values.push_back(var(i));
+                else if constexpr(std::is_same_v<VarOn, MCTruth>)
                 {
-                    if(cuts(i) && (!comps || (match_id != kNoMatch && (*comps)(sr->dlp_true[match_id])) || !ismc))
+                    if(!ismc || c.match == kNoMatch)
                     {
-                        values.push_back(var(i));
+                        values.push_back(kNoMatchValue);
                     }
-                }
-                else if constexpr(std::is_same_v<VarOn, MCTruth>)
-                {
-                    if(cuts(i) && (!comps || (match_id != kNoMatch && (*comps)(sr->dlp_true[match_id])) || !ismc))
+                    else
                     {
-                        if(!ismc || match_id == kNoMatch)
-                        {
-                            values.push_back(kNoMatchValue);
-                        }
-                        else
-                        {
-                            int64_t nu_id = sr->dlp_true[match_id].nu_id;
-                            values.push_back(nu_id >= 0 ? var(sr->mc.nu[nu_id]) : kNoMatchValue);
-                        }
+                        int64_t nu_id = sr->dlp_true[c.match].nu_id;
+                        values.push_back(nu_id >= 0 ? var(sr->mc.nu[nu_id]) : kNoMatchValue);
                     }
                 }
-                else if constexpr(std::is_same_v<VarOn, TParticleType> || std::is_same_v<VarOn, RParticleType>)
+                else if constexpr(is_particle_var)
                 {
-                    if(cuts(i) && (!comps || (match_id != kNoMatch && (*comps)(sr->dlp_true[match_id]))))
+                    // Particle variables are only filled for interactions
+                    // strictly passing the complementary cuts.
+                    for(size_t n(c.pbegin); n < c.pend; ++n)
                     {
-                        for(auto const & j : i.particles)
+                        if constexpr(std::is_same_v<VarOn, RParticleType>)
+                            values.push_back(var(i.particles[result.particles[n]]));
+                        else if constexpr(std::is_same_v<VarOn, TParticleType>)
                         {
-                            if(pcuts(j))
-                            {
-                                if constexpr(std::is_same_v<VarOn, RParticleType>)
-                                    values.push_back(var(j));
-                                else if constexpr(std::is_same_v<VarOn, TParticleType>)
-                                {
-                                    if(j.match_ids.size() > 0 && particles.find(j.match_ids[0]) != particles.end())
-                                        values.push_back(var(*particles[j.match_ids[0]]));
-                                    else
-                                        values.push_back(kNoMatchValue); // No match found.
-                                }
-                            }
+                            const TParticleType * match = matches.reco_to_true_particle(c.index, result.particles[n]);
+                            values.push_back(match ? var(*match) : kNoMatchValue);
                         }
                     }
                 }
@@ -742,6 +1715,19 @@ ana::SpillMultiVar spill_multivar_helper(
     });
 }
 
+// Helper method for constructing a SpillMultiVar object when run in the
+// "event" mode using a shared selection pass.
+ana::SpillMultiVar spill_multivar_helper(const std::shared_ptr<SelectionPass> & selection, const VarFn<EventType> & var)
+{
+    return ana::SpillMultiVar([selection, var](const caf::Proxy<caf::StandardRecord> * sr) -> std::vector<double>
+    {
+        std::vector<double> values;
+        if(selection->evaluate(*sr).event_passed)
+            values.push_back(var(*sr));
+        return values;
+    });
+}
+
 // Helper method for constructing a SpillMultiVar object when run in the
 // "event" mode.
 ana::SpillMultiVar spill_multivar_helper(const CutFn<EventType> & cut, const VarFn<EventType> & var)
@@ -755,13 +1741,11 @@ ana::SpillMultiVar spill_multivar_helper(const CutFn<EventType> & cut, const Var
     });
 }
 
-// Helper method for constructing a set of SpillMultiVar objects that track the
-// exposure information for a given set of cuts.
-std::vector<NamedSpillMultiVar> construct_exposure_vars(const std::vector<cfg::ConfigurationTable> & cuts)
+// Compose the cuts that decrement the exposure for a given set of cuts.
+std::pair<CutFn<EventType>, CutFn<SpillType>> construct_exposure_cuts(const std::vector<cfg::ConfigurationTable> & cuts)
 {
-    std::vector<NamedSpillMultiVar> exposure_vars;
-    std::vector<CutFn<EventType>> cut_functions;
-    std::vector<CutFn<SpillType>> spill_cut_functions;
+    std::vector<BoundCut<EventType>> cut_functions;
+    std::vector<BoundCut<SpillType>> spill_cut_functions;
 
     // Iterate over the cuts and construct the exposure variables.
     for(const auto & cut : cuts)
@@ -780,20 +1764,16 @@ std::vector<NamedSpillMultiVar> construct_exposure_vars(const std::vector<cfg::C
             if(cut.get_string_field("type") == "event")
             {
                 name = "event_" + name;
-                auto factory = CutFactoryRegistry<EventType>::instance().get(name);
-                auto cut_fn = factory(params);
-                cut_functions.push_back(cut_fn);
+                cut_functions.push_back(bind_cut<EventType>(name, params));
             }
             else if(cut.get_string_field("type") == "spill")
             {
                 name = "spill_" + name;
-                auto factory = CutFactoryRegistry<SpillType>::instance().get(name);
-                auto cut_fn = factory(params);
-                
+
                 // We do not transform this to an event-level cut because we
                 // need to apply it to each and every spill that contains
                 // exposure that we want to track.
-                spill_cut_functions.push_back(cut_fn);
+                spill_cut_functions.push_back(bind_cut<SpillType>(name, params));
             }
             else
             {
@@ -811,34 +1791,61 @@ std::vector<NamedSpillMultiVar> construct_exposure_vars(const std::vector<cfg::C
     auto spill_cut = [spill_cut_functions](const SpillType & s) -> bool {
         return std::all_of(spill_cut_functions.begin(), spill_cut_functions.end(), [&s](auto & f) { return f(s); });
     };
+    return std::make_pair(CutFn<EventType>(cut), CutFn<SpillType>(spill_cut));
+}
+
+// Helper method for constructing a set of SpillMultiVar objects that track the
+// exposure information for a given set of cuts.
+std::vector<NamedSpillMultiVar> construct_exposure_vars(const std::vector<cfg::ConfigurationTable> & cuts)
+{
+    std::vector<NamedSpillMultiVar> exposure_vars;
+    std::pair<CutFn<EventType>, CutFn<SpillType>> exposure_cuts = construct_exposure_cuts(cuts);
+    CutFn<EventType> cut = exposure_cuts.first;
+    CutFn<SpillType> spill_cut = exposure_cuts.second;
 
     // Compose the exposure variables
     auto livetime_var = [](const EventType & e) -> double {
         // Return the livetime for the event.
-        if(e.hdr.ismc)
-            return (e.hdr.first_in_subrun) ? (double)e.hdr.ngenevt : 0.0;
-        else
-            return e.hdr.bnbinfo.size() + e.hdr.numiinfo.size() + e.hdr.noffbeambnb + e.hdr.noffbeamnumi;
+        return ExposureLedger::of(e).livetime;
     };
     exposure_vars.push_back(std::make_pair("livetime", spill_multivar_helper(cut, livetime_var)));
 
     auto pot_var = [spill_cut](const EventType & e) -> double {
-        
-        if(e.hdr.ismc)
-            return (e.hdr.first_in_subrun) ? (double)e.hdr.pot : 0.0;
-        else
-        {
-            double tot(0);
-            for(const auto & bnb : e.hdr.bnbinfo)
-                tot += (spill_cut(bnb) ? (double)bnb.TOR875 : 0);
-            return tot;
-        }
+        // Return the POT of the spills passing the spill cuts.
+        return ExposureLedger::of(e, spill_cut).pot;
     };
     exposure_vars.push_back(std::make_pair("pot", spill_multivar_helper(cut, pot_var)));
 
     return exposure_vars;
 }
 
+// Resolve the storage type of a branch variable.
+StorageType branch_storage(const cfg::ConfigurationTable & var,
+                           const std::string & type,
+                           StorageType fallback,
+                           bool infer)
+{
+    if(var.has_field("storage"))
+        return parse_storage(var.get_string_field("storage"));
+    if(!infer)
+        return fallback;
+
+    // The name of the variable in the registry.
+    std::string name = var.get_string_field("name");
+    if(var.has_field("selector") && (type == "true" || type == "true_particle"))
+        name = "true_particle_" + name;
+    else if(var.has_field("selector") && (type == "reco" || type == "reco_particle"))
+        name = "reco_particle_" + name;
+    else if(type == "mctruth")
+        name = "true_" + name;
+    else
+        name = type + "_" + name;
+
+    if(StorageRegistry::instance().is_registered(name))
+        return StorageRegistry::instance().get(name);
+    return fallback;
+}
+
 // Explicitly instantiate Registry for the factory types we use:
 // Cut Registry
 template class Registry<CutFactory<TType>>;
@@ -856,6 +1863,41 @@ template class Registry<VarFactory<TParticleType>>;
 template class Registry<VarFactory<RParticleType>>;
 template class Registry<VarFactory<EventType>>;
 
+// Explicit instantiation for the storage type registry
+template class Registry<StorageType>;
+template class Registry<std::vector<std::string>>;
+
 // Explicit instantiation for selector registries
 template class Registry<SelectorFactory<TType>>;
-template class Registry<SelectorFactory<RType>>;
\ No newline at end of file
+template class Registry<SelectorFactory<RType>>;
+
+// Explicit instantiation for the fast (function pointer) registries
+template class Registry<FnPtr<TType, bool>>;
+template class Registry<FnPtr<RType, bool>>;
+template class Registry<FnPtr<TParticleType, bool>>;
+template class Registry<FnPtr<RParticleType, bool>>;
+template class Registry<FnPtr<EventType, bool>>;
+template class Registry<FnPtr<SpillType, bool>>;
+template class Registry<FnPtr<TType, double>>;
+template class Registry<FnPtr<RType, double>>;
+template class Registry<FnPtr<MCTruth, double>>;
+template class Registry<FnPtr<TParticleType, double>>;
+template class Registry<FnPtr<RParticleType, double>>;
+template class Registry<FnPtr<EventType, double>>;
+template class Registry<FnPtr<TType, size_t>>;
+template class Registry<FnPtr<RType, size_t>>;
+
+// Explicit instantiation for the cut chains
+template class CutChain<TType>;
+template class CutChain<RType>;
+template class CutChain<TParticleType>;
+template class CutChain<RParticleType>;
+template class CutChain<EventType>;
+
+// Explicit instantiation for the particle caches
+template class ParticleCache<TParticleType>;
+template class ParticleCache<RParticleType>;
+
+// Explicit instantiation for the geometry caches
+template class GeometryCache<TType>;
+template class GeometryCache<RType>;
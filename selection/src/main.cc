@@ -13,6 +13,9 @@
 #include <iostream>
 #include <string>
 #include <memory>
+#include <set>
+#include <optional>
+#include <filesystem>
 
 #include "sbnanaobj/StandardRecord/Proxy/SRProxy.h"
 #include "TError.h"
@@ -28,6 +31,14 @@
 #include "spill_cuts.h"
 #include "selectors.h"
 #include "analysis.h"
+#include "shards.h"
+#include "incremental.h"
+#include "plan.h"
+#include "pruning.h"
+#include "loader.h"
+#include "skim.h"
+#include "progress.h"
+#include "io.h"
 
 std::shared_ptr<VarFn<RParticleType>> pvars::primfn = std::make_shared<VarFn<RParticleType>>(pvars::default_primary_classification<RParticleType>);
 std::shared_ptr<VarFn<RParticleType>> pvars::pidfn = std::make_shared<VarFn<RParticleType>>(pvars::default_pid<RParticleType>);
@@ -81,6 +92,20 @@ void error_handler(int level, bool abort, const char * location, const char * me
     ::DefaultErrorHandler(level, abort, location, message);
 }
 
+/**
+ * @brief An input file with trees that have no cached result in the
+ * incremental mode.
+ */
+struct PendingFile
+{
+    std::string source;                                              ///< The name of the (per-file) sample.
+    std::string sample;                                              ///< The name of the sample.
+    std::string file;                                                ///< The path of the input file.
+    bool ismc;                                                       ///< Whether the sample is a simulation sample.
+    std::optional<std::set<std::string>> branches;                   ///< The branches to read (all if empty).
+    std::vector<std::pair<const ana::TreePlan *, std::string>> trees; ///< The pending trees and their fragments.
+};
+
 int main(int argc, char * argv[])
 {
     // Set the ROOT error handler to our custom error handler. This allows us
@@ -90,10 +115,53 @@ int main(int argc, char * argv[])
     // Check if the configuration file is provided as a command line argument
     if (argc < 2)
     {
-        std::cerr << "Usage: " << argv[0] << " <configuration_file>" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " <configuration_file> [--shard i/N] [--skim]" << std::endl;
+        std::cerr << "       " << argv[0] << " --merge <output_file> <shard_output_files...>" << std::endl;
         return 1;
     }
 
+    // Merge mode: combine the outputs of a sharded run.
+    if(std::string(argv[1]) == "--merge")
+    {
+        if(argc < 4)
+        {
+            std::cerr << "Usage: " << argv[0] << " --merge <output_file> <shard_output_files...>" << std::endl;
+            return 1;
+        }
+        try
+        {
+            ana::merge_shards(argv[2], std::vector<std::string>(argv + 3, argv + argc));
+        }
+        catch(const std::runtime_error & e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    // Parse the (optional) shard specification and skim flag.
+    ana::ShardSpec shard;
+    bool skim_mode = false;
+    for(int i = 2; i < argc; ++i)
+    {
+        std::string arg(argv[i]);
+        try
+        {
+            if(arg == "--shard" && i + 1 < argc)
+                shard = ana::parse_shard(argv[++i]);
+            else if(arg == "--skim")
+                skim_mode = true;
+            else
+                throw std::runtime_error("Unrecognized argument '" + arg + "'.");
+        }
+        catch(const std::runtime_error & e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+
     // Load the configuration file
     cfg::ConfigurationTable config;
     try
@@ -101,6 +169,16 @@ int main(int argc, char * argv[])
         // Load the configuration file
         config.set_config(argv[1]);
 
+        // Enable the (optional) profiling of the cuts and variables. This
+        // must be done before any selection is constructed.
+        if(config.get_bool_field("general.profile", false))
+        {
+            size_t period = 1;
+            if(config.has_field("general.profile_sampling"))
+                period = config.get_int_field("general.profile_sampling");
+            Profiler::instance().enable(period);
+        }
+
         // Construct the "final_state_signal" particle-level cut function.
         if(config.has_field("general.fsthresh"))
         {
@@ -111,86 +189,163 @@ int main(int argc, char * argv[])
             pcuts::final_state_signal_thresholds = fsthresh;
         }
 
-        // Construct the category function.
+        // Construct the category function. The classifier is shared by the
+        // "true_category" branches and the cutflows split by category.
         if(config.has_field("category"))
         {
-            // Map of category enumeration to cut functions.
-            std::map<double, CutFn<TType>> category_cut_functions;
+            auto classifier = std::make_shared<CategoryClassifier>(config.get_subtables("category"));
+            VarFactoryRegistry<TType>::instance().register_fn(
+                "true_category",
+                [classifier](const std::vector<double>&) -> VarFn<TType> {
+                    return [classifier](const TType & e) { return classifier->classify(e); };
+                }
+            );
+        }
 
-            // Iterate over the categories and construct the cut functions.
-            std::vector<cfg::ConfigurationTable> categories(config.get_subtables("category"));
-            for(const auto & category : categories)
-            {
-                std::vector<CutFn<TType>> true_cut_functions;
-                std::vector<cfg::ConfigurationTable> cuts = category.get_subtables("cuts");
-                for(const auto & cut : cuts)
-                {
-                    // Retrieve the cut name and check for negation.
-                    std::string name = cut.get_string_field("name");
-                    bool invert = false;
-                    if(name.at(0) == '!')
-                    {
-                        invert = true;
-                        name = name.substr(1); // Remove the negation character.
-                    }
-                    name = "true_" + name;
+        // Configure the (optional) incremental mode, in which the results of
+        // each tree for each input file are cached.
+        std::string output = config.get_string_field("general.output") + (shard.enabled() ? shard.suffix() : "");
+        std::unique_ptr<ana::ResultCache> cache;
+        if(config.has_field("general.cache_dir"))
+            cache = std::make_unique<ana::ResultCache>(config.get_string_field("general.cache_dir"), config);
 
-                    // Load parameters (if any) for the cut.
-                    std::vector<double> params;
-                    if(cut.has_field("parameters"))
-                        params = cut.get_double_vector("parameters");
+        // SpectrumLoader
+        ana::Analysis analysis(output);
 
-                    auto factory = CutFactoryRegistry<TType>::instance().get(name);
-                    if(invert)
-                    {
-                        // If the cut is inverted, we need to negate the function.
-                        auto fn = factory(params);
-                        true_cut_functions.push_back([fn](const TType & e) { return !fn(e); });
-                    }
-                    else
-                        // Otherwise, we just add the function as is.
-                        true_cut_functions.push_back(factory(params));
-                }
-                // Compose a common cut function for the category.
-                auto category_cut = [true_cut_functions](const TType & e) -> bool {
-                    return std::all_of(true_cut_functions.begin(), true_cut_functions.end(), [&e](auto & f) { return f(e); });
-                };
-                category_cut_functions.try_emplace(
-                    category_cut_functions.size(),
-                    category_cut
-                );
+        // Configure the output file: compression, basket size, and the
+        // storage types of the branches.
+        ana::OutputOptions output_options;
+        if(config.has_field("general.compression"))
+        {
+            int level = 4;
+            if(config.has_field("general.compression_level"))
+                level = config.get_int_field("general.compression_level");
+            output_options.compression = ana::compression_settings(config.get_string_field("general.compression"), level);
+        }
+        if(config.has_field("general.basket_size"))
+            output_options.basket_size = config.get_int_field("general.basket_size");
+
+        // Configure the (periodic) progress reporting of the samples.
+        ana::ProgressOptions progress_options = ana::parse_progress(config);
+        std::shared_ptr<ana::ProgressMonitor> monitor;
+        if(progress_options.interval > 0)
+            monitor = std::make_shared<ana::ProgressMonitor>(progress_options);
+        StorageType default_storage = parse_storage(config.get_string_field("general.default_storage", "double"));
+        bool infer_storage = config.get_bool_field("general.infer_storage", false);
+
+        // Set the number of samples that are run concurrently.
+        size_t parallel_samples = 1;
+        if(config.has_field("general.parallel_samples"))
+            parallel_samples = config.get_int_field("general.parallel_samples");
+
+        // Apply the output, progress, and concurrency settings to an
+        // Analysis (the incremental mode runs one Analysis per batch).
+        auto configure = [&](ana::Analysis & a)
+        {
+            a.SetOutputOptions(output_options);
+            if(monitor)
+                a.SetProgressMonitor(monitor);
+            a.SetParallelSamples(parallel_samples);
+        };
+        configure(analysis);
+
+        // Set the PID functions.
+        set_fcn(pvars::primfn, config.get_string_field("general.primfn", "default_primary_classification"));
+        set_fcn(pvars::pidfn, config.get_string_field("general.pidfn", "default_pid"));
+
+        // Set the detector of the geometry checks.
+        try
+        {
+            set_detector(config.get_string_field("general.detector", "sbnd"));
+        }
+        catch(const std::runtime_error & e)
+        {
+            throw cfg::ConfigurationError(e.what());
+        }
+
+        // Retrieve the configured paths of a sample.
+        auto sample_paths = [](const cfg::ConfigurationTable & sample)
+        {
+            std::vector<std::string> paths;
+            try
+            {
+                paths.push_back(sample.get_string_field("path"));
+            }
+            catch(const cfg::ConfigurationError &)
+            {
+                paths = sample.get_string_vector("path");
             }
+            return paths;
+        };
 
-            // Create the category function.
-            auto category_fn = [category_cut_functions](const TType & e) -> double
+        // Skim mode: write the records of each input file passing the cuts
+        // of the [skim] block to "<skim.output>/<sample>/<file>".
+        if(skim_mode)
+        {
+            ana::SkimOptions skim = ana::parse_skim(config);
+            try
             {
-                // Iterate over the category cut functions and return the first
-                // one that returns true.
-                for(const auto & [category, cut_fn] : category_cut_functions)
+                for(const auto & sample : config.get_subtables("sample"))
                 {
-                    if(cut_fn(e))
-                        return category; // Return the category number.
+                    if(sample.get_bool_field("disable", false))
+                        continue;
+                    std::string sname = sample.get_string_field("name");
+                    std::set<std::string> outputs;
+                    for(const std::string & file : ana::shard_files(sample_paths(sample), shard))
+                    {
+                        std::string out = skim.output + "/" + sname + "/" + std::filesystem::path(file).filename().string();
+                        if(!outputs.insert(out).second)
+                            throw std::runtime_error("Sample '" + sname + "' has more than one input file named " + std::filesystem::path(file).filename().string() + ".");
+                        ana::skim_file(file, out, skim, sample.get_bool_field("ismc"), sname + "/skim");
+                    }
                 }
-                return PLACEHOLDERVALUE; // No category matched.
-            };
-            // Register the category function.
-            VarFactoryRegistry<TType>::instance().register_fn(
-                "true_category",
-                [category_fn](const std::vector<double>&) -> VarFn<TType> { return category_fn; }
-            );
+            }
+            catch(const std::runtime_error & e)
+            {
+                std::cerr << "Error: " << e.what() << std::endl;
+                return 1;
+            }
+            return 0;
         }
 
-        // SpectrumLoader
-        ana::Analysis analysis(config.get_string_field("general.output"));
+        // Compile the trees once for all samples. This reports every
+        // invalid tree definition (e.g., an unknown cut or variable name)
+        // before any sample is loaded.
+        ana::SelectionPlan plan(config, default_storage, infer_storage);
 
-        // Set the PID functions.
-        set_fcn(pvars::primfn, config.get_string_field("general.primfn", "default_primary_classification"));
-        set_fcn(pvars::pidfn, config.get_string_field("general.pidfn", "default_pid"));
+        // The histograms are not cached by the incremental mode, and the
+        // POT-normalized histograms of the shards cannot be summed.
+        for(const ana::TreePlan & tree : plan.trees())
+        {
+            if(cache && !tree.histograms.empty())
+                throw cfg::ConfigurationError("Tree " + tree.name + ": Histograms are not supported in the incremental mode.");
+            for(const ana::HistogramSpec & spec : tree.histograms)
+            {
+                if(shard.enabled() && spec.pot)
+                    throw cfg::ConfigurationError("Tree " + tree.name + ": Histogram " + spec.name + " cannot be normalized to a POT in the sharded mode.");
+            }
+        }
+
+        // Create a SpectrumLoader which (optionally) reads only the branches
+        // of the StandardRecord that are used by the trees of the sample and
+        // tunes the reads of the input files. The loaders of monitored
+        // samples also report their progress.
+        bool prune = config.get_bool_field("general.prune_branches", false);
+        ana::IOOptions io = ana::parse_io(config);
+        auto make_loader = [&monitor, &io](const std::string & name, const auto & files, const std::optional<std::set<std::string>> & branches) -> std::unique_ptr<ana::RecordSpectrumLoader>
+        {
+            if(monitor)
+                return std::make_unique<ana::MonitoredSpectrumLoader>(files, branches, monitor->sample(name), io);
+            if(branches || io.enabled())
+                return std::make_unique<ana::PrunedSpectrumLoader>(files, branches, io);
+            return std::make_unique<ana::RecordSpectrumLoader>(files);
+        };
 
         // Configure the samples in the analysis
         std::vector<cfg::ConfigurationTable> samples = config.get_subtables("sample");
-        std::vector<std::unique_ptr<ana::SpectrumLoader>> loaders;
+        std::vector<std::unique_ptr<ana::RecordSpectrumLoader>> loaders;
         loaders.reserve(samples.size());
+        std::vector<PendingFile> pending_files;
         for(const auto & sample : samples)
         {
             // Check if the sample has the "disable" flag set to true
@@ -200,82 +355,131 @@ int main(int argc, char * argv[])
                 continue;
             }
 
-            // Create a SpectrumLoader for each sample
-            std::unique_ptr<ana::SpectrumLoader> loader;
-            try
+            std::string sname = sample.get_string_field("name");
+            bool ismc = sample.get_bool_field("ismc");
+            std::optional<std::set<std::string>> branches;
+            if(prune)
             {
-                sample.get_string_field("path");
-                loader = std::make_unique<ana::SpectrumLoader>(sample.get_string_field("path"));
+                branches = ana::required_branches(plan, ismc);
+                if(branches)
+                {
+                    std::cout << "Sample '" << sname << "' reads the branches:";
+                    for(const std::string & branch : *branches)
+                        std::cout << " " << branch;
+                    std::cout << std::endl;
+                }
             }
-            catch(const cfg::ConfigurationError &)
+
+            // The incremental mode and the sharded mode need the (expanded)
+            // list of files of the sample.
+            std::vector<std::string> files;
+            if(cache || shard.enabled())
             {
-                loader = std::make_unique<ana::SpectrumLoader>(sample.get_string_vector("path"));
+                files = ana::shard_files(sample_paths(sample), shard);
+                if(files.empty())
+                {
+                    std::cout << "Sample '" << sname << "' has no files in shard " << shard.index << "/" << shard.count << ", skipping." << std::endl;
+                    continue;
+                }
             }
-            analysis.AddLoader(sample.get_string_field("name"), loader.get(), sample.get_bool_field("ismc"));
-            loaders.push_back(std::move(loader));
 
-            // Main loop over the trees defined in the configuration
-            std::vector<cfg::ConfigurationTable> trees(config.get_subtables("tree"));
-            for(const auto & tree : trees)
+            // Incremental mode: collect the files that have trees without a
+            // cached result. Only those trees are run (see below).
+            if(cache)
             {
-                std::vector<cfg::ConfigurationTable> cuts = tree.get_subtables("cut");
-                std::vector<cfg::ConfigurationTable> vars = tree.get_subtables("branch");
-                std::string mode = tree.get_string_field("mode");
-                
-                std::map<std::string, ana::SpillMultiVar> vars_map;
-                for(const auto & var : vars)
+                size_t ncached(0), nrun(0);
+                for(size_t i = 0; i < files.size(); ++i)
                 {
-                    // If the variable type is "both", we need to construct two
-                    // variables: one for "true" and one for "reco".
-                    if(var.get_string_field("type") == "both")
-                    {
-                        NamedSpillMultiVar thisvar_true = construct(cuts, var, mode, "true", sample.get_bool_field("ismc"));
-                        NamedSpillMultiVar thisvar_reco = construct(cuts, var, mode, "reco", sample.get_bool_field("ismc"));
-                        vars_map.try_emplace(thisvar_true.first, thisvar_true.second);
-                        vars_map.try_emplace(thisvar_reco.first, thisvar_reco.second);
-                    }
-                    else if(var.get_string_field("type") == "both_particle")
-                    {
-                        NamedSpillMultiVar thisvar_true = construct(cuts, var, mode, "true_particle", sample.get_bool_field("ismc"));
-                        NamedSpillMultiVar thisvar_reco = construct(cuts, var, mode, "reco_particle", sample.get_bool_field("ismc"));
-                        vars_map.try_emplace(thisvar_true.first, thisvar_true.second);
-                        vars_map.try_emplace(thisvar_reco.first, thisvar_reco.second);
-                    }
-                    else if(var.get_string_field("type") == "true"
-                            || var.get_string_field("type") == "reco"
-                            || var.get_string_field("type") == "mctruth"
-                            || var.get_string_field("type") == "true_particle"
-                            || var.get_string_field("type") == "reco_particle"
-                            || var.get_string_field("type") == "event")
-                    {
-                        NamedSpillMultiVar thisvar = construct(cuts, var, mode, var.get_string_field("type"), sample.get_bool_field("ismc"));
-                        vars_map.try_emplace(thisvar.first, thisvar.second);
-                    }
-                    else
+                    PendingFile pending{sname + "_file" + std::to_string(i), sname, files[i], ismc, branches, {}};
+                    for(const auto & tree : plan.trees())
                     {
-                        throw std::runtime_error("Illegal variable type '" + var.get_string_field("type") + "' for branch " + tree.get_string_field("name") +  ":" + var.get_string_field("name"));
+                        // Simulation-only trees have no output for data.
+                        if(tree.sim_only && !ismc)
+                            continue;
+                        std::string fragment = cache->fragment(sname, tree.table, ismc, files[i]);
+                        if(cache->cached(fragment))
+                        {
+                            ++ncached;
+                            continue;
+                        }
+                        pending.trees.emplace_back(&tree, fragment);
                     }
+                    if(pending.trees.empty())
+                        continue;
+                    nrun += pending.trees.size();
+                    pending_files.push_back(std::move(pending));
                 }
-                analysis.AddTreeForSample(sample.get_string_field("name"), tree.get_string_field("name"), vars_map, tree.get_bool_field("sim_only"));
+                std::cout << "Sample '" << sname << "': " << ncached << " cached and " << nrun << " pending tree results over " << files.size() << " files." << std::endl;
+                continue;
+            }
 
-                // Add the exposure tree.
-                if(tree.get_bool_field("add_exposure", false))
+            // Create a SpectrumLoader for each sample
+            std::unique_ptr<ana::RecordSpectrumLoader> loader;
+            if(shard.enabled())
+            {
+                // Only the subset of the files assigned to this shard.
+                loader = make_loader(sname, files, branches);
+            }
+            else if(io.prefetch)
+            {
+                // The next input file is only prefetched from a list of
+                // files, so the wildcards are expanded.
+                loader = make_loader(sname, ana::expand_paths(sample_paths(sample)), branches);
+            }
+            else
+            {
+                try
+                {
+                    sample.get_string_field("path");
+                    loader = make_loader(sname, sample.get_string_field("path"), branches);
+                }
+                catch(const cfg::ConfigurationError &)
                 {
-                    // Construct the exposure variables.
-                    std::map<std::string, ana::SpillMultiVar> exposure_vars_map;
-                    std::vector<NamedSpillMultiVar> exposure_vars = construct_exposure_vars(cuts);
+                    loader = make_loader(sname, sample.get_string_vector("path"), branches);
+                }
+            }
+            analysis.AddLoader(sname, loader.get(), ismc);
+            loaders.push_back(std::move(loader));
 
-                    // Add the exposure variables to the map.
-                    for(const auto & exposure_var : exposure_vars)
-                        exposure_vars_map.try_emplace(exposure_var.first, exposure_var.second);
+            // Main loop over the trees defined in the configuration
+            for(const auto & tree : plan.trees())
+                plan.book(analysis, sname, sname, ismc, tree);
+        }
 
-                    // Add the exposure tree for the sample.
-                    analysis.AddTreeForSample(sample.get_string_field("name"), tree.get_string_field("name")+"_exposure", exposure_vars_map, tree.get_bool_field("sim_only"));
+        // Incremental mode: run the pending trees in bounded batches of
+        // files, split the results of each batch into the cache, and merge
+        // the cached results into the output file. The loaders (and booked
+        // trees) of a batch are released before the next batch is created.
+        if(cache)
+        {
+            int64_t batch_size = std::max<int64_t>(parallel_samples, 1);
+            if(config.has_field("general.cache_batch_size"))
+                batch_size = config.get_int_field("general.cache_batch_size");
+            if(batch_size <= 0)
+                throw cfg::ConfigurationError("general.cache_batch_size must be positive.");
+            for(size_t begin = 0; begin < pending_files.size(); begin += batch_size)
+            {
+                ana::Analysis batch(cache->scratch());
+                configure(batch);
+                std::vector<std::unique_ptr<ana::RecordSpectrumLoader>> batch_loaders;
+                for(size_t i = begin; i < std::min(begin + batch_size, pending_files.size()); ++i)
+                {
+                    const PendingFile & p = pending_files[i];
+                    batch_loaders.push_back(make_loader(p.source, p.file, p.branches));
+                    batch.AddLoader(p.source, batch_loaders.back().get(), p.ismc);
+                    for(const auto & [tree, fragment] : p.trees)
+                    {
+                        cache->book(p.source, p.sample, tree->name, fragment);
+                        plan.book(batch, p.source, p.sample, p.ismc, *tree);
+                    }
                 }
+                batch.Go();
+                cache->store();
             }
+            cache->merge(output + ".root", output_options.compression);
         }
-
-        analysis.Go();
+        else
+            analysis.Go();
     }
     catch(const cfg::ConfigurationError &e)
     {
@@ -11,6 +11,9 @@
  * @author mueller@fnal.gov
  */
 #include <iostream>
+#include <cmath>
+
+#include "TLeaf.h"
 
 #include "sbnanaobj/StandardRecord/StandardRecord.h"
 #include "sbnanaobj/StandardRecord/SRInteractionDLP.h"
@@ -221,6 +224,55 @@ std::vector<row_t> read_event_data(const std::string & name)
     return rows;
 }
 
+// Read the table data from the TTree at the specified path.
+std::vector<row_t> read_table_data(const std::string & name)
+{
+    TTree * t = dynamic_cast<TTree *>(gDirectory->Get(name.c_str()));
+    if(!t)
+    {
+        throw std::runtime_error("Could not find TTree " + name + " in the current directory.");
+    }
+
+    // Retrieve the leaves of the numeric branches.
+    std::vector<TLeaf *> leaves;
+    for(auto const & branch : *t->GetListOfBranches())
+    {
+        auto b = dynamic_cast<TBranch *>(branch);
+        if(!b)
+            continue;
+        TLeaf * leaf = b->GetLeaf(b->GetName());
+        if(!leaf || std::string(leaf->GetTypeName()) == "string")
+            continue;
+        leaves.push_back(leaf);
+    }
+
+    // Read the entries from the TTree.
+    std::vector<row_t> rows;
+    for(int i = 0; i < t->GetEntries(); ++i)
+    {
+        t->GetEntry(i);
+        row_t row;
+        for(TLeaf * leaf : leaves)
+            row[leaf->GetName()] = leaf->GetValue();
+        rows.push_back(row);
+    }
+
+    return rows;
+}
+
+// Check a single value against its expected value.
+bool check_value(const std::string & label, double value, double expected, double tolerance)
+{
+    if(std::abs(value - expected) <= tolerance)
+    {
+        std::cout << "\033[32mValidation passed:\033[0m   " << label << "." << std::endl;
+        return true;
+    }
+    std::cout << "\033[31mValidation failed:\033[0m   " << label << "." << std::endl;
+    std::cout << "    expected: " << expected << ", got: " << value << std::endl;
+    return false;
+}
+
 // Match the (Run, Subrun, Evt) metadata between a row_t object and a
 // condition_t object.
 bool match_metadata(const row_t & row, const condition_t & condition)
@@ -7,20 +7,36 @@
  * logic and functionality.
  * @author mueller@fnal.gov
  */
+#define PLACEHOLDERVALUE std::numeric_limits<double>::quiet_NaN()
+#define PROTON_BINDING_ENERGY 30.9 // MeV
+#define BEAM_IS_NUMI false
+
 #include <iostream>
+#include <tuple>
+#include <random>
+#include <algorithm>
 
 #include "sbnanaobj/StandardRecord/StandardRecord.h"
 #include "sbnanaobj/StandardRecord/SRInteractionDLP.h"
 #include "sbnanaobj/StandardRecord/SRInteractionTruthDLP.h"
 #include "sbnanaobj/StandardRecord/SRParticleDLP.h"
 #include "sbnanaobj/StandardRecord/SRParticleTruthDLP.h"
+#include "sbnanaobj/StandardRecord/Flat/FlatRecord.h"
 
 #include "TFile.h"
 #include "TTree.h"
+#include "TLeaf.h"
 #include "TH1F.h"
 
+#include "configuration.h"
+#include "framework.h"
+#include "cuts.h"
+#include "skim.h"
 #include "test.h"
 
+std::shared_ptr<VarFn<RParticleType>> pvars::primfn = std::make_shared<VarFn<RParticleType>>(pvars::default_primary_classification<RParticleType>);
+std::shared_ptr<VarFn<RParticleType>> pvars::pidfn = std::make_shared<VarFn<RParticleType>>(pvars::default_pid<RParticleType>);
+
 /**
  * @brief Main function for the validation code.
  * @details This function serves two purposes: generating the structured CAF
@@ -33,6 +49,9 @@
  *                 testing.
  * - `--validate`: Validate the output of the framework against the expected
  *                 results.
+ * - `--unit`:     Validate the building blocks of the framework that do not
+ *                 depend on the output of the framework (writing their own
+ *                 inputs where needed).
  * @return int The exit code of the program. Returns 0 on success, non-zero
  * on failure.
  */
@@ -41,15 +60,15 @@ int main(int argc, char * argv[])
     // Check if the command line arguments are valid.
     if(argc < 2)
     {
-        std::cerr << "Usage: " << argv[0] << " --generate | --validate" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " --generate | --validate | --unit" << std::endl;
         return 1;
     }
 
     // Check the command line arguments for the mode.
     std::string mode = argv[1];
-    if(mode != "--generate" && mode != "--validate")
+    if(mode != "--generate" && mode != "--validate" && mode != "--unit")
     {
-        std::cerr << "Invalid mode: " << mode << ". Use --generate or --validate." << std::endl;
+        std::cerr << "Invalid mode: " << mode << ". Use --generate, --validate, or --unit." << std::endl;
         return 1;
     }
 
@@ -1243,9 +1262,329 @@ int main(int argc, char * argv[])
         // Check if each condition_t entry is present in the rows vector.
         match_conditions(rows, conditions);
 
+        /**
+         * @brief The ninth set of checks is the cutflow of the "reco" mode
+         * tree over the "sim-like" and "data-like" events.
+         * @details The cutflow has one stage per cut (stage 0 contains all
+         * objects), and the counts are checked against a hand count of the
+         * generated events. Each event has a single reco interaction with a
+         * single particle, so the events, interactions, and particles
+         * surviving each stage are equal.
+         *
+         * - SCF00: All 16 "sim-like" events survive stage 0 (no cut).
+         *
+         * - SCF01: Only the 8 "sim-like" events with a valid flash match
+         *   (ES00 and ES02) survive the valid_flashmatch cut.
+         *
+         * - DCF00: All 4 "data-like" events survive stage 0 (no cut).
+         *
+         * - DCF01: Only the 2 "data-like" events with a valid flash match
+         *   (ED00) survive the valid_flashmatch cut.
+         */
+        std::cout << "\n\033[1mCutflow of the 'reco' mode tree \033[0m" << std::endl;
+
+        // Expected (hand-counted) survivors of each stage for each sample.
+        const std::vector<std::tuple<std::string, std::string, std::vector<double>>> cutflows = {
+            {"SCF", "events/test_simlike/test_reco_cutflow", {16, 8}},
+            {"DCF", "events/test_datalike/test_reco_cutflow", {4, 2}},
+        };
+        for(const auto & [label, name, expected] : cutflows)
+        {
+            rows = read_table_data(name);
+            check_value(label + " stages", rows.size(), expected.size());
+            for(size_t k = 0; k < std::min(rows.size(), expected.size()); ++k)
+            {
+                std::string stage = label + (k < 10 ? "0" : "") + std::to_string(k);
+                check_value(stage + " stage", rows[k].at("stage"), k);
+                check_value(stage + " events", rows[k].at("events"), expected[k]);
+                check_value(stage + " interactions", rows[k].at("interactions"), expected[k]);
+                check_value(stage + " particles", rows[k].at("particles"), expected[k]);
+            }
+        }
+
+        /**
+         * @brief The tenth set of checks compares the "event" mode tree of
+         * the pruned run (test_pruned.toml, which only reads the branches of
+         * the header) to the same tree of the unpruned run.
+         * @details The run is skipped if "test_pruned.root" is not present.
+         *
+         * - PRN00: The pruned and unpruned trees have the same entries and
+         *   values.
+         *
+         * - PRN01: The pruned and unpruned cutflows have the same counts.
+         */
+        TFile pruned("test_pruned.root", "READ");
+        if(pruned.IsOpen())
+        {
+            std::cout << "\n\033[1mPruned and unpruned 'event' mode trees \033[0m" << std::endl;
+            // Compare the rows of a TTree of both runs.
+            auto compare = [&f, &pruned](const std::string & label, const std::string & path, auto read)
+            {
+                f.cd();
+                std::vector<row_t> expected = read(path);
+                pruned.cd();
+                std::vector<row_t> observed = read(path);
+                size_t mismatches(0);
+                for(size_t i(0); i < std::min(observed.size(), expected.size()); ++i)
+                    mismatches += observed[i] != expected[i];
+                check_value(label + " rows", observed.size(), expected.size());
+                check_value(label + " mismatched rows", mismatches, 0);
+            };
+            for(const std::string sample : {"test_simlike", "test_datalike"})
+            {
+                compare("PRN00 " + sample, "events/" + sample + "/test_event_header", read_event_data);
+                compare("PRN01 " + sample, "events/" + sample + "/test_event_header_cutflow", read_table_data);
+            }
+            pruned.Close();
+        }
+
         // Finished!
         std::cout << "\n\033[1m---        DONE        ---\033[0m" << std::endl;
         f.Close();
     }
+
+    // If the mode is unit, we run the validation of the building blocks.
+    if(mode == "--unit")
+    {
+        std::cout << "\033[1m--- Running validation ---\033[0m" << std::endl;
+        /**
+         * @brief The first building block is the exposure ledger, which is
+         * filled by each worker and merged at the end of the sample.
+         * @details Two workers observe disjoint sets of records in different
+         * orders (each worker also observes some records which reuse the
+         * header of an earlier record, as MC files may do). The merged
+         * ledgers are compared to the exposure of all observed records. The
+         * POT values are not exactly representable, so a change of the
+         * summation order would show up in the comparison.
+         *
+         * - LED00: A record which reuses the header of an earlier record is
+         *   counted (not discarded) and reported as a duplicate.
+         *
+         * - LED01: The merged totals match the exposure of all observed
+         *   records, for both orders of the merge.
+         *
+         * - LED02: The exposure of each subrun does not depend on the order
+         *   of the records or of the merges.
+         */
+        std::cout << "\n\033[1mExposure ledger \033[0m" << std::endl;
+
+        // The distinct records (in (run, subrun, event) order).
+        std::mt19937 gen(2024);
+        std::uniform_real_distribution<double> potdist(1e11, 1e13);
+        std::vector<std::pair<std::array<int64_t, 3>, ExposureCounts>> records;
+        for(int64_t run = 1; run <= 2; ++run)
+        {
+            for(int64_t subrun = 0; subrun < 5; ++subrun)
+            {
+                for(int64_t event = 0; event < 10; ++event)
+                {
+                    ExposureCounts counts;
+                    counts.pot = potdist(gen);
+                    counts.livetime = event + 1;
+                    counts.spills = event % 3;
+                    counts.events = 1;
+                    records.push_back({{run, subrun, event}, counts});
+                }
+            }
+        }
+
+        // The first worker observes the first half of the records in order,
+        // the second worker the second half in a shuffled order. Both observe
+        // ten records which reuse the header of one of their records.
+        auto observe = [&records](ExposureLedger & ledger, std::vector<size_t> order)
+        {
+            for(size_t i : order)
+            {
+                const auto & [key, counts] = records[i];
+                ledger.add(SubrunKey(key[0], key[1]), key[2], counts);
+            }
+        };
+        std::vector<size_t> first, second;
+        for(size_t i = 0; i < records.size() / 2; ++i)
+            first.push_back(i);
+        for(size_t i = records.size() / 2; i < records.size(); ++i)
+            second.push_back(i);
+        std::shuffle(second.begin(), second.end(), gen);
+        std::vector<size_t> repeated_first(first.begin(), first.begin() + 10), repeated_second(second.begin(), second.begin() + 10);
+        first.insert(first.end(), repeated_first.begin(), repeated_first.end());
+        second.insert(second.end(), repeated_second.begin(), repeated_second.end());
+
+        // The expected exposure of each subrun and in total (every observed
+        // record, summed in (run, subrun, event) order).
+        std::map<SubrunKey, std::map<int64_t, ExposureCounts>> observed;
+        for(const std::vector<size_t> * order : {&first, &second})
+        {
+            for(size_t i : *order)
+            {
+                const auto & [key, counts] = records[i];
+                observed[SubrunKey(key[0], key[1])][key[2]].merge(counts);
+            }
+        }
+        std::map<SubrunKey, ExposureCounts> expected;
+        for(const auto & [subrun, events] : observed)
+        {
+            for(const auto & [event, counts] : events)
+                expected[subrun].merge(counts);
+        }
+        ExposureCounts totals;
+        for(const auto & [subrun, counts] : expected)
+            totals.merge(counts);
+
+        ExposureLedger a, b;
+        observe(a, first);
+        observe(b, second);
+        check_value("LED00 events of the first worker", a.totals().events, first.size());
+        check_value("LED00 events of the second worker", b.totals().events, second.size());
+        check_value("LED00 duplicates of the first worker", a.duplicates(), 10);
+        check_value("LED00 duplicates of the second worker", b.duplicates(), 10);
+
+        ExposureLedger ab(a), ba(b);
+        ab.merge(b);
+        ba.merge(a);
+        for(const auto & [label, ledger] : {std::make_pair(std::string("LED01 (first, second)"), &ab), std::make_pair(std::string("LED01 (second, first)"), &ba)})
+        {
+            ExposureCounts result = ledger->totals();
+            check_value(label + " pot", result.pot, totals.pot);
+            check_value(label + " livetime", result.livetime, totals.livetime);
+            check_value(label + " spills", result.spills, totals.spills);
+            check_value(label + " events", result.events, totals.events);
+            check_value(label + " duplicates", ledger->duplicates(), 20);
+        }
+
+        size_t mismatches(0);
+        std::map<SubrunKey, ExposureCounts> subruns_ab(ab.subruns()), subruns_ba(ba.subruns());
+        for(const auto & [subrun, counts] : expected)
+        {
+            for(const auto * subruns : {&subruns_ab, &subruns_ba})
+            {
+                auto it = subruns->find(subrun);
+                if(it == subruns->end() || it->second.pot != counts.pot || it->second.livetime != counts.livetime
+                   || it->second.spills != counts.spills || it->second.events != counts.events)
+                    ++mismatches;
+            }
+        }
+        check_value("LED02 subruns", subruns_ab.size() + subruns_ba.size(), 2 * expected.size());
+        check_value("LED02 mismatched subruns", mismatches, 0);
+
+        /**
+         * @brief The second building block is the skim of a flat CAF file.
+         * @details A flat CAF file is written with the flattening of the
+         * StandardRecord (flat::Flat), skimmed with the "valid_flashmatch"
+         * reco cut and drop_interactions, and the skimmed file is read back
+         * leaf by leaf.
+         *
+         * - SKM00: Only the passing records are kept, and the records are
+         *   identified by entry (the second record has the same header as
+         *   the first record, but no passing interaction and no exposure).
+         *
+         * - SKM01: The passing (last two) reco interactions of the first
+         *   record are kept and renumbered, along with the interaction id of
+         *   their particles, and the match ids of the true interactions are
+         *   remapped (or removed).
+         *
+         * - SKM02: The third record has no passing interaction, but is the
+         *   first record of its subrun, so it is kept without interactions.
+         *
+         * - SKM03: The exposure histograms are copied.
+         */
+        std::cout << "\n\033[1mSkim of a flat CAF file \033[0m" << std::endl;
+        {
+            TFile file("validation_skim.flat.root", "RECREATE");
+            TH1F * pot = new TH1F("TotalPOT", "TotalPOT", 1, 0, 1);
+            TH1F * nevt = new TH1F("TotalEvents", "TotalEvents", 1, 0, 1);
+            TTree * tree = new TTree("recTree", "recTree");
+            flat::Flat<caf::StandardRecord> flat(tree, "rec", "", nullptr);
+            auto write = [&](caf::StandardRecord & rec, int64_t subrun, bool first)
+            {
+                rec.hdr.run = 1;
+                rec.hdr.subrun = subrun;
+                rec.hdr.evt = 0;
+                rec.hdr.first_in_subrun = first;
+                rec.hdr.pot = first ? 1.0 : 0.0;
+                rec.ndlp = rec.dlp.size();
+                rec.ndlp_true = rec.dlp_true.size();
+                for(size_t i(0); i < rec.dlp.size(); ++i)
+                {
+                    for(auto & p : rec.dlp[i].particles)
+                        p.interaction_id = i;
+                }
+                pot->Fill(rec.hdr.pot);
+                nevt->Fill(1);
+                flat.Clear();
+                flat.Fill(rec);
+                tree->Fill();
+            };
+
+            const multiplicity_t fs = {1, 0, 0, 0, 0};
+            caf::StandardRecord first;
+            first.dlp.push_back(generate_interaction<caf::SRInteractionDLP>(0, 0, fs, false));
+            first.dlp.push_back(generate_interaction<caf::SRInteractionDLP>(1, 1, fs));
+            first.dlp.push_back(generate_interaction<caf::SRInteractionDLP>(2, 2, fs));
+            first.dlp_true.push_back(generate_interaction<caf::SRInteractionTruthDLP>(0, 0, fs));
+            first.dlp_true.push_back(generate_interaction<caf::SRInteractionTruthDLP>(1, 0, fs));
+            pair(first.dlp[0], first.dlp_true[0]);
+            pair(first.dlp[2], first.dlp_true[1]);
+            write(first, 0, true);
+
+            caf::StandardRecord duplicate;
+            duplicate.dlp.push_back(generate_interaction<caf::SRInteractionDLP>(0, 0, fs, false));
+            write(duplicate, 0, false);
+
+            caf::StandardRecord exposure;
+            exposure.dlp.push_back(generate_interaction<caf::SRInteractionDLP>(0, 0, fs, false));
+            exposure.dlp_true.push_back(generate_interaction<caf::SRInteractionTruthDLP>(0, 0, fs));
+            write(exposure, 1, true);
+
+            file.cd();
+            tree->Write();
+            pot->Write();
+            nevt->Write();
+            file.Close();
+        }
+
+        const toml::table doc = toml::parse("[skim]\noutput = \"validation_skim\"\nmode = \"reco\"\ndrop_interactions = true\n"
+                                            "cut = [{name = \"valid_flashmatch\", type = \"reco\"}]\n");
+        cfg::ConfigurationTable config(&doc, toml::node_view<const toml::node>(doc));
+        ana::skim_file("validation_skim.flat.root", "validation_skim/skimmed.flat.root", ana::parse_skim(config), true, "unit/skim");
+
+        TFile skimmed("validation_skim/skimmed.flat.root", "READ");
+        TTree * tree = skimmed.Get<TTree>("recTree");
+        auto check_leaf = [tree](const std::string & label, const std::string & name, const std::vector<double> & expected)
+        {
+            TLeaf * leaf = tree->GetLeaf(name.c_str());
+            size_t len = leaf ? leaf->GetLen() : 0;
+            size_t mismatches(0);
+            for(size_t i(0); i < std::min(len, expected.size()); ++i)
+                mismatches += leaf->GetValue(i) != expected[i];
+            check_value(label + " " + name + " size", len, expected.size());
+            check_value(label + " " + name + " mismatches", mismatches, 0);
+        };
+        check_value("SKM00 entries", tree ? tree->GetEntries() : 0, 2);
+        if(tree && tree->GetEntries() == 2)
+        {
+            tree->GetEntry(0);
+            check_leaf("SKM01", "rec.ndlp", {2});
+            check_leaf("SKM01", "rec.dlp.id", {0, 1});
+            check_leaf("SKM01", "rec.dlp.particles.id", {1, 2});
+            check_leaf("SKM01", "rec.dlp.particles.interaction_id", {0, 1});
+            check_leaf("SKM01", "rec.dlp.match_ids", {1});
+            check_leaf("SKM01", "rec.dlp_true.match_ids..length", {0, 1});
+            check_leaf("SKM01", "rec.dlp_true.match_ids..idx", {0, 0});
+            check_leaf("SKM01", "rec.dlp_true.match_ids", {1});
+
+            tree->GetEntry(1);
+            check_leaf("SKM02", "rec.hdr.subrun", {1});
+            check_leaf("SKM02", "rec.ndlp", {0});
+            check_leaf("SKM02", "rec.ndlp_true", {0});
+            check_leaf("SKM02", "rec.dlp.particles.id", {});
+            check_leaf("SKM02", "rec.dlp_true.particles.id", {});
+        }
+        TH1F * pot = skimmed.Get<TH1F>("TotalPOT");
+        check_value("SKM03 TotalPOT", pot ? pot->GetEntries() : 0, 3);
+        skimmed.Close();
+
+        // Finished!
+        std::cout << "\n\033[1m---        DONE        ---\033[0m" << std::endl;
+    }
     return 0;
 }
\ No newline at end of file
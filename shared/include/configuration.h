@@ -216,6 +216,18 @@ namespace cfg
          */
         std::vector<ConfigurationTable> get_subtables(const std::string & table) const;
 
+        /**
+         * @brief Get the TOML representation of the table or of a field.
+         * @details This function formats the requested field (or the full
+         * table, if no field is requested) as TOML. The representation is
+         * deterministic, so it can be used to identify (e.g., hash) a part
+         * of the configuration. References to parameters are not resolved.
+         * @param field The field that is requested (optional).
+         * @return The TOML representation of the field, which is empty if
+         * the field is not present.
+         */
+        std::string serialize(const std::string & field = "") const;
+
     private:
         /**
          * @brief Resolve a scalar that may be given as a literal or a string
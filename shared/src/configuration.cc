@@ -10,6 +10,7 @@
  * @author mueller@fnal.gov
  */
 #include <string>
+#include <sstream>
 
 #include "configuration.h"
 #include "toml++/toml.h"
@@ -238,6 +239,16 @@ namespace cfg
         return tables;
     }
 
+    // Get the TOML representation of the table or of a field.
+    std::string ConfigurationTable::serialize(const std::string & field) const
+    {
+        toml::node_view<const toml::node> nv = field.empty() ? scope : scope.at_path(field);
+        std::ostringstream ss;
+        if(nv)
+            ss << nv;
+        return ss.str();
+    }
+
     toml::node_view<const toml::node> ConfigurationTable::lookup(const std::string& path) const
     {
         // There are two places to look for the path: first in the local scope,
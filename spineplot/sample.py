@@ -93,7 +93,7 @@ class Sample:
         if override_exposure is not None:
             self.override_exposure(override_exposure, exposure_type)
 
-        self._data = pd.concat([self._file_handle[tree].arrays(library='pd') for tree in trees])
+        self._data = pd.concat([self.decode_sentinels(self._file_handle[tree].arrays(library='pd')) for tree in trees])
         if self._category_branch not in self._data.columns:
             raise ValueError(f'Category branch `{self._category_branch}` not found in sample `{self._name}`.')
         if override_category is not None:
@@ -124,8 +124,15 @@ class Sample:
         # systematic uncertainties.
         if systematics is not None:    
             for sys in systematics:
-                systs = [k for k in self._file_handle[sys].keys() if k not in ['Run', 'Subrun', 'Evt']]
-                self._systematics.update({syst: Systematic(syst, self._file_handle[sys][syst]) for syst in systs})
+                # Quantized universe weights are stored with two auxiliary
+                # branches ("<name>_step" and "<name>_overflow").
+                keys = self._file_handle[sys].keys()
+                auxiliary = [f'{k}{s}' for k in keys for s in ['_step', '_overflow'] if f'{k}{s}' in keys]
+                systs = [k for k in keys if k not in ['Run', 'Subrun', 'Evt'] + auxiliary]
+                self._systematics.update({syst: Systematic(syst, self._file_handle[sys][syst],
+                                                           step=self._file_handle[sys][f'{syst}_step'] if f'{syst}_step' in keys else None,
+                                                           overflow=self._file_handle[sys][f'{syst}_overflow'] if f'{syst}_overflow' in keys else None)
+                                          for syst in systs})
         
         # Add statistical uncertainty. This can always be added to the
         # sample, because it is not dependent on some external source
@@ -328,4 +335,33 @@ class Sample:
         -------
         result : pd.Series
         """
-        return self._data.eval(formula)
\ No newline at end of file
+        return self._data.eval(formula)
+
+    @staticmethod
+    def decode_sentinels(data) -> pd.DataFrame:
+        """
+        Decodes the NaN placeholders of the integer branches of a
+        TTree. Branches stored as int32 or uint8 encode NaN as the
+        minimum value of int32 (-2147483648) or the maximum value of
+        uint8 (255), respectively. These branches are converted to
+        float64 with the placeholders replaced by NaN, so that they
+        can be treated like the double-valued branches.
+
+        Parameters
+        ----------
+        data : pd.DataFrame
+            The data of the TTree.
+
+        Returns
+        -------
+        data : pd.DataFrame
+            The data of the TTree with the placeholders decoded.
+        """
+        sentinels = {np.dtype(np.int32): np.iinfo(np.int32).min, np.dtype(np.uint8): np.iinfo(np.uint8).max}
+        for column in data.columns:
+            if data[column].dtype in sentinels:
+                sentinel = sentinels[data[column].dtype]
+                values = data[column].to_numpy().astype(np.float64)
+                values[data[column].to_numpy() == sentinel] = np.nan
+                data[column] = values
+        return data
@@ -42,6 +42,12 @@ class Systematic:
     _handle : uproot.models.TBranch.Model_TBranchElement
         The handle to the branch containing the weights for the
         systematic parameter.
+    _step : uproot.models.TBranch.Model_TBranchElement
+        The handle to the branch containing the quantization step of
+        the weights (None unless the weights are quantized).
+    _overflow : uproot.models.TBranch.Model_TBranchElement
+        The handle to the branch containing the weights that could not
+        be quantized (None unless the weights are quantized).
     _variables : dict
         The Variable objects to be used for the calculation of the
         impact of the systematic uncertainty. The keys are the names of
@@ -68,6 +74,8 @@ class Systematic:
     -------
     register_variable(variable)
         Register a Variable object with the Systematic object.
+    read_weights()
+        Reads the universe weights of all candidates from the TTree.
     process(sample, nuniv=1000)
         Processes the systematic uncertainty for the given sample for
         all configured Variables.
@@ -79,7 +87,7 @@ class Systematic:
         Combine a list of Systematic objects into a single Systematic
         object.
     """
-    def __init__(self, name, handle, label=None):
+    def __init__(self, name, handle, label=None, step=None, overflow=None):
         """
         Initializes the Systematic object with the given name and Variable.
 
@@ -90,12 +98,47 @@ class Systematic:
         handle : uproot.models.TBranch.Model_TBranchElement
             The handle to the branch containing the weights for the
             systematic parameter.
+        step : uproot.models.TBranch.Model_TBranchElement, optional
+            The handle to the branch containing the quantization step
+            of the weights. The default is None (weights not quantized).
+        overflow : uproot.models.TBranch.Model_TBranchElement, optional
+            The handle to the branch containing the weights that could
+            not be quantized. The default is None.
         """
         self._name = name
         self._label = label
         self._handle = handle
+        self._step = step
+        self._overflow = overflow
         self._variables = dict()
 
+    def read_weights(self) -> np.ndarray:
+        """
+        Reads the universe weights of all candidates from the TTree.
+        The weights may be stored as a variable-length vector, as a
+        fixed-size array of floats, or as a fixed-size array of 16-bit
+        offsets from one in units of the quantization step (with the
+        weights that could not be quantized stored in order in the
+        overflow branch).
+
+        Returns
+        -------
+        numpy.ndarray
+            An array of shape (ncandidates, nweights) containing the
+            universe weights.
+        """
+        weights = self._handle.array(library='np')
+        if weights.dtype == object:
+            return np.stack(weights)
+        if self._step is None:
+            return weights.astype(np.float64)
+        step = self._step.array(library='np').astype(np.float64)
+        decoded = 1.0 + weights.astype(np.float64) * step[:, np.newaxis]
+        overflow = weights == -32768
+        if overflow.any():
+            decoded[overflow] = np.concatenate(self._overflow.array(library='np'))
+        return decoded
+
     def register_variable(self, variable):
         """
         Register a Variable object with the Systematic object.
@@ -131,7 +174,7 @@ class Systematic:
         # where the systematic weights are stored in a TTree.
         if self._handle is not None:
             # Read the weights from the TTree
-            weights_array = np.stack(self._handle.array(library='np'))[mask, :]
+            weights_array = self.read_weights()[mask, :]
             
             if weights_array.shape[1] == 7:
                 # Set the "sigma" levels corresponding to each weight in the
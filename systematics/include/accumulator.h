@@ -0,0 +1,246 @@
+/**
+ * @file accumulator.h
+ * @brief Header file for the UniverseAccumulator class.
+ * @details This file contains the header for the UniverseAccumulator class.
+ * The UniverseAccumulator class accumulates the universe weights of a
+ * systematic as a function of a variable in a dense array, which is only
+ * converted to a histogram when the results are written to the output file.
+ * @author mueller@fnal.gov
+ */
+#ifndef ACCUMULATOR_H
+#define ACCUMULATOR_H
+#include <string>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+#include "TH2D.h"
+
+namespace sys
+{
+    /**
+     * @class UniverseAccumulator
+     * @brief A class to accumulate universe weights in a dense [bin x
+     * universe] array.
+     * @details This class replaces the per-universe filling of a TH2D with
+     * the variable on the x-axis and the universe index on the y-axis. The
+     * x-bin of a candidate is found once, after which the contiguous universe
+     * weights of the candidate are added to the contiguous row of the bin.
+     * The array has the same binning (including the underflow and overflow
+     * bins) as the equivalent TH2D, which can be produced at write time with
+     * @ref make_histogram.
+     */
+    class UniverseAccumulator
+    {
+        public:
+
+        /**
+         * @brief Constructor for the UniverseAccumulator class.
+         * @param name The name of the equivalent histogram.
+         * @param nbins The number of bins of the variable.
+         * @param min The lower edge of the variable range.
+         * @param max The upper edge of the variable range.
+         * @param nuniverses The number of universes.
+         */
+        UniverseAccumulator(const std::string & name, size_t nbins, double min, double max, size_t nuniverses)
+            : name(name), nbins(nbins), min(min), max(max), nuniverses(nuniverses),
+              stride(nuniverses + 1), entries(0), data((nbins + 2) * (nuniverses + 1), 0.0),
+              nominal(nbins + 2, 0.0) {}
+
+        /**
+         * @brief Find the bin of the variable.
+         * @details The bin follows the TH1 convention: bin 0 is the underflow
+         * bin, bins 1 to nbins are the regular bins, and bin nbins+1 is the
+         * overflow bin (which also holds NaN values).
+         * @param x The value of the variable.
+         * @return The bin of the variable.
+         */
+        size_t find_bin(double x) const
+        {
+            if(x < min) return 0;
+            if(!(x < max)) return nbins + 1;
+            return 1 + std::min<size_t>((size_t)(nbins * (x - min) / (max - min)), nbins - 1);
+        }
+
+        /**
+         * @brief Add the universe weights of a candidate.
+         * @details Universes beyond the configured number of universes are
+         * added to the overflow column of the bin. The candidate is also
+         * counted (with unit weight) in the central value of the bin.
+         * @tparam T The type of the universe weights.
+         * @param bin The bin of the variable (see @ref find_bin).
+         * @param weights A pointer to the contiguous universe weights.
+         * @param n The number of universe weights.
+         * @return void
+         */
+        template<typename T>
+        void add(size_t bin, const T * weights, size_t n)
+        {
+            double * row = data.data() + bin * stride;
+            size_t m = std::min(n, nuniverses);
+            for(size_t u = 0; u < m; ++u)
+                row[u] += weights[u];
+            for(size_t u = m; u < n; ++u)
+                row[nuniverses] += weights[u];
+            nominal[bin] += 1.0;
+            entries += n;
+        }
+
+        /**
+         * @brief Merge the weights of another accumulator into this one.
+         * @details This is used to combine the accumulators filled by
+         * separate worker threads.
+         * @param other The accumulator to merge.
+         * @return void
+         * @throw std::runtime_error if the accumulators have a different
+         * binning or number of universes.
+         */
+        void merge(const UniverseAccumulator & other)
+        {
+            if(other.nbins != nbins || other.min != min || other.max != max || other.nuniverses != nuniverses)
+                throw std::runtime_error("UniverseAccumulator: Cannot merge '" + other.name + "' into '" + name + "' (different binning or number of universes).");
+            for(size_t i = 0; i < data.size(); ++i)
+                data[i] += other.data[i];
+            for(size_t i = 0; i < nominal.size(); ++i)
+                nominal[i] += other.nominal[i];
+            entries += other.entries;
+        }
+
+        /**
+         * @brief Reset the accumulated weights to zero.
+         * @return void
+         */
+        void clear()
+        {
+            std::fill(data.begin(), data.end(), 0.0);
+            std::fill(nominal.begin(), nominal.end(), 0.0);
+            entries = 0;
+        }
+
+        /**
+         * @brief Get the number of universes.
+         * @return The number of universes.
+         */
+        size_t get_nuniverses() const { return nuniverses; }
+
+        /**
+         * @brief Get the sum of the weights of a universe over the regular
+         * bins of the variable.
+         * @param u The index of the universe.
+         * @return The sum of the weights of the universe.
+         */
+        double universe_sum(size_t u) const
+        {
+            double sum(0);
+            for(size_t b = 1; b <= nbins; ++b)
+                sum += data[b * stride + u];
+            return sum;
+        }
+
+        /**
+         * @brief Convert the accumulated weights to a TH2D.
+         * @details The histogram has the variable on the x-axis and the
+         * universe index on the y-axis. The caller takes ownership of the
+         * histogram, which is not attached to any directory.
+         * @return The histogram of the accumulated weights.
+         */
+        TH2D * make_histogram() const
+        {
+            TH2D * hist = new TH2D(name.c_str(), name.c_str(), nbins, min, max, nuniverses, 0, nuniverses);
+            hist->SetDirectory(nullptr);
+            for(size_t b = 0; b < nbins + 2; ++b)
+            {
+                for(size_t u = 0; u < stride; ++u)
+                    hist->SetBinContent(b, u + 1, data[b * stride + u]);
+            }
+            hist->ResetStats();
+            hist->SetEntries(entries);
+            return hist;
+        }
+
+        /**
+         * @brief Calculate the covariance matrix of the universes.
+         * @details The covariance matrix is calculated over the regular bins
+         * of the variable with respect to the central value, i.e.,
+         * C_ij = 1/N sum_u (n_ui - cv_i) (n_uj - cv_j), where n_ui is the
+         * content of bin i in universe u and cv_i is the number of
+         * candidates in bin i. The universes are accumulated with a
+         * Welford-style online update of the mean and co-moment matrix,
+         * which is then shifted to the central value. The caller takes
+         * ownership of the histogram, which is not attached to any
+         * directory.
+         * @param name The name of the histogram.
+         * @return The covariance matrix, binned in the variable on both axes.
+         */
+        TH2D * make_covariance(const std::string & name) const
+        {
+            std::vector<double> mean(nbins, 0.0), comoment(nbins * nbins, 0.0), delta(nbins);
+            for(size_t u = 0; u < nuniverses; ++u)
+            {
+                double k = u + 1;
+                for(size_t i = 0; i < nbins; ++i)
+                {
+                    delta[i] = data[(i + 1) * stride + u] - mean[i];
+                    mean[i] += delta[i] / k;
+                }
+                for(size_t i = 0; i < nbins; ++i)
+                {
+                    double residual = data[(i + 1) * stride + u] - mean[i];
+                    for(size_t j = 0; j < nbins; ++j)
+                        comoment[i * nbins + j] += delta[j] * residual;
+                }
+            }
+
+            TH2D * hist = new TH2D(name.c_str(), name.c_str(), nbins, min, max, nbins, min, max);
+            hist->SetDirectory(nullptr);
+            for(size_t i = 0; i < nbins && nuniverses > 0; ++i)
+            {
+                for(size_t j = 0; j < nbins; ++j)
+                {
+                    double shift = (mean[i] - nominal[i + 1]) * (mean[j] - nominal[j + 1]);
+                    hist->SetBinContent(i + 1, j + 1, comoment[i * nbins + j] / nuniverses + shift);
+                }
+            }
+            return hist;
+        }
+
+        /**
+         * @brief Calculate the correlation matrix from a covariance matrix.
+         * @details Bins with zero variance have zero correlation. The caller
+         * takes ownership of the histogram, which is not attached to any
+         * directory.
+         * @param covariance The covariance matrix (see @ref make_covariance).
+         * @param name The name of the histogram.
+         * @return The correlation matrix.
+         */
+        static TH2D * make_correlation(const TH2D * covariance, const std::string & name)
+        {
+            TH2D * hist = (TH2D *)covariance->Clone(name.c_str());
+            hist->SetTitle(name.c_str());
+            hist->SetDirectory(nullptr);
+            int n = covariance->GetNbinsX();
+            for(int i = 1; i <= n; ++i)
+            {
+                for(int j = 1; j <= n; ++j)
+                {
+                    double norm = std::sqrt(covariance->GetBinContent(i, i) * covariance->GetBinContent(j, j));
+                    hist->SetBinContent(i, j, norm > 0 ? covariance->GetBinContent(i, j) / norm : 0.0);
+                }
+            }
+            return hist;
+        }
+
+        private:
+        std::string name; // Name of the equivalent histogram
+        size_t nbins; // Number of bins of the variable
+        double min; // Lower edge of the variable range
+        double max; // Upper edge of the variable range
+        size_t nuniverses; // Number of universes
+        size_t stride; // Length of a row (universes plus overflow)
+        size_t entries; // Number of added weights
+        std::vector<double> data; // Accumulated weights [bin][universe]
+        std::vector<double> nominal; // Central value (number of candidates) [bin]
+    };
+} // namespace sys
+#endif // ACCUMULATOR_H
@@ -16,6 +16,7 @@
 
 #include "configuration.h"
 #include "utilities.h"
+#include "accumulator.h"
 
 #include "TH1D.h"
 #include "TH2D.h"
@@ -48,7 +49,58 @@ namespace sys::detsys
      */
     class DetsysCalculator
     {
+    public:
+        /**
+         * @brief Type definition for the handle of a detector systematic.
+         * @details A handle is obtained once per detector systematic with
+         * @ref get_handle and replaces the name-based lookups in the
+         * evaluation of the weights.
+         */
+        typedef size_t Handle;
+
     private:
+        /**
+         * @struct SplineTable
+         * @brief The precompiled splines of a single detector systematic.
+         * @details The cubic coefficients of the spline of each bin are
+         * stored in a flat table. All splines of a detector systematic share
+         * the same knots (the configured z-scores), so the spline segment
+         * and the offset within the segment of each random universe are
+         * computed once at construction.
+         */
+        struct SplineTable
+        {
+            std::string name; // Name of the detector systematic
+            std::vector<double> edges; // Bin edges of the binning variable
+            std::vector<double> knots; // Knot positions (z-scores)
+            size_t nsegments; // Number of spline segments per bin
+            std::vector<double> coefficients; // Coefficients [bin][segment][y, b, c, d]
+            std::vector<size_t> universe_segments; // Spline segment of each random universe
+            std::vector<double> universe_offsets; // Offset within the segment of each random universe
+            std::map<std::string, UniverseAccumulator *> results; // Result accumulators (by variable name)
+        };
+
+        /**
+         * @brief Find the spline segment of a z-score.
+         * @details This mirrors the segment search of TSpline3::Eval: values
+         * outside of the knots are extrapolated with the first or last
+         * segment.
+         * @param table The precompiled splines of the detector systematic.
+         * @param zscore The z-score.
+         * @param offset The offset of the z-score within the segment.
+         * @return The index of the spline segment.
+         */
+        static size_t find_segment(const SplineTable & table, double zscore, double & offset);
+
+        /**
+         * @brief Find the bin of the binning variable.
+         * @param table The precompiled splines of the detector systematic.
+         * @param value The value of the binning variable.
+         * @return The index of the bin (zero-based), or the number of bins if
+         * the value is outside of the binning.
+         */
+        static size_t find_bin(const SplineTable & table, double value);
+
         bool initialized;
         TDirectory * histogram_directory;
         TDirectory * result_directory;
@@ -59,10 +111,13 @@ namespace sys::detsys
         std::string variable;
         std::vector<std::string> variations;
         std::map<std::string, TH1D *> detsys_results1D;
-        std::map<std::string, TH2D *> detsys_results2D;
+        std::map<std::string, UniverseAccumulator *> detsys_results2D;
         size_t nuniverses;
         double nominal_count;
         std::vector<double> random_zscores;
+        std::vector<SplineTable> tables;
+        std::map<std::string, Handle> handles;
+        std::vector<double> universe_weights;
 
     public:
         /**
@@ -87,18 +142,57 @@ namespace sys::detsys
          */
         DetsysCalculator();
 
+        /**
+         * @brief Create a copy of the calculator with empty results.
+         * @details The copy shares the (read-only) splines of this calculator,
+         * but has its own result accumulators and nominal count. This allows
+         * each worker thread to fill its own copy, which is merged back into
+         * this calculator with @ref merge.
+         * @return A copy of the calculator with empty results.
+         */
+        DetsysCalculator fork() const;
+
+        /**
+         * @brief Merge the results of a copy created with @ref fork.
+         * @details The result accumulators and nominal count of the copy are
+         * added to this calculator. The accumulators of the copy are released.
+         * @param other The copy to merge.
+         * @return void
+         */
+        void merge(DetsysCalculator & other);
+
         /**
          * @brief Add a variable to the list of result histograms.
          * @details This function adds a variable to the list of result
          * histograms by creating a new TH1D and TH2D for each configured
          * detector variation. The name of each histogram follows the naming
-         * scheme "<variable>_<detsys>_1D" and "<variable>_<detsys>_2D".
+         * scheme "<variable>_<detsys>_1D" and "<variable>_<detsys>_2D". The
+         * results of a variable that was added before are replaced.
          * @param variable The SysVariable object to be added to the list of
          * result histograms.
          * @return void
          */
         void add_variable(SysVariable & variable);
 
+        /**
+         * @brief Compile the splines of a detector systematic.
+         * @details The cubic coefficients of the spline of each bin are
+         * copied into the flat table that is evaluated by @ref get_weight
+         * and @ref get_universe_weights, so the splines remain owned by the
+         * caller. The splines must share the knots. This is used by the
+         * constructor for each configured detector systematic, but may also
+         * be used to add splines to a default-constructed calculator.
+         * @param name The name of the detector systematic.
+         * @param edges The bin edges of the binning variable.
+         * @param knots The knot positions (z-scores) of the splines.
+         * @param bin_splines The spline of each bin.
+         * @return The handle of the detector systematic.
+         * @throw std::runtime_error if the number of splines does not match
+         * the binning or if there are no knots.
+         */
+        Handle add_splines(const std::string & name, const std::vector<double> & edges,
+                           const std::vector<double> & knots, const std::vector<TSpline3 *> & bin_splines);
+
         /**
          * @brief Accessor method for the initialized flag.
          * @details This function returns the initialized flag.
@@ -136,7 +230,25 @@ namespace sys::detsys
          * @param name The name of the detector systematic.
          * @return The z-scores for the specified detector systematic.
          */
-        std::vector<double> get_zscores(std::string name);
+        const std::vector<double> & get_zscores(const std::string & name);
+
+        /**
+         * @brief Get the z-scores for a specified detector systematic.
+         * @details This function returns the z-scores (the knots of the
+         * splines) for a specified detector systematic.
+         * @param handle The handle of the detector systematic.
+         * @return The z-scores for the specified detector systematic.
+         */
+        const std::vector<double> & get_zscores(Handle handle) const;
+
+        /**
+         * @brief Get the handle of a detector systematic.
+         * @param name The name of the detector systematic.
+         * @return The handle of the detector systematic.
+         * @throw std::runtime_error if the detector systematic is not
+         * configured.
+         */
+        Handle get_handle(const std::string & name) const;
 
         /**
          * @brief Write the variation histograms to the output file.
@@ -158,9 +270,31 @@ namespace sys::detsys
          * the configuration parameter "variations.keys". The histogram consists
          * of the binned variable (X) and the weighted entries across the
          * universes (Y).
+         * @param prefix The prefix of the name of each histogram (e.g., the
+         * name of the tree followed by an underscore).
+         * @return void
+         */
+        void write_results(const std::string & prefix = "");
+
+        /**
+         * @brief Reset the results of the detector systematic variations.
+         * @details The result histograms and accumulators of each variable
+         * are kept (with their binning) but emptied, and the nominal count is
+         * reset, so that the calculator can accumulate the results of another
+         * tree.
          * @return void
          */
-        void write_results();
+        void reset_results();
+
+        /**
+         * @brief Get the result accumulators of a variable.
+         * @details This function returns the accumulated universe weights of
+         * a variable for each configured detector systematic.
+         * @param varname The name of the variable.
+         * @return The result accumulators of the variable, keyed by the name
+         * of the detector systematic.
+         */
+        std::map<std::string, const UniverseAccumulator *> get_results(const std::string & varname) const;
 
         /**
          * @brief Access the histograms by name.
@@ -182,7 +316,34 @@ namespace sys::detsys
          * @param zscore The z-score for which the weight is to be calculated.
          * @return The weight for the specified value and z-score.
          */
-        double get_weight(std::string name, double value, double zscore);
+        double get_weight(const std::string & name, double value, double zscore);
+
+        /**
+         * @brief Get the weight for a given value and z-score for a specified
+         * detector systematic.
+         * @details This function evaluates the precompiled spline of the bin
+         * containing the value. Values outside of the binning have a weight
+         * of one.
+         * @param handle The handle of the detector systematic.
+         * @param value The value for which the weight is to be calculated.
+         * @param zscore The z-score for which the weight is to be calculated.
+         * @return The weight for the specified value and z-score.
+         */
+        double get_weight(Handle handle, double value, double zscore) const;
+
+        /**
+         * @brief Get the weights of all random universes for a given value
+         * for a specified detector systematic.
+         * @details This function evaluates the precompiled spline of the bin
+         * containing the value for the pre-rolled z-scores of all random
+         * universes in a single batch.
+         * @param handle The handle of the detector systematic.
+         * @param value The value for which the weights are to be calculated.
+         * @param weights The output array of (at least) @ref get_nuniverses
+         * weights.
+         * @return void
+         */
+        void get_universe_weights(Handle handle, double value, double * weights) const;
 
         /**
          * @brief Add a value to the histogram for a specified detector
@@ -196,7 +357,22 @@ namespace sys::detsys
          * @param value The value to be added to the histogram.
          * @return void
          */
-        void add_value(std::string varname, double binvar, std::string detsysname, double value);
+        void add_value(const std::string & varname, double binvar, const std::string & detsysname, double value);
+
+        /**
+         * @brief Add a value to the histogram for a specified detector
+         * systematic.
+         * @details This function adds a value to the histogram for a specified
+         * detector systematic while respecting the pre-rolled z-scores of
+         * the random universes. The weights of all universes are evaluated
+         * in a single batch.
+         * @param varname The name of the variable.
+         * @param binvar The value of the binning variable.
+         * @param handle The handle of the detector systematic.
+         * @param value The value to be added to the histogram.
+         * @return void
+         */
+        void add_value(const std::string & varname, double binvar, Handle handle, double value);
     };
 } // namespace sys::detsys
 #endif // DETSYS_H
\ No newline at end of file
@@ -8,6 +8,9 @@
  */
 #ifndef SYSTEMATIC_H
 #define SYSTEMATIC_H
+#include <vector>
+#include <string>
+
 #include "configuration.h"
 
 #include "TTree.h"
@@ -27,6 +30,48 @@ namespace sys
      */
     enum class Type { kMULTISIM, kMULTISIGMA, kVARIATION };
 
+    /**
+     * @brief Enumeration for the storage of the universe weights.
+     * @details The enumeration defines how the universe weights of a
+     * systematic are stored in its TTree. The types are:
+     * - kVECTOR: a variable-length vector of doubles (the default).
+     * - kFLOAT: a fixed-size array of floats.
+     * - kQUANTIZED: a fixed-size array of 16-bit offsets from one, in units
+     *   of a "step" (stored in the "<name>_step" branch) chosen such that
+     *   each weight is stored within the configured precision. Weights that
+     *   cannot be represented are marked with @ref kQUANTIZED_OVERFLOW and
+     *   stored, in order, as floats in the "<name>_overflow" branch.
+     */
+    enum class WeightStorage { kVECTOR, kFLOAT, kQUANTIZED };
+
+    /**
+     * @brief The marker of a quantized weight that is stored in the overflow
+     * branch.
+     */
+    constexpr Short_t kQUANTIZED_OVERFLOW = -32768;
+
+    /**
+     * @struct WeightFormat
+     * @brief The configuration of the storage of the universe weights.
+     */
+    struct WeightFormat
+    {
+        WeightStorage storage = WeightStorage::kVECTOR; // Storage of the universe weights
+        double precision = 1e-4; // Maximum absolute error of a quantized weight
+    };
+
+    /**
+     * @brief Parse the storage of the universe weights.
+     * @details The storage is configured with the "output.weight_storage"
+     * field ("vector", "float", or "quantized"; default "vector") and the
+     * precision of the quantized weights with the "output.weight_precision"
+     * field (default 1e-4).
+     * @param config The full configuration.
+     * @return The configuration of the storage of the universe weights.
+     * @throw cfg::ConfigurationError if the storage or precision is invalid.
+     */
+    WeightFormat parse_weight_format(cfg::ConfigurationTable & config);
+
     /**
      * @brief Class representing a systematic.
      * @details The Systematic class encapsulates the properties of a
@@ -47,6 +92,21 @@ namespace sys
         TTree * tree;
         std::vector<double> * weights;
         std::vector<double> * nsigma;
+
+        // Fixed-size storage of the universe weights
+        WeightFormat format;
+        size_t nweights;
+        Float_t step;
+        std::vector<Float_t> float_weights;
+        std::vector<Short_t> quantized_weights;
+        std::vector<float> * overflow;
+
+        /**
+         * @brief Create the fixed-size branches of the universe weights.
+         * @param n the number of universe weights per candidate
+         * @return void
+         */
+        void book(size_t n);
         
     public:
         /**
@@ -56,8 +116,9 @@ namespace sys
          * @param table the configuration table containing the systematic
          * configuration details
          * @param t the TTree associated with the systematic
+         * @param f the storage of the universe weights
          */
-        Systematic(cfg::ConfigurationTable & table, TTree * t);
+        Systematic(cfg::ConfigurationTable & table, TTree * t, const WeightFormat & f = {});
 
         /**
          * @brief Get the index of the systematic parameter.
@@ -102,6 +163,34 @@ namespace sys
          * @return std::vector<double>*& reference to the nsigma vector.
          */
         std::vector<double> * & get_nsigma();
+
+        /**
+         * @brief Create the branches of the systematic in its TTree.
+         * @details The branch of the universe weights (and the branch of the
+         * z-scores, if configured) is created immediately, so that it exists
+         * even if the TTree is never filled. The fixed-size branches are
+         * booked with the number of universe weights per candidate; if it is
+         * not known (zero), no weight branch is booked and a warning is
+         * printed.
+         * @param n the number of universe weights per candidate (unused for
+         * the variable-length storage)
+         * @return void
+         */
+        void create_branches(size_t n);
+
+        /**
+         * @brief Store the universe weights of a candidate.
+         * @details The weights are copied into the (reused) buffers of the
+         * branches in the configured storage, ready for the next fill of the
+         * TTree.
+         * @param data pointer to the first universe weight
+         * @param n the number of universe weights
+         * @return void
+         * @throw std::runtime_error if the number of universe weights differs
+         * from the size of the fixed-size branches booked by
+         * @ref create_branches.
+         */
+        void store(const double * data, size_t n);
     };
 } // namespace sys
 #endif // SYSTEMATIC_H
\ No newline at end of file
@@ -12,6 +12,7 @@
 #ifndef TREES_H
 #define TREES_H
 #include <iostream>
+#include <vector>
 
 #include "detsys.h"
 #include "configuration.h"
@@ -51,18 +52,24 @@ namespace sys::trees
     void copy_tree(cfg::ConfigurationTable & table, TFile * output, TFile * input);
 
     /**
-     * @brief Add reweightable systematics to the output TTree.
+     * @brief Add reweightable systematics to the output TTrees.
      * @details This function adds reweightable systematics to the output
-     * TTree. The function loops over the input TTree to build a map for the
-     * selected signal candidates to their index in the input TTree. The
-     * function then loops over the neutrinos in the CAF input files and
-     * populates the output TTree with the selected signal candidates and the
-     * universe weights for matched neutrinos.
-     * @param table The table that contains the configuration for the tree.
+     * TTrees of all "add_weights" trees. The function first loops over the
+     * input TTree of each tree to build a map for the selected signal
+     * candidates to their index in the input TTree. The function then loops
+     * over the neutrinos in the CAF input files once, dispatching each
+     * matched neutrino to every tree with a selected signal candidate, and
+     * populates the output TTrees of each tree with its selected signal
+     * candidates and the universe weights for the matched neutrinos. The
+     * output TTrees and histograms of each tree are the same as if the tree
+     * had been processed on its own.
+     * @param config The full configuration.
+     * @param tables The tables that contain the configuration for the trees.
      * @param output The output TFile.
      * @param input The input TFile.
+     * @param calc The DetsysCalculator.
      * @return void
      */
-    void copy_with_weight_systematics(cfg::ConfigurationTable & config, cfg::ConfigurationTable & table, TFile * output, TFile * input, sys::detsys::DetsysCalculator & calc);
+    void copy_with_weight_systematics(cfg::ConfigurationTable & config, std::vector<cfg::ConfigurationTable> & tables, TFile * output, TFile * input, sys::detsys::DetsysCalculator & calc);
 }
 #endif
\ No newline at end of file
@@ -11,6 +11,9 @@
 #ifndef WEIGHT_READER_H
 #define WEIGHT_READER_H
 #include <chrono>
+#include <set>
+#include <tuple>
+#include <vector>
 
 #include "TChain.h"
 #include "TTreeReader.h"
@@ -21,6 +24,79 @@
 
 namespace sys
 {
+    /**
+     * @struct WeightSpan
+     * @brief A non-owning view of a contiguous run of universe weights.
+     * @details The view points into the storage of the @ref WeightReader
+     * and is only valid until the reader advances to the next entry.
+     */
+    struct WeightSpan
+    {
+        const float * data; // Pointer to the first universe weight
+        size_t count; // Number of universe weights
+
+        size_t size() const { return count; }
+        const float * begin() const { return data; }
+        const float * end() const { return data + count; }
+        float operator[](size_t i) const { return data[i]; }
+    };
+
+    /**
+     * @struct IOOptions
+     * @brief The configuration of the I/O tuning of a @ref WeightReader.
+     * @details The TTreeCache of the TChain is restricted to the branches
+     * that the reader reads, unless a learning phase is configured.
+     */
+    struct IOOptions
+    {
+        Long64_t cache_size = -1; // Size of the TTreeCache in bytes (negative for the ROOT default)
+        Int_t learn_entries = 0; // Entries of the learning phase (zero to cache the read branches only)
+        bool prefetch = false; // Flag to prefetch the cache and the next file asynchronously
+    };
+
+    /**
+     * @brief Build a universe weight cache from a set of CAF files.
+     * @details This function reads the universe weights of all neutrinos
+     * in the CAF input files (structured or flat) and writes them to a
+     * compact sidecar file. The sidecar contains only the event header
+     * (run, subrun, event) and, for each neutrino, the neutrino energy and
+     * the universe weights of all weight groups. Events without neutrinos
+     * are skipped. The sidecar can be read back with @ref WeightReader in
+     * place of the CAF input files, and keeps the same indexing (run,
+     * subrun, event, neutrino index, and neutrino energy). The fingerprint
+     * of the input files (see @ref weight_source_fingerprint) is stored
+     * alongside, so that a stale sidecar can be detected.
+     * @param input The input file, file pattern, or file list to read.
+     * @param path The path of the sidecar file to write.
+     * @return void
+     * @throw std::runtime_error if the sidecar file cannot be created.
+     */
+    void build_weight_cache(const std::string & input, const std::string & path);
+
+    /**
+     * @brief Compute the fingerprint of a set of CAF files.
+     * @details The fingerprint lists each file of the input (expanded as by
+     * the @ref WeightReader) with its size and modification time, one file
+     * per line.
+     * @param input The input file, file pattern, or file list.
+     * @return The fingerprint of the input files.
+     * @throw std::runtime_error if the size or modification time of a file
+     * cannot be queried.
+     */
+    std::string weight_source_fingerprint(const std::string & input);
+
+    /**
+     * @brief Check if a universe weight cache was built from the current
+     * version of a set of CAF files.
+     * @details The fingerprint stored by @ref build_weight_cache is compared
+     * to the fingerprint of the input files. A sidecar without a fingerprint
+     * (or which cannot be opened) does not match.
+     * @param path The path of the sidecar file.
+     * @param input The input file, file pattern, or file list.
+     * @return True if the sidecar matches the input files.
+     */
+    bool weight_cache_matches(const std::string & path, const std::string & input);
+
     /**
      * @class WeightReader
      * @brief A class to read and access weight information from CAF files.
@@ -30,11 +106,18 @@ namespace sys
      * the next entry, set the weight group index, and access metadata such as
      * run, subrun, and event numbers. It also provides methods to get the number
      * of neutrinos, weight groups, and universes, as well as the weight values
-     * themselves.
+     * themselves. A universe weight cache (see @ref build_weight_cache) is
+     * detected automatically and can be read in place of the CAF files.
      */
     class WeightReader
     {
         public:
+
+        /**
+         * @brief Type definition for the (run, subrun, event) key of an
+         * event.
+         */
+        typedef std::tuple<uint32_t, uint32_t, uint32_t> event_key_t;
         
         /**
          * @brief Constructor for the WeightReader class.
@@ -57,12 +140,72 @@ namespace sys
          * @brief Advance to the next entry in the TChain.
          * @details This method advances the TChain to the next entry and
          * updates the entry index. It returns true if successful, false
-         * otherwise. Internally, it will correctly handle differences between
-         * structured and flat CAF files.
+         * otherwise. The first call visits the first entry (of the TChain, or
+         * of the selected entries). Internally, it will correctly handle
+         * differences between structured and flat CAF files.
          * @return True if successful, false otherwise.
          */
         bool next();
 
+        /**
+         * @brief Restrict the reader to the entries of a set of events.
+         * @details This method scans only the header branches (run, subrun,
+         * and event) of the TChain and records the entries that match one
+         * of the requested events. Afterwards, @ref next only visits (and
+         * reads the weight branches of) the matched entries. This should be
+         * called before the first call to @ref next.
+         * @param keys The (run, subrun, event) keys of the requested events.
+         * @return The number of matched entries.
+         */
+        size_t select(const std::set<event_key_t> & keys);
+
+        /**
+         * @brief Restrict the reader to an explicit list of entries.
+         * @details This method restricts the reader to the listed entries of
+         * the TChain, which should be in ascending order. It is used to
+         * split the entries selected by @ref select across several readers.
+         * @param entries The entries of the TChain to read.
+         * @return void
+         */
+        void select_entries(const std::vector<Long64_t> & entries);
+
+        /**
+         * @brief Get the entries the reader is restricted to.
+         * @return The selected entries of the TChain.
+         */
+        const std::vector<Long64_t> & get_selected() const { return selected; }
+
+        /**
+         * @brief Get the number of entries in the TChain.
+         * @return The number of entries in the TChain.
+         */
+        Long64_t get_entries() { return chain.GetEntries(); }
+
+        /**
+         * @brief Enable or disable the progress bar.
+         * @details The progress bar should be disabled if several readers
+         * are used concurrently.
+         * @param enable True to enable the progress bar.
+         * @return void
+         */
+        void set_progress(bool enable) { show_progress = enable; }
+
+        /**
+         * @brief Configure the I/O of the TChain.
+         * @details This method (re)creates the TTreeCache of the TChain with
+         * the configured size and adds the branches read by the reader (the
+         * header and weight branches) to it. Unless a learning phase is
+         * configured, the learning phase is skipped. If prefetching is
+         * enabled, the cache is filled asynchronously and the next file of
+         * the TChain is opened in the background once the reader moves to a
+         * new file. Asynchronous prefetching must be enabled (through the
+         * "TFile.AsyncPrefetching" setting of gEnv) before the reader is
+         * constructed.
+         * @param options The configuration of the I/O tuning.
+         * @return void
+         */
+        void configure_io(const IOOptions & options);
+
         /**
          * @brief Set the weight group index.
          * @details This method sets the weight group index for the current
@@ -139,6 +282,19 @@ namespace sys
          */
         float get_weight(size_t idn, size_t idu) const;
 
+        /**
+         * @brief Accessor method for all universe weights of a neutrino.
+         * @details This method returns a view of the contiguous universe
+         * weights for the specified neutrino and the current weight group.
+         * It handles both structured and flat CAF files.
+         * @param idn The index of the neutrino.
+         * @return A view of the universe weights for the specified neutrino
+         * and weight group.
+         * @note This method assumes that the weight group index has been set
+         * using the @ref set method.
+         */
+        WeightSpan get_weights(size_t idn) const;
+
         /**
          * @brief Accessor method for the neutrino energy.
          * @details This method returns the neutrino energy for the
@@ -150,6 +306,34 @@ namespace sys
 
         private:
 
+        /**
+         * @brief Read the weight branches of a flat CAF entry.
+         * @details This method reads the length branches of the entry first
+         * and grows the buffers of the weight branches to fit before reading
+         * them. Only the weight branches are read from the TChain.
+         * @param index The index of the entry in the TChain.
+         * @return void
+         * @throw std::runtime_error if the entry cannot be loaded.
+         */
+        void load_flat(Long64_t index);
+
+        /**
+         * @brief Index the weights of a universe weight cache entry.
+         * @details This method computes the offsets of the weight groups of
+         * each neutrino and of the universes of each weight group from the
+         * lengths stored in the cache.
+         * @return void
+         */
+        void load_cache();
+
+        /**
+         * @brief Open the next file of the TChain in the background.
+         * @details This method is called once the reader moves to a new file
+         * of the TChain. Only remote files are opened in the background.
+         * @return void
+         */
+        void prefetch_next();
+
         /**
          * @brief A simple progress bar for the TChain.
          * @details This method provides a simple progress bar for the TChain
@@ -161,8 +345,16 @@ namespace sys
         void progress_bar(size_t entry, size_t total) const;
 
         bool isflat; // Flag to indicate if the input file is flat or structured
+        bool iscache; // Flag to indicate if the input file is a universe weight cache
         TChain chain; // TChain to hold the input files
         size_t entry; // Current entry index in the TChain
+        bool prefetch; // Flag to open the next file of the TChain in the background
+        Int_t tree_number; // Index of the current file of the TChain
+
+        // Selective reads
+        bool selective; // Flag to indicate if only the selected entries are read
+        std::vector<Long64_t> selected; // Selected entries of the TChain
+        size_t cursor; // Index of the next entry (of the TChain, or of the selected entries)
 
         std::unique_ptr<TTreeReader> reader; // TTreeReader for structured CAF files
         
@@ -176,24 +368,31 @@ namespace sys
         std::unique_ptr<TTreeReaderValue<uint64_t>> nnu_structured; // Number of neutrinos for structured CAF files
 
         // Neutrino-level indexing
-        Int_t nwgt[10]; // Number of weight groups for each neutrino
-        Int_t iwgt[10]; // Index of the weight group for each neutrino
+        std::vector<Int_t> nwgt; // Number of weight groups for each neutrino
+        std::vector<Int_t> iwgt; // Index of the weight group for each neutrino
         size_t idx; // Index of the current weight group
-        Float_t nu_energy[10]; // Neutrino energy for each neutrino
+        std::vector<Float_t> nu_energy; // Neutrino energy for each neutrino
         std::unique_ptr<TTreeReaderArray<Float_t>> nu_energy_structured; // Neutrino energy for structured CAF files
 
         // Systematic-level indexing
-        Int_t nuniv[15000]; // Number of universes for each weight group
-        Int_t iuniv[15000]; // Index of the universe for each weight group
-        Float_t wgts[500000]; // Weight values for each universe
+        std::vector<Int_t> nuniv; // Number of universes for each weight group
+        std::vector<Int_t> iuniv; // Index of the universe for each weight group
+        std::vector<Float_t> wgts; // Weight values for each universe
 
         // MC-truth branch
         std::unique_ptr<TTreeReaderArray<caf::SRTrueInteraction>> mc; // MC-truth data for structured CAF files
 
+        // Universe weight cache branches
+        std::unique_ptr<TTreeReaderValue<std::vector<float>>> cache_energy; // Neutrino energy for each neutrino
+        std::unique_ptr<TTreeReaderValue<std::vector<int>>> cache_nwgt; // Number of weight groups for each neutrino
+        std::unique_ptr<TTreeReaderValue<std::vector<int>>> cache_nuniv; // Number of universes for each weight group
+        std::unique_ptr<TTreeReaderValue<std::vector<float>>> cache_weights; // Weight values for each universe
+
         // Progress bar timestamp
         mutable std::chrono::steady_clock::time_point progress_start_time; // Start time for the progress bar
         mutable bool progress_started = false; // Flag to indicate if the progress bar has started
         mutable int last_printed_percent = -1; // Last printed percent for the progress bar
+        bool show_progress = true; // Flag to indicate if the progress bar is shown
     };
 } // namespace sys
 #endif  // WEIGHT_READER_H
\ No newline at end of file
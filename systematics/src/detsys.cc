@@ -12,6 +12,8 @@
 #include <map>
 #include <vector>
 #include <random>
+#include <algorithm>
+#include <stdexcept>
 
 #include "detsys.h"
 #include "configuration.h"
@@ -25,6 +27,8 @@
 // Constructor for the DetsysCalculator class that initializes the class using
 // the configuration table, the output file, and the input file. 
 sys::detsys::DetsysCalculator::DetsysCalculator(cfg::ConfigurationTable & table, TFile * output, TFile * input)
+    : initialized(true),
+      nominal_count(0)
 {
     // Roll random z-scores to create a set of universes for later.
     std::random_device rd;
@@ -33,6 +37,7 @@ sys::detsys::DetsysCalculator::DetsysCalculator(cfg::ConfigurationTable & table,
     nuniverses = table.get_int_field("variations.nuniverses");
     for(size_t n(0); n < nuniverses; ++n)
         random_zscores.push_back(dist(gen));
+    universe_weights.resize(nuniverses);
 
     // Create the output directories to store the histograms and splines.
     // Also, load a few configuration details.
@@ -150,7 +155,77 @@ sys::detsys::DetsysCalculator::DetsysCalculator(cfg::ConfigurationTable & table,
             }
             splines[name].push_back(new TSpline3("spline", x.data(), y.data(), x.size()));
         }
+
+        // This block compiles the splines into a flat table of the cubic
+        // coefficients of each segment of each bin.
+        TAxis * axis = hdummies[name]->GetXaxis();
+        std::vector<double> edges;
+        for(int j(0); j < axis->GetNbins(); ++j)
+            edges.push_back(axis->GetBinLowEdge(j + 1));
+        edges.push_back(axis->GetBinUpEdge(axis->GetNbins()));
+        add_splines(name, edges, zscores[name], splines[name]);
+    }
+}
+
+// Compile the splines of a detector systematic into a flat table of the
+// cubic coefficients of each segment of each bin.
+sys::detsys::DetsysCalculator::Handle sys::detsys::DetsysCalculator::add_splines(const std::string & name, const std::vector<double> & edges, const std::vector<double> & knots, const std::vector<TSpline3 *> & bin_splines)
+{
+    if(edges.size() != bin_splines.size() + 1)
+        throw std::runtime_error("DetsysCalculator: Detector systematic '" + name + "' has " + std::to_string(bin_splines.size()) + " splines for " + std::to_string(edges.size() - 1) + " bins.");
+    if(knots.empty())
+        throw std::runtime_error("DetsysCalculator: Detector systematic '" + name + "' has no knots.");
+
+    SplineTable table;
+    table.name = name;
+    table.edges = edges;
+    table.knots = knots;
+    table.nsegments = std::max<size_t>(knots.size(), 2) - 1;
+    for(TSpline3 * spline : bin_splines)
+    {
+        for(size_t k(0); k < table.nsegments; ++k)
+        {
+            double x, y, b, c, d;
+            spline->GetCoeff(k, x, y, b, c, d);
+            table.coefficients.insert(table.coefficients.end(), {y, b, c, d});
+        }
+    }
+
+    // The splines share the same knots, so the segment of each random
+    // universe is found once.
+    for(double z : random_zscores)
+    {
+        double offset;
+        table.universe_segments.push_back(find_segment(table, z, offset));
+        table.universe_offsets.push_back(offset);
     }
+    zscores[name] = knots;
+    handles[name] = tables.size();
+    tables.push_back(table);
+    return handles[name];
+}
+
+// Find the spline segment of a z-score.
+size_t sys::detsys::DetsysCalculator::find_segment(const SplineTable & table, double zscore, double & offset)
+{
+    const std::vector<double> & knots = table.knots;
+    size_t segment(0);
+    if(knots.size() > 1 && zscore >= knots.back())
+        segment = knots.size() - 2;
+    else if(knots.size() > 1 && zscore > knots.front())
+        segment = std::upper_bound(knots.begin(), knots.end(), zscore) - knots.begin() - 1;
+    segment = std::min(segment, table.nsegments - 1);
+    offset = zscore - knots[segment];
+    return segment;
+}
+
+// Find the bin of the binning variable.
+size_t sys::detsys::DetsysCalculator::find_bin(const SplineTable & table, double value)
+{
+    const std::vector<double> & edges = table.edges;
+    if(!(value >= edges.front() && value < edges.back()))
+        return edges.size() - 1;
+    return std::upper_bound(edges.begin(), edges.end(), value) - edges.begin() - 1;
 }
 
 // Add a variable to the list of result histograms.
@@ -160,17 +235,56 @@ void sys::detsys::DetsysCalculator::add_variable(SysVariable & variable)
     // the detector systematic universes.
     for(auto & [key, value] : hdummies)
     {
+        // Replace (and release) the results of a variable added before.
         std::string name = variable.name + "_" + key;
+        delete detsys_results1D[name];
+        delete detsys_results2D[name];
         detsys_results1D[name] = new TH1D(name.c_str(), name.c_str(), 1000, -0.25, 0.25);
-        detsys_results2D[name] = new TH2D(name.c_str(), name.c_str(), variable.nbins, variable.min, variable.max, nuniverses, 0, nuniverses);
+        detsys_results2D[name] = new UniverseAccumulator(name, variable.nbins, variable.min, variable.max, nuniverses);
+        tables[handles[key]].results[variable.name] = detsys_results2D[name];
     }
 }
 
 // Default constructor for the DetsysCalculator class.
 sys::detsys::DetsysCalculator::DetsysCalculator()
-    : initialized(false)
+    : initialized(false),
+      nuniverses(0),
+      nominal_count(0)
     {}
 
+// Create a copy of the calculator with empty results.
+sys::detsys::DetsysCalculator sys::detsys::DetsysCalculator::fork() const
+{
+    DetsysCalculator copy(*this);
+    copy.nominal_count = 0;
+    for(auto & [key, value] : copy.detsys_results2D)
+    {
+        value = new UniverseAccumulator(*value);
+        value->clear();
+    }
+    for(SplineTable & table : copy.tables)
+    {
+        for(auto & [key, value] : table.results)
+            value = copy.detsys_results2D[key + "_" + table.name];
+    }
+    return copy;
+}
+
+// Merge the results of a copy created with fork().
+void sys::detsys::DetsysCalculator::merge(DetsysCalculator & other)
+{
+    nominal_count += other.nominal_count;
+    other.nominal_count = 0;
+    for(auto & [key, value] : other.detsys_results2D)
+    {
+        detsys_results2D[key]->merge(*value);
+        delete value;
+    }
+    other.detsys_results2D.clear();
+    for(SplineTable & table : other.tables)
+        table.results.clear();
+}
+
 // Accessor method for the initialized flag.
 bool sys::detsys::DetsysCalculator::is_initialized()
 {
@@ -196,11 +310,26 @@ void sys::detsys::DetsysCalculator::increment_nominal_count(double value)
 }
 
 // Method to get the zscores for a given detector systematic parameter.
-std::vector<double> sys::detsys::DetsysCalculator::get_zscores(std::string name)
+const std::vector<double> & sys::detsys::DetsysCalculator::get_zscores(const std::string & name)
 {
     return zscores[name];
 }
 
+// Method to get the zscores for a given detector systematic handle.
+const std::vector<double> & sys::detsys::DetsysCalculator::get_zscores(Handle handle) const
+{
+    return tables[handle].knots;
+}
+
+// Method to get the handle of a given detector systematic parameter.
+sys::detsys::DetsysCalculator::Handle sys::detsys::DetsysCalculator::get_handle(const std::string & name) const
+{
+    auto it = handles.find(name);
+    if(it == handles.end())
+        throw std::runtime_error("DetsysCalculator: Detector systematic '" + name + "' is not configured.");
+    return it->second;
+}
+
 // Write the histogram of each configured variation and the splines for each
 // detector systematic parameter to the output file.
 void sys::detsys::DetsysCalculator::write()
@@ -221,31 +350,51 @@ void sys::detsys::DetsysCalculator::write()
     }
 }
 
+// Reset the results of each variable and the nominal count.
+void sys::detsys::DetsysCalculator::reset_results()
+{
+    nominal_count = 0;
+    for(auto & [key, value] : detsys_results1D)
+        value->Reset();
+    for(auto & [key, value] : detsys_results2D)
+        value->clear();
+}
+
 // Write the result histograms for each detector systematic parameter to the
 // output file.
-void sys::detsys::DetsysCalculator::write_results()
+void sys::detsys::DetsysCalculator::write_results(const std::string & prefix)
 {
     result_directory->cd();
     for(auto & [key, value] : detsys_results2D)
     {
-        std::string name = key + "_2D";
-        histogram_directory->WriteObject(value, name.c_str());
-        for(int i(0); i < value->GetNbinsY(); ++i)
-        {
-            double sum(0);
-            for(int j(0); j < value->GetNbinsX(); ++j)
-                sum += value->GetBinContent(j+1, i+1);
-            detsys_results1D[key]->Fill((sum - nominal_count) / nominal_count);
-        }
+        std::string name = prefix + key + "_2D";
+        TH2D * hist = value->make_histogram();
+        histogram_directory->WriteObject(hist, name.c_str());
+        for(size_t i(0); i < value->get_nuniverses(); ++i)
+            detsys_results1D[key]->Fill((value->universe_sum(i) - nominal_count) / nominal_count);
+        delete hist;
     }
     for(auto & [key, value] : detsys_results1D)
     {
-        std::string name = key + "_1D";
+        std::string name = prefix + key + "_1D";
         histogram_directory->WriteObject(value, name.c_str());
     }
     
 }
 
+// Accessor method for the result accumulators of a variable.
+std::map<std::string, const sys::UniverseAccumulator *> sys::detsys::DetsysCalculator::get_results(const std::string & varname) const
+{
+    std::map<std::string, const UniverseAccumulator *> results;
+    for(const SplineTable & table : tables)
+    {
+        auto it = table.results.find(varname);
+        if(it != table.results.end())
+            results[table.name] = it->second;
+    }
+    return results;
+}
+
 // Accessor method for the histograms.
 TH1D * sys::detsys::DetsysCalculator::operator[](std::string key)
 {
@@ -254,22 +403,61 @@ TH1D * sys::detsys::DetsysCalculator::operator[](std::string key)
 
 // Method to get the weight for a given detector systematic parameter, value
 // of the binning variable, and z-score.
-double sys::detsys::DetsysCalculator::get_weight(std::string name, double value, double zscore)
+double sys::detsys::DetsysCalculator::get_weight(const std::string & name, double value, double zscore)
+{
+    return get_weight(get_handle(name), value, zscore);
+}
+
+// Method to get the weight for a given detector systematic handle, value of
+// the binning variable, and z-score.
+double sys::detsys::DetsysCalculator::get_weight(Handle handle, double value, double zscore) const
 {
-    if(value < hdummies[name]->GetXaxis()->GetXmin() || value > hdummies[name]->GetXaxis()->GetXmax())
+    const SplineTable & table = tables[handle];
+    size_t bin = find_bin(table, value);
+    if(bin == table.edges.size() - 1)
         return 1;
-    else
+    double dx;
+    size_t segment = find_segment(table, zscore, dx);
+    const double * c = table.coefficients.data() + 4 * (bin * table.nsegments + segment);
+    return c[0] + dx * (c[1] + dx * (c[2] + dx * c[3]));
+}
+
+// Method to get the weights of all pre-rolled z-scores (universes) for a
+// given detector systematic handle and value of the binning variable.
+void sys::detsys::DetsysCalculator::get_universe_weights(Handle handle, double value, double * weights) const
+{
+    const SplineTable & table = tables[handle];
+    size_t bin = find_bin(table, value);
+    if(bin == table.edges.size() - 1)
+    {
+        std::fill(weights, weights + nuniverses, 1.0);
+        return;
+    }
+    const double * c = table.coefficients.data() + 4 * bin * table.nsegments;
+    const size_t * segments = table.universe_segments.data();
+    const double * offsets = table.universe_offsets.data();
+    for(size_t u(0); u < nuniverses; ++u)
     {
-        int bin = hdummies[name]->FindBin(value);
-        return splines[name][bin-1]->Eval(zscore);
+        const double * cu = c + 4 * segments[u];
+        double dx = offsets[u];
+        weights[u] = cu[0] + dx * (cu[1] + dx * (cu[2] + dx * cu[3]));
     }
 }
 
 // Method to add a value to the detector systematic parameter histogram
 // for all pre-roll z-scores (universes).
-void sys::detsys::DetsysCalculator::add_value(std::string varname, double binvar, std::string detsysname, double value)
+void sys::detsys::DetsysCalculator::add_value(const std::string & varname, double binvar, const std::string & detsysname, double value)
+{
+    add_value(varname, binvar, get_handle(detsysname), value);
+}
+
+// Method to add a value to the detector systematic parameter histogram
+// for all pre-roll z-scores (universes) of a detector systematic handle.
+void sys::detsys::DetsysCalculator::add_value(const std::string & varname, double binvar, Handle handle, double value)
 {
-    std::string name = varname + "_" + detsysname;
-    for(size_t i(0); i < nuniverses; ++i)
-        detsys_results2D[name]->Fill(binvar, i, get_weight(detsysname, value, random_zscores[i]));
+    auto it = tables[handle].results.find(varname);
+    if(it == tables[handle].results.end())
+        throw std::runtime_error("DetsysCalculator: Variable '" + varname + "' has no result histogram for detector systematic '" + tables[handle].name + "'.");
+    get_universe_weights(handle, value, universe_weights.data());
+    it->second->add(it->second->find_bin(binvar), universe_weights.data(), nuniverses);
 }
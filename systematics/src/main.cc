@@ -18,6 +18,7 @@
 #include "configuration.h"
 #include "trees.h"
 #include "detsys.h"
+#include "weight_reader.h"
 
 #include "TROOT.h"
 #include "TFile.h"
@@ -38,12 +39,15 @@ int main(int argc, char * argv[])
      * @brief Check the number of arguments. The code expects the configuration
      * file as the only argument.
      * @details This block checks the number of arguments. The code expects the
-     * configuration file as the only argument. If the number of arguments is not
-     * correct, the code prints the usage and exits with an error code.
+     * configuration file as the only argument, optionally preceded by
+     * "--build-weight-cache". If the number of arguments is not correct, the
+     * code prints the usage and exits with an error code.
      */
-    if(argc != 2)
+    bool build_cache = argc == 3 && std::string(argv[1]) == "--build-weight-cache";
+    if(argc != 2 && !build_cache)
     {
         std::cerr << "Usage: " << argv[0] << " <configuration.toml>" << std::endl;
+        std::cerr << "       " << argv[0] << " --build-weight-cache <configuration.toml>" << std::endl;
         return 1;
     }
 
@@ -63,7 +67,7 @@ int main(int argc, char * argv[])
     cfg::ConfigurationTable config;
     try
     {
-        config.set_config(argv[1]);
+        config.set_config(argv[argc - 1]);
     }
     catch(const cfg::ConfigurationError & e)
     {
@@ -71,6 +75,20 @@ int main(int argc, char * argv[])
         return 1;
     }
 
+    /**
+     * @brief Build the universe weight cache, if requested.
+     * @details This block reads the universe weights of the CAF input files
+     * ("input.weights") once and writes them to the universe weight cache
+     * ("input.weights_cache"). Later runs with the same configuration read
+     * the universe weights from the cache instead.
+     * @see sys::build_weight_cache
+     */
+    if(build_cache)
+    {
+        sys::build_weight_cache(config.get_string_field("input.weights"), config.get_string_field("input.weights_cache"));
+        return 0;
+    }
+
     /**
      * @brief Open the input and output ROOT files.
      * @details This block opens the input and output ROOT files. The input
@@ -119,6 +137,7 @@ int main(int argc, char * argv[])
         std::cout << "No trees found in the configuration file." << std::endl;
     }
 
+    std::vector<cfg::ConfigurationTable> weight_tables;
     for(cfg::ConfigurationTable & table : tables)
     {
         std::cout << "Processing tree: " << table.get_string_field("origin") << std::endl;
@@ -126,9 +145,18 @@ int main(int argc, char * argv[])
         if(type == "copy")
             sys::trees::copy_tree(table, output, input);
         else if(type == "add_weights")
-            sys::trees::copy_with_weight_systematics(config, table, output, input, calc);
+            weight_tables.push_back(table);
     }
 
+    /**
+     * @brief Add the systematics to the "add_weights" trees.
+     * @details All "add_weights" trees are served by a single pass over the
+     * universe weights, which dispatches each matched neutrino to every tree
+     * with a selected signal candidate.
+     * @see sys::trees::copy_with_weight_systematics()
+     */
+    sys::trees::copy_with_weight_systematics(config, weight_tables, output, input, calc);
+
     input->Close();
     output->Close();
 
@@ -6,19 +6,48 @@
  * systematics that can be applied to the analysis.
  * @author mueller@fnal.gov
  */
+#include <cmath>
+#include <string>
+#include <iostream>
+#include <stdexcept>
+
 #include "systematic.h"
 #include "configuration.h"
 
 #include "TTree.h"
 
+// Parse the storage of the universe weights.
+sys::WeightFormat sys::parse_weight_format(cfg::ConfigurationTable & config)
+{
+    WeightFormat format;
+    std::string storage = config.get_string_field("output.weight_storage", "vector");
+    if(storage == "vector")
+        format.storage = WeightStorage::kVECTOR;
+    else if(storage == "float")
+        format.storage = WeightStorage::kFLOAT;
+    else if(storage == "quantized")
+        format.storage = WeightStorage::kQUANTIZED;
+    else
+        throw cfg::ConfigurationError("Invalid weight storage '" + storage + "' (expected 'vector', 'float', or 'quantized').");
+    if(config.has_field("output.weight_precision"))
+        format.precision = config.get_double_field("output.weight_precision");
+    if(!(format.precision > 0))
+        throw cfg::ConfigurationError("The weight_precision field must be positive.");
+    return format;
+}
+
 // Construct a new Systematic object.
-sys::Systematic::Systematic(cfg::ConfigurationTable & table, TTree * t)
+sys::Systematic::Systematic(cfg::ConfigurationTable & table, TTree * t, const WeightFormat & f)
     : name(table.get_string_field("name")),
       index(table.get_int_field("index")),
       type(table.get_string_field("type") == "multisim" ? Type::kMULTISIM : table.get_string_field("type") == "multisigma" ? Type::kMULTISIGMA : Type::kVARIATION),
       tree(t),
       weights(new std::vector<double>()),
-      nsigma(new std::vector<double>())
+      nsigma(new std::vector<double>()),
+      format(f),
+      nweights(0),
+      step(2 * f.precision),
+      overflow(new std::vector<float>())
 {
     if(table.has_field("nsigma"))
         *nsigma = table.get_double_vector("nsigma");
@@ -65,4 +94,78 @@ std::vector<double> * & sys::Systematic::get_weights()
 std::vector<double> * & sys::Systematic::get_nsigma()
 {
     return nsigma;
+}
+
+// Create the branches of the systematic in its TTree.
+void sys::Systematic::create_branches(size_t n)
+{
+    if(format.storage == WeightStorage::kVECTOR)
+        tree->Branch(name.c_str(), &weights);
+    else if(n > 0)
+        book(n);
+    else
+        std::cerr << "Warning: The number of universe weights of systematic " << name << " is not known. Its fixed-size branch is not booked." << std::endl;
+    if(nsigma->size() > 0)
+        tree->Branch((name + "_sigma").c_str(), &nsigma);
+}
+
+// Create the fixed-size branches of the universe weights.
+void sys::Systematic::book(size_t n)
+{
+    if(n == 0)
+        throw std::runtime_error("Systematic " + name + " has no universe weights, which cannot be stored in a fixed-size branch.");
+    nweights = n;
+    std::string leaves = name + "[" + std::to_string(n) + "]";
+    if(format.storage == WeightStorage::kFLOAT)
+    {
+        float_weights.resize(n);
+        tree->Branch(name.c_str(), float_weights.data(), (leaves + "/F").c_str());
+    }
+    else
+    {
+        quantized_weights.resize(n);
+        tree->Branch(name.c_str(), quantized_weights.data(), (leaves + "/S").c_str());
+        tree->Branch((name + "_step").c_str(), &step, (name + "_step/F").c_str());
+        tree->Branch((name + "_overflow").c_str(), &overflow);
+    }
+}
+
+// Store the universe weights of a candidate.
+void sys::Systematic::store(const double * data, size_t n)
+{
+    if(format.storage == WeightStorage::kVECTOR)
+    {
+        weights->assign(data, data + n);
+        return;
+    }
+    if(n != nweights)
+        throw std::runtime_error("Systematic " + name + " has " + std::to_string(n) + " universe weights for a candidate, but "
+                                 + std::to_string(nweights) + " were expected by its fixed-size branch.");
+
+    if(format.storage == WeightStorage::kFLOAT)
+    {
+        for(size_t i(0); i < n; ++i)
+            float_weights[i] = data[i];
+        return;
+    }
+
+    /**
+     * @brief Quantize the weights as offsets from one.
+     * @details Each weight is rounded to the nearest multiple of the step
+     * (twice the precision) from one, so that the error is at most the
+     * configured precision. Weights that are out of the range of a 16-bit
+     * offset (or not finite) are stored in the overflow branch.
+     */
+    overflow->clear();
+    for(size_t i(0); i < n; ++i)
+    {
+        double q = std::round((data[i] - 1.0) / step);
+        if(std::isfinite(q) && q > kQUANTIZED_OVERFLOW && q <= 32767)
+            quantized_weights[i] = (Short_t)q;
+        else
+        {
+            quantized_weights[i] = kQUANTIZED_OVERFLOW;
+            overflow->push_back(data[i]);
+        }
+    }
 }
\ No newline at end of file
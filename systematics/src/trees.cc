@@ -9,20 +9,243 @@
  * @author mueller@fnal.gov
  */
 #include <iostream>
+#include <fstream>
+#include <set>
+#include <cmath>
+#include <limits>
+#include <tuple>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <numeric>
+#include <exception>
+#include <stdexcept>
+#include <algorithm>
 
 #include "trees.h"
+#include "accumulator.h"
 #include "detsys.h"
 #include "utilities.h"
 #include "configuration.h"
 #include "systematic.h"
 #include "weight_reader.h"
 
+#include "TROOT.h"
+#include "TEnv.h"
 #include "TFile.h"
 #include "TDirectory.h"
 #include "TTree.h"
+#include "TBranch.h"
+#include "TLeaf.h"
 #include "TH1D.h"
 #include "TH2D.h"
 
+namespace
+{
+    /**
+     * @struct Match
+     * @brief A neutrino matched to a selected signal candidate.
+     * @details The universe weights are stored for each of the configured
+     * systematics (in the order of the systematics map) until the main
+     * thread fills them into the systematic TTrees. The weights of all
+     * matches of a round are stored contiguously in the buffers of the
+     * worker (see @ref TreeResults), which are reused across rounds.
+     */
+    struct Match
+    {
+        size_t candidate; // Entry of the signal candidate in the input TTree
+        Int_t run; // Run number
+        Int_t subrun; // Subrun number
+        Int_t event; // Event number
+        size_t bounds; // Index of the first bound of the weights of the match
+    };
+
+    /**
+     * @struct InputColumn
+     * @brief A branch of an input TTree, bound to a buffer of its own type.
+     * @details The branches of the selection output are stored as doubles,
+     * floats, 32-bit integers, or 8-bit unsigned integers (see the storage
+     * types of the selection). The buffer is large enough for any of these
+     * types, and the value is converted to and from a double with
+     * @ref decode.
+     */
+    struct InputColumn
+    {
+        std::string name; // Name of the branch
+        char code; // Leaf type code of the branch ('D', 'F', 'I', or 'b')
+        alignas(8) unsigned char buffer[8]; // Buffer bound to the branch
+    };
+
+    /**
+     * @brief Read the value of a column as a double.
+     * @details Integer branches cannot hold a NaN, so the selection stores
+     * NaN as the minimum value of a 32-bit integer (INT32_MIN) and as the
+     * maximum value of an 8-bit unsigned integer (255). These sentinels are
+     * decoded back to NaN here.
+     * @param column The column to read.
+     * @return The value of the column.
+     */
+    double decode(const InputColumn & column)
+    {
+        if(column.code == 'F')
+        {
+            float v;
+            std::memcpy(&v, column.buffer, sizeof(v));
+            return v;
+        }
+        if(column.code == 'I')
+        {
+            int32_t v;
+            std::memcpy(&v, column.buffer, sizeof(v));
+            return (v == std::numeric_limits<int32_t>::min()) ? std::numeric_limits<double>::quiet_NaN() : v;
+        }
+        if(column.code == 'b')
+        {
+            uint8_t v;
+            std::memcpy(&v, column.buffer, sizeof(v));
+            return (v == std::numeric_limits<uint8_t>::max()) ? std::numeric_limits<double>::quiet_NaN() : v;
+        }
+        double v;
+        std::memcpy(&v, column.buffer, sizeof(v));
+        return v;
+    }
+
+    /**
+     * @brief Bind the branches of an input TTree to typed buffers.
+     * @details All branches except Run, Subrun, and Evt are bound, in the
+     * order of the input TTree. The type of each branch is taken from its
+     * (single) leaf.
+     * @param tree The input TTree.
+     * @param columns The columns to bind (filled by this function; the
+     * buffers must not move after the binding).
+     * @return void
+     * @throw std::runtime_error if a branch is not a single value of one of
+     * the supported types.
+     */
+    void bind_columns(TTree * tree, std::vector<InputColumn> & columns)
+    {
+        static const std::map<std::string, char> codes = {
+            {"Double_t", 'D'}, {"Float_t", 'F'}, {"Int_t", 'I'}, {"UChar_t", 'b'}
+        };
+        TObjArray * branches = tree->GetListOfBranches();
+        columns.clear();
+        columns.reserve(branches->GetEntries());
+        for(int i(0); i < branches->GetEntries(); ++i)
+        {
+            TBranch * branch = (TBranch *) branches->At(i);
+            std::string name = branch->GetName();
+            if(name == "Run" || name == "Subrun" || name == "Evt")
+                continue;
+            TLeaf * leaf = (branch->GetNleaves() == 1) ? (TLeaf *) branch->GetListOfLeaves()->At(0) : nullptr;
+            auto it = leaf ? codes.find(leaf->GetTypeName()) : codes.end();
+            if(leaf == nullptr || leaf->GetLen() != 1 || it == codes.end())
+                throw std::runtime_error("Branch " + name + " of TTree " + tree->GetName() + " is not a single double, float, int32, or uint8 value.");
+            columns.push_back(InputColumn{name, it->second, {}});
+        }
+        for(InputColumn & column : columns)
+            tree->SetBranchAddress(column.name.c_str(), (void *) column.buffer);
+    }
+
+    /**
+     * @struct TreeState
+     * @brief The state of an "add_weights" tree during the systematics pass.
+     * @details The input TTree cannot be read concurrently by the workers,
+     * so the values of the binning variables (and of the detector systematic
+     * variable) of each selected signal candidate are cached. The other
+     * branches are read back from the input TTree by the main thread, into
+     * the branch buffers that are bound to the output TTree, when the output
+     * TTrees are filled.
+     */
+    struct TreeState
+    {
+        cfg::ConfigurationTable table; // Configuration of the tree
+        TDirectory * directory; // Output directory of the tree
+        std::vector<InputColumn> brs; // Branch buffers (typed, see @ref InputColumn)
+        Int_t run, subrun, event; // Branch buffers (Run, Subrun, Evt)
+        TTree * output_tree; // Output TTree of the selected signal candidates
+        std::map<sys::trees::index_t, size_t> candidates; // Selected signal candidates
+        TTree * input_tree; // Input TTree of the selected signal candidates (read by the main thread)
+        std::vector<double> values; // Cached values of the binning (and detector systematic) variables of each candidate
+        std::map<std::string, sys::Systematic *> systematics; // Configured systematics (by name)
+        std::map<std::string, TTree *> systrees; // Systematic TTrees (by type)
+        std::vector<size_t> sysvar_columns; // Columns of the binning variables
+        size_t variable_column = 0; // Column of the detector systematic variable
+        double nominal_count = 0; // Number of matched signal candidates
+
+        /**
+         * @brief Get the cached values of a candidate.
+         * @details The values of the binning variables come first (in the
+         * order of the binning variables), followed by the value of the
+         * detector systematic variable.
+         * @param candidate The entry of the candidate in the input TTree.
+         * @return The cached values of the candidate.
+         */
+        const double * row(size_t candidate) const { return values.data() + candidate * (sysvar_columns.size() + 1); }
+
+        /**
+         * @brief Bind the branches of the input TTree to the buffers of the
+         * tree.
+         * @details Trees with the same origin share the input TTree, so the
+         * branches are bound only while the entries of this tree are read.
+         * @return void
+         */
+        void attach()
+        {
+            for(InputColumn & br : brs)
+                input_tree->SetBranchAddress(br.name.c_str(), (void *) br.buffer);
+            input_tree->SetBranchAddress("Run", &run);
+            input_tree->SetBranchAddress("Subrun", &subrun);
+            input_tree->SetBranchAddress("Evt", &event);
+        }
+    };
+
+    /**
+     * @struct TreeResults
+     * @brief The results of a worker for a single tree.
+     */
+    struct TreeResults
+    {
+        sys::detsys::DetsysCalculator calc; // Copy of the DetsysCalculator with worker-local results
+        std::map<sys::trees::syst_t, sys::UniverseAccumulator *> results2d; // Worker-local universe accumulators
+        std::map<sys::trees::syst_t, std::string> names; // Base names of the result histograms
+        std::vector<Match> matches; // Matches of the current round
+        std::vector<double> weights; // Universe weights of the matches of the current round
+        std::vector<size_t> bounds; // Bounds of the weights of each systematic of each match
+
+        /**
+         * @brief Clear the matches of the current round.
+         * @details The buffers keep their capacity, so that the weights of
+         * the next round are stored without reallocation.
+         */
+        void clear()
+        {
+            matches.clear();
+            weights.clear();
+            bounds.clear();
+        }
+    };
+
+    /**
+     * @struct Worker
+     * @brief The thread-local state of a worker of the systematics pass.
+     * @details Each worker reads its own share of the CAF input files and
+     * fills its own accumulators (one set per tree), which are merged after
+     * all entries have been processed.
+     */
+    struct Worker
+    {
+        Worker(const std::string & input, const sys::detsys::DetsysCalculator & calc, size_t ntrees)
+            : reader(input)
+        {
+            for(size_t k(0); k < ntrees; ++k)
+                trees.push_back(TreeResults{calc.fork(), {}, {}, {}});
+        }
+
+        sys::WeightReader reader; // Reader for the worker's entries
+        std::vector<TreeResults> trees; // Results for each tree
+    };
+}
+
 // Copy the input TTree to the output TTree.
 void sys::trees::copy_tree(cfg::ConfigurationTable & table, TFile * output, TFile * input)
 {
@@ -50,6 +273,30 @@ void sys::trees::copy_tree(cfg::ConfigurationTable & table, TFile * output, TFil
         directory->WriteObject(livetime, "Livetime");
     }
     
+    /**
+     * @brief Copy the input TTree using fast cloning.
+     * @details Fast cloning copies the compressed baskets of the input TTree
+     * directly, without decompressing and recompressing each entry. The
+     * branch types and layout of the input TTree are preserved. This is the
+     * default, and can be disabled with the "fast" field of the tree block.
+     * If fast cloning is not possible, the entry-by-entry copy below is
+     * used instead.
+     */
+    TTree * input_tree = (TTree *) input->Get(table.get_string_field("origin").c_str());
+    if(table.get_bool_field("fast", true))
+    {
+        directory->cd();
+        TTree * clone = input_tree->CloneTree(-1, "fast");
+        if(clone != nullptr)
+        {
+            clone->SetName(table.get_string_field("name").c_str());
+            clone->SetTitle(table.get_string_field("name").c_str());
+            directory->WriteObject(clone, table.get_string_field("name").c_str());
+            return;
+        }
+        std::cerr << "Warning: Fast cloning of " << table.get_string_field("origin") << " failed. Falling back to the entry-by-entry copy." << std::endl;
+    }
+
     /**
      * @brief Create the output TTree with the name specified in the
      * configuration file.
@@ -59,16 +306,14 @@ void sys::trees::copy_tree(cfg::ConfigurationTable & table, TFile * output, TFil
     /**
      * @brief Connect to the input TTree and associated branches.
      * @details Three are N+3 branches in the input TTree, where N is the
-     * number of branches in the input TTree of type double. The three
-     * other branches (Run, Subrun, Evt) are of type int. This block uses
-     * a single array to store the values of the double branches and three
-     * separate variables to store the values of the int branches.
+     * number of branches of selected variables. The three other branches
+     * (Run, Subrun, Evt) are of type int. This block binds each variable
+     * branch to a buffer of its own type (see @ref InputColumn) and uses
+     * three separate variables to store the values of the int branches.
      */
-    TTree * input_tree = (TTree *) input->Get(table.get_string_field("origin").c_str());
     int run, subrun, event;
-    double br[input_tree->GetNbranches()-3];
-    for (int i = 0; i < input_tree->GetNbranches()-3; i++)
-        input_tree->SetBranchAddress(input_tree->GetListOfBranches()->At(i)->GetName(), br+i);
+    std::vector<InputColumn> br;
+    bind_columns(input_tree, br);
     input_tree->SetBranchAddress("Run", &run);
     input_tree->SetBranchAddress("Subrun", &subrun);
     input_tree->SetBranchAddress("Evt", &event);
@@ -76,14 +321,14 @@ void sys::trees::copy_tree(cfg::ConfigurationTable & table, TFile * output, TFil
     /**
      * @brief Create the branches in the output TTree following the same
      * structure as the input TTree.
-     * @details The same array (type double) and three variables (type int)
-     * as used above with the input TTree are used to create the branches
-     * in the output TTree. The branches are created in the same order as
-     * the input TTree. This process streamlines the copying of the values
-     * from the input TTree to the output TTree.
+     * @details The same buffers and three variables (type int) as used
+     * above with the input TTree are used to create the branches in the
+     * output TTree, with the types of the input TTree. The branches are
+     * created in the same order as the input TTree. This process streamlines
+     * the copying of the values from the input TTree to the output TTree.
      */
-    for (int i = 0; i < input_tree->GetNbranches()-3; i++)
-        output_tree->Branch(input_tree->GetListOfBranches()->At(i)->GetName(), br+i);
+    for(InputColumn & column : br)
+        output_tree->Branch(column.name.c_str(), (void *) column.buffer, (column.name + "/" + column.code).c_str());
     output_tree->Branch("Run", &run);
     output_tree->Branch("Subrun", &subrun);
     output_tree->Branch("Evt", &event);
@@ -104,291 +349,658 @@ void sys::trees::copy_tree(cfg::ConfigurationTable & table, TFile * output, TFil
     directory->WriteObject(output_tree, table.get_string_field("name").c_str());
 }
 
-// Add reweightable systematics to the output TTree.
-void sys::trees::copy_with_weight_systematics(cfg::ConfigurationTable & config, cfg::ConfigurationTable & table, TFile * output, TFile * input, sys::detsys::DetsysCalculator & calc)
+// Add reweightable systematics to the output TTrees.
+void sys::trees::copy_with_weight_systematics(cfg::ConfigurationTable & config, std::vector<cfg::ConfigurationTable> & tables, TFile * output, TFile * input, sys::detsys::DetsysCalculator & calc)
 {
+    if(tables.empty())
+        return;
+
     /**
-     * @brief Create the output subdirectory following the nesting outlined
-     * in the configuration file.
-     */
-    TDirectory * directory = (TDirectory *) output;
-    directory = create_directory(directory, table.get_string_field("destination").c_str());
-    directory->cd();
-    
-    /**
-     * @brief Check if the exposure information ("POT", "Livetime") has
-     * alread been copied and saved. If not, copy the exposure information
-     * to the output TTree.
+     * @brief Configure the variables for the histograms of the systematic
+     * results.
+     * @details The systematic weights / selected ratios are stored as a
+     * function of the variables specified in the configuration file. The 1D
+     * histogram contains a single entry per universe with a fill value
+     * corresponding to the ratio of the selected signal candidates with the
+     * universe weight to the nominal count. The 2D histogram contains a 2D
+     * histogram with the variable on the x-axis and the universe index on
+     * the y-axis. The fill value is the universe weight. The 1D histograms
+     * can be easily inspected to see the one-bin effect (uncertainty) of the
+     * systematic on the selected signal candidates. The 2D histograms contain
+     * similar information, but can additionally be used to inspect the effect
+     * of the systematic as a function of the variable or calculate a
+     * covariance matrix. The 2D results are accumulated in dense arrays (see
+     * @ref UniverseAccumulator) and only converted to histograms when they
+     * are written.
      */
-    if(!directory->GetListOfKeys()->Contains("POT"))
+    std::vector<SysVariable> sysvariables;
+    for(cfg::ConfigurationTable & t : config.get_subtables("sysvar"))
     {
-        std::cout << "Copying POT and Livetime histograms." << std::endl;
-        TDirectory * parent = (TDirectory *) input;
-        parent = get_parent_directory(parent, table.get_string_field("origin").c_str());
-        TH1D * pot = (TH1D *) parent->Get("POT");
-        TH1D * livetime = (TH1D *) parent->Get("Livetime");
-        directory->WriteObject(pot, "POT");
-        directory->WriteObject(livetime, "Livetime");
+        sysvariables.push_back(SysVariable(t));
+        calc.add_variable(sysvariables.back());
     }
+    std::vector<cfg::ConfigurationTable> systables = config.get_subtables("sys");
 
     /**
-     * @brief Connect to the input TTree and associated branches.
-     * @details Three are N+3 branches in the input TTree, where N is the
-     * number of branches in the input TTree of type double. The three
-     * other branches (Run, Subrun, Evt) are of type int. This block uses
-     * a single array to store the values of the double branches and three
-     * separate variables to store the values of the int branches. There is
-     * one quirk, however, as we would also like to have access to the
-     * "true_neutrino_id" branch in the input TTree directly.
+     * @brief Configure each of the trees.
+     * @details The candidate maps, cached values, and output TTrees of every
+     * tree are set up before the (single) pass over the universe weights.
      */
-    TTree * input_tree = (TTree *) input->Get(table.get_string_field("origin").c_str());
-    std::map<std::string, double> brs;
-    double nu_id;
-    Int_t run, subrun, event;
-    for(int i(0); i < input_tree->GetNbranches()-3; ++i)
+    bool use_additional_hash = config.get_bool_field("input.use_additional_hash", false);
+    sys::WeightFormat format = sys::parse_weight_format(config);
+    std::vector<std::unique_ptr<TreeState>> trees;
+    for(cfg::ConfigurationTable & table : tables)
     {
-        std::string brname = input_tree->GetListOfBranches()->At(i)->GetName();
-        brs[brname] = 0;
-        input_tree->SetBranchAddress(brname.c_str(), &brs[brname]);
-    }
-    input_tree->SetBranchAddress("true_neutrino_id", &nu_id);
-    input_tree->SetBranchAddress("Run", &run);
-    input_tree->SetBranchAddress("Subrun", &subrun);
-    input_tree->SetBranchAddress("Evt", &event);
+        trees.push_back(std::make_unique<TreeState>());
+        TreeState & tree = *trees.back();
+        tree.table = table;
+
+        /**
+         * @brief Create the output subdirectory following the nesting outlined
+         * in the configuration file.
+         */
+        TDirectory * directory = (TDirectory *) output;
+        directory = create_directory(directory, table.get_string_field("destination").c_str());
+        directory->cd();
+        tree.directory = directory;
+
+        /**
+         * @brief Check if the exposure information ("POT", "Livetime") has
+         * alread been copied and saved. If not, copy the exposure information
+         * to the output TTree.
+         */
+        if(!directory->GetListOfKeys()->Contains("POT"))
+        {
+            std::cout << "Copying POT and Livetime histograms." << std::endl;
+            TDirectory * parent = (TDirectory *) input;
+            parent = get_parent_directory(parent, table.get_string_field("origin").c_str());
+            TH1D * pot = (TH1D *) parent->Get("POT");
+            TH1D * livetime = (TH1D *) parent->Get("Livetime");
+            directory->WriteObject(pot, "POT");
+            directory->WriteObject(livetime, "Livetime");
+        }
+
+        /**
+         * @brief Connect to the input TTree and associated branches.
+         * @details Three are N+3 branches in the input TTree, where N is the
+         * number of branches of selected variables. The three other branches
+         * (Run, Subrun, Evt) are of type int. This block binds each variable
+         * branch to a buffer of its own type (see @ref InputColumn) and uses
+         * three separate variables to store the values of the int branches.
+         * There is one quirk, however, as we would also like to have access
+         * to the "true_neutrino_id" (and possibly "true_neutrino_energy")
+         * branch in the input TTree directly.
+         */
+        TTree * input_tree = (TTree *) input->Get(table.get_string_field("origin").c_str());
+        bind_columns(input_tree, tree.brs);
+        auto find_branch = [&](const std::string & name) -> const InputColumn &
+        {
+            for(const InputColumn & column : tree.brs)
+            {
+                if(column.name == name)
+                    return column;
+            }
+            throw std::runtime_error("Branch " + name + " is not a branch of the input TTree " + table.get_string_field("origin") + ".");
+        };
+        const InputColumn & nu_id = find_branch("true_neutrino_id");
+        const InputColumn * nu_energy = use_additional_hash ? &find_branch("true_neutrino_energy") : nullptr;
+        input_tree->SetBranchAddress("Run", &tree.run);
+        input_tree->SetBranchAddress("Subrun", &tree.subrun);
+        input_tree->SetBranchAddress("Evt", &tree.event);
+
+        /**
+         * @brief Create the output TTree with the name specified in the
+         * configuration file.
+         * @details The output TTree is created with the same branches as the
+         * input TTree, plus the Run, Subrun, and Evt branches. The same
+         * buffers and three variables (type int) as used above with the input
+         * TTree are used to create the branches in the output TTree, with the
+         * types of the input TTree. The branches are created in the same order
+         * as the input TTree. This process streamlines the copying of the
+         * values from the input TTree to the output TTree.
+         */
+        tree.output_tree = new TTree(table.get_string_field("name").c_str(), table.get_string_field("name").c_str());
+        for(InputColumn & br : tree.brs)
+            tree.output_tree->Branch(br.name.c_str(), (void *) br.buffer, (br.name + "/" + br.code).c_str());
+        tree.output_tree->Branch("Run", &tree.run);
+        tree.output_tree->Branch("Subrun", &tree.subrun);
+        tree.output_tree->Branch("Evt", &tree.event);
+
+        /**
+         * @brief Configure the weight-based systematics.
+         * @details This block configures the weight-based systematics. The
+         * systematics are split (by type) into separate TTrees, which is
+         * enforced by the "type" field in the configuration block for each
+         * systematic. Because we do not wish to loop over the selected signal
+         * candidates multiple times, we must store the systematic information
+         * in such a way that we can easily accomodate this scheme. The
+         * "systematics" map of each tree holds Systematic objects keyed by the
+         * name of the systematic parameter. Each Systematic object contains
+         * metadata about the systematic parameter (name, index, type, etc.),
+         * some configuration information, and a pointer to the output TTree,
+         * weights vector, and zscores vector. The universe weights are
+         * stored in the configured format (see @ref sys::WeightFormat).
+         */
+        std::vector<std::string> table_types = table.get_string_vector("table_types");
+        for(const std::string & s : table_types)
+        {
+            std::string tname = table.get_string_field("name") + '_' + s;
+            tree.systrees[tname] = new TTree(
+                (tname + "Tree").c_str(),
+                (tname + "Tree").c_str());
+            tree.systrees[tname]->SetDirectory(nullptr);
+            tree.systrees[tname]->Branch("Run", &tree.run);
+            tree.systrees[tname]->Branch("Subrun", &tree.subrun);
+            tree.systrees[tname]->Branch("Evt", &tree.event);
+            tree.systrees[tname]->SetDirectory(directory);
+            tree.systrees[tname]->SetAutoFlush(1000);
+        }
+
+        for(cfg::ConfigurationTable & t : systables)
+        {
+            std::string tname = table.get_string_field("name") + '_' + t.get_string_field("type");
+            tree.systematics.insert(std::make_pair<std::string, Systematic *>(t.get_string_field("name"), new Systematic(t, tree.systrees[tname], format)));
+        }
 
+        /**
+         * @brief Resolve the columns of the binning variables.
+         * @details The workers read the values of the selected signal
+         * candidates from the cached values (see @ref TreeState::row), so the
+         * columns of the variables that are used in the systematics are
+         * resolved once, up front.
+         */
+        std::map<std::string, size_t> columns;
+        for(const InputColumn & br : tree.brs)
+            columns.insert(std::make_pair(br.name, columns.size()));
+        auto column = [&](const std::string & name)
+        {
+            auto it = columns.find(name);
+            if(it == columns.end())
+                throw std::runtime_error("Variable '" + name + "' is not a branch of the input TTree " + table.get_string_field("origin") + ".");
+            return it->second;
+        };
+        for(SysVariable & sv : sysvariables)
+            tree.sysvar_columns.push_back(column(sv.name));
+        bool has_variations = false;
+        for(auto & [key, value] : tree.systematics)
+            has_variations = has_variations || (value->get_type() != Type::kMULTISIM && value->get_type() != Type::kMULTISIGMA);
+        tree.variable_column = has_variations ? column(calc.get_variable()) : 0;
+
+        /**
+         * @brief Create the map of selected signal candidates.
+         * @details This block creates a map of selected signal candidates. The
+         * map is built by looping over the input TTree and storing an index of
+         * the run, subrun, event, nu_id, and nu_energy branches as the key. The
+         * value is the index of the entry in the input TTree. Only the values
+         * of the variables used by the workers are cached (see
+         * @ref TreeState::row).
+         */
+        size_t stride = tree.sysvar_columns.size() + 1;
+        tree.input_tree = input_tree;
+        tree.values.resize(input_tree->GetEntries() * stride);
+        for(Long64_t i(0); i < input_tree->GetEntries(); ++i)
+        {
+            input_tree->GetEntry(i);
+            double * row = tree.values.data() + i * stride;
+            for(size_t s(0); s < tree.sysvar_columns.size(); ++s)
+                row[s] = decode(tree.brs[tree.sysvar_columns[s]]);
+            row[stride - 1] = decode(tree.brs[tree.variable_column]);
+            if(!use_additional_hash)
+                tree.candidates.insert(std::make_pair<index_t, size_t>(std::make_tuple(tree.run, tree.subrun, tree.event, decode(nu_id), 0), i));
+            else
+                tree.candidates.insert(std::make_pair<index_t, size_t>(std::make_tuple(tree.run, tree.subrun, tree.event, decode(nu_id), decode(*nu_energy)), i));
+        }
+        input_tree->ResetBranchAddresses();
+    }
 
     /**
-     * @brief Create the output TTree with the name specified in the
-     * configuration file.
-     * @details The output TTree is created with the same branches as the
-     * input TTree, plus the Run, Subrun, and Evt branches. The same array
-     * (type double) and three variables (type int) as used above with the
-     * input TTree are used to create the branches in the output TTree. The
-     * branches are created in the same order as the input TTree. This
-     * process streamlines the copying of the values from the input TTree to
-     * the output TTree.
+     * @brief Configure the workers.
+     * @details Each worker owns its own WeightReader and, for each tree, a
+     * copy of the DetsysCalculator with empty results and its own universe
+     * accumulators. The number of workers is configured with the
+     * "input.threads" field (default 1). With more than one worker, the
+     * selected entries of the CAF input files are processed in rounds of
+     * "input.batch_entries" entries per worker (default 10000).
      */
-    TTree * output_tree = new TTree(table.get_string_field("name").c_str(), table.get_string_field("name").c_str());
-    for(auto & br : brs)
-        output_tree->Branch(br.first.c_str(), &br.second);
-    output_tree->Branch("Run", &run);
-    output_tree->Branch("Subrun", &subrun);
-    output_tree->Branch("Evt", &event);
-    
+    size_t nthreads = config.has_field("input.threads") ? std::max<int64_t>(config.get_int_field("input.threads"), 1) : 1;
+    if(nthreads > 1)
+        ROOT::EnableThreadSafety();
+
     /**
-     * @brief Create the map of selected signal candidates.
-     * @details This block creates a map of selected signal candidates. The
-     * map is built by looping over the input TTree and storing an index of the
-     * run, subrun, event, nu_id, and nu_energy branches as the key. The
-     * value is the index of the entry in the input TTree.
+     * @brief Select the source of the universe weights.
+     * @details The universe weights are read from the universe weight cache
+     * configured with the "input.weights_cache" field if it exists (see
+     * @ref sys::build_weight_cache), and from the CAF input files otherwise.
+     * A cache which was not built from the current version of the CAF input
+     * files (see @ref sys::weight_cache_matches) is rebuilt first.
      */
-    std::map<index_t, size_t> candidates;
-    bool use_additional_hash = config.get_bool_field("input.use_additional_hash", false);
-    for(int i(0); i < input_tree->GetEntries(); ++i)
+    std::string source = config.get_string_field("input.weights");
+    if(config.has_field("input.weights_cache"))
     {
-        input_tree->GetEntry(i);
-        if(!use_additional_hash)
-            candidates.insert(std::make_pair<index_t, size_t>(std::make_tuple(run, subrun, event, nu_id, 0), i));
+        std::string cache = config.get_string_field("input.weights_cache");
+        if(std::ifstream(cache).good())
+        {
+            if(!sys::weight_cache_matches(cache, source))
+            {
+                std::cerr << "Warning: Universe weight cache " << cache << " was not built from the current files of " << source << ". Rebuilding it." << std::endl;
+                sys::build_weight_cache(source, cache);
+            }
+            std::cout << "Reading universe weights from the cache " << cache << "." << std::endl;
+            source = cache;
+        }
         else
-            candidates.insert(std::make_pair<index_t, size_t>(std::make_tuple(run, subrun, event, nu_id, brs["true_neutrino_energy"]), i));
+            std::cerr << "Warning: Universe weight cache " << cache << " does not exist. Reading universe weights from " << source << "." << std::endl;
     }
 
     /**
-     * @brief Configure the weight-based systematics.
-     * @details This block configures the weight-based systematics. The
-     * systematics are split (by type) into separate TTrees, which is
-     * enforced by the "type" field in the configuration block for each
-     * systematic. Because we do not wish to loop over the selected signal
-     * candidates multiple times, we must store the systematic information
-     * in such a way that we can easily accomodate this scheme. The variable
-     * "systematics" is a map of Systematic objects keyed by the name of the
-     * systematic parameter. Each Systematic object contains metadata about
-     * the systematic parameter (name, index, type, etc.), some
-     * configuration information, and a pointer to the output TTree,
-     * weights vector, and zscores vector.
+     * @brief Configure the I/O of the readers.
+     * @details The TTreeCache of each reader can be sized with the
+     * "input.tree_cache_size" field (in MB) and, by default, only caches the
+     * branches read by the reader; a learning phase can be configured with
+     * the "input.tree_cache_learn_entries" field. The "input.prefetch" field
+     * enables the asynchronous filling of the cache and the background open
+     * of the next input file, which must be enabled before any input file is
+     * opened.
      */
-    std::map<std::string, Systematic *> systematics;
-    std::map<std::string, TTree *> systrees;
+    sys::IOOptions io;
+    bool tune_io = config.has_field("input.tree_cache_size") || config.has_field("input.tree_cache_learn_entries") || config.has_field("input.prefetch");
+    if(config.has_field("input.tree_cache_size"))
+        io.cache_size = std::max<double>(config.get_double_field("input.tree_cache_size"), 0) * 1024 * 1024;
+    if(config.has_field("input.tree_cache_learn_entries"))
+        io.learn_entries = std::max<int64_t>(config.get_int_field("input.tree_cache_learn_entries"), 0);
+    io.prefetch = config.get_bool_field("input.prefetch", false);
+    if(io.prefetch)
+        gEnv->SetValue("TFile.AsyncPrefetching", 1);
 
     /**
-     * @brief Create histograms for storing the systematic results as a 
-     * function of a collection of variables.
-     * @details This block creates histograms for storing the systematic
-     * weights / selected ratios as a function of a the variables specified
-     * in the configuration file. The histograms are stored in a map with
-     * the key being a pair of the variable name and the systematic name.
-     * The 1D histogram contains a single entry per universe with a fill
-     * value corresponding to the ratio of the selected signal candidates
-     * with the universe weight to the nominal count. The 2D histogram
-     * contains a 2D histogram with the variable on the x-axis and the
-     * universe index on the y-axis. The fill value is the universe weight.
-     * The 1D histograms can be easily inspected to see the one-bin effect
-     * (uncertainty) of the systematic on the selected signal candidates.
-     * The 2D histograms contain similar information, but can additionally
-     * be used to inspect the effect of the systematic as a function of the
-     * variable or calculate a covariance matrix.
+     * @brief Create the branches of the systematics.
+     * @details The branches are created before any candidate is stored, so
+     * that they exist even in a tree without matched candidates. The
+     * fixed-size branches of the universe weights (see
+     * @ref sys::WeightFormat) need the number of weights per candidate: the
+     * number of universes of the weight group (for each binning variable)
+     * for the multisim and multisigma systematics, and the number of
+     * z-scores for the variations. The number of universes of each weight
+     * group is read from the first neutrino of the weight source that has
+     * the weight group.
      */
-    std::vector<SysVariable> sysvariables;
-    std::map<syst_t, TH2D *> results2d;
-    std::map<syst_t, TH1D *> results1d;
-    for(cfg::ConfigurationTable & t : config.get_subtables("sysvar"))
+    std::map<size_t, size_t> universes;
+    if(format.storage != sys::WeightStorage::kVECTOR)
     {
-        sysvariables.push_back(SysVariable(t));
-        calc.add_variable(sysvariables.back());
+        std::set<size_t> indices;
+        for(std::unique_ptr<TreeState> & tree : trees)
+        {
+            for(auto & [key, value] : tree->systematics)
+            {
+                if(value->get_type() == Type::kMULTISIM || value->get_type() == Type::kMULTISIGMA)
+                    indices.insert(value->get_index());
+            }
+        }
+        if(!indices.empty())
+        {
+            sys::WeightReader probe(source);
+            probe.set_progress(false);
+            while(universes.size() < indices.size() && probe.next())
+            {
+                for(size_t idn(0); idn < probe.get_nnu(); ++idn)
+                {
+                    for(size_t index : indices)
+                    {
+                        if(universes.count(index) == 0 && index < probe.get_nwgt(idn))
+                        {
+                            probe.set(index);
+                            universes[index] = probe.get_nuniv(idn);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    for(std::unique_ptr<TreeState> & tree : trees)
+    {
+        for(auto & [key, value] : tree->systematics)
+        {
+            size_t n(0);
+            if(value->get_type() == Type::kMULTISIM || value->get_type() == Type::kMULTISIGMA)
+                n = universes.count(value->get_index()) ? sysvariables.size() * universes[value->get_index()] : 0;
+            else
+                n = calc.get_zscores(calc.get_handle(key)).size();
+            value->create_branches(n);
+        }
     }
 
-    /**
-     * @brief Loop over the systematic types in the configuration file.
-     * @details This block loops over the systematic types in the
-     * configuration file. The "table" field in the configuration file
-     * specifies the name of the table lists in the configuration file that
-     * contain the exact definition of the systematics. Principally, this
-     * loop is used to load and configure the systematics of each type in
-     * sequential order.
-     */
-    std::vector<std::string> table_types = table.get_string_vector("table_types");
-    for(const std::string & s : table_types)
+    std::vector<std::unique_ptr<Worker>> workers;
+    for(size_t t(0); t < nthreads; ++t)
     {
-        std::string tname = table.get_string_field("name") + '_' + s;
-        systrees[tname] = new TTree(
-            (tname + "Tree").c_str(),
-            (tname + "Tree").c_str());
-        systrees[tname]->SetDirectory(nullptr);
-        systrees[tname]->Branch("Run", &run);
-        systrees[tname]->Branch("Subrun", &subrun);
-        systrees[tname]->Branch("Evt", &event);
-        systrees[tname]->SetDirectory(directory);
-        systrees[tname]->SetAutoFlush(1000);
+        workers.push_back(std::make_unique<Worker>(source, calc, trees.size()));
+        workers.back()->reader.set_progress(nthreads == 1);
+        if(tune_io)
+            workers.back()->reader.configure_io(io);
     }
 
-    for(cfg::ConfigurationTable & t : config.get_subtables("sys"))
+    /**
+     * @brief Restrict the readers to the events of the selected signal
+     * candidates.
+     * @details Only a small fraction of the events in the CAF input files
+     * contain a selected signal candidate (of any of the trees). The reader
+     * first scans the (cheap) header branches to find the matching entries,
+     * so that the weights are only read and decompressed for these entries.
+     * This can be disabled with the "input.selective_reads" field, in which
+     * case all entries are read.
+     */
+    std::vector<Long64_t> entries;
+    if(config.get_bool_field("input.selective_reads", true))
     {
-        std::string tname = table.get_string_field("name") + '_' + t.get_string_field("type");
-        systematics.insert(std::make_pair<std::string, Systematic *>(t.get_string_field("name"), new Systematic(t, systrees[tname])));
-        Systematic * tmp = systematics[t.get_string_field("name")];
-        tmp->get_tree()->Branch(t.get_string_field("name").c_str(), &systematics[t.get_string_field("name")]->get_weights());
-        if(tmp->get_nsigma()->size() > 0)
+        std::set<sys::WeightReader::event_key_t> keys;
+        for(std::unique_ptr<TreeState> & tree : trees)
         {
-            tmp->get_tree()->Branch((t.get_string_field("name") + "_sigma").c_str(), &systematics[t.get_string_field("name")]->get_nsigma());
+            for(const auto & [key, entry] : tree->candidates)
+                keys.insert(std::make_tuple(std::get<0>(key), std::get<1>(key), std::get<2>(key)));
         }
+        size_t nselected = workers[0]->reader.select(keys);
+        entries = workers[0]->reader.get_selected();
+        std::cout << "Reading weights for " << nselected << " entries (" << keys.size() << " events with selected candidates in " << trees.size() << " trees)." << std::endl;
+    }
+    else
+    {
+        entries.resize(workers[0]->reader.get_entries());
+        std::iota(entries.begin(), entries.end(), 0);
     }
 
-    sys::WeightReader reader(config.get_string_field("input.weights"));
-
-    double nominal_count(0);
-    while(reader.next())
+    /**
+     * @brief Process the entries of a worker.
+     * @details This function loops over the neutrinos in the entries
+     * assigned to the worker. Each neutrino is dispatched to every tree with
+     * a matched selected signal candidate: the universe weights of the
+     * configured systematics are collected into a Match and added to the
+     * (thread-local) accumulators of the worker for the tree. The output
+     * TTrees are filled afterwards, in order, by the main thread.
+     */
+    auto process = [&](Worker & worker)
     {
-        /**
-         * @brief Loop over the neutrinos in the CAF input files.
-         * @details This block loops over the neutrinos in the CAF input
-         * files. The loop is used to populate the output TTree with the
-         * selected signal candidates and the universe weights for matched
-         * neutrinos. The loop also retrieves the selected signal candidate
-         * that has been matched with the parent neutrino and copies the
-         * values to the output TTree.
-         */
-        for(size_t idn(0); idn < reader.get_nnu(); ++idn)
+        sys::WeightReader & reader = worker.reader;
+        while(reader.next())
         {
-            index_t index;
-            if(!use_additional_hash)
-                index = std::make_tuple(reader.get_run(), reader.get_subrun(), reader.get_event(), idn, 0);
-            else
-                index = std::make_tuple(reader.get_run(), reader.get_subrun(), reader.get_event(), idn, (double)reader.get_energy(idn));
-            if(candidates.find(index) != candidates.end())
+            for(size_t idn(0); idn < reader.get_nnu(); ++idn)
             {
-                /**
-                 * @brief Retrieve the selected signal candidate and copy
-                 * the values to the output TTree.
-                 * @details This block retrieves the selected signal
-                 * candidate that has been matched with the parent neutrino
-                 * and copies the values to the output TTree.
-                 */
-                input_tree->GetEntry(candidates[index]);
-                run = reader.get_run();
-                subrun = reader.get_subrun();
-                event = reader.get_event();
-                calc.increment_nominal_count(1.0);
-                nominal_count += 1.0;
-                output_tree->Fill();
-
-                /**
-                 * @brief Store the universe weights in the output TTree.
-                 * @details This block stores the universe weights in the
-                 * output TTree for each of the configured systematics.  
-                 */
-                for(auto & [key, value] : systematics)
+                index_t index;
+                if(!use_additional_hash)
+                    index = std::make_tuple(reader.get_run(), reader.get_subrun(), reader.get_event(), idn, 0);
+                else
+                    index = std::make_tuple(reader.get_run(), reader.get_subrun(), reader.get_event(), idn, (double)reader.get_energy(idn));
+
+                for(size_t k(0); k < trees.size(); ++k)
                 {
-                    value->get_weights()->clear();
-                    if(value->get_type() == Type::kMULTISIM || value->get_type() == Type::kMULTISIGMA)
+                    TreeState & tree = *trees[k];
+                    auto candidate = tree.candidates.find(index);
+                    if(candidate == tree.candidates.end())
+                        continue;
+
+                    /**
+                     * @brief Retrieve the selected signal candidate.
+                     * @details This block retrieves the cached values of the
+                     * selected signal candidate that has been matched with
+                     * the parent neutrino.
+                     */
+                    TreeResults & results = worker.trees[k];
+                    const double * row = tree.row(candidate->second);
+                    Match match{candidate->second, (Int_t)reader.get_run(), (Int_t)reader.get_subrun(), (Int_t)reader.get_event(), results.bounds.size()};
+                    std::vector<double> & weights = results.weights;
+                    results.bounds.push_back(weights.size());
+                    results.calc.increment_nominal_count(1.0);
+
+                    /**
+                     * @brief Collect the universe weights.
+                     * @details This block collects the universe weights for
+                     * each of the configured systematics and adds them to the
+                     * accumulators of the worker.
+                     */
+                    for(auto & [key, value] : tree.systematics)
                     {
-                        for(SysVariable & sv : sysvariables)
+                        if(value->get_type() == Type::kMULTISIM || value->get_type() == Type::kMULTISIGMA)
                         {
-                            syst_t syskey = std::make_pair(sv.name, value->get_index());
-                            reader.set(value->get_index());
-                            if(results1d.find(syskey) == results1d.end())
-                            {
-                                results1d[syskey] = new TH1D((sv.name + "_" + key + "_1d").c_str(), (sv.name + "_" + key + "_1d").c_str(), 1000, -0.25, 0.25);
-                                results1d[syskey]->SetDirectory(nullptr);
-                                results2d[syskey] = new TH2D((sv.name + "_" + key + "_2d").c_str(), (sv.name + "_" + key + "_2d").c_str(), sv.nbins, sv.min, sv.max, reader.get_nuniv(idn), 0, reader.get_nuniv(idn));
-                                results2d[syskey]->SetDirectory(nullptr);
-                            }
-                            for(size_t u(0); u < reader.get_nuniv(idn); ++u)
+                            for(size_t s(0); s < sysvariables.size(); ++s)
                             {
-                                value->get_weights()->push_back(reader.get_weight(idn, u));
-                                results2d[syskey]->Fill(brs[sv.name], u, reader.get_weight(idn, u));
+                                SysVariable & sv = sysvariables[s];
+                                syst_t syskey = std::make_pair(sv.name, value->get_index());
+                                reader.set(value->get_index());
+                                UniverseAccumulator * & accumulator = results.results2d[syskey];
+                                if(accumulator == nullptr)
+                                {
+                                    results.names[syskey] = sv.name + "_" + key;
+                                    accumulator = new UniverseAccumulator(sv.name + "_" + key + "_2d", sv.nbins, sv.min, sv.max, reader.get_nuniv(idn));
+                                }
+                                sys::WeightSpan span = reader.get_weights(idn);
+                                weights.insert(weights.end(), span.begin(), span.end());
+                                accumulator->add(accumulator->find_bin(row[s]), span.begin(), span.size());
                             }
                         }
-                    }
-                    else
+                        else
+                        {
+                            sys::detsys::DetsysCalculator::Handle handle = results.calc.get_handle(key);
+                            double x = row[sysvariables.size()];
+                            for(double z : results.calc.get_zscores(handle))
+                                weights.push_back(results.calc.get_weight(handle, x, z));
+                            for(size_t s(0); s < sysvariables.size(); ++s)
+                                results.calc.add_value(sysvariables[s].name, row[s], handle, x);
+                        }
+                        results.bounds.push_back(weights.size());
+                    } // End of loop over the configured systematics.
+                    results.matches.push_back(std::move(match));
+                } // End of loop over the trees.
+            } // End of loop over the neutrinos.
+        }
+    };
+
+    size_t batch = config.has_field("input.batch_entries") ? std::max<int64_t>(config.get_int_field("input.batch_entries"), 1) : 10000;
+    if(nthreads == 1)
+        batch = std::max<size_t>(entries.size(), 1);
+    for(size_t start(0); start < entries.size(); start += nthreads * batch)
+    {
+        /**
+         * @brief Process a round of entries.
+         * @details The entries of the round are split into contiguous
+         * slices, one per worker, so that the concatenation of the matches
+         * of the workers (in order) follows the order of the CAF input files.
+         */
+        for(size_t t(0); t < nthreads; ++t)
+        {
+            size_t first = std::min(start + t * batch, entries.size());
+            size_t last = std::min(first + batch, entries.size());
+            workers[t]->reader.select_entries(std::vector<Long64_t>(entries.begin() + first, entries.begin() + last));
+            for(TreeResults & results : workers[t]->trees)
+                results.clear();
+        }
+        if(nthreads == 1)
+            process(*workers[0]);
+        else
+        {
+            std::vector<std::thread> threads;
+            std::vector<std::exception_ptr> errors(nthreads);
+            for(size_t t(0); t < nthreads; ++t)
+            {
+                threads.emplace_back([&, t]()
+                {
+                    try { process(*workers[t]); }
+                    catch(...) { errors[t] = std::current_exception(); }
+                });
+            }
+            for(std::thread & thread : threads)
+                thread.join();
+            for(std::exception_ptr & error : errors)
+            {
+                if(error)
+                    std::rethrow_exception(error);
+            }
+            size_t done = std::min(start + nthreads * batch, entries.size());
+            std::cout << "\r\033[KProcessed " << done << " of " << entries.size() << " entries." << std::flush;
+            if(done == entries.size())
+                std::cout << std::endl;
+        }
+
+        /**
+         * @brief Fill the output TTrees.
+         * @details This block reads back each matched signal candidate from
+         * the input TTree and copies it, along with the universe weights of
+         * each configured systematic, to the output TTree and the systematic
+         * TTrees of its tree.
+         */
+        for(std::unique_ptr<Worker> & worker : workers)
+        {
+            for(size_t k(0); k < trees.size(); ++k)
+            {
+                TreeState & tree = *trees[k];
+                TreeResults & results = worker->trees[k];
+                tree.attach();
+                for(Match & match : results.matches)
+                {
+                    tree.input_tree->GetEntry(match.candidate);
+                    tree.run = match.run;
+                    tree.subrun = match.subrun;
+                    tree.event = match.event;
+                    tree.nominal_count += 1.0;
+                    tree.output_tree->Fill();
+
+                    const size_t * bounds = results.bounds.data() + match.bounds;
+                    for(auto & [key, value] : tree.systematics)
                     {
-                        for(double & z : calc.get_zscores(key))
-                            value->get_weights()->push_back(calc.get_weight(key, brs[calc.get_variable()], z));
-                        for(SysVariable & sv : sysvariables)
-                            calc.add_value(sv.name, brs[sv.name], key, brs[calc.get_variable()]);
+                        value->store(results.weights.data() + bounds[0], bounds[1] - bounds[0]);
+                        ++bounds;
                     }
-                } // End of loop over the configured systematics.
-
-                /**
-                 * @brief Fill the systematic TTrees.
-                 * @details This block fills the systematic TTrees with
-                 * the universe weights for the parent neutrino. Each
-                 * configured systematic should have its weights vector
-                 * populated by the above loop.
-                 */
-                for(auto & [key, value] : systrees)
-                    value->Fill();
-            } // End of block for matched signal candidates.
+                    for(auto & [key, value] : tree.systrees)
+                        value->Fill();
+                }
+                tree.input_tree->ResetBranchAddresses();
+                results.clear();
+            }
         }
     }
 
-    // Write the output TTree to the output file.
-    directory->WriteObject(output_tree, table.get_string_field("name").c_str());
-    for(auto & [key, value] : systrees)
-        directory->WriteObject(value, (key+"Tree").c_str());
-    
-    // Write the systematic histograms to the output file.
+    /**
+     * @brief Write the results of each tree.
+     * @details The trees are written in the order of the configuration
+     * file, each with the same output TTrees and histograms as if it had
+     * been processed on its own.
+     */
     TDirectory * histogram_directory = create_directory(output, config.get_string_field("output.histogram_destination"));
-    for(auto & [key, value] : results2d)
+    bool covariance = config.get_bool_field("output.covariance", false);
+    for(size_t k(0); k < trees.size(); ++k)
     {
-        std::string name = value->GetName();
-        histogram_directory->WriteObject(value, name.c_str());
-        for(int i(0); i < value->GetNbinsY(); ++i)
+        TreeState & tree = *trees[k];
+
+        /**
+         * @brief Merge the results of the workers.
+         * @details The accumulators of the workers are merged in order, so
+         * that the first worker holding a result defines its binning. The
+         * detector systematic results of the DetsysCalculator are reset
+         * (and reused) for each tree. If more than one tree is served, the
+         * names of the histograms of each tree are prefixed with the name of
+         * the tree, so that the trees do not overwrite each other's results.
+         */
+        if(k > 0)
+            calc.reset_results();
+        std::string prefix = trees.size() > 1 ? tree.table.get_string_field("name") + "_" : std::string();
+        std::map<syst_t, UniverseAccumulator *> results2d;
+        std::map<syst_t, std::string> names;
+        for(std::unique_ptr<Worker> & worker : workers)
         {
-            double sum(0);
-            for(int j(0); j < value->GetNbinsX(); ++j)
-                sum += value->GetBinContent(j+1, i+1);
-            results1d[key]->Fill((sum - nominal_count) / nominal_count);
+            TreeResults & results = worker->trees[k];
+            for(auto & [key, value] : results.results2d)
+            {
+                if(results2d.find(key) == results2d.end())
+                {
+                    results2d[key] = value;
+                    names[key] = results.names[key];
+                }
+                else
+                {
+                    results2d[key]->merge(*value);
+                    delete value;
+                }
+            }
+            results.results2d.clear();
+            calc.merge(results.calc);
         }
-        delete value;
-    }
-    for(auto & [key, value] : results1d)
-    {
-        std::string name = value->GetName();
-        histogram_directory->WriteObject(value, name.c_str());
-        delete value;
-    }
 
-    // Write detector systematic histograms to the output file.
-    if(calc.is_initialized())
-        calc.write_results();
-}
\ No newline at end of file
+        // Write the output TTree to the output file.
+        tree.directory->WriteObject(tree.output_tree, tree.table.get_string_field("name").c_str());
+        for(auto & [key, value] : tree.systrees)
+            tree.directory->WriteObject(value, (key+"Tree").c_str());
+
+        // Write the systematic histograms to the output file.
+        std::map<std::string, TH2D *> totals;
+        auto write_covariance = [&](const std::string & name, const std::string & sysvar, const UniverseAccumulator & accumulator)
+        {
+            TH2D * cov = accumulator.make_covariance(prefix + name + "_cov");
+            TH2D * corr = UniverseAccumulator::make_correlation(cov, prefix + name + "_corr");
+            histogram_directory->WriteObject(cov, cov->GetName());
+            histogram_directory->WriteObject(corr, corr->GetName());
+            if(totals.find(sysvar) == totals.end())
+            {
+                totals[sysvar] = (TH2D *)cov->Clone((prefix + sysvar + "_total_cov").c_str());
+                totals[sysvar]->SetTitle((prefix + sysvar + "_total_cov").c_str());
+                totals[sysvar]->SetDirectory(nullptr);
+            }
+            else
+                totals[sysvar]->Add(cov);
+            delete cov;
+            delete corr;
+        };
+
+        std::map<syst_t, TH1D *> results1d;
+        for(auto & [key, value] : results2d)
+        {
+            if(covariance)
+                write_covariance(names[key], key.first, *value);
+            TH2D * hist = value->make_histogram();
+            std::string name = prefix + hist->GetName();
+            histogram_directory->WriteObject(hist, name.c_str());
+            results1d[key] = new TH1D((prefix + names[key] + "_1d").c_str(), (prefix + names[key] + "_1d").c_str(), 1000, -0.25, 0.25);
+            results1d[key]->SetDirectory(nullptr);
+            for(size_t i(0); i < value->get_nuniverses(); ++i)
+                results1d[key]->Fill((value->universe_sum(i) - tree.nominal_count) / tree.nominal_count);
+            delete hist;
+            delete value;
+        }
+        for(auto & [key, value] : results1d)
+        {
+            std::string name = value->GetName();
+            histogram_directory->WriteObject(value, name.c_str());
+            delete value;
+        }
+
+        /**
+         * @brief Write the covariance matrices.
+         * @details If enabled with the "output.covariance" field, the
+         * covariance and correlation matrices of each systematic (with
+         * respect to the central value) are written next to the 1D results
+         * as "<variable>_<systematic>_cov" and "<variable>_<systematic>_corr".
+         * The total covariance matrix of each variable is the sum over all
+         * systematics (treated as uncorrelated), and is written as
+         * "<variable>_total_cov" and "<variable>_total_corr".
+         */
+        if(covariance)
+        {
+            if(calc.is_initialized())
+            {
+                for(SysVariable & sv : sysvariables)
+                {
+                    for(auto & [name, accumulator] : calc.get_results(sv.name))
+                        write_covariance(sv.name + "_" + name, sv.name, *accumulator);
+                }
+            }
+            for(auto & [sysvar, total] : totals)
+            {
+                TH2D * corr = UniverseAccumulator::make_correlation(total, prefix + sysvar + "_total_corr");
+                histogram_directory->WriteObject(total, total->GetName());
+                histogram_directory->WriteObject(corr, corr->GetName());
+                delete corr;
+                delete total;
+            }
+        }
+
+        // Write detector systematic histograms to the output file.
+        if(calc.is_initialized())
+            calc.write_results(prefix);
+    }
+}
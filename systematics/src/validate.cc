@@ -0,0 +1,294 @@
+/**
+ * @file validate.cc
+ * @brief Validation execution file for the systematics code.
+ * @details This file contains the main function for testing the numerical
+ * building blocks of the systematics code against independent (reference)
+ * computations. Each check prints its result in the same format as the
+ * validation of the selection framework, and the exit code is non-zero if
+ * any check fails.
+ * @author mueller@fnal.gov
+ */
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <random>
+#include <limits>
+#include <algorithm>
+
+#include "configuration.h"
+#include "detsys.h"
+#include "accumulator.h"
+#include "systematic.h"
+
+#include "TSpline.h"
+#include "TTree.h"
+
+/**
+ * @brief Check a single value against its expected value.
+ * @param label The label of the check.
+ * @param value The observed value.
+ * @param expected The expected value.
+ * @param tolerance The absolute tolerance of the check.
+ * @param failures The number of failed checks, incremented on failure.
+ * @return void
+ */
+void check_value(const std::string & label, double value, double expected, double tolerance, int & failures)
+{
+    if(std::abs(value - expected) <= tolerance)
+    {
+        std::cout << "\033[32mValidation passed:\033[0m   " << label << "." << std::endl;
+        return;
+    }
+    std::cout << "\033[31mValidation failed:\033[0m   " << label << "." << std::endl;
+    std::cout << "    expected: " << expected << ", got: " << value << std::endl;
+    ++failures;
+}
+
+/**
+ * @brief Validate the precompiled splines of the DetsysCalculator.
+ * @details The weights of the flat coefficient table are compared to
+ * TSpline3::Eval of the source splines at the knots, between the knots, and
+ * outside of the knots (extrapolation). The knots are unevenly spaced.
+ *
+ * - SPL00: The weight matches the spline at and between the knots.
+ *
+ * - SPL01: The weight matches the extrapolated spline outside of the knots.
+ *
+ * - SPL02: The weight is one outside of the binning.
+ * @param failures The number of failed checks, incremented on failure.
+ * @return void
+ */
+void validate_splines(int & failures)
+{
+    std::cout << "\n\033[1mDetector systematic splines \033[0m" << std::endl;
+
+    std::vector<double> edges = {0.0, 1.0, 2.5};
+    std::vector<double> knots = {-2.0, -1.0, 0.0, 1.0, 3.0};
+    std::vector<std::vector<double>> ordinates = {
+        {0.80, 0.95, 1.00, 1.10, 1.05},
+        {1.30, 1.10, 1.00, 0.97, 0.70},
+    };
+    std::vector<TSpline3 *> splines;
+    for(const std::vector<double> & y : ordinates)
+        splines.push_back(new TSpline3("spline", knots.data(), y.data(), knots.size()));
+
+    sys::detsys::DetsysCalculator calculator;
+    sys::detsys::DetsysCalculator::Handle handle = calculator.add_splines("test", edges, knots, splines);
+
+    const double tolerance = 1e-9;
+    for(size_t bin(0); bin < splines.size(); ++bin)
+    {
+        double value = 0.5 * (edges[bin] + edges[bin + 1]);
+        std::string label = "SPL bin " + std::to_string(bin);
+        for(size_t k(0); k < knots.size(); ++k)
+        {
+            double z = knots[k];
+            check_value("SPL00 " + label + " at knot z = " + std::to_string(z), calculator.get_weight(handle, value, z), splines[bin]->Eval(z), tolerance, failures);
+            if(k + 1 < knots.size())
+            {
+                z = 0.5 * (knots[k] + knots[k + 1]);
+                check_value("SPL00 " + label + " between knots z = " + std::to_string(z), calculator.get_weight(handle, value, z), splines[bin]->Eval(z), tolerance, failures);
+                z = knots[k] + 0.1 * (knots[k + 1] - knots[k]);
+                check_value("SPL00 " + label + " between knots z = " + std::to_string(z), calculator.get_weight(handle, value, z), splines[bin]->Eval(z), tolerance, failures);
+            }
+        }
+        for(double z : {-3.0, 4.0})
+            check_value("SPL01 " + label + " outside knots z = " + std::to_string(z), calculator.get_weight(handle, value, z), splines[bin]->Eval(z), tolerance, failures);
+    }
+    for(double value : {-0.5, 2.5, 10.0})
+        check_value("SPL02 outside binning x = " + std::to_string(value), calculator.get_weight(handle, value, 0.5), 1.0, 0.0, failures);
+
+    for(TSpline3 * spline : splines)
+        delete spline;
+}
+
+/**
+ * @brief Validate the covariance matrix of the UniverseAccumulator.
+ * @details The accumulator is filled with (seeded) random candidates and
+ * universe weights, then the online (Welford-style) covariance matrix is
+ * compared to a direct two-pass computation, C_ij = 1/N sum_u (n_ui - cv_i)
+ * (n_uj - cv_j), of the same universes. The candidates include values
+ * outside of the binning, which must not enter the covariance matrix. A
+ * second configuration has universe weights very close to one, for which
+ * the covariance is small compared to the squared bin contents, to probe the
+ * cancellation in the online update.
+ *
+ * - COV00: The covariance matrix matches the two-pass computation.
+ *
+ * - COV01: The covariance matrix with a small weight spread matches the
+ *   two-pass computation.
+ * @param failures The number of failed checks, incremented on failure.
+ * @return void
+ */
+void validate_covariance(int & failures)
+{
+    std::cout << "\n\033[1mUniverse covariance matrix \033[0m" << std::endl;
+
+    const size_t nbins(4), nuniverses(100), ncandidates(500);
+    const double min(0.0), max(2.0);
+    for(const auto & [label, spread] : {std::make_pair(std::string("COV00"), 0.2), std::make_pair(std::string("COV01"), 1e-4)})
+    {
+        std::mt19937 gen(12345);
+        std::uniform_real_distribution<double> xdist(min - 0.5, max + 0.5);
+        std::normal_distribution<double> wdist(1.0, spread);
+
+        sys::UniverseAccumulator accumulator("test", nbins, min, max, nuniverses);
+        std::vector<std::vector<double>> contents(nuniverses, std::vector<double>(nbins, 0.0));
+        std::vector<double> cv(nbins, 0.0);
+        std::vector<double> weights(nuniverses);
+        for(size_t n(0); n < ncandidates; ++n)
+        {
+            double x = xdist(gen);
+            for(double & w : weights)
+                w = wdist(gen);
+            accumulator.add(accumulator.find_bin(x), weights.data(), nuniverses);
+
+            // Direct accumulation over the regular bins only.
+            if(x < min || x >= max)
+                continue;
+            size_t bin = std::min<size_t>((size_t)(nbins * (x - min) / (max - min)), nbins - 1);
+            cv[bin] += 1.0;
+            for(size_t u(0); u < nuniverses; ++u)
+                contents[u][bin] += weights[u];
+        }
+
+        // Two-pass computation with respect to the central value.
+        std::vector<double> expected(nbins * nbins, 0.0);
+        double scale(0);
+        for(size_t i(0); i < nbins; ++i)
+        {
+            for(size_t j(0); j < nbins; ++j)
+            {
+                for(size_t u(0); u < nuniverses; ++u)
+                    expected[i * nbins + j] += (contents[u][i] - cv[i]) * (contents[u][j] - cv[j]);
+                expected[i * nbins + j] /= nuniverses;
+                scale = std::max(scale, std::abs(expected[i * nbins + j]));
+            }
+        }
+
+        TH2D * covariance = accumulator.make_covariance("covariance");
+        double deviation(0);
+        for(size_t i(0); i < nbins; ++i)
+        {
+            for(size_t j(0); j < nbins; ++j)
+                deviation = std::max(deviation, std::abs(covariance->GetBinContent(i + 1, j + 1) - expected[i * nbins + j]));
+        }
+        check_value(label + " maximum relative deviation", deviation / scale, 0.0, 1e-9, failures);
+        delete covariance;
+    }
+}
+
+/**
+ * @brief Validate the round trip of the quantized universe weights.
+ * @details The weights of a candidate are stored by a Systematic with the
+ * quantized storage in an in-memory TTree, read back, and dequantized as one
+ * plus the offset times the step (or the next overflow value for weights
+ * marked with kQUANTIZED_OVERFLOW). The weights include values at the
+ * rounding boundaries and at the edges of the range of the 16-bit offsets,
+ * as well as values out of range and non-finite values.
+ *
+ * - QNT00: The weights in range are recovered within the precision.
+ *
+ * - QNT01: The weights out of range (and only these) are stored in the
+ *   overflow branch.
+ *
+ * - QNT02: The overflow weights are recovered in order (to float
+ *   precision, non-finite values included).
+ * - QNT03: The fixed-size branches are booked before the first candidate
+ *   is stored.
+ * @param failures The number of failed checks, incremented on failure.
+ * @return void
+ */
+void validate_quantization(int & failures)
+{
+    std::cout << "\n\033[1mQuantized universe weights \033[0m" << std::endl;
+
+    const toml::table doc = toml::parse("name = \"test\"\nindex = 0\ntype = \"multisim\"\n");
+    cfg::ConfigurationTable table(&doc, toml::node_view<const toml::node>(doc));
+    for(double precision : {1e-4, 1e-3})
+    {
+        std::string label = "QNT precision " + std::to_string(precision);
+        sys::WeightFormat format;
+        format.storage = sys::WeightStorage::kQUANTIZED;
+        format.precision = precision;
+
+        // The weights of the candidate, and whether each is in range.
+        const double step = (Float_t)(2 * precision);
+        const double inf = std::numeric_limits<double>::infinity();
+        std::vector<double> weights = {1.0, 1.0 + 0.5 * step, 1.0 - 0.5 * step, 1.0 + 0.49 * step, 0.0,
+                                       1.0 + 32767 * step, 1.0 - 32767 * step, 1.0 + 32768 * step, 1.0 - 32768 * step,
+                                       100.0, -100.0, 1e6, inf, -inf, std::numeric_limits<double>::quiet_NaN()};
+        std::vector<bool> in_range = {true, true, true, true, true, true, true, false, false, false, false, false, false, false, false};
+        std::mt19937 gen(7);
+        std::normal_distribution<double> wdist(1.0, 0.3);
+        for(size_t i(0); i < 100; ++i)
+        {
+            weights.push_back(wdist(gen));
+            in_range.push_back(true);
+        }
+
+        // Store and read back the weights.
+        TTree tree("weights", "weights");
+        tree.SetDirectory(nullptr);
+        sys::Systematic systematic(table, &tree, format);
+        systematic.create_branches(weights.size());
+        check_value(label + " QNT03 booked branches", (tree.GetBranch("test") != nullptr) + (tree.GetBranch("test_step") != nullptr) + (tree.GetBranch("test_overflow") != nullptr), 3, 0, failures);
+        systematic.store(weights.data(), weights.size());
+        tree.Fill();
+
+        std::vector<Short_t> quantized(weights.size());
+        Float_t stored_step;
+        std::vector<float> * overflow = nullptr;
+        tree.SetBranchAddress("test", quantized.data());
+        tree.SetBranchAddress("test_step", &stored_step);
+        tree.SetBranchAddress("test_overflow", &overflow);
+        tree.GetEntry(0);
+
+        double deviation(0);
+        size_t misplaced(0), mismatched(0), next(0);
+        for(size_t i(0); i < weights.size(); ++i)
+        {
+            if((quantized[i] == sys::kQUANTIZED_OVERFLOW) == in_range[i])
+            {
+                ++misplaced;
+                continue;
+            }
+            if(in_range[i])
+            {
+                deviation = std::max(deviation, std::abs(1.0 + quantized[i] * (double)stored_step - weights[i]));
+                continue;
+            }
+            float expected = weights[i];
+            float value = next < overflow->size() ? (*overflow)[next] : 0.0f;
+            ++next;
+            if(!(value == expected || (std::isnan(value) && std::isnan(expected))))
+                ++mismatched;
+        }
+        check_value(label + " QNT00 maximum deviation", deviation, 0.0, precision * (1 + 1e-6), failures);
+        check_value(label + " QNT01 misplaced weights", misplaced, 0, 0, failures);
+        check_value(label + " QNT01 overflow weights", overflow->size(), next, 0, failures);
+        check_value(label + " QNT02 mismatched overflow weights", mismatched, 0, 0, failures);
+        delete overflow;
+    }
+}
+
+/**
+ * @brief Main function for the validation code.
+ * @details This function runs each of the validation checks of the
+ * systematics code in turn.
+ * @param argc The number of command line arguments.
+ * @param argv The command line arguments (unused).
+ * @return int The exit code of the program. Returns 0 if all checks passed,
+ * non-zero otherwise.
+ */
+int main(int argc, char * argv[])
+{
+    int failures(0);
+    std::cout << "\033[1m--- Running validation ---\033[0m" << std::endl;
+    validate_splines(failures);
+    validate_covariance(failures);
+    validate_quantization(failures);
+    std::cout << "\n\033[1m---        DONE        ---\033[0m" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
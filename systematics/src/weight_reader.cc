@@ -11,13 +11,20 @@
 #include <iomanip>
 #include <chrono>
 #include <sstream>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
 
 #include "weight_reader.h"
 
 #include "TChain.h"
+#include "TFile.h"
+#include "TTree.h"
 #include "TTreeReader.h"
 #include "TTreeReaderValue.h"
 #include "TTreeReaderArray.h"
+#include "TNamed.h"
+#include "TSystem.h"
 
 #include "sbnanaobj/StandardRecord/SRTrueInteraction.h"
 
@@ -25,6 +32,10 @@
 sys::WeightReader::WeightReader(const std::string & input)
 : chain("recTree"),
   entry(0),
+  prefetch(false),
+  tree_number(-1),
+  selective(false),
+  cursor(0),
   idx(0),
   progress_started(false)
 {
@@ -50,6 +61,11 @@ sys::WeightReader::WeightReader(const std::string & input)
         chain.Add(input.c_str());
     }
     
+    // Check if the input is a universe weight cache
+    iscache = chain.GetBranch("cache.wgt.univ") != nullptr;
+    if(iscache)
+        isflat = false;
+
     // Create the TTreeReader
     reader = std::make_unique<TTreeReader>(&chain);
     
@@ -60,19 +76,16 @@ sys::WeightReader::WeightReader(const std::string & input)
 
     if(isflat)
     {
-        // Event-level indexing
-        chain.SetBranchAddress("rec.mc.nu..length", &nnu);
-
-        // Neutrino-level indexing
-        chain.SetBranchAddress("rec.mc.nu.wgt..length", nwgt);
-        chain.SetBranchAddress("rec.mc.nu.wgt..idx", &iwgt);
-        chain.SetBranchAddress("rec.mc.nu.E", &nu_energy);
-
-        // Systematic-level indexing
-        chain.SetBranchAddress("rec.mc.nu.wgt.univ..length", &nuniv);
-        chain.SetBranchAddress("rec.mc.nu.wgt.univ..idx", &iuniv);
-        chain.SetBranchAddress("rec.mc.nu.wgt.univ", &wgts);
-        chain.GetEntry(0);
+        // The weight branches are read (and sized) entry-by-entry.
+        load_flat(0);
+    }
+    else if(iscache)
+    {
+        // Universe weight cache branches
+        cache_energy = std::make_unique<TTreeReaderValue<std::vector<float>>>(*reader, "cache.nu.E");
+        cache_nwgt = std::make_unique<TTreeReaderValue<std::vector<int>>>(*reader, "cache.nu.nwgt");
+        cache_nuniv = std::make_unique<TTreeReaderValue<std::vector<int>>>(*reader, "cache.wgt.nuniv");
+        cache_weights = std::make_unique<TTreeReaderValue<std::vector<float>>>(*reader, "cache.wgt.univ");
     }
     else
     {
@@ -82,19 +95,169 @@ sys::WeightReader::WeightReader(const std::string & input)
         nu_energy_structured = std::make_unique<TTreeReaderArray<Float_t>>(*reader, "rec.mc.nu.E");
     }
     reader->Next();
+    if(iscache)
+        load_cache();
+}
+
+// Restrict the reader to the entries of a set of events.
+size_t sys::WeightReader::select(const std::set<event_key_t> & keys)
+{
+    /**
+     * @brief Scan the header branches on a separate TChain.
+     * @details The TTreeReader only reads the branches that it has been
+     * asked for, so this pass does not touch (or decompress) the weight
+     * branches. The entry numbers are shared with the main TChain, which
+     * holds the same files in the same order.
+     */
+    TChain header("recTree");
+    header.Add(&chain);
+    TTreeReader header_reader(&header);
+    TTreeReaderValue<uint32_t> header_run(header_reader, "rec.hdr.run");
+    TTreeReaderValue<uint32_t> header_subrun(header_reader, "rec.hdr.subrun");
+    TTreeReaderValue<uint32_t> header_event(header_reader, "rec.hdr.evt");
+
+    selected.clear();
+    while(header_reader.Next())
+    {
+        if(keys.find(std::make_tuple(*header_run, *header_subrun, *header_event)) != keys.end())
+            selected.push_back(header_reader.GetCurrentEntry());
+    }
+    selective = true;
+    cursor = 0;
+    return selected.size();
+}
+
+// Restrict the reader to an explicit list of entries.
+void sys::WeightReader::select_entries(const std::vector<Long64_t> & entries)
+{
+    selected = entries;
+    selective = true;
+    cursor = 0;
+}
+
+// Configure the I/O of the TChain.
+void sys::WeightReader::configure_io(const IOOptions & options)
+{
+    if(options.prefetch)
+        chain.SetCacheSize(0);
+    chain.SetCacheSize(options.cache_size);
+    if(options.learn_entries > 0)
+        chain.SetCacheLearnEntries(options.learn_entries);
+
+    // The header branches are read by every reader.
+    std::vector<std::string> branches{"rec.hdr.run", "rec.hdr.subrun", "rec.hdr.evt"};
+    if(iscache)
+        branches.insert(branches.end(), {"cache.nu.E", "cache.nu.nwgt", "cache.wgt.nuniv", "cache.wgt.univ"});
+    else if(isflat)
+        branches.insert(branches.end(), {"rec.mc.nu..length", "rec.mc.nu.E", "rec.mc.nu.wgt..length", "rec.mc.nu.wgt..idx",
+                                         "rec.mc.nu.wgt.univ..length", "rec.mc.nu.wgt.univ..idx", "rec.mc.nu.wgt.univ"});
+    else
+        branches.insert(branches.end(), {"rec.mc.nnu", "rec.mc.nu*"});
+    for(const std::string & branch : branches)
+        chain.AddBranchToCache(branch.c_str(), true);
+    if(options.learn_entries == 0)
+        chain.StopCacheLearningPhase();
+    prefetch = options.prefetch;
+}
+
+// Open the next file of the TChain in the background.
+void sys::WeightReader::prefetch_next()
+{
+    TObjArray * files = chain.GetListOfFiles();
+    if(!files || tree_number + 1 >= files->GetEntries())
+        return;
+    std::string next = files->At(tree_number + 1)->GetTitle();
+    if(next.find("://") != std::string::npos && next.rfind("file://", 0) != 0)
+        TFile::AsyncOpen(next.c_str());
 }
 
 // Advance to the next entry in the TChain.
 bool sys::WeightReader::next()
 {
-    this->progress_bar(entry+1, chain.GetEntries());
+    if(prefetch && chain.GetTreeNumber() != tree_number)
+    {
+        tree_number = chain.GetTreeNumber();
+        prefetch_next();
+    }
+
+    // Both paths visit their entries through the cursor, starting from the
+    // first entry. The entry loaded by the constructor is read again.
     if(!chain.GetTree() || !reader) return false;
-    if(entry >= (size_t)chain.GetEntries()) return false;
-    if(!reader->Next()) return false;
-    chain.GetEntry(++entry);
+    size_t n = selective ? selected.size() : (size_t)chain.GetEntries();
+    if(cursor >= n) return false;
+    if(show_progress) this->progress_bar(cursor+1, n);
+    entry = selective ? (size_t)selected[cursor] : cursor;
+    ++cursor;
+    if(reader->SetEntry(entry) != TTreeReader::kEntryValid) return false;
+    if(isflat) load_flat(entry);
+    else if(iscache) load_cache();
     return true;
 }
 
+// Index the weights of a universe weight cache entry.
+void sys::WeightReader::load_cache()
+{
+    const std::vector<int> & groups = **cache_nwgt;
+    iwgt.resize(groups.size());
+    std::exclusive_scan(groups.begin(), groups.end(), iwgt.begin(), 0);
+
+    const std::vector<int> & universes = **cache_nuniv;
+    iuniv.resize(universes.size());
+    std::exclusive_scan(universes.begin(), universes.end(), iuniv.begin(), 0);
+}
+
+// Read the weight branches of a flat CAF entry.
+void sys::WeightReader::load_flat(Long64_t index)
+{
+    Long64_t local = chain.LoadTree(index);
+    if(local < 0)
+        throw std::runtime_error("WeightReader: Unable to load entry " + std::to_string(index) + " of the TChain.");
+
+    /**
+     * @brief Read a single branch of the current TTree into a buffer.
+     * @details The address is set on every read, as the buffer may have
+     * been reallocated and the TChain may have moved to a new TTree.
+     */
+    auto read = [&](const char * name, void * address)
+    {
+        chain.SetBranchAddress(name, address);
+        chain.GetBranch(name)->GetEntry(local);
+    };
+
+    /**
+     * @brief Grow a buffer to fit at least n elements.
+     * @details The buffers are never shrunk and always hold at least one
+     * element so that they have a valid address.
+     */
+    auto reserve = [](auto & buffer, size_t n)
+    {
+        if(buffer.size() < std::max<size_t>(n, 1))
+            buffer.resize(std::max<size_t>(n, 1));
+    };
+
+    // Event-level indexing
+    read("rec.mc.nu..length", &nnu);
+
+    // Neutrino-level indexing
+    reserve(nwgt, nnu);
+    reserve(iwgt, nnu);
+    reserve(nu_energy, nnu);
+    read("rec.mc.nu.wgt..length", nwgt.data());
+    read("rec.mc.nu.wgt..idx", iwgt.data());
+    read("rec.mc.nu.E", nu_energy.data());
+
+    // Systematic-level indexing
+    size_t ngroups = std::accumulate(nwgt.begin(), nwgt.begin() + nnu, size_t(0));
+    reserve(nuniv, ngroups);
+    reserve(iuniv, ngroups);
+    read("rec.mc.nu.wgt.univ..length", nuniv.data());
+    read("rec.mc.nu.wgt.univ..idx", iuniv.data());
+
+    size_t nweights = std::accumulate(nuniv.begin(), nuniv.begin() + ngroups, size_t(0));
+    reserve(wgts, nweights);
+    read("rec.mc.nu.wgt.univ", wgts.data());
+}
+
 // Set the weight group index.
 void sys::WeightReader::set(size_t index)
 {
@@ -104,6 +267,8 @@ void sys::WeightReader::set(size_t index)
 // Accessor method for the number of neutrinos.
 uint32_t sys::WeightReader::get_nnu() const
 {
+    if(iscache)
+        return (*cache_energy)->size();
     return isflat ? nnu : **nnu_structured;
 }
 
@@ -113,6 +278,8 @@ uint32_t sys::WeightReader::get_nwgt(Int_t i) const
     if(i < 0 || i >= (Int_t)this->get_nnu())
         throw std::out_of_range("WeightReader: Index out of range in 'get_nwgt()'");
     
+    if(iscache)
+        return (**cache_nwgt)[i];
     return isflat ? nwgt[i] : (*mc)[i].wgt.size();
 }
 
@@ -122,13 +289,17 @@ uint32_t sys::WeightReader::get_nuniv(size_t idn) const
     if(idn >= get_nnu() || idx >= get_nwgt(idn))
         throw std::out_of_range("WeightReader: Index out of range in 'get_nuniv()'");
 
+    if(iscache)
+        return (**cache_nuniv)[iwgt[idn] + idx];
     return isflat ? nuniv[iwgt[idn] + idx] : (*mc)[idn].wgt[idx].univ.size();
 }
 
 // Accessor method for the weight value.
 float sys::WeightReader::get_weight(size_t idn, size_t idu) const
 {
-    if(isflat)
+    if(iscache)
+        return (**cache_weights)[iuniv[iwgt[idn] + idx] + idu];
+    else if(isflat)
     {
         size_t n = iwgt[idn] + idx;
         size_t univ_offset = iuniv[n];
@@ -138,12 +309,141 @@ float sys::WeightReader::get_weight(size_t idn, size_t idu) const
         return (*mc)[idn].wgt[idx].univ[idu];
 }
 
+// Accessor method for all universe weights of a neutrino.
+sys::WeightSpan sys::WeightReader::get_weights(size_t idn) const
+{
+    if(idn >= get_nnu() || idx >= get_nwgt(idn))
+        throw std::out_of_range("WeightReader: Index out of range in 'get_weights()'");
+
+    if(iscache)
+    {
+        size_t n = iwgt[idn] + idx;
+        return WeightSpan{(*cache_weights)->data() + iuniv[n], (size_t)(**cache_nuniv)[n]};
+    }
+    else if(isflat)
+    {
+        size_t n = iwgt[idn] + idx;
+        return WeightSpan{wgts.data() + iuniv[n], (size_t)nuniv[n]};
+    }
+    else
+    {
+        const auto & univ = (*mc)[idn].wgt[idx].univ;
+        return WeightSpan{univ.data(), univ.size()};
+    }
+}
+
 // Accessor method for the neutrino energy.
 float sys::WeightReader::get_energy(size_t idn) const
 {
+    if(iscache)
+        return (**cache_energy)[idn];
     return isflat ? nu_energy[idn] : (*nu_energy_structured)[idn];
 }
 
+// Build a universe weight cache from a set of CAF files.
+void sys::build_weight_cache(const std::string & input, const std::string & path)
+{
+    // The fingerprint is taken first, so that a file modified during the
+    // build invalidates the cache.
+    std::string fingerprint = weight_source_fingerprint(input);
+    WeightReader reader(input);
+    std::vector<Long64_t> entries(reader.get_entries());
+    std::iota(entries.begin(), entries.end(), 0);
+    reader.select_entries(entries);
+
+    TFile * file = TFile::Open(path.c_str(), "RECREATE");
+    if(!file || file->IsZombie())
+        throw std::runtime_error("WeightReader: Unable to create the universe weight cache " + path + ".");
+
+    /**
+     * @brief Create the cache TTree.
+     * @details The TTree uses the same name and header branches as the CAF
+     * files, so that the header scan of @ref WeightReader::select works
+     * unchanged. The weights of each event are stored as flat vectors,
+     * with the offsets recomputed from the lengths when reading.
+     */
+    uint32_t run, subrun, event;
+    std::vector<float> energy, weights;
+    std::vector<int> nwgt, nuniv;
+    TTree * tree = new TTree("recTree", "Universe weight cache");
+    tree->Branch("rec.hdr.run", &run);
+    tree->Branch("rec.hdr.subrun", &subrun);
+    tree->Branch("rec.hdr.evt", &event);
+    tree->Branch("cache.nu.E", &energy);
+    tree->Branch("cache.nu.nwgt", &nwgt);
+    tree->Branch("cache.wgt.nuniv", &nuniv);
+    tree->Branch("cache.wgt.univ", &weights);
+
+    while(reader.next())
+    {
+        if(reader.get_nnu() == 0)
+            continue;
+        run = reader.get_run();
+        subrun = reader.get_subrun();
+        event = reader.get_event();
+        energy.clear();
+        nwgt.clear();
+        nuniv.clear();
+        weights.clear();
+        for(size_t idn(0); idn < reader.get_nnu(); ++idn)
+        {
+            energy.push_back(reader.get_energy(idn));
+            nwgt.push_back(reader.get_nwgt(idn));
+            for(size_t g(0); g < (size_t)nwgt.back(); ++g)
+            {
+                reader.set(g);
+                WeightSpan span = reader.get_weights(idn);
+                nuniv.push_back(span.size());
+                weights.insert(weights.end(), span.begin(), span.end());
+            }
+        }
+        tree->Fill();
+    }
+
+    file->cd();
+    tree->Write();
+    TNamed("fingerprint", fingerprint.c_str()).Write();
+    std::cout << "Wrote the universe weights of " << tree->GetEntries() << " events to " << path << "." << std::endl;
+    file->Close();
+}
+
+// Compute the fingerprint of a set of CAF files.
+std::string sys::weight_source_fingerprint(const std::string & input)
+{
+    // The input is expanded as in the constructor of the WeightReader.
+    TChain files("recTree");
+    if(input.find("*") == std::string::npos && input.find(".txt") != std::string::npos)
+    {
+        std::ifstream infile(input);
+        std::string line;
+        while(std::getline(infile, line))
+            files.Add(line.c_str());
+    }
+    else
+        files.Add(input.c_str());
+
+    std::ostringstream ss;
+    TIter next(files.GetListOfFiles());
+    while(TObject * element = next())
+    {
+        FileStat_t stat;
+        if(gSystem->GetPathInfo(element->GetTitle(), stat) != 0)
+            throw std::runtime_error("WeightReader: Unable to query the size and modification time of " + std::string(element->GetTitle()) + ".");
+        ss << element->GetTitle() << '|' << stat.fSize << '|' << stat.fMtime << '\n';
+    }
+    return ss.str();
+}
+
+// Check if a universe weight cache was built from the current version of a set of CAF files.
+bool sys::weight_cache_matches(const std::string & path, const std::string & input)
+{
+    std::unique_ptr<TFile> file(TFile::Open(path.c_str(), "READ"));
+    if(!file || file->IsZombie())
+        return false;
+    TNamed * fingerprint = file->Get<TNamed>("fingerprint");
+    return fingerprint && weight_source_fingerprint(input) == fingerprint->GetTitle();
+}
+
 // Simple progress bar for the TChain.
 void sys::WeightReader::progress_bar(size_t entry, size_t total) const
 {